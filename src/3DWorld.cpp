@@ -66,13 +66,13 @@ char *lighting_file[NUM_LIGHTING_TYPES] = {0};
 // Note that these are all the default values when no config variable is specified.
 bool combined_gu(0), underwater(0), kbd_text_mode(0), univ_stencil_shadows(1), use_waypoint_app_spots(0), enable_tiled_mesh_ao(0), tiled_terrain_only(0);
 bool show_lightning(0), disable_shader_effects(0), use_waypoints(0), group_back_face_cull(0), start_maximized(0), claim_planet(0), skip_light_vis_test(0);
-bool no_smoke_over_mesh(0), enable_model3d_tex_comp(0), global_lighting_update(0), lighting_update_offline(0), mesh_difuse_tex_comp(1), smoke_dlights(0), keep_keycards_on_death(0);
-bool texture_alpha_in_red_comp(0), use_model2d_tex_mipmaps(1), mt_cobj_tree_build(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
+bool no_smoke_over_mesh(0), enable_model3d_tex_comp(0), global_lighting_update(0), lighting_update_offline(0), incremental_lighting_rebake(0), mesh_difuse_tex_comp(1), smoke_dlights(0), keep_keycards_on_death(0);
+bool texture_alpha_in_red_comp(0), use_model2d_tex_mipmaps(1), mt_cobj_tree_build(0), sah_cobj_tree_build(0), compact_cobj_tree_nodes(0), refit_dynamic_cobj_trees(0), cache_bvh_files(0), lighting_ray_packets(0), async_tile_gen(1), uobj_spatial_hash(1), uobj_parallel_update(1), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
 bool gen_tree_roots(1), fast_water_reflect(0), vsync_enabled(0), use_voxel_cobjs(0), disable_sound(0), enable_depth_clamp(0), volume_lighting(0), no_subdiv_model(0);
 bool detail_normal_map(0), init_core_context(0), use_core_context(0), enable_multisample(1), dynamic_smap_bias(0), model3d_wn_normal(0), snow_shadows(0), user_action_key(0);
 bool enable_dlight_shadows(1), tree_indir_lighting(0), ctrl_key_pressed(0), only_pine_palm_trees(0), enable_gamma_correct(0), use_z_prepass(0), reflect_dodgeballs(0);
 bool store_cobj_accum_lighting_as_blocked(0), all_model3d_ref_update(0), begin_motion(0), enable_mouse_look(MOUSE_LOOK_DEF), enable_init_shields(1), tt_triplanar_tex(0);
-bool enable_model3d_bump_maps(1), use_obj_file_bump_grayscale(1), invert_bump_maps(0), use_interior_cube_map_refl(0), enable_cube_map_bump_maps(1), no_store_model_textures_in_memory(0);
+bool enable_model3d_bump_maps(1), use_obj_file_bump_grayscale(1), parallel_obj_file_parse(1), use_simd_noise(1), force_cpu_mesh_noise(0), lmap_brick_compress(1), invert_bump_maps(0), use_interior_cube_map_refl(0), enable_cube_map_bump_maps(1), no_store_model_textures_in_memory(0);
 bool enable_model3d_custom_mipmaps(1), flatten_tt_mesh_under_models(0), show_map_view_mandelbrot(0), smileys_chase_player(0), disable_fire_delay(0), disable_recoil(0);
 bool enable_dpart_shadows(0), enable_tt_model_reflect(1), enable_tt_model_indir(0), auto_calc_tt_model_zvals(0), use_model_lod_blocks(0), enable_translocator(0), enable_grass_fire(0);
 bool disable_model_textures(0), start_in_inf_terrain(0), allow_shader_invariants(1), config_unlimited_weapons(0), disable_tt_water_reflect(0), allow_model3d_quads(1);
@@ -94,7 +94,7 @@ int enable_fsource(0), run_forward(0), advanced(0), dynamic_mesh_scroll(0);
 int read_snow_file(0), write_snow_file(0), mesh_detail_tex(NOISE_TEX);
 int read_light_files[NUM_LIGHTING_TYPES] = {0}, write_light_files[NUM_LIGHTING_TYPES] = {0};
 unsigned num_snowflakes(0), create_voxel_landscape(0), hmap_filter_width(0), num_dynam_parts(100), snow_coverage_resolution(2), num_birds_per_tile(2), num_fish_per_tile(15);
-unsigned erosion_iters(0), erosion_iters_tt(0), video_framerate(60), num_video_threads(0), skybox_tid(0);
+unsigned erosion_iters(0), erosion_iters_tt(0), erosion_bench_droplets(0), video_framerate(60), num_video_threads(0), skybox_tid(0), cobj_tree_bench_rays(0), benchmark_frames(0), tile_upload_budget_ms(4), tile_cache_mem_mb(256);
 float NEAR_CLIP(DEF_NEAR_CLIP), FAR_CLIP(DEF_FAR_CLIP), system_max_orbit(1.0), sky_occlude_scale(0.0), tree_slope_thresh(5.0), mouse_sensitivity(1.0), tt_grass_scale_factor(1.0);
 float water_plane_z(0.0), base_gravity(1.0), crater_depth(1.0), crater_radius(1.0), disabled_mesh_z(FAR_CLIP), vegetation(1.0), atmosphere(1.0), biome_x_offset(0.0);
 float mesh_file_scale(1.0), mesh_file_tz(0.0), speed_mult(1.0), mesh_z_cutoff(-FAR_CLIP), relh_adj_tex(0.0), dodgeball_metalness(1.0), ray_step_size_mult(1.0);
@@ -107,7 +107,7 @@ float model_mat_lod_thresh(5.0), clouds_per_tile(0.5), def_atmosphere(1.0), def_
 float light_int_scale[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0}, first_ray_weight[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0};
 double camera_zh(0.0);
 point mesh_origin(all_zeros), camera_pos(all_zeros), cube_map_center(all_zeros);
-string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name;
+string user_text, cobjs_out_fn, profiler_trace_fn, benchmark_camera_path, benchmark_output_fn("benchmark.json"), tile_cache_dir, texture_cache_dir, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name;
 colorRGB ambient_lighting_scale(1,1,1), mesh_color_scale(1,1,1);
 colorRGBA bkg_color, flower_color(ALPHA0);
 set<unsigned char> keys, keyset;
@@ -126,11 +126,11 @@ bool vert_opt_flags[3] = {0}; // {enable, full_opt, verbose}
 extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, water_is_lava, use_grass_tess, def_tex_compress;
 extern int camera_flight, DISABLE_WATER, DISABLE_SCENERY, camera_invincible, onscreen_display, mesh_freq_filter, show_waypoints, last_inventory_frame;
 extern int tree_coll_level, GLACIATE, UNLIMITED_WEAPONS, destroy_thresh, MAX_RUN_DIST, mesh_gen_mode, mesh_gen_shape, map_drag_x, map_drag_y;
-extern unsigned NPTS, NRAYS, LOCAL_RAYS, GLOBAL_RAYS, DYNAMIC_RAYS, NUM_THREADS, MAX_RAY_BOUNCES, grass_density, max_unique_trees, shadow_map_sz;
-extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS;
+extern unsigned NPTS, NRAYS, LOCAL_RAYS, GLOBAL_RAYS, DYNAMIC_RAYS, NUM_THREADS, MAX_RAY_BOUNCES, lighting_rebake_margin, lighting_bake_passes, lighting_bake_checkpoint_secs, grass_density, max_unique_trees, shadow_map_sz;
+extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS, num_job_threads;
 extern float fticks, team_damage, self_damage, player_damage, smiley_damage, smiley_speed, tree_deadness, tree_dead_prob, lm_dz_adj, nleaves_scale, flower_density, universe_ambient_scale;
 extern float mesh_scale, tree_scale, mesh_height_scale, smiley_acc, hmv_scale, last_temp, grass_length, grass_width, branch_radius_scale, tree_height_scale, planet_update_rate;
-extern float MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT, def_tex_aniso;
+extern float MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT, def_tex_aniso, lighting_bake_noise_thresh;
 extern double map_x, map_y;
 extern point hmv_pos, camera_last_pos;
 extern colorRGBA sunlight_color;
@@ -238,6 +238,7 @@ void quit_3dworld() { // called once at the end for proper cleanup
 
 	cout << "quitting" << endl;
 	kill_current_raytrace_threads();
+	shutdown_job_system(); // finish any pending screenshot/video writes
 	clear_context();
 	exit_openal();
 
@@ -875,6 +876,7 @@ void keyboard_proc(unsigned char key, int x, int y) {
 	case 'f': // print framerate and stats
 		show_framerate = 1;
 		timing_profiler_stats();
+		if (world_mode == WMODE_GROUND) {print_cobj_tree_refit_stats();}
 		break;
 	case 'g': // pause/resume playback of eventlist
 		pause_frame = !pause_frame;
@@ -1617,8 +1619,17 @@ int load_config(string const &config_file) {
 	kwmb.add("use_dense_voxels", use_dense_voxels);
 	kwmb.add("use_voxel_cobjs", use_voxel_cobjs);
 	kwmb.add("mt_cobj_tree_build", mt_cobj_tree_build);
+	kwmb.add("sah_cobj_tree_build", sah_cobj_tree_build);
+	kwmb.add("compact_cobj_tree_nodes", compact_cobj_tree_nodes);
+	kwmb.add("refit_dynamic_cobj_trees", refit_dynamic_cobj_trees);
+	kwmb.add("cache_bvh_files", cache_bvh_files);
+	kwmb.add("lighting_ray_packets", lighting_ray_packets);
+	kwmb.add("async_tile_gen", async_tile_gen);
+	kwmb.add("uobj_spatial_hash", uobj_spatial_hash);
+	kwmb.add("uobj_parallel_update", uobj_parallel_update);
 	kwmb.add("global_lighting_update", global_lighting_update);
 	kwmb.add("lighting_update_offline", lighting_update_offline);
+	kwmb.add("incremental_lighting_rebake", incremental_lighting_rebake);
 	kwmb.add("two_sided_lighting", two_sided_lighting);
 	kwmb.add("disable_sound", disable_sound);
 	kwmb.add("start_maximized", start_maximized);
@@ -1648,6 +1659,10 @@ int load_config(string const &config_file) {
 	kwmb.add("tt_triplanar_tex", tt_triplanar_tex);
 	kwmb.add("enable_model3d_bump_maps", enable_model3d_bump_maps);
 	kwmb.add("use_obj_file_bump_grayscale", use_obj_file_bump_grayscale);
+	kwmb.add("parallel_obj_file_parse", parallel_obj_file_parse);
+	kwmb.add("use_simd_noise", use_simd_noise);
+	kwmb.add("force_cpu_mesh_noise", force_cpu_mesh_noise);
+	kwmb.add("lmap_brick_compress", lmap_brick_compress);
 	kwmb.add("invert_bump_maps", invert_bump_maps);
 	kwmb.add("use_interior_cube_map_refl", use_interior_cube_map_refl);
 	kwmb.add("enable_cube_map_bump_maps", enable_cube_map_bump_maps);
@@ -1723,6 +1738,10 @@ int load_config(string const &config_file) {
 	kwmu.add("hmap_filter_width", hmap_filter_width);
 	kwmu.add("erosion_iters", erosion_iters);
 	kwmu.add("erosion_iters_tt", erosion_iters_tt);
+	kwmu.add("erosion_bench_droplets", erosion_bench_droplets);
+	kwmu.add("lighting_rebake_margin", lighting_rebake_margin);
+	kwmu.add("lighting_bake_passes", lighting_bake_passes);
+	kwmu.add("lighting_bake_checkpoint_secs", lighting_bake_checkpoint_secs);
 	kwmu.add("num_dynam_parts", num_dynam_parts);
 	kwmu.add("num_birds_per_tile", num_birds_per_tile);
 	kwmu.add("num_fish_per_tile", num_fish_per_tile);
@@ -1731,6 +1750,11 @@ int load_config(string const &config_file) {
 	kwmu.add("dlight_grid_bitshift", DL_GRID_BS);
 	kwmu.add("video_framerate", video_framerate);
 	kwmu.add("num_video_threads", num_video_threads);
+	kwmu.add("num_job_threads", num_job_threads);
+	kwmu.add("tile_upload_budget_ms", tile_upload_budget_ms);
+	kwmu.add("tile_cache_mem_mb", tile_cache_mem_mb);
+	kwmu.add("cobj_tree_bench_rays", cobj_tree_bench_rays);
+	kwmu.add("benchmark_frames", benchmark_frames);
 
 	kw_to_val_map_t<float> kwmf(error);
 	kwmf.add("gravity", base_gravity);
@@ -1762,6 +1786,7 @@ int load_config(string const &config_file) {
 	kwmf.add("crater_size", crater_depth);
 	kwmf.add("crater_radius", crater_radius);
 	kwmf.add("indir_light_exp", indir_light_exp);
+	kwmf.add("lighting_bake_noise_thresh", lighting_bake_noise_thresh);
 	kwmf.add("snow_random", snow_random);
 	kwmf.add("temperature", init_temperature);
 	kwmf.add("mesh_start_mag", MESH_START_MAG);
@@ -1824,6 +1849,11 @@ int load_config(string const &config_file) {
 
 	kw_to_val_map_t<string> kwms(error);
 	kwms.add("cobjs_out_filename", cobjs_out_fn);
+	kwms.add("profiler_trace_filename", profiler_trace_fn);
+	kwms.add("benchmark_camera_path", benchmark_camera_path);
+	kwms.add("benchmark_output_filename", benchmark_output_fn);
+	kwms.add("tile_cache_dir", tile_cache_dir);
+	kwms.add("texture_cache_dir", texture_cache_dir);
 
 	while (read_str(fp, strc)) { // slow but should be OK: these ones require special handling
 		string const str(strc);
@@ -2222,7 +2252,7 @@ int main(int argc, char** argv) {
 		);
 		//glutInitContextProfile(GLUT_FORWARD_COMPATIBLE);
 	}
-	if (enable_timing_profiler) {toggle_timing_profiler();} // enable profiler logging on init without using the 'u' key
+	if (enable_timing_profiler || benchmark_frames > 0) {toggle_timing_profiler();} // enable profiler logging on init without using the 'u' key
 	progress();
 	/*int const cur_window =*/ glutCreateWindow("3D World");
 	progress();
@@ -2271,6 +2301,7 @@ int main(int argc, char** argv) {
 		build_lightmap(1);
 	}
 	check_gl_error(7777);
+	if (benchmark_frames > 0) {run_benchmark();} // runs frames directly and exits
 	glutMainLoop(); // Switch to main loop
 	quit_3dworld(); // never actually gets here
     return 0;
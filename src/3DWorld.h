@@ -11,6 +11,7 @@
 #include "globals.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> // for memcpy
 #include <math.h>
 #include "gl_includes.h"
 
@@ -959,6 +960,18 @@ public:
 colorRGBA const DEF_TEX_COLOR(0.0, 0.0, 0.0, 0.0); // black with alpha of 0.0
 
 
+struct tex_cache_levels_t { // precomputed mipmap levels and/or block compressed data from the texture cache
+	uint64_t data_hash, mip_key; // hash of the base level the levels were generated from, and of the mipmap and compression params
+	unsigned gl_format; // compressed format, or 0 for uncompressed
+	vector<unsigned char> data; // level 0 is included if compressed, otherwise levels start at 1
+	vector<unsigned> offsets; // start of each level in data
+
+	tex_cache_levels_t() : data_hash(0), mip_key(0), gl_format(0) {}
+	bool empty() const {return offsets.empty();}
+	void clear() {data_hash = mip_key = 0; gl_format = 0; vector<unsigned char>().swap(data); offsets.clear();}
+};
+
+
 class texture_t { // size >= 116
 
 public:
@@ -974,8 +987,16 @@ protected:
 	colorRGBA color;
 	vector<unsigned> mm_offsets;
 	enum {DEFER_TYPE_NONE=0, DEFER_TYPE_DDS, NUM_DEFER_TYPE};
+	std::string cache_fn; // set when loaded from a file with the texture cache enabled; cleared after the first upload
+	tex_cache_levels_t cached_levels;
 
 	void maybe_swap_rb(unsigned char *ptr) const;
+	bool load_from_cache(int index, bool allow_diff_width_height, bool allow_two_byte_grayscale, bool ignore_word_alignment);
+	void write_to_cache() const;
+	bool upload_with_cache();
+	uint64_t get_cache_mip_key() const;
+	void build_cache_levels(unsigned gl_format);
+	void gen_mipmap_level(unsigned char const *idata, unsigned w, unsigned h, vector<unsigned char> &odata, int mip_mode) const;
 
 public:
 	texture_t() : type(0), format(0), use_mipmaps(0), defer_load_type(DEFER_TYPE_NONE), wrap(0), mirror(0), invert_y(0), do_compress(0), has_binary_alpha(0),
@@ -990,6 +1011,7 @@ public:
 	void init();
 	void do_gl_init(bool free_after_upload=0);
 	void upload_cube_map_face(unsigned ix);
+	bool is_compressed() const;
 	GLenum calc_internal_format() const;
 	GLenum calc_format() const;
 	GLenum get_data_format() const {return (is_16_bit_gray ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE);}
@@ -1127,6 +1149,29 @@ inline uint32_t pcg32_random_r(pcg32_random_t* rng) {
 	return (xorshifted >> rot) | (xorshifted << ((-(int32_t)rot) & 31));
 }
 
+class fnv_hash_t { // 64-bit FNV-1a, used for cache file keys
+	uint64_t h;
+public:
+	fnv_hash_t() : h(14695981039346656037ULL) {}
+	uint64_t get() const {return h;}
+
+	void add_bytes(void const *data, size_t sz) {
+		for (size_t i = 0; i < sz; ++i) {h ^= ((uint8_t const *)data)[i]; h *= 1099511628211ULL;}
+	}
+	void add_words(void const *data, size_t sz) { // 8 bytes at a time, which is much faster for large buffers; Note: result differs from add_bytes()
+		size_t const nwords(sz/8);
+
+		for (size_t i = 0; i < nwords; ++i) {
+			uint64_t w;
+			memcpy(&w, ((uint8_t const *)data + 8*i), 8);
+			h = (h ^ w)*1099511628211ULL;
+		}
+		add_bytes(((uint8_t const *)data + 8*nwords), (sz - 8*nwords));
+	}
+	template<typename T> void add(T const &v) {add_bytes(&v, sizeof(T));}
+	void add_str(std::string const &s) {add(s.size()); add_bytes(s.data(), s.size());}
+};
+
 class rgen_pregen_t : public rgen_core_t {
 
 	std::shared_ptr<std::vector<double>> pregen_rand_reals;
@@ -1313,6 +1358,11 @@ colorRGBA const BACKGROUND_NIGHT(BLACK);
 void register_timing_value(const char *str, int delta_time);
 void toggle_timing_profiler();
 void timing_profiler_stats();
+void timing_profiler_next_frame();
+bool write_timing_profiler_json(std::string const &fn);
+void profile_zone_begin(char const *name);
+void profile_zone_end();
+extern bool profiler_zones_enabled;
 
 // macros
 #define GET_TIME_MS()    glutGet(GLUT_ELAPSED_TIME)
@@ -1346,6 +1396,18 @@ public:
 	void end() {if (enabled && !name.empty()) {register_timing_value(name.c_str(), GET_DELTA_TIME); name.clear();}}
 };
 
+// hierarchical profiler zone with high resolution timing; thread safe, so can be used inside OpenMP loops;
+// name must be a string literal (or otherwise outlive the profiler) since only the pointer is stored
+class profile_scope_t {
+	bool active;
+public:
+	profile_scope_t(char const *const name) : active(profiler_zones_enabled) {if (active) {profile_zone_begin(name);}}
+	~profile_scope_t() {if (active) {profile_zone_end();}}
+};
+#define PROFILE_SCOPE_CAT2(a, b) a##b
+#define PROFILE_SCOPE_CAT(a, b) PROFILE_SCOPE_CAT2(a, b)
+#define PROFILE_SCOPE(name) profile_scope_t const PROFILE_SCOPE_CAT(profile_scope_, __LINE__)(name)
+
 
 // world modes
 enum {WMODE_GROUND=0, WMODE_UNIVERSE, WMODE_INF_TERRAIN, NUM_WMODE};
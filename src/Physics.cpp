@@ -1659,6 +1659,7 @@ void shift_other_objs(vector3d const &vd) {
 
 void advance_physics_objects() {
 
+	PROFILE_SCOPE("Physics");
 	apply_obj_physics(part_clouds);
 	apply_obj_physics(fires);
 	for (unsigned d = 0; d < 2; ++d) {explosion_part_man[d].apply_physics(0.5, 4.0, (d == 1));} // gravity=0.5, air_factor=0.25
@@ -511,11 +511,13 @@ void texture_t::init() {
 	build_mipmaps();
 }
 
+bool texture_t::is_compressed() const {return (COMPRESS_TEXTURES && do_compress && type != 2 && !is_16_bit_gray);}
+
 GLenum texture_t::calc_internal_format() const {
 
 	assert(ncolors >= 1 && ncolors <= 4);
 	if (is_16_bit_gray) {return GL_R16;} // compressed?
-	return get_internal_texture_format(ncolors, (COMPRESS_TEXTURES && do_compress && type != 2), 0); // linear_space=0
+	return get_internal_texture_format(ncolors, is_compressed(), 0); // linear_space=0
 }
 
 GLenum texture_t::calc_format() const {
@@ -539,9 +541,12 @@ void texture_t::do_gl_init(bool free_after_upload) {
 	else {
 		assert(is_allocated());
 		assert(width > 0 && height > 0);
-		glTexImage2D(GL_TEXTURE_2D, 0, calc_internal_format(), width, height, 0, calc_format(), get_data_format(), data);
-		if (use_mipmaps == 1 || use_mipmaps == 2) {gen_mipmaps();}
-		if (use_mipmaps == 3 || use_mipmaps == 4) {create_custom_mipmaps();}
+
+		if (!upload_with_cache()) { // mipmaps and compression done by the driver
+			glTexImage2D(GL_TEXTURE_2D, 0, calc_internal_format(), width, height, 0, calc_format(), get_data_format(), data);
+			if (use_mipmaps == 1 || use_mipmaps == 2) {gen_mipmaps();}
+			if (use_mipmaps == 3 || use_mipmaps == 4) {create_custom_mipmaps();}
+		}
 	}
 	//assert(glIsTexture(tid)); // for some reason this check is slow
 	if (free_after_upload) {free_client_mem();}
@@ -919,59 +924,62 @@ void texture_t::make_normal_map() {
 }
 
 
-void texture_t::create_custom_mipmaps() {
+// computes the next mipmap level from the w x h image idata; mip_mode is a use_mipmaps value, where 3 and 4 select custom alpha mipmaps for RGBA textures
+void texture_t::gen_mipmap_level(unsigned char const *idata, unsigned w, unsigned h, vector<unsigned char> &odata, int mip_mode) const {
 
-	assert(is_allocated());
-	GLenum const format(calc_format());
-	unsigned const tsize(num_bytes());
-	vector<unsigned char> idata, odata;
-	idata.resize(tsize);
-	memcpy(&idata.front(), data, tsize);
+	unsigned const w1(max(w,    1U)), h1(max(h,    1U));
+	unsigned const w2(max(w>>1, 1U)), h2(max(h>>1, 1U));
+	unsigned const xinc((w2 < w1) ? ncolors : 0), yinc((h2 < h1) ? ncolors*w1 : 0);
+	bool const custom_alpha(ncolors == 4 && (mip_mode == 3 || mip_mode == 4));
 	color_wrapper cw; cw.set_c4(color);
+	odata.resize(ncolors*w2*h2);
 
-	for (unsigned w = width, h = height, level = 1; w > 1 || h > 1; w >>= 1, h >>= 1, ++level) {
-		unsigned const w1(max(w,    1U)), h1(max(h,    1U));
-		unsigned const w2(max(w>>1, 1U)), h2(max(h>>1, 1U));
-		unsigned const xinc((w2 < w1) ? ncolors : 0), yinc((h2 < h1) ? ncolors*w1 : 0);
-		odata.resize(ncolors*w2*h2);
-
-		for (unsigned y = 0; y < h2; ++y) {
-			for (unsigned x = 0; x < w2; ++x) {
-				unsigned const ix1(ncolors*(y*w2+x)), ix2(ncolors*((y<<1)*w1+(x<<1)));
+	for (unsigned y = 0; y < h2; ++y) {
+		for (unsigned x = 0; x < w2; ++x) {
+			unsigned const ix1(ncolors*(y*w2+x)), ix2(ncolors*((y<<1)*w1+(x<<1)));
 
-				if (ncolors == 1) {
-					odata[ix1] = (unsigned char)(((unsigned)idata[ix2] + idata[ix2+xinc] + idata[ix2+yinc] + idata[ix2+yinc+xinc]) >> 2);
+			if (!custom_alpha) { // box filter
+				for (int c = 0; c < ncolors; ++c) {
+					odata[ix1+c] = (unsigned char)(((unsigned)idata[ix2+c] + idata[ix2+xinc+c] + idata[ix2+yinc+c] + idata[ix2+yinc+xinc+c]) >> 2);
 				}
-				else if (ncolors == 3) {
-					UNROLL_3X(odata[ix1+i_] = (unsigned char)(((unsigned)idata[ix2+i_] + idata[ix2+xinc+i_] + idata[ix2+yinc+i_] + idata[ix2+yinc+xinc+i_]) >> 2);)
+			}
+			else { // custom alpha mipmaps
+				unsigned const a1(idata[ix2+3]), a2(idata[ix2+xinc+3]), a3(idata[ix2+yinc+3]), a4(idata[ix2+yinc+xinc+3]);
+				unsigned const a_sum(a1 + a2 + a3 + a4);
+
+				if (a_sum == 0) { // fully transparent
+					if (mip_mode == 4) {UNROLL_3X(odata[ix1+i_] = cw.c[i_];)} // use average texture color
+					else { // color is average of all 4 values
+						UNROLL_3X(odata[ix1+i_] = (unsigned char)(((unsigned)idata[ix2+i_] + idata[ix2+xinc+i_] + idata[ix2+yinc+i_] + idata[ix2+yinc+xinc+i_]) / 4);)
+					}
+					odata[ix1+3] = 0;
 				}
-				else { // custom alpha mipmaps
-					assert(ncolors == 4);
-					unsigned const a1(idata[ix2+3]), a2(idata[ix2+xinc+3]), a3(idata[ix2+yinc+3]), a4(idata[ix2+yinc+xinc+3]);
-					unsigned const a_sum(a1 + a2 + a3 + a4);
-
-					if (a_sum == 0) { // fully transparent
-						if (use_mipmaps == 4) {UNROLL_3X(odata[ix1+i_] = cw.c[i_];)} // use average texture color
-						else { // color is average of all 4 values
-							UNROLL_3X(odata[ix1+i_] = (unsigned char)(((unsigned)idata[ix2+i_] + idata[ix2+xinc+i_] + idata[ix2+yinc+i_] + idata[ix2+yinc+xinc+i_]) / 4);)
-						}
-						odata[ix1+3] = 0;
+				else { // pre-multiplied and normalized colors
+					if (mip_mode == 4) {
+						unsigned const a_cw(1020 - a_sum); // use average texture color for transparent pixels
+						UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_] + a_cw*cw.c[i_]) / 1020);)
 					}
-					else { // pre-multiplied and normalized colors
-						if (use_mipmaps == 4) {
-							unsigned const a_cw(1020 - a_sum); // use average texture color for transparent pixels
-							UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_] + a_cw*cw.c[i_]) / 1020);)
-						}
-						else {
-							UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_]) / a_sum);)
-						}
-						odata[ix1+3] = min(255U, min(max(max(a1, a2), max(a3, a4)), unsigned(mipmap_alpha_weight*a_sum)));
+					else {
+						UNROLL_3X(odata[ix1+i_] = (unsigned char)((a1*idata[ix2+i_] + a2*idata[ix2+xinc+i_] + a3*idata[ix2+yinc+i_] + a4*idata[ix2+yinc+xinc+i_]) / a_sum);)
 					}
+					odata[ix1+3] = min(255U, min(max(max(a1, a2), max(a3, a4)), unsigned(mipmap_alpha_weight*a_sum)));
 				}
-			} // for x
-		} // for y
+			}
+		} // for x
+	} // for y
+}
+
+
+void texture_t::create_custom_mipmaps() {
+
+	assert(is_allocated());
+	GLenum const format(calc_format());
+	vector<unsigned char> idata(data, data+num_bytes()), odata;
+
+	for (unsigned w = width, h = height, level = 1; w > 1 || h > 1; w >>= 1, h >>= 1, ++level) {
+		gen_mipmap_level(&idata.front(), w, h, odata, use_mipmaps);
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // needed for mipmap levels where width*ncolors is not aligned
-		glTexImage2D(GL_TEXTURE_2D, level, calc_internal_format(), w2, h2, 0, format, get_data_format(), &odata.front());
+		glTexImage2D(GL_TEXTURE_2D, level, calc_internal_format(), max(w>>1, 1U), max(h>>1, 1U), 0, format, get_data_format(), &odata.front());
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		idata.swap(odata);
 	} // for w
@@ -2249,6 +2249,7 @@ void tree_cont_t::gen_trees_tt_within_radius(int x1, int y1, int x2, int y2, poi
 
 void regen_trees(bool keep_old) {
 
+	PROFILE_SCOPE("Regen Trees");
 	if (!scrolling) {cout << "vegetation: " << vegetation << endl;}
 	RESET_TIME;
 	static int init(0), last_rgi(0), last_xoff2(0), last_yoff2(0);
@@ -1242,6 +1242,7 @@ float ugalaxy::get_radius_at(point const &pos_, bool exact) const {
 	dir[1] *= scale[1];
 	dir[2] *= scale[2];
 	float const rval(radius*dir.mag());
+	if (exact) return rval; // don't update the cache, since exact queries may come from multiple threads
 	lrq_rad = rval;
 	lrq_pos = pos_;
 	return rval;
@@ -2783,7 +2784,7 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 	pos -= cell.pos;
 	float const planet_thresh(expand*4.0*MAX_PLANET_EXTENT + r_add), moon_thresh(expand*2.0*MAX_PLANET_EXTENT + r_add);
 	float const pt_sq(planet_thresh*planet_thresh), mt_sq(moon_thresh*moon_thresh);
-	static int last_galaxy(-1), last_cluster(-1), last_system(-1);
+	static thread_local int last_galaxy(-1), last_cluster(-1), last_system(-1); // search hints; may be called from multiple threads
 	int const first_galaxy_to_try((galaxy_hint >= 0) ? galaxy_hint : last_galaxy);
 	unsigned const ng((unsigned)cell.galaxies->size());
 	unsigned const go((first_galaxy_to_try >= 0 && first_galaxy_to_try < int(ng)) ? last_galaxy : 0);
@@ -2796,7 +2797,7 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 		if (!galaxy.gen) continue; // not yet generated
 		float const distg(p2p_dist(pos, galaxy.pos));
 		if (distg > g_expand*(galaxy.radius + MAX_SYSTEM_EXTENT) + r_add) continue;
-		float const galaxy_radius(galaxy.get_radius_at((pos - galaxy.pos)/max(distg, TOLERANCE)));
+		float const galaxy_radius(galaxy.get_radius_at((pos - galaxy.pos)/max(distg, TOLERANCE), 1)); // exact=1 to avoid the non thread safe cache
 		if (distg > g_expand*(galaxy_radius + MAX_SYSTEM_EXTENT) + r_add) continue;
 
 		if (max_level == UTYPE_GALAXY) { // galaxy
@@ -8,6 +8,7 @@
 #include "asteroid.h"
 #include "timetest.h"
 #include "openal_wrap.h"
+#include "job_system.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -28,7 +29,7 @@ unsigned owner_counts[NUM_ALIGNMENT] = {0};
 float resource_counts[NUM_ALIGNMENT] = {0.0};
 
 
-extern bool claim_planet, water_is_lava, no_shift_universe;
+extern bool claim_planet, water_is_lava, no_shift_universe, uobj_parallel_update;
 extern int uxyz[], window_width, window_height, do_run, fire_key, display_mode, DISABLE_WATER, frame_counter;
 extern unsigned NUM_THREADS;
 extern float zmax, zmin, fticks, univ_temp, temperature, atmosphere, vegetation, base_gravity, urm_static;
@@ -333,31 +334,102 @@ void proc_collision(free_obj *const uobj, upos_point_type const &cpos, point con
 }
 
 
-void process_univ_objects() {
+struct uobj_env_t { // results of read-only universe queries for one free object
+	s_object clobj; // closest object
+	point sun_pos;
+	vector3d gravity, swp_accel;
+	float temperature;
+	int found_close;
+	bool active, near_b_hole;
+	uobj_env_t() : sun_pos(all_zeros), gravity(zero_vector), swp_accel(zero_vector), temperature(0.0), found_close(0), active(0), near_b_hole(0) {}
+};
+
+vector<uobj_env_t> uobj_envs;
+
+
+// use the handle slot rather than the pointer to spread the work across frames so that this is deterministic
+bool calc_uobj_gravity_this_frame(free_obj const *const uobj) {return (((uobj->get_time() + uobj->get_handle_slot()) & (GRAV_CHECK_MOD-1)) == 0);}
+
+bool env_temp_known(uobj_env_t const &env) {return (env.found_close && env.clobj.type != UTYPE_ASTEROID);}
+
+void calc_uobj_temperature(free_obj const *const uobj, uobj_env_t &env) {
+
+	env.sun_pos = all_zeros;
+
+	if (env_temp_known(env)) {
+		assert(env.clobj.object != NULL);
+		env.temperature = universe.get_point_temperature(env.clobj, uobj->get_pos(), env.sun_pos)*(FOBJ_TEMP_SCALE - uobj->get_shadow_val()); // shadow_val = 0-3
+	}
+	else if (!uobj->is_particle() && !uobj->is_proj()) {
+		env.temperature = universe.get_point_temperature(env.clobj, uobj->get_pos(), env.sun_pos)*FOBJ_TEMP_SCALE;
+	}
+	else {env.temperature = 0.0;}
+}
+
+void calc_uobj_gravity(free_obj const *const uobj, uobj_env_t &env) { // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
+
+	upos_point_type const &obj_pos(uobj->get_pos());
+	env.gravity     = env.swp_accel = zero_vector;
+	env.near_b_hole = 0;
+	if (env_temp_known(env)) {get_gravity(env.clobj, obj_pos, env.gravity, 1);}
+
+	if (!stat_objs.empty()) {
+		vector<free_obj const*> stat_obj_query_res;
+		all_query_data qdata(&stat_objs, obj_pos, 10.0, urm_static, uobj, stat_obj_query_res);
+		get_all_close_objects(qdata);
+				
+		for (unsigned j = 0; j < stat_obj_query_res.size(); ++j) { // asteroid/black hole gravity
+			env.near_b_hole |= (stat_obj_query_res[j]->get_gravity(env.gravity, obj_pos) == 2);
+		}
+	}
+	if (env.clobj.has_valid_system()) {
+		env.swp_accel = env.clobj.get_star().get_solar_wind_accel(obj_pos, uobj->get_mass(), uobj->get_surf_area());
+	}
+}
 
-	vector<free_obj const*> stat_obj_query_res;
+// Note: may be called in parallel for different objects since it only reads the universe and the object
+void query_uobj_env(free_obj const *const uobj, uobj_env_t &env) {
+
+	env = uobj_env_t();
+	bool const no_coll(uobj->no_coll()), particle(uobj->is_particle());
+	if (no_coll && particle)   return; // no collisions, gravity, or temperature on this object
+	if (uobj->is_stationary()) return;
+	env.active = 1;
+	float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
+	// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
+	bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
+	env.found_close = (uobj->is_orbiting() ? 0 : universe.get_object_closest_to_pos(env.clobj, uobj->get_pos(), include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
+	calc_uobj_temperature(uobj, env);
+	if (calc_uobj_gravity_this_frame(uobj)) {calc_uobj_gravity(uobj, env);}
+}
+
+
+void process_univ_objects() {
 
-	for (unsigned i = 0; i < uobjs.size(); ++i) { // can we use cached_objs?
+	unsigned const nobjs(uobjs.size());
+	uobj_envs.resize(nobjs);
+	{
+		PROFILE_SCOPE("Univ Obj Env Query");
+		// parallel phase: closest object, temperature, and gravity queries
+		parallel_for(0, nobjs, [](int i) {query_uobj_env(uobjs[i], uobj_envs[i]);}, uobj_parallel_update, 16);
+	}
+	// serial phase in a fixed order: collisions, damage, and planet claiming
+	for (unsigned i = 0; i < nobjs; ++i) { // can we use cached_objs?
+		uobj_env_t &env(uobj_envs[i]);
+		if (!env.active) continue;
 		free_obj *const uobj(uobjs[i]);
-		bool const no_coll(uobj->no_coll()), particle(uobj->is_particle()), projectile(uobj->is_proj());
-		if (no_coll && particle)   continue; // no collisions, gravity, or temperature on this object
-		if (uobj->is_stationary()) continue;
+		bool const no_coll(uobj->no_coll()), projectile(uobj->is_proj());
 		bool const is_ship(uobj->is_ship()), orbiting(uobj->is_orbiting());
-		bool const calc_gravity(((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
+		bool const calc_gravity(calc_uobj_gravity_this_frame(uobj));
 		bool const lod_coll(PLAYER_SLOW_PLANET_APPROACH && is_ship && uobj->is_player_ship()); // enable if we want to do close planet flyby
 		float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
 		upos_point_type const &obj_pos(uobj->get_pos());
-		vector3d gravity(zero_vector); // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
-		point sun_pos(all_zeros);
-
-		// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
-		s_object clobj; // closest object
-		bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
-		int const found_close(orbiting ? 0 : universe.get_object_closest_to_pos(clobj, obj_pos, include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
-		bool temp_known(0), has_rings(0);
+		s_object &clobj(env.clobj);
+		bool const temp_known(env_temp_known(env));
+		bool has_rings(0), moved(0);
 		float limit_speed_dist(clobj.dist);
 
-		if (found_close) {
+		if (env.found_close) {
 			if (clobj.type == UTYPE_ASTEROID) {
 				uasteroid const &asteroid(clobj.get_asteroid());
 				float const dist_to_cobj(clobj.dist - (asteroid.radius + radius));
@@ -376,6 +448,7 @@ void process_univ_objects() {
 						float const elastic((lod_coll ? 0.1 : 1.0)*SBODY_COLL_ELASTIC);
 						upos_point_type const cpos(asteroid.pos + norm*min(rsum, 1.1*dist)); // move away from the asteroid, but limit the distance to smooth the response
 						proc_collision(uobj, cpos, asteroid.pos, asteroid.radius, asteroid.get_velocity(), 1.0, elastic, asteroid.get_fragment_tid(obj_pos));
+						moved = 1;
 
 						if (is_ship && clobj.asteroid_field == AST_BELT_ID) { // ship collision with asteroid belt
 							//clobj.get_asteroid_belt().detach_asteroid(clobj.asteroid); // incomplete
@@ -387,9 +460,7 @@ void process_univ_objects() {
 				assert(clobj.object != NULL);
 				float const clobj_radius(clobj.object->get_radius());
 				point const clobj_pos(clobj.object->get_pos());
-				float const temperature(universe.get_point_temperature(clobj, obj_pos, sun_pos)*(FOBJ_TEMP_SCALE - uobj->get_shadow_val())); // shadow_val = 0-3
-				uobj->set_temp(temperature, sun_pos);
-				temp_known = 1;
+				uobj->set_temp(env.temperature, env.sun_pos);
 				float hmap_scale(0.0);
 				if (clobj.type == UTYPE_MOON  ) {hmap_scale = MOON_HMAP_SCALE;  }
 				if (clobj.type == UTYPE_PLANET) {hmap_scale = PLANET_HMAP_SCALE;}
@@ -420,12 +491,12 @@ void process_univ_objects() {
 
 						if (clobj.object->collision(obj_pos, radius_coll, uobj->get_velocity(), cpos, coll_r, simple_coll)) {
 							proc_collision(uobj, cpos, clobj_pos, coll_r, zero_vector, clobj.object->mass, elastic, clobj.object->get_fragment_tid(obj_pos));
-							coll = 2;
+							coll  = 2;
+							moved = 1;
 						}
 					} // collision
 					if (is_ship) {uobj->near_sobj(clobj, coll);}
 				} // planet or moon
-				if (calc_gravity) {get_gravity(clobj, obj_pos, gravity, 1);}
 
 				if (clobj.type == UTYPE_PLANET) {
 					// when near a planet with rings, use the dist to the outer rings to limit speed so that we don't fly through the rings too quickly
@@ -435,28 +506,12 @@ void process_univ_objects() {
 				}
 			}
 		} // found_close
-		if (!temp_known) {
-			float temperature(0.0);
-			if (!particle && !projectile) {temperature = universe.get_point_temperature(clobj, obj_pos, sun_pos)*FOBJ_TEMP_SCALE;}
-			uobj->set_temp(temperature, sun_pos);
-		}
-		if (calc_gravity) {
-			bool near_b_hole(0);
-			vector3d swp_accel(zero_vector);
-
-			if (!stat_objs.empty()) {
-				all_query_data qdata(&stat_objs, obj_pos, 10.0, urm_static, uobj, stat_obj_query_res);
-				get_all_close_objects(qdata);
-				
-				for (unsigned j = 0; j < stat_obj_query_res.size(); ++j) { // asteroid/black hole gravity
-					near_b_hole |= (stat_obj_query_res[j]->get_gravity(gravity, obj_pos) == 2);
-				}
-			}
-			if (clobj.has_valid_system()) {
-				swp_accel = clobj.get_star().get_solar_wind_accel(obj_pos, uobj->get_mass(), uobj->get_surf_area());
-			}
-			uobj->add_gravity_swp(gravity, swp_accel, float(GRAV_CHECK_MOD), near_b_hole);
+		if (moved) { // queried values that depend on the object position must be recomputed
+			if (!temp_known) {calc_uobj_temperature(uobj, env);}
+			if (calc_gravity) {calc_uobj_gravity(uobj, env);}
 		}
+		if (!temp_known) {uobj->set_temp(env.temperature, env.sun_pos);}
+		if (calc_gravity) {uobj->add_gravity_swp(env.gravity, env.swp_accel, float(GRAV_CHECK_MOD), env.near_b_hole);}
 		if (is_ship) {
 			for (unsigned t = 0; t < temp_sources.size(); ++t) { // check for temperature of weapons - inefficient
 				temp_source const &ts(temp_sources[t]);
@@ -1078,7 +1133,8 @@ orbiting_ship *add_orbiting_ship(unsigned sclass, bool guardian, bool on_surface
 	// not sure what to set orbit_radius to - could collide with other orbiting objects
 	float const orbit_radius(on_surface ? 0.0 : 2.0*world.get_radius()), rate(0.0);
 	point const start_pos((pos_from_parent && on_surface) ? point(parent->get_pos() - world.get_pos()) : all_zeros);
-	orbiting_ship *const ship(new orbiting_ship(sclass, parent->get_align(), guardian, world_path, zero_vector, start_pos, orbit_radius, angle, rate));
+	static free_obj_pool_t<orbiting_ship> orbiting_ship_pool("Orbiting Ships");
+	orbiting_ship *const ship(orbiting_ship_pool.alloc(sclass, parent->get_align(), guardian, world_path, zero_vector, start_pos, orbit_radius, angle, rate));
 	ship->set_parent(parent);
 	add_uobj_ship(ship);
 	return ship;
@@ -1543,7 +1543,7 @@ bool rand_spawn_mixin::needs_respawned() const {
 uobject_rand_spawn_t *uobject_rand_spawn_t::create(unsigned type, float radius_, float dmax, float vmag) {
 	
 	switch (type) {
-	case SPO_COMET: {return new ucomet(radius_, dmax, vmag);}
+	case SPO_COMET: {static free_obj_pool_t<ucomet> comet_pool("Comets"); return comet_pool.alloc(radius_, dmax, vmag);}
 	default: assert(0);
 	}
 	return NULL;
@@ -0,0 +1,68 @@
+// 3D World - Benchmark Mode: runs a fixed number of frames along an optional camera path and writes profiler stats as JSON
+// by Frank Gennari
+// 10/17/26
+
+#include "3DWorld.h"
+#include <fstream>
+
+using std::string;
+
+
+extern bool profiler_zones_enabled;
+extern unsigned benchmark_frames;
+extern point surface_pos;
+extern string benchmark_camera_path, benchmark_output_fn;
+
+void display(void);
+void quit_3dworld();
+
+
+// reads positions in the format written to positions.log.txt by the 'f' key: one "x y z" per line
+bool read_camera_path(string const &fn, vector<point> &path) {
+
+	std::ifstream in(fn);
+
+	if (!in.good()) {
+		std::cerr << "Error opening benchmark camera path file " << fn << endl;
+		return 0;
+	}
+	point pos;
+	while (in >> pos.x >> pos.y >> pos.z) {path.push_back(pos);}
+
+	if (!in.eof()) {
+		std::cerr << "Error reading benchmark camera path file " << fn << " at point " << path.size() << endl;
+		return 0;
+	}
+	cout << "Read " << path.size() << " camera path points from " << fn << endl;
+	return 1;
+}
+
+
+// called from main() in place of glutMainLoop() when benchmark_frames > 0;
+// the window is hidden, but a GL context is still required (use a virtual framebuffer with software GL on machines without a GPU)
+void run_benchmark() {
+
+	vector<point> path;
+	if (!benchmark_camera_path.empty() && !read_camera_path(benchmark_camera_path, path)) {exit(1);}
+	cout << "Running benchmark for " << benchmark_frames << " frames" << endl;
+	glutHideWindow();
+	if (!profiler_zones_enabled) {toggle_timing_profiler();}
+	point prev_path_pos(path.empty() ? all_zeros : path.front());
+
+	for (unsigned frame = 0; frame < benchmark_frames; ++frame) {
+		if (path.size() > 1) { // move the camera to the interpolated path position for this frame
+			float const t(float(frame)*(path.size() - 1)/max(1U, (benchmark_frames - 1)));
+			unsigned const ix(min(unsigned(t), unsigned(path.size() - 2)));
+			point const pos(path[ix] + (t - ix)*(path[ix+1] - path[ix]));
+			surface_pos  += (pos - prev_path_pos); // apply relative movement, which still works after tiled terrain origin shifts
+			prev_path_pos = pos;
+		}
+		display();
+	}
+	timing_profiler_next_frame(); // collect zones from the last frame
+	bool const success(write_timing_profiler_json(benchmark_output_fn));
+	timing_profiler_stats(); // print to the console as well
+	if (!success) {exit(1);}
+	quit_3dworld();
+}
+
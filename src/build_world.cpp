@@ -312,6 +312,7 @@ void set_global_state() {
 
 void process_groups() {
 
+	PROFILE_SCOPE("Process Groups");
 	if (animate2) {advance_physics_objects();}
 
 	if (display_mode & 0x0200) {
@@ -884,7 +885,7 @@ void add_all_coll_objects(const char *filename, bool re_add) {
 	bool const verbose(!scrolling);
 	if (verbose) {cobj_stats();}
 	pre_rt_bvh_build_hook(); // required for light ray tracing so that BVH nodes are properly expanded
-	build_cobj_tree(0, verbose);
+	build_cobj_tree(0, verbose, 1); // use the BVH cache file if enabled
 	post_rt_bvh_build_hook(); // required for light ray tracing (unexpand cobjs but leave BVH nodes expanded)
 	check_contained_cube_sides();
 	flag_cobjs_indoors_outdoors();
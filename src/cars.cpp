@@ -6,7 +6,9 @@
 #include "openal_wrap.h"
 #include "explosion.h" // for add_blastr()
 #include "lightmap.h" // for light_source
+#include "job_system.h"
 #include <cfloat> // for FLT_MAX
+#include <mutex>
 
 float const MIN_CAR_STOP_SEP = 0.25; // in units of car lengths
 
@@ -17,6 +19,8 @@ extern point pre_smap_player_pos;
 extern vector<light_source> dl_sources;
 extern city_params_t city_params;
 
+std::mutex car_sound_mutex; // car collisions are processed in parallel
+
 
 bool city_model_t::read(FILE *fp) { // filename body_material_id fixed_color_id xy_rot dz lod_mult shadow_mat_ids
 
@@ -137,7 +141,9 @@ bool car_t::front_intersects_car(car_t const &c) const {
 
 void car_t::honk_horn_if_close() const {
 	point const pos(get_center());
-	if (dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) {gen_sound(SOUND_HORN, pos);}
+	if (!dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) return;
+	std::lock_guard<std::mutex> lock(car_sound_mutex);
+	gen_sound(SOUND_HORN, pos);
 }
 
 void car_t::honk_horn_if_close_and_fast() const {
@@ -237,15 +243,11 @@ bool car_t::check_collision(car_t &c, road_gen_base_t const &road_gen) {
 }
 
 
-bool comp_car_road_then_pos::operator()(car_t const &c1, car_t const &c2) const { // sort spatially for collision detection and drawing
-	if (c1.cur_city != c2.cur_city) return (c1.cur_city < c2.cur_city);
-	if (c1.is_parked() != c2.is_parked()) {return c2.is_parked();} // parked cars last
-	if (c1.cur_road != c2.cur_road) return (c1.cur_road < c2.cur_road);
-
-	if (c1.is_parked()) { // sort parked cars back to front relative to camera so that alpha blending works
-		return (p2p_dist_xy_sq(c1.bcube.get_cube_center(), camera_pos) > p2p_dist_xy_sq(c2.bcube.get_cube_center(), camera_pos));
-	}
-	return (c1.bcube.d[c1.dim][c1.dir] < c2.bcube.d[c2.dim][c2.dir]); // compare front end of car (used for collisions)
+car_sort_key_t::car_sort_key_t(car_t const &c, unsigned ix_, point const &camera_pos) : ix(ix_), city(c.cur_city), road(c.cur_road), seg(c.cur_seg),
+	road_type(c.cur_road_type), parked(c.is_parked())
+{ // sort spatially for collision detection and drawing
+	if (parked) {pos = -p2p_dist_xy_sq(c.bcube.get_cube_center(), camera_pos);} // sort parked cars back to front relative to camera so that alpha blending works
+	else {pos = c.bcube.d[c.dim][c.dir];} // compare front end of car (used for collisions)
 }
 
 
@@ -538,6 +540,7 @@ void car_draw_state_t::add_car_headlights(car_t const &car, cube_t &lights_bcube
 
 void car_manager_t::remove_destroyed_cars() {
 	remove_destroyed(cars);
+	car_keys.clear(); // force a full sort
 	car_destroyed = 0;
 }
 
@@ -771,7 +774,7 @@ bool car_manager_t::check_car_for_ped_colls(car_t &car) const {
 	coll_area.d[car.dim][car.dir] += (car.dir ? 1.25 : -1.25)*car.get_length(); // extend the front
 	coll_area.d[!car.dim][0] -= 0.5*car.get_width();
 	coll_area.d[!car.dim][1] += 0.5*car.get_width();
-	static rand_gen_t rgen;
+	static thread_local rand_gen_t rgen; // called from multiple threads
 
 	for (auto i = peds.begin(); i != peds.end(); ++i) {
 		if (coll_area.contains_pt_xy_exp(i->pos, i->radius)) {
@@ -800,68 +803,156 @@ bool car_manager_t::choose_dest_parked_car(unsigned city_id, unsigned &plot_id,
 	return 0;
 }
 
-void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
-	if (cars.empty() || !animate2) return;
-	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
-	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
-	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
-#pragma omp critical(modify_car_data)
-	{
-		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
-		sort(cars.begin(), cars.end(), comp_car_road_then_pos(camera_pdu.pos - dstate.xlate)); // sort by city/road/position for intersection tests and tile shadow map binds
+// O(n + number of inversions), fast for nearly sorted data; falls back to std::sort if more than max_moves elements are moved
+template<typename T> void insertion_sort(vector<T> &v, size_t max_moves) {
+	size_t num_moves(0);
+
+	for (unsigned i = 1; i < v.size(); ++i) {
+		if (!(v[i] < v[i-1])) continue; // already in order
+		T const val(v[i]);
+		unsigned j(i);
+		for (; j > 0 && val < v[j-1]; --j) {v[j] = v[j-1];}
+		v[j] = val;
+		num_moves += (i - j);
+		if (num_moves > max_moves) {sort(v.begin(), v.end()); return;} // too far out of order (camera moved a long distance?)
 	}
-	entering_city.clear();
+}
+
+// cars move a small distance each frame, so last frame's order is nearly correct; only cars that changed city/road are fully re-sorted
+void car_manager_t::sort_cars() {
+	point const camera_pos(camera_pdu.pos - dstate.xlate);
+	bool const full_sort(car_keys.size() != cars.size()); // cars were added or removed
+	unsigned num_keep(0);
+	changed_car_keys.clear();
+
+	for (unsigned i = 0; i < cars.size(); ++i) {
+		car_sort_key_t const key(cars[i], i, camera_pos);
+		if (!full_sort && key.same_road(car_keys[i])) {car_keys[num_keep++] = key;} // Note: num_keep <= i
+		else {changed_car_keys.push_back(key);}
+	}
+	car_keys.resize(num_keep);
+	insertion_sort(car_keys, 4*car_keys.size()); // cars on the same road only move relative to nearby cars on that road
+	sort(changed_car_keys.begin(), changed_car_keys.end());
+	vector_add_to(changed_car_keys, car_keys);
+	std::inplace_merge(car_keys.begin(), car_keys.begin()+num_keep, car_keys.end());
+	// apply the permutation to the range of cars that changed position
+	unsigned start(0), end(cars.size());
+	while (start < end && car_keys[start].ix == start) {++start;}
+	while (end > start && car_keys[end-1].ix == end-1) {--end;}
+
+	if (start < end) {
+		sort_temp_cars.assign(cars.begin()+start, cars.begin()+end);
+
+		for (unsigned i = start; i < end; ++i) {
+			assert(car_keys[i].ix >= start && car_keys[i].ix < end);
+			cars[i] = sort_temp_cars[car_keys[i].ix - start];
+			car_keys[i].ix = i;
+		}
+	}
+}
+
+void car_manager_t::build_car_blocks() { // one block per city, with parked cars at the end
 	car_blocks.clear();
-	float const speed(CAR_SPEED_SCALE*car_speed*fticks);
 	bool saw_parked(0);
-	//unsigned num_on_conn_road(0);
 
-	for (auto i = cars.begin(); i != cars.end(); ++i) { // move cars
-		unsigned const cix(i - cars.begin());
-		i->car_in_front = nullptr; // reset for this frame
+	for (unsigned cix = 0; cix < car_keys.size(); ++cix) {
+		car_sort_key_t const &key(car_keys[cix]);
 
-		if (car_blocks.empty() || i->cur_city != car_blocks.back().cur_city) {
+		if (car_blocks.empty() || key.city != car_blocks.back().cur_city) {
 			if (!saw_parked && !car_blocks.empty()) {car_blocks.back().first_parked = cix;} // no parked cars in prev city
 			saw_parked = 0; // reset for next city
-			car_blocks.emplace_back(cix, i->cur_city);
+			car_blocks.emplace_back(cix, key.city);
 		}
-		if (i->is_parked()) {
-			if (!saw_parked) {car_blocks.back().first_parked = cix; saw_parked = 1;}
-			continue; // no update for parked cars
-		}
-		i->move(speed);
-		if (i->entering_city) {entering_city.push_back(cix);} // record for use in collision detection
-		if (!i->stopped_at_light && i->is_almost_stopped() && i->in_isect()) {get_car_isec(*i).stoplight.mark_blocked(i->dim, i->dir);} // blocking intersection
-		register_car_at_city(*i);
-	} // for i
+		if (key.parked && !saw_parked) {car_blocks.back().first_parked = cix; saw_parked = 1;}
+	}
 	if (!saw_parked && !car_blocks.empty()) {car_blocks.back().first_parked = cars.size();} // no parked cars in final city
 	car_blocks.emplace_back(cars.size(), 0); // add terminator
+}
+
+void car_manager_t::move_cars_in_block(unsigned block_ix, float speed) {
+	car_block_t const &cb(car_blocks[block_ix]);
+	vector<unsigned> &entering(entering_city_by_block[block_ix]);
+	entering.clear();
+
+	for (unsigned cix = cb.start; cix < car_blocks[block_ix+1].start; ++cix) {
+		car_t &car(cars[cix]);
+		car.car_in_front = nullptr; // reset for this frame
+		if (cix >= cb.first_parked) continue; // no update for parked cars
+		car.move(speed);
+		if (car.entering_city) {entering.push_back(cix);} // record for use in collision detection
+		if (!car.stopped_at_light && car.is_almost_stopped() && car.in_isect()) {get_car_isec(car).stoplight.mark_blocked(car.dim, car.dir);} // blocking intersection
+		register_car_at_city(car);
+	}
+}
 
-	for (auto i = cars.begin(); i != cars.end(); ++i) { // collision detection
-		if (i->is_parked()) continue; // no collisions for parked cars
-		bool const on_conn_road(i->cur_city == CONN_CITY_IX);
-		float const length(i->get_length()), max_check_dist(max(3.0f*length, (length + i->get_max_lookahead_dist()))); // max of collision dist and car-in-front dist
-
-		for (auto j = i+1; j != cars.end(); ++j) { // check for collisions with cars on the same road (can't test seg because they can be on diff segs but still collide)
-			if (i->cur_city != j->cur_city || i->cur_road != j->cur_road) break; // different cities or roads
-			if (!on_conn_road && i->cur_road_type == j->cur_road_type && abs((int)i->cur_seg - (int)j->cur_seg) > (on_conn_road ? 1 : 0)) break; // diff road segs or diff isects
-			check_collision(*i, *j);
-			i->register_adj_car(*j);
-			j->register_adj_car(*i);
-			if (!dist_xy_less_than(i->get_center(), j->get_center(), max_check_dist)) break;
+// if deferred_colls is non-null, collisions with cars in other cities are recorded there rather than processed, since those cars may be updated by another thread
+void car_manager_t::check_collisions_in_block(unsigned block_ix, vector<pair<unsigned, unsigned>> *deferred_colls) {
+	unsigned const block_end(car_blocks[block_ix+1].start);
+
+	for (unsigned cix = car_blocks[block_ix].start; cix < car_blocks[block_ix].first_parked; ++cix) { // parked cars have no collisions
+		car_t &car(cars[cix]);
+		car_sort_key_t const &key(car_keys[cix]);
+		bool const on_conn_road(key.city == CONN_CITY_IX);
+		float const length(car.get_length()), max_check_dist(max(3.0f*length, (length + car.get_max_lookahead_dist()))); // max of collision dist and car-in-front dist
+
+		for (unsigned j = cix+1; j < block_end; ++j) { // check for collisions with cars on the same road (can't test seg because they can be on diff segs but still collide)
+			car_sort_key_t const &jkey(car_keys[j]); // cull using hot fields to avoid touching the car itself
+			if (key.road != jkey.road) break; // different roads
+			if (!on_conn_road && key.road_type == jkey.road_type && key.seg != jkey.seg) break; // diff road segs or diff isects
+			check_collision(car, cars[j]);
+			car.register_adj_car(cars[j]);
+			cars[j].register_adj_car(car);
+			if (!dist_xy_less_than(car.get_center(), cars[j].get_center(), max_check_dist)) break;
 		}
 		if (on_conn_road) { // on connector road, check before entering intersection to a city
 			for (auto ix = entering_city.begin(); ix != entering_city.end(); ++ix) {
-				if (*ix != unsigned(i - cars.begin())) {check_collision(*i, cars[*ix]);}
+				if (*ix != cix) {check_collision(car, cars[*ix]);}
 			}
-			//++num_on_conn_road;
 		}
-		if (i->in_isect()) {
-			int const next_car(find_next_car_after_turn(*i)); // Note: calculates in i->car_in_front
-			if (next_car >= 0) {check_collision(*i, cars[next_car]);} // make sure we collide with the correct car
+		if (car.in_isect()) {
+			int const next_car(find_next_car_after_turn(car)); // Note: calculates in car.car_in_front
+
+			if (next_car >= 0) { // make sure we collide with the correct car
+				if (deferred_colls && cars[next_car].cur_city != key.city) {deferred_colls->emplace_back(cix, next_car);}
+				else {check_collision(car, cars[next_car]);}
+			}
 		}
-		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(*i);}
-	} // for i
+		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(car);}
+	} // for cix
+}
+
+void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
+	if (cars.empty() || !animate2) return;
+	PROFILE_SCOPE("City Cars Update");
+	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
+	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
+	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
+#pragma omp critical(modify_car_data)
+	{
+		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
+		sort_cars(); // sort by city/road/position for intersection tests and tile shadow map binds
+	}
+	build_car_blocks();
+	unsigned const num_blocks(car_blocks.size() - 1);
+	float const speed(CAR_SPEED_SCALE*car_speed*fticks);
+	entering_city_by_block.resize(num_blocks);
+	deferred_colls_by_block.resize(num_blocks);
+	// cities are independent, except for the connector road network, which is processed serially after the cities
+	parallel_for(0, num_blocks, [&](int b) {move_cars_in_block(b, speed);}, 1, 1); // grain=1
+	entering_city.clear();
+	for (unsigned b = 0; b < num_blocks; ++b) {vector_add_to(entering_city_by_block[b], entering_city);}
+
+	parallel_for(0, num_blocks, [&](int b) { // collision detection
+		deferred_colls_by_block[b].clear();
+		if (car_blocks[b].cur_city != CONN_CITY_IX) {check_collisions_in_block(b, &deferred_colls_by_block[b]);}
+	}, 1, 1); // grain=1
+
+	for (unsigned b = 0; b < num_blocks; ++b) {
+		for (auto i = deferred_colls_by_block[b].begin(); i != deferred_colls_by_block[b].end(); ++i) {check_collision(cars[i->first], cars[i->second]);}
+	}
+	for (unsigned b = 0; b < num_blocks; ++b) {
+		if (car_blocks[b].cur_city == CONN_CITY_IX) {check_collisions_in_block(b, nullptr);}
+	}
 	update_cars(); // run update logic
 
 	if (map_mode) { // create cars_by_road
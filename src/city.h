@@ -193,10 +193,22 @@ struct car_city_vect_t {
 struct comp_car_road {
 	bool operator()(car_base_t const &c1, car_base_t const &c2) const {return (c1.cur_road < c2.cur_road);}
 };
-struct comp_car_road_then_pos {
-	vector3d const &camera_pos;
-	comp_car_road_then_pos(vector3d const &camera_pos_) : camera_pos(camera_pos_) {}
-	bool operator()(car_t const &c1, car_t const &c2) const;
+struct car_sort_key_t { // hot car fields used for sorting and collision culling, stored in an array parallel to cars (size = 16)
+	float pos; // front of the car for moving cars; negative squared distance to the camera for parked cars, so that they're drawn back to front
+	unsigned ix; // index of the car in cars
+	unsigned short city, road, seg;
+	unsigned char road_type;
+	bool parked;
+
+	car_sort_key_t() : pos(0.0), ix(0), city(0), road(0), seg(0), road_type(0), parked(0) {}
+	car_sort_key_t(car_t const &c, unsigned ix_, point const &camera_pos);
+	bool same_road(car_sort_key_t const &k) const {return (city == k.city && parked == k.parked && road == k.road);}
+	bool operator<(car_sort_key_t const &k) const { // sort by city, then moving before parked, then road, then position
+		if (city   != k.city  ) return (city < k.city);
+		if (parked != k.parked) return k.parked;
+		if (road   != k.road  ) return (road < k.road);
+		return (pos < k.pos);
+	}
 };
 
 
@@ -316,6 +328,23 @@ struct plot_xy_t {
 	int get_adj(unsigned x, unsigned y, unsigned dir) const {assert(x < nx && y < ny); return adj_plots[y*nx + x].adj[dir];} // -1 == no plot
 };
 
+// all-pairs shortest path distances over a small graph, such as the intersections of a city; lookups are O(1)
+class route_table_t {
+	unsigned num_nodes;
+	vector<float> dists; // indexed by [dest][src]; FLT_MAX if unreachable
+public:
+	struct edge_t {
+		unsigned node;
+		float len;
+		edge_t(unsigned n, float l) : node(n), len(l) {}
+	};
+	route_table_t() : num_nodes(0) {}
+	bool empty() const {return dists.empty();}
+	void clear() {num_nodes = 0; dists.clear();}
+	void build(vector<vector<edge_t>> const &adj); // adj[src] = edges leaving src
+	float get_dist(unsigned src, unsigned dest) const {assert(src < num_nodes && dest < num_nodes); return dists[dest*num_nodes + src];}
+};
+
 struct parking_lot_t : public cube_t {
 	bool dim, dir;
 	unsigned short row_sz, num_rows;
@@ -617,13 +646,16 @@ class car_manager_t {
 		car_block_t(unsigned s, unsigned c) : start(s), cur_city(c), first_parked(0) {}
 	};
 	city_road_gen_t const &road_gen;
-	vector<car_t> cars;
+	vector<car_t> cars, sort_temp_cars;
+	vector<car_sort_key_t> car_keys, changed_car_keys; // car_keys is parallel to cars after sorting
 	vector<car_block_t> car_blocks, car_blocks_by_road;
 	vector<cube_with_ix_t> cars_by_road;
 	ped_city_vect_t peds_crossing_roads;
 	car_draw_state_t dstate;
 	rand_gen_t rgen;
 	vector<unsigned> entering_city;
+	vector<vector<unsigned>> entering_city_by_block;
+	vector<vector<pair<unsigned, unsigned>>> deferred_colls_by_block; // collisions with cars in other cities
 	bool car_destroyed;
 
 	cube_t const get_cb_bcube(car_block_t const &cb ) const;
@@ -633,12 +665,16 @@ class car_manager_t {
 	void add_car();
 	void get_car_ix_range_for_cube(vector<car_block_t>::const_iterator cb, cube_t const &bc, unsigned &start, unsigned &end) const;
 	void remove_destroyed_cars();
+	void sort_cars();
+	void build_car_blocks();
+	void move_cars_in_block(unsigned block_ix, float speed);
+	void check_collisions_in_block(unsigned block_ix, vector<pair<unsigned, unsigned>> *deferred_colls);
 	void update_cars();
 	int find_next_car_after_turn(car_t &car);
 public:
 	car_manager_t(city_road_gen_t const &road_gen_) : road_gen(road_gen_), dstate(car_model_loader), car_destroyed(0) {}
 	bool empty() const {return cars.empty();}
-	void clear() {cars.clear(); car_blocks.clear();}
+	void clear() {cars.clear(); car_keys.clear(); car_blocks.clear();}
 	unsigned get_model_gpu_mem() const {return car_model_loader.get_gpu_mem();}
 	void init_cars(unsigned num);
 	void add_parked_cars(vector<car_t> const &new_cars) {vector_add_to(new_cars, cars);}
@@ -660,6 +696,8 @@ public:
 }; // car_manager_t
 
 
+struct ped_update_ctx_t;
+
 struct pedestrian_t : public waiting_obj_t {
 
 	point target_pos, dest_car_center; // since cars are sorted each frame, we can't find their positions by index so we need to cache them here
@@ -667,12 +705,13 @@ struct pedestrian_t : public waiting_obj_t {
 	point pos;
 	float radius, speed, anim_time;
 	unsigned plot, next_plot, dest_plot, dest_bldg; // Note: can probably be made unsigned short later, though these are global plot and building indices
-	unsigned short city, model_id, ssn, colliding_ped;
+	unsigned colliding_ped; // index into peds, which may have more than 64K entries
+	unsigned short city, model_id, ssn;
 	unsigned char stuck_count;
 	bool collided, ped_coll, is_stopped, in_the_road, at_crosswalk, at_dest, has_dest_bldg, has_dest_car, destroyed;
 
 	pedestrian_t(float radius_) : target_pos(all_zeros), dir(zero_vector), vel(zero_vector), pos(all_zeros), radius(radius_), speed(0.0), anim_time(0.0), plot(0), next_plot(0), dest_plot(0),
-		dest_bldg(0), city(0), model_id(0), ssn(0), colliding_ped(0), stuck_count(0), collided(0), ped_coll(0), is_stopped(0), in_the_road(0), at_crosswalk(0), at_dest(0), has_dest_bldg(0),
+		dest_bldg(0), colliding_ped(0), city(0), model_id(0), ssn(0), stuck_count(0), collided(0), ped_coll(0), is_stopped(0), in_the_road(0), at_crosswalk(0), at_dest(0), has_dest_bldg(0),
 		has_dest_car(0), destroyed(0) {}
 	bool operator<(pedestrian_t const &ped) const {return ((city == ped.city) ? (plot < ped.plot) : (city < ped.city));} // currently only compares city + plot
 	string get_name() const;
@@ -684,9 +723,11 @@ struct pedestrian_t : public waiting_obj_t {
 	void stop();
 	void go();
 	bool check_for_safe_road_crossing(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, vect_cube_t *dbg_cubes=nullptr) const;
-	bool check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force);
-	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir);
-	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid);
+	bool add_ped_avoid_force(point const &opos, vector3d const &ovel, float oradius, float prox_radius_sq, vector3d &force) const;
+	bool check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned ped_end, unsigned target_plot, float prox_radius, vector3d &force);
+	bool check_ped_ped_coll_adj_plot(ped_update_ctx_t &ctx, unsigned pid, unsigned ped_start, unsigned ped_end, unsigned target_plot, float prox_radius, vector3d &force);
+	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, ped_update_ctx_t &ctx, float delta_dir);
+	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_end);
 	bool check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube);
 	bool check_road_coll(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube) const;
 	bool is_valid_pos(vect_cube_t const &colliders, bool &ped_at_dest, ped_manager_t const *const ped_mgr) const;
@@ -694,7 +735,7 @@ struct pedestrian_t : public waiting_obj_t {
 	point get_dest_pos(cube_t const &plot_bcube, cube_t const &next_plot_bcube, ped_manager_t const &ped_mgr) const;
 	bool choose_alt_next_plot(ped_manager_t const &ped_mgr);
 	void get_avoid_cubes(ped_manager_t const &ped_mgr, vect_cube_t const &colliders, point const &dest_pos, vect_cube_t &avoid) const;
-	void next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir);
+	void next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, ped_update_ctx_t &ctx, float delta_dir);
 	void register_at_dest();
 	void destroy() {destroyed = 1;} // that's it, no other effects
 	void debug_draw(ped_manager_t &ped_mgr) const;
@@ -735,6 +776,27 @@ public:
 	unsigned run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest);
 };
 
+struct ped_snapshot_t { // ped state at the start of the frame, read by peds in adjacent plots
+	point pos;
+	vector3d vel;
+	float radius;
+	unsigned plot;
+	ped_snapshot_t() : radius(0.0), plot(0) {}
+	ped_snapshot_t(pedestrian_t const &ped) : pos(ped.pos), vel(ped.vel), radius(ped.radius), plot(ped.plot) {}
+};
+
+// per-plot update state; plots are updated in parallel, and peds only write to peds in their own plot
+struct ped_update_ctx_t {
+	vector<ped_snapshot_t> const &snapshot;
+	vector<pair<unsigned, unsigned>> &deferred_colls; // {ped, colliding ped} for collisions with peds in other plots, applied after the update
+	path_finder_t &path_finder; // per-thread
+	rand_gen_t rgen; // per-plot so that results don't depend on thread scheduling
+	unsigned ped_end; // end of this plot's ped range
+
+	ped_update_ctx_t(vector<ped_snapshot_t> const &snapshot_, vector<pair<unsigned, unsigned>> &deferred_colls_, path_finder_t &path_finder_, unsigned ped_end_) :
+		snapshot(snapshot_), deferred_colls(deferred_colls_), path_finder(path_finder_), ped_end(ped_end_) {}
+};
+
 class ped_manager_t { // pedestrians
 
 	struct city_ixs_t {
@@ -748,8 +810,10 @@ class ped_manager_t { // pedestrians
 	vector<pedestrian_t> peds;
 	vector<city_ixs_t> by_city; // first ped/plot index for each city
 	vector<unsigned> by_plot;
-	vector<unsigned char> need_to_sort_city;
+	vector<unsigned char> need_to_sort_city, plot_changed;
 	vector<car_city_vect_t> cars_by_city;
+	vector<ped_snapshot_t> peds_snapshot;
+	vector<vector<pair<unsigned, unsigned>>> deferred_ped_colls; // per plot
 	rand_gen_t rgen;
 	ao_draw_state_t dstate;
 	int selected_ped_ssn;
@@ -762,10 +826,10 @@ class ped_manager_t { // pedestrians
 	void sort_by_city_and_plot();
 	road_isec_t const &get_car_isec(car_base_t const &car) const;
 	void register_ped_new_plot(pedestrian_t const &ped);
+	void update_peds_in_plot(unsigned plot, unsigned frame_seed, float delta_dir);
 	int get_road_ix_for_ped_crossing(pedestrian_t const &ped, bool road_dim) const;
 public:
 	// for use in pedestrian_t, mostly for collisions and path finding
-	path_finder_t path_finder;
 	vect_cube_t const &get_colliders_for_plot(unsigned city_ix, unsigned plot_ix) const;
 	cube_t const &get_city_plot_bcube_for_peds(unsigned city_ix, unsigned plot_ix) const;
 	cube_t get_expanded_city_bcube_for_peds(unsigned city_ix) const;
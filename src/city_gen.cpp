@@ -9,7 +9,9 @@
 #include "lightmap.h"
 #include "buildings.h"
 #include "tree_3dw.h"
+#include "job_system.h"
 #include <cfloat> // for FLT_MAX
+#include <queue>
 
 using std::string;
 
@@ -17,6 +19,7 @@ bool const CHECK_HEIGHT_BORDER_ONLY = 1; // choose building site to minimize edg
 float const OUTSIDE_TERRAIN_HEIGHT  = 0.0;
 float const CAR_LANE_OFFSET         = 0.15; // in units of road width
 float const CITY_LIGHT_FALLOFF      = 0.2;
+unsigned const MAX_ROUTE_TABLE_NODES = 2048; // larger cities use the local heuristic for car routing (table would be > 16MB)
 
 
 city_params_t city_params;
@@ -712,6 +715,35 @@ void plot_xy_t::gen_adj_plots(vector<road_plot_t> const &plots) {
 	}
 }
 
+void route_table_t::build(vector<vector<edge_t>> const &adj) {
+	num_nodes = adj.size();
+	dists.clear();
+	dists.resize(size_t(num_nodes)*num_nodes, FLT_MAX);
+	vector<vector<edge_t>> radj(num_nodes); // reversed edges, so that we can search outward from each dest
+
+	for (unsigned n = 0; n < num_nodes; ++n) {
+		for (auto e = adj[n].begin(); e != adj[n].end(); ++e) {assert(e->node < num_nodes); radj[e->node].emplace_back(n, e->len);}
+	}
+	parallel_for(0, num_nodes, [&](int dest) { // Dijkstra's algorithm from each dest
+		typedef pair<float, unsigned> dist_node_t;
+		std::priority_queue<dist_node_t, vector<dist_node_t>, std::greater<dist_node_t>> open;
+		float *const dist(dists.data() + size_t(dest)*num_nodes);
+		dist[dest] = 0.0;
+		open.push(dist_node_t(0.0, dest));
+
+		while (!open.empty()) {
+			dist_node_t const cur(open.top());
+			open.pop();
+			if (cur.first > dist[cur.second]) continue; // stale entry
+
+			for (auto e = radj[cur.second].begin(); e != radj[cur.second].end(); ++e) {
+				float const new_dist(cur.first + e->len);
+				if (new_dist < dist[e->node]) {dist[e->node] = new_dist; open.push(dist_node_t(new_dist, e->node));}
+			}
+		} // while
+	});
+}
+
 
 class city_road_gen_t : public road_gen_base_t {
 
@@ -1103,6 +1135,9 @@ class city_road_gen_t : public road_gen_base_t {
 		map<unsigned, road_isec_t const *> cix_to_isec; // maps city_ix to intersection
 		vector<vect_cube_t> plot_colliders;
 		plot_xy_t plot_xy;
+		route_table_t isec_routes; // shortest road distance between intersections, indexed the same as dest_isec
+		vector<int> isec_exit_node; // 4 per isec {-x, +x, -y, +y}: next isec reached by leaving in that orient; -1 for none or connector road
+		vector<float> isec_exit_len; // 4 per isec: road distance to the next isec
 		unsigned city_id, cluster_id, plot_id_offset;
 		//string city_name; // future work
 		float tot_road_len;
@@ -1488,6 +1523,56 @@ class city_road_gen_t : public road_gen_base_t {
 				} // for i
 			} // for n
 			for (auto r = roads.begin(); r != roads.end(); ++r) {tot_road_len += r->get_length();} // calculate tot_road_len
+			if (!is_global_rn) {build_isec_routes();}
+		}
+		unsigned get_isec_node(unsigned type, unsigned ix) const { // type is {2-way, 3-way, 4-way}; same order as get_isec_by_ix()
+			assert(type < 3 && ix < isecs[type].size());
+			for (unsigned n = 0; n < type; ++n) {ix += isecs[n].size();}
+			return ix;
+		}
+		void build_isec_routes() {
+			isec_routes.clear();
+			isec_exit_node.clear();
+			isec_exit_len .clear();
+			unsigned const num_nodes(isecs[0].size() + isecs[1].size() + isecs[2].size());
+			if (num_nodes == 0 || num_nodes > MAX_ROUTE_TABLE_NODES) return; // no isecs, or too many to store all pairs
+			isec_exit_node.resize(4*num_nodes, -1);
+			isec_exit_len .resize(4*num_nodes, 0.0);
+			vector<vector<route_table_t::edge_t>> adj(num_nodes);
+
+			for (unsigned n = 0, node = 0; n < 3; ++n) { // {2-way, 3-way, 4-way}
+				for (auto i = isecs[n].begin(); i != isecs[n].end(); ++i, ++node) {
+					for (unsigned d = 0; d < 4; ++d) { // {-x, +x, -y, +y}
+						if (!(i->conn & (1<<d)) || i->conn_ix[d] < 0) continue; // no connection, or connector road (handled by conn_to_city)
+						bool const dir(d&1);
+						unsigned seg_ix(i->conn_ix[d]);
+						float len(0.5*i->get_sz_dim(d>>1)); // exit this isec
+
+						for (unsigned iter = 0; iter <= segs.size(); ++iter) { // follow segments until the next isec
+							road_seg_t const &seg(get_seg(seg_ix));
+							len += seg.get_length();
+							if (seg.conn_type[dir] == TYPE_RSEG) {seg_ix = seg.conn_ix[dir]; continue;}
+							if (seg.conn_type[dir] < TYPE_ISEC2 || seg.conn_type[dir] > TYPE_ISEC4) break; // dead end?
+							unsigned const type(seg.conn_type[dir] - TYPE_ISEC2), next_node(get_isec_node(type, seg.conn_ix[dir]));
+							len += 0.5*isecs[type][seg.conn_ix[dir]].get_sz_dim(d>>1); // enter next isec
+							isec_exit_node[4*node + d] = next_node;
+							isec_exit_len [4*node + d] = len;
+							adj[node].emplace_back(next_node, len);
+							break;
+						} // for iter
+					} // for d
+				} // for i
+			} // for n
+			isec_routes.build(adj);
+		}
+		// returns the road distance to dest_node when leaving cur_node in orient, or FLT_MAX if unknown/unreachable
+		float get_route_dist_via(unsigned cur_node, unsigned orient, unsigned dest_node) const {
+			if (isec_routes.empty()) return FLT_MAX;
+			assert(orient < 4 && 4*cur_node + orient < isec_exit_node.size());
+			int const next_node(isec_exit_node[4*cur_node + orient]);
+			if (next_node < 0) return FLT_MAX;
+			float const dist(isec_routes.get_dist(next_node, dest_node));
+			return ((dist == FLT_MAX) ? FLT_MAX : (dist + isec_exit_len[4*cur_node + orient]));
 		}
 		bool check_valid_conn_intersection(cube_t const &c, bool dim, bool dir, bool is_4_way) const {
 			return (is_4_way ? (find_3way_int_at(c, dim, dir) >= 0) : (find_conn_int_seg(c, dim, dir) >= 0));
@@ -1979,7 +2064,9 @@ class city_road_gen_t : public road_gen_base_t {
 					dir = (move_dir ? ((dx < 0) ? 0 : 1) : ((dy < 0) ? 2 : 3));	
 				}
 				else { // take a detour in a random direction
-					static rand_gen_t rgen;
+					rand_gen_t rgen; // seeded locally rather than static so that parallel ped updates are thread safe and deterministic
+					rgen.set_state(global_plot+1, (global_dest_plot + frame_counter));
+					rgen.rand_mix();
 					bool rand_dir(rgen.rand_bool());
 					dir = (move_dir ? (rand_dir ? 0 : 1) : (rand_dir ? 2 : 3));
 					
@@ -2230,7 +2317,29 @@ class city_road_gen_t : public road_gen_base_t {
 					orients[TURN_RIGHT] = stoplight_ns::conn_right[orient_in];
 
 					// TODO: use dest_seg.car_count to estimate traffic and route around
-					if (car.dest_valid && car.cur_city != CONN_CITY_IX) { // Note: don't need to update dest logic on connector roads since there are no choices to make
+					int const dest_node((car.dest_valid && car.cur_city != CONN_CITY_IX) ? car_rn.get_car_dest_isec_node(car, road_networks, global_rn) : -1);
+
+					if (dest_node >= 0) { // use the route table to choose the turn dir on the shortest path to the dest
+						unsigned const cur_node(car_rn.get_isec_node(car.get_isec_type(), car.cur_seg));
+						float best_dist(0.0);
+						bool found(0);
+
+						for (unsigned tdir = 0; tdir < 3; ++tdir) { // choose the valid turn dir from {none/straight, left, right} with the shortest remaining distance
+							unsigned const orient(orients[tdir]);
+							if (!isec.is_orient_currently_valid(orient, tdir)) continue; // can't turn in this dir
+
+							if (isec.conn_to_city >= 0 && isec.conn_ix[orient] < 0) { // city connector isec
+								if (isec.conn_to_city != car.dest_city) continue; // leads to incorrect city, skip
+								car.turn_dir = tdir; // this is our destination - done
+								found = 1;
+								break;
+							}
+							float const dist(car_rn.get_route_dist_via(cur_node, orient, dest_node)); // FLT_MAX if unreachable, but still valid as a last resort
+							if (!found || dist < best_dist) {best_dist = dist; car.turn_dir = tdir; found = 1;}
+						} // for tdir
+						assert(found); // no dead end roads
+					}
+					else if (car.dest_valid && car.cur_city != CONN_CITY_IX) { // Note: don't need to update dest logic on connector roads since there are no choices to make
 						point const dest_pos(car_rn.get_car_dest_isec_center(car, road_networks, global_rn));
 						vector3d const dest_dir(dest_pos - car.get_center());
 						bool const pri_dim(fabs(dest_dir.x) < fabs(dest_dir.y)), pri_dir(dest_dir[pri_dim] > 0), sec_dir(dest_dir[!pri_dim] > 0);
@@ -2283,6 +2392,19 @@ class city_road_gen_t : public road_gen_base_t {
 			assert(isec != nullptr); // path must exist, otherwise this city wouldn't have been chosen
 			return isec->get_cube_center();
 		}
+		int get_car_dest_isec_node(car_t &car, vector<road_network_t> const &road_networks, road_network_t const &global_rn) const { // returns -1 if there's no route table
+			if (isec_routes.empty()) return -1;
+			if (car.dest_city == city_id) {return car.dest_isec;} // local destination within the current city
+			assert(car.dest_city < road_networks.size());
+			road_isec_t const *const isec(find_isec_to_dest_city(car, road_networks[car.dest_city], global_rn)); // destination in another city
+			assert(isec != nullptr); // path must exist, otherwise this city wouldn't have been chosen
+
+			for (unsigned n = 0; n < 3; ++n) {
+				if (!isecs[n].empty() && isec >= &isecs[n].front() && isec <= &isecs[n].back()) {return get_isec_node(n, (isec - &isecs[n].front()));}
+			}
+			assert(0); // must be one of our isecs
+			return -1;
+		}
 		road_isec_t const *find_isec_to_dest_city(car_t &car, road_network_t const &dest_rn, road_network_t const &global_rn) const {
 			assert(car. cur_city == city_id);
 			assert(car.dest_city == dest_rn.city_id);
@@ -3033,6 +3155,7 @@ public:
 	}
 	void next_frame(bool use_threads_2_3) { // Note: threads: 0=draw, 1=roads and cars, 2=pedestrians
 		if (!city_params.enabled()) return;
+		PROFILE_SCOPE("City Update");
 
 		if (!use_threads_2_3 || omp_get_thread_num_3dw() == 1) {
 			road_gen.next_frame(); // update stoplights; must be before car_manager next_frame() call
@@ -80,12 +80,13 @@ public:
 		float const dist_sq(v1.mag_sq());
 		vector3d const v1n(v1/dist_sq);
 		float light(1.0); // start off fully lit
-		node_ix_mgr nixm(nodes, pos, sun_pos);
-		unsigned const num_nodes((unsigned)nodes.size());
+		node_ix_mgr nixm(pos, sun_pos);
+		unsigned const num_nodes(get_num_nodes()); // nodes may be in compact form
+		tree_node tmp;
 
 		for (unsigned nix = 0; nix < num_nodes;) {
-			tree_node const &n(nodes[nix]);
-			if (!nixm.check_node(nix)) continue;
+			tree_node const &n(get_node(nix, tmp));
+			if (!nixm.check_node(n, nix)) continue; // Note: modifies nix
 
 			for (unsigned i = n.start; i < n.end; ++i) { // check leaves
 				particle_cloud const &pc(mgr[objects[i].id]);
@@ -4,14 +4,30 @@
 
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
+#include <chrono>
+#include <fstream>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define USE_SSE_RAY_PACKETS
+#endif
 
 
 unsigned const MAX_LEAF_SIZE = 2;
+unsigned const MAX_SAH_LEAF  = 8; // larger leaves are allowed when the SAH says splitting is worse
+unsigned const NUM_SAH_BINS  = 16;
+unsigned const SAH_MT_MIN_NUM = 1024; // smallest subtree that will be built as its own parallel task
 float const POLY_TOLER       = 1.0E-6;
 float const OVERLAP_AMT      = 0.02;
+float const SAH_TRAV_COST    = 1.0; // cost of a node traversal relative to a cobj intersection test
+unsigned const BVH_CACHE_MAGIC   = 0x48564243; // "CBVH"
+unsigned const BVH_CACHE_VERSION = 2; // increment when the node layout or builders change
+float const REFIT_SA_RATIO   = 2.0; // refit subtrees whose surface area has grown by more than this factor since they were built are rebuilt
 
 
-extern bool mt_cobj_tree_build, begin_motion;
+extern bool mt_cobj_tree_build, sah_cobj_tree_build, compact_cobj_tree_nodes, refit_dynamic_cobj_trees, cache_bvh_files, begin_motion;
+extern char *coll_obj_file;
+extern unsigned cobj_tree_bench_rays;
 extern int display_mode, frame_counter, cobj_counter;
 extern coll_obj_group coll_objects;
 extern vector<unsigned> falling_cobjs;
@@ -78,12 +94,82 @@ cube_t tquad_t::get_bcube() const {
 
 bool cobj_tree_base::get_root_bcube(cube_t &bc) const {
 	
-	if (nodes.empty()) return 0;
-	bc = nodes[0];
+	if (is_empty()) return 0;
+	tree_node tmp;
+	bc = get_node(0, tmp);
 	return 1;
 }
 
 
+inline uint16_t quantize_lo(float v, float base, float step) { // rounds down
+	int q(max(0, min(65535, int(floor((v - base)/step)))));
+	while (q > 0 && (base + float(q)*step) > v) {--q;} // fix FP error so that the bounds are conservative
+	return q;
+}
+inline uint16_t quantize_hi(float v, float base, float step) { // rounds up
+	int q(max(0, min(65535, int(ceil((v - base)/step)))));
+	while (q < 65535 && (base + float(q)*step) < v) {++q;}
+	assert(base + float(q)*step >= v);
+	return q;
+}
+
+void cobj_tree_base::cnode_frame_t::set(cube_t const &bc) {
+
+	for (unsigned i = 0; i < 3; ++i) {
+		float const ext(bc.d[i][1] - bc.d[i][0]), max_abs(max(fabs(bc.d[i][0]), fabs(bc.d[i][1])));
+		// smallest power of 2 step that covers the extent in 65535 steps, with extra space for FP error in base + q*step
+		float const min_step(max(ext, 1.0E-6f*max_abs)*(1.0f + 1.0E-5f)/65535.0f);
+		int exp(0);
+		frexp(max(min_step, 1.0E-30f), &exp); // min_step <= 2^exp
+		step_exp[i] = (uint8_t)max(1, min(254, exp + 127));
+		base[i]     = bc.d[i][0];
+	}
+	pad = 0;
+}
+
+// replaces nodes with the smaller compact_tree_node format; must be called after the tree is built in depth-first order;
+// each block of CNODES_PER_BLOCK nodes is quantized relative to the union of its nodes' bounds, which is contained in their lowest common ancestor
+void cobj_tree_base::build_compact_nodes() {
+
+	clear_compact_nodes();
+	if (nodes.empty()) return;
+	num_cnodes = nodes.size();
+	cblocks.resize((num_cnodes + CNODES_PER_BLOCK - 1)/CNODES_PER_BLOCK);
+
+	for (unsigned bix = 0; bix < cblocks.size(); ++bix) {
+		compact_node_block_t &b(cblocks[bix]);
+		unsigned const nstart(bix*CNODES_PER_BLOCK), nend(min(num_cnodes, nstart+CNODES_PER_BLOCK));
+		cube_t fbc(nodes[nstart]);
+		for (unsigned nix = nstart+1; nix < nend; ++nix) {fbc.union_with_cube(nodes[nix]);}
+		b.frame.set(fbc);
+		memset(b.n, 0, sizeof(b.n)); // unused slots in the last block
+	}
+	for (unsigned nix = 0; nix < num_cnodes; ++nix) {
+		tree_node const &n(nodes[nix]);
+		compact_node_block_t &b(cblocks[nix/CNODES_PER_BLOCK]);
+		compact_tree_node &c(b.n[nix%CNODES_PER_BLOCK]);
+
+		for (unsigned i = 0; i < 3; ++i) {
+			float const step(b.frame.get_step(i));
+			c.lo[i] = quantize_lo(n.d[i][0], b.frame.base[i], step);
+			c.hi[i] = quantize_hi(n.d[i][1], b.frame.base[i], step);
+		}
+
+		if (n.start < n.end) { // leaf
+			assert(n.next_node_id == nix+1);
+			c.ix = (leaf_ranges.size() | CNODE_LEAF_FLAG);
+			leaf_ranges.emplace_back(n.start, n.end);
+		}
+		else {
+			assert(n.next_node_id > nix && n.next_node_id < CNODE_LEAF_FLAG);
+			c.ix = n.next_node_id;
+		}
+	}
+	assert(leaf_ranges.size() < CNODE_LEAF_FLAG);
+	vector<tree_node>().swap(nodes); // free the memory
+}
+
+
 bool cobj_tree_base::check_for_leaf(unsigned num, unsigned skip_dims) {
 
 	if (num <= MAX_LEAF_SIZE || skip_dims == 7) { // base case
@@ -94,6 +180,119 @@ bool cobj_tree_base::check_for_leaf(unsigned num, unsigned skip_dims) {
 }
 
 
+// *** BVH cache files ***
+
+
+void add_build_flags(fnv_hash_t &hash) { // flags that change the tree layout
+	hash.add((unsigned)sah_cobj_tree_build | ((unsigned)compact_cobj_tree_nodes << 1));
+}
+
+void add_to_hash(fnv_hash_t &hash, coll_tquad const &t) { // unused points are uninitialized, so hash each field
+	hash.add(t.npts);
+	hash.add_bytes(t.pts, t.npts*sizeof(point));
+	hash.add(t.normal);
+	hash.add(t.cid);
+}
+void add_to_hash(fnv_hash_t &hash, sphere_with_id_t const &s) {
+	hash.add(s.pos);
+	hash.add(s.radius);
+	hash.add(s.id);
+}
+
+template<typename V> void write_cache_vector(std::ostream &out, V const &v) {
+	uint64_t const sz(v.size());
+	out.write((char const *)&sz, sizeof(sz));
+	if (!v.empty()) {out.write((char const *)v.data(), sz*sizeof(typename V::value_type));}
+}
+
+template<typename V> bool read_cache_vector(std::istream &in, V &v, uint64_t file_size) {
+	uint64_t sz(0);
+	in.read((char *)&sz, sizeof(sz));
+	if (!in.good() || sz*sizeof(typename V::value_type) > file_size) return 0; // truncated or corrupted file
+	v.resize(sz);
+	if (sz > 0) {in.read((char *)v.data(), sz*sizeof(typename V::value_type));}
+	return in.good();
+}
+
+
+// checks that the nodes read from a cache file can be traversed without going out of bounds
+bool cobj_tree_base::nodes_valid(unsigned num_objs) const {
+
+	if (nodes.empty() == cblocks.empty()) return 0; // must have exactly one of the two node types
+	if (!cblocks.empty() && (num_cnodes == 0 || (num_cnodes + CNODES_PER_BLOCK - 1)/CNODES_PER_BLOCK != cblocks.size())) return 0;
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
+
+	for (unsigned nix = 0; nix < num_nodes; ++nix) {
+		if (!cblocks.empty() && (get_cnode(nix).ix & CNODE_LEAF_FLAG) && (get_cnode(nix).ix & ~CNODE_LEAF_FLAG) >= leaf_ranges.size()) return 0;
+		tree_node const &n(get_node(nix, tmp));
+		if (n.start > n.end || n.end > num_objs || n.next_node_id <= nix || n.next_node_id > num_nodes) return 0;
+	}
+	return 1;
+}
+
+
+template<typename T> bool cobj_tree_base::write_cache_file(std::string const &fn, uint64_t key, vector<T> const &leaf_data) const {
+
+	std::ofstream out(fn, std::ios::out | std::ios::binary);
+	
+	if (!out.good()) {
+		std::cerr << "Error opening BVH cache file for write: " << fn << endl;
+		return 0;
+	}
+	unsigned const header[5] = {BVH_CACHE_MAGIC, BVH_CACHE_VERSION, sizeof(tree_node), sizeof(compact_node_block_t), sizeof(T)};
+	unsigned const stats[4] = {max_depth, max_leaf_count, num_leaf_nodes, num_cnodes};
+	out.write((char const *)header, sizeof(header));
+	out.write((char const *)&key, sizeof(key));
+	out.write((char const *)stats, sizeof(stats));
+	write_cache_vector(out, leaf_data);
+	write_cache_vector(out, nodes);
+	write_cache_vector(out, cblocks);
+	write_cache_vector(out, leaf_ranges);
+
+	if (!out.good()) {
+		std::cerr << "Error writing BVH cache file " << fn << endl;
+		return 0;
+	}
+	return 1;
+}
+
+
+// returns false without modifying the tree if the file doesn't exist or doesn't match key;
+// leaf_data must contain the same objects that were used to generate key, and is replaced with the cached (reordered) version
+template<typename T> bool cobj_tree_base::read_cache_file(std::string const &fn, uint64_t key, vector<T> &leaf_data) {
+
+	std::ifstream in(fn, std::ios::in | std::ios::binary);
+	if (!in.good()) return 0; // no cache file, not an error
+	in.seekg(0, std::ios::end);
+	uint64_t const file_size(in.tellg());
+	in.seekg(0, std::ios::beg);
+	unsigned header[5] = {0}, stats[4] = {0};
+	uint64_t file_key(0);
+	in.read((char *)header, sizeof(header));
+	in.read((char *)&file_key, sizeof(file_key));
+	if (!in.good() || header[0] != BVH_CACHE_MAGIC) {std::cerr << "Error reading BVH cache file " << fn << ": invalid file format" << endl; return 0;}
+	if (header[1] != BVH_CACHE_VERSION || header[2] != sizeof(tree_node) || header[3] != sizeof(compact_node_block_t) || header[4] != sizeof(T)) return 0; // old version
+	if (file_key != key) return 0; // scene or model has changed
+	vector<T> cached_data;
+	in.read((char *)stats, sizeof(stats));
+	num_cnodes = stats[3];
+	bool const read_ok(in.good() && read_cache_vector(in, cached_data, file_size) && read_cache_vector(in, nodes, file_size) &&
+		read_cache_vector(in, cblocks, file_size) && read_cache_vector(in, leaf_ranges, file_size));
+
+	if (!read_ok || cached_data.size() != leaf_data.size() || !nodes_valid(cached_data.size())) {
+		std::cerr << "Error reading BVH cache file " << fn << endl;
+		clear();
+		return 0;
+	}
+	leaf_data.swap(cached_data);
+	max_depth      = stats[0];
+	max_leaf_count = stats[1];
+	num_leaf_nodes = stats[2];
+	return 1;
+}
+
+
 // performance critical
 template<bool xneg, bool yneg, bool zneg> bool get_line_clip(point const &p1, vector3d const &dinv, float const d[3][2]) {
 
@@ -114,9 +313,8 @@ template<bool xneg, bool yneg, bool zneg> bool get_line_clip(point const &p1, ve
 	return 0;
 }
 
-cobj_tree_base::node_ix_mgr::node_ix_mgr(vector<tree_node> const &nodes_, point const &p1_, point const &p2_)
-  : p1(p1_), p2(p2_), dinv(p2 - p1), nodes(nodes_)
-{
+cobj_tree_base::node_ix_mgr::node_ix_mgr(point const &p1_, point const &p2_) : p1(p1_), p2(p2_), dinv(p2 - p1) {
+
 	dinv.invert();
 	if (dinv.x < 0.0) {
 		if (dinv.y < 0.0) {
@@ -131,9 +329,7 @@ cobj_tree_base::node_ix_mgr::node_ix_mgr(vector<tree_node> const &nodes_, point
 			else              {get_line_clip_func = get_line_clip<0,0,0>;}}}
 }
 
-bool cobj_tree_base::node_ix_mgr::check_node(unsigned &nix) const {
-
-	tree_node const &n(nodes[nix]);
+bool cobj_tree_base::node_ix_mgr::check_node(tree_node const &n, unsigned &nix) const {
 
 	if (!get_line_clip_func(p1, dinv, n.d)) {
 		assert(n.next_node_id > nix);
@@ -145,6 +341,51 @@ bool cobj_tree_base::node_ix_mgr::check_node(unsigned &nix) const {
 }
 
 
+cobj_tree_base::ray_packet_t::ray_packet_t(unsigned num, point const *p1, point const *p2) : active_mask((1U << num) - 1) {
+
+	assert(num > 0 && num <= RAY_PACKET_SIZE);
+
+	for (unsigned r = 0; r < RAY_PACKET_SIZE; ++r) {
+		unsigned const ix(min(r, num-1)); // unused lanes duplicate the last ray
+		vector3d dinv_r(p2[ix] - p1[ix]);
+		dinv_r.invert();
+		UNROLL_3X(org[i_][r] = p1[ix][i_]; dinv[i_][r] = dinv_r[i_];)
+		tmax[r] = 1.0;
+	}
+}
+
+// performance critical; returns a bitmask of the active rays that intersect the bbox d within their current [0, tmax] range
+unsigned cobj_tree_base::ray_packet_t::get_node_hit_mask(float const d[3][2]) const {
+
+#ifdef USE_SSE_RAY_PACKETS
+	__m128 tmin_v(_mm_setzero_ps()), tmax_v(_mm_load_ps(tmax));
+
+	for (unsigned i = 0; i < 3; ++i) { // slab test in each dim
+		__m128 const o(_mm_load_ps(org[i])), di(_mm_load_ps(dinv[i]));
+		__m128 const t1(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(d[i][0]), o), di)), t2(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(d[i][1]), o), di));
+		tmin_v = _mm_max_ps(tmin_v, _mm_min_ps(t1, t2));
+		tmax_v = _mm_min_ps(tmax_v, _mm_max_ps(t1, t2));
+	}
+	return (unsigned(_mm_movemask_ps(_mm_cmplt_ps(tmin_v, tmax_v))) & active_mask);
+#else
+	unsigned mask(0);
+
+	for (unsigned r = 0; r < RAY_PACKET_SIZE; ++r) {
+		if (!(active_mask & (1U << r))) continue;
+		float tmin_r(0.0), tmax_r(tmax[r]);
+
+		for (unsigned i = 0; i < 3; ++i) {
+			float const t1((d[i][0] - org[i][r])*dinv[i][r]), t2((d[i][1] - org[i][r])*dinv[i][r]);
+			tmin_r = max(tmin_r, min(t1, t2));
+			tmax_r = min(tmax_r, max(t1, t2));
+		}
+		if (tmin_r < tmax_r) {mask |= (1U << r);}
+	}
+	return mask;
+#endif
+}
+
+
 // *** cobj_tree_simple_type_t ***
 
 
@@ -227,18 +468,34 @@ template<typename T> void cobj_tree_simple_type_t<T>::build_tree(unsigned nix, u
 }
 
 
-template<typename T> void cobj_tree_simple_type_t<T>::build_tree_top(bool verbose) {
+template<typename T> uint64_t cobj_tree_simple_type_t<T>::get_cache_key() const {
 
-	nodes.reserve(get_conservative_num_nodes(objects.size()));
-	nodes.push_back(tree_node(0, (unsigned)objects.size()));
-	assert(nodes.size() == 1);
-	max_depth = max_leaf_count = num_leaf_nodes = 0;
-	if (!objects.empty()) {build_tree(0, 0, 0);}
-	nodes[0].next_node_id = (unsigned)nodes.size();
-	for (unsigned i = 0; i < 3; ++i) {vector<T>().swap(temp_bins[i]);}
+	fnv_hash_t hash;
+	add_build_flags(hash);
+	for (auto i = objects.begin(); i != objects.end(); ++i) {add_to_hash(hash, *i);}
+	return hash.get();
+}
+
+
+template<typename T> void cobj_tree_simple_type_t<T>::build_tree_top(bool verbose, std::string const &cache_fn) {
 
+	uint64_t const cache_key(cache_fn.empty() ? 0 : get_cache_key());
+	bool const from_cache(!cache_fn.empty() && read_cache_file(cache_fn, cache_key, objects));
+
+	if (!from_cache) {
+		nodes.reserve(get_conservative_num_nodes(objects.size()));
+		nodes.push_back(tree_node(0, (unsigned)objects.size()));
+		assert(nodes.size() == 1);
+		max_depth = max_leaf_count = num_leaf_nodes = 0;
+		if (!objects.empty()) {build_tree(0, 0, 0);}
+		nodes[0].next_node_id = (unsigned)nodes.size();
+		for (unsigned i = 0; i < 3; ++i) {vector<T>().swap(temp_bins[i]);}
+		if (compact_cobj_tree_nodes) {build_compact_nodes();}
+		if (!cache_fn.empty()) {write_cache_file(cache_fn, cache_key, objects);}
+	}
 	if (verbose) {
-		cout << "objects: " << objects.size() << ", cap: " << objects.capacity() << ", nodes: " << nodes.size() << ", cap: " << nodes.capacity()
+		if (from_cache) {cout << "Read BVH from cache file " << cache_fn << endl;}
+		cout << "objects: " << objects.size() << ", cap: " << objects.capacity() << ", nodes: " << get_num_nodes() << ", node_mem: " << get_node_mem()
 			 << ", depth: " << max_depth << ", max_leaf: " << max_leaf_count << ", leaf_nodes: " << num_leaf_nodes << endl;
 	}
 }
@@ -288,15 +545,16 @@ void cobj_tree_tquads_t::add_polygons(vector<polygon_t> const &polygons, bool ve
 
 bool cobj_tree_tquads_t::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA *color, int *cindex, int ignore_cobj, bool exact) const {
 
-	if (nodes.empty()) return 0;
+	if (is_empty()) return 0;
 	bool ret(0);
 	float t(0.0), tmin(0.0), tmax(1.0);
-	node_ix_mgr nixm(nodes, p1, p2);
-	unsigned const num_nodes((unsigned)nodes.size());
+	node_ix_mgr nixm(p1, p2);
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		tree_node const &n(get_node(nix, tmp));
+		if (!nixm.check_node(n, nix)) continue; // Note: modifies nix
 
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
 			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
@@ -342,10 +600,11 @@ void cobj_tree_sphere_t::add_spheres(vector<sphere_with_id_t> &spheres_, bool ve
 void cobj_tree_sphere_t::get_ids_int_sphere(point const &center, float radius, vector<unsigned> &ids) const {
 
 	if (objects.empty()) return;
-	unsigned const num_nodes((unsigned)nodes.size());
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
+		tree_node const &n(get_node(nix, tmp));
 		assert(n.start <= n.end);
 
 		if (!sphere_cube_intersect(center, radius, n)) {
@@ -395,42 +654,78 @@ void cobj_bvh_tree::clear() {
 
 	cobj_tree_base::clear();
 	cixs.resize(0);
+	build_cids.resize(0);
+	build_sa.resize(0);
 }
 
 
-void cobj_bvh_tree::add_cobjs(bool verbose) {
+uint64_t cobj_bvh_tree::get_cache_key() const {
+
+	fnv_hash_t hash;
+	add_build_flags(hash);
+
+	for (auto i = cixs.begin(); i != cixs.end(); ++i) { // the tree only depends on cobj IDs and bcubes
+		hash.add(*i);
+		hash.add((*cobjs)[*i].d);
+	}
+	return hash.get();
+}
+
+
+// if cache_fn is nonempty, the tree is read from that file if it matches the current cobjs, otherwise it's built and written to that file
+void cobj_bvh_tree::add_cobjs(bool verbose, std::string const &cache_fn) {
 
 	RESET_TIME;
 	clear();
 	if (!create_cixs()) return; // nothing to be done
-	bool const do_mt_build(mt_cobj_tree_build && cixs.size() > 10000);
-	build_tree_from_cixs(do_mt_build);
+	uint64_t const cache_key(cache_fn.empty() ? 0 : get_cache_key());
+	bool const from_cache(!cache_fn.empty() && read_cache_file(cache_fn, cache_key, cixs));
 
+	if (!from_cache) {
+		bool const do_mt_build(mt_cobj_tree_build && cixs.size() > 10000);
+		build_tree_from_cixs(do_mt_build);
+		if (!cache_fn.empty()) {write_cache_file(cache_fn, cache_key, cixs);}
+	}
 	if (verbose) {
-		PRINT_TIME(" Cobj Tree Create");
-		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << nodes.size()
+		PRINT_TIME((from_cache ? " Cobj Tree Read" : " Cobj Tree Create"));
+		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << get_num_nodes() << ", node_mem: " << get_node_mem()
 				<< ", depth: " << max_depth << ", max_leaves: " << max_leaf_count << ", leaf_nodes: " << num_leaf_nodes << endl;
 	}
 }
 
 
 // to be called from within add_cobjs() or after a call to add_cobj_ids()
-void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
+void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {build_tree_from_cixs(do_mt_build, sah_cobj_tree_build);}
 
-	max_depth = max_leaf_count = num_leaf_nodes = 0;
-	nodes.resize(get_conservative_num_nodes(cixs.size()) + 64*do_mt_build); // add 8 extra nodes for each of 8 top level splits
-	unsigned const root(0);
-	nodes[root] = tree_node(0, (unsigned)cixs.size());
+void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build, bool use_sah) {
+	build_nodes(do_mt_build, use_sah);
+	if (compact_cobj_tree_nodes) {build_compact_nodes();}
+}
+
+void cobj_bvh_tree::build_nodes(bool do_mt_build, bool use_sah) {
+
+	clear_compact_nodes();
+	build_sa.clear();
 
-	if (do_mt_build) { // 2x faster build time, 10% slower traversal
-		build_tree_top_level_omp();
+	if (use_sah) {
+		build_tree_sah(do_mt_build);
 	}
 	else {
-		per_thread_data ptd(1, nodes.size(), 1);
-		build_tree(root, 0, 0, ptd);
-		nodes.resize(ptd.get_next_node_ix());
+		max_depth = max_leaf_count = num_leaf_nodes = 0;
+		nodes.resize(get_conservative_num_nodes(cixs.size()) + 64*do_mt_build); // add 8 extra nodes for each of 8 top level splits
+		unsigned const root(0);
+		nodes[root] = tree_node(0, (unsigned)cixs.size());
+
+		if (do_mt_build) { // 2x faster build time, 10% slower traversal
+			build_tree_top_level_omp();
+		}
+		else {
+			per_thread_data ptd(1, nodes.size(), 1);
+			build_tree(root, 0, 0, ptd);
+			nodes.resize(ptd.get_next_node_ix());
+		}
+		nodes[root].next_node_id = (unsigned)nodes.size();
 	}
-	nodes[root].next_node_id = (unsigned)nodes.size();
 }
 
 
@@ -438,15 +733,16 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
 	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
 {
-	if (nodes.empty()) return 0;
+	if (is_empty()) return 0;
 	bool ret(0);
 	float t(0.0), tmin(0.0), tmax(1.0), max_alpha(0.0);
-	node_ix_mgr nixm(nodes, p1, p2);
-	unsigned const num_nodes((unsigned)nodes.size());
+	node_ix_mgr nixm(p1, p2);
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		tree_node const &n(get_node(nix, tmp));
+		if (!nixm.check_node(n, nix)) continue; // Note: modifies nix
 
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
 			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
@@ -476,12 +772,65 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 }
 
 
+// exact mode (closest hit) version of check_coll_line() for up to RAY_PACKET_SIZE lines that share one tree traversal;
+// returns a bitmask of the lines that hit something; cpos, cnorm, and cindex are only written for lines that hit
+unsigned cobj_bvh_tree::check_coll_line_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex,
+	int ignore_cobj, int test_alpha, bool skip_non_drawn, bool const *skip_init_colls, bool skip_movable) const
+{
+	if (is_empty() || num == 0) return 0;
+	ray_packet_t rp(num, p1, p2);
+	float max_alpha[RAY_PACKET_SIZE] = {0};
+	unsigned hit_mask(0);
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(get_node(nix, tmp));
+		unsigned const node_mask(rp.get_node_hit_mask(n.d));
+
+		if (node_mask == 0) {
+			assert(n.next_node_id > nix);
+			nix = n.next_node_id; // failed the bbox test for all lines
+			continue;
+		}
+		++nix;
+
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			if ((int)cixs[i] == ignore_cobj) continue;
+			coll_obj const &c(get_cobj(i));
+			if (!obj_ok(c))                  continue;
+			if (skip_non_drawn  && !c.cp.might_be_drawn())              continue;
+			if (skip_movable    && c.is_movable())                      continue;
+			if (test_alpha == 1 && c.is_semi_trans())                   continue;
+			if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA) continue;
+
+			for (unsigned r = 0; r < num; ++r) {
+				if (!(node_mask & (1U << r))) continue;
+				if (test_alpha == 2 && c.cp.color.alpha <= max_alpha[r]) continue;
+				if (skip_init_colls && skip_init_colls[r] && c.contains_pt(p1[r]) && c.contains_point(p1[r])) continue;
+				float t(0.0);
+				vector3d norm;
+				if (!c.line_int_exact(p1[r], p2[r], t, norm, 0.0, rp.tmax[r])) continue;
+				cindex[r]    = cixs[i];
+				cpos  [r]    = p1[r] + (p2[r] - p1[r])*t;
+				cnorm [r]    = norm;
+				max_alpha[r] = c.cp.color.alpha;
+				rp.tmax  [r] = t;
+				hit_mask    |= (1U << r);
+			}
+		}
+	}
+	return hit_mask;
+}
+
+
 bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 
-	unsigned const num_nodes((unsigned)nodes.size());
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
+		tree_node const &n(get_node(nix, tmp));
 
 		if (!n.contains_pt(p)) {
 			assert(n.next_node_id > nix);
@@ -501,10 +850,11 @@ bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 void cobj_bvh_tree::get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs,
 	int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const
 {
-	unsigned const num_nodes((unsigned)nodes.size());
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
+		tree_node const &n(get_node(nix, tmp));
 		assert(n.start <= n.end);
 
 		if (!cube.intersects(n, toler)) {
@@ -528,13 +878,14 @@ void cobj_bvh_tree::get_intersecting_cobjs(cube_t const &cube, vector<unsigned>
 bool cobj_bvh_tree::is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const {
 
 	assert(npts > 0);
-	if (nodes.empty()) return 0;
-	node_ix_mgr nixm(nodes, viewer, pts[0]);
-	unsigned const num_nodes((unsigned)nodes.size());
+	if (is_empty()) return 0;
+	node_ix_mgr nixm(viewer, pts[0]);
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		tree_node const &n(get_node(nix, tmp));
+		if (!nixm.check_node(n, nix)) continue; // Note: modifies nix
 
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
 			if ((int)cixs[i] == ignore_cobj) continue;
@@ -553,13 +904,14 @@ bool cobj_bvh_tree::is_cobj_contained(point const &viewer, point const *const pt
 void cobj_bvh_tree::get_coll_line_cobjs(point const &pos1, point const &pos2, int ignore_cobj, vector<int> *cobjs, cobj_query_callback *cqc, bool do_expand) const {
 
 	assert(cobjs || cqc);
-	if (nodes.empty()) return;
-	node_ix_mgr nixm(nodes, pos1, pos2);
-	unsigned const num_nodes((unsigned)nodes.size());
+	if (is_empty()) return;
+	node_ix_mgr nixm(pos1, pos2);
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		tree_node const &n(get_node(nix, tmp));
+		if (!nixm.check_node(n, nix)) continue; // Note: modifies nix
 			
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
 			if ((int)cixs[i] == ignore_cobj) continue;
@@ -586,13 +938,14 @@ void cobj_bvh_tree::get_coll_line_cobjs(point const &pos1, point const &pos2, in
 // Note: actually, this only returns sphere intersection candidates
 void cobj_bvh_tree::get_coll_sphere_cobjs(point const &center, float radius, int ignore_cobj, vert_coll_detector &vcd) const {
 
-	if (nodes.empty()) return;
-	unsigned const num_nodes((unsigned)nodes.size());
+	if (is_empty()) return;
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
 	cube_t bcube(center, center);
 	bcube.expand_by(radius);
 
 	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
+		tree_node const &n(get_node(nix, tmp));
 
 		if (!n.intersects(bcube)/* && !sphere_cube_intersect(center, radius, n)*/) {
 			assert(n.next_node_id > nix);
@@ -642,7 +995,7 @@ void cobj_bvh_tree::build_tree_top_level_omp() { // single octtree level
 
 	// create child nodes and call recursively
 	unsigned cur(n.start), cur_nix(1);
-	unsigned curs[8], cur_nixs[8];
+	unsigned curs[8], cur_nixs[8], used_end_nixs[8];
 	
 	for (int bix = 0; bix < 8; ++bix) {
 		unsigned const count(top_temp_bins[bix].size());
@@ -664,10 +1017,25 @@ void cobj_bvh_tree::build_tree_top_level_omp() { // single octtree level
 		build_tree(kid, ((count == num) ? 7 : 0), 1, ptd); // if all in one bin, make that bin a leaf
 		unsigned const next_kid(ptd.get_next_node_ix());
 		assert(next_kid <= end_nix);
-		if (next_kid < end_nix) {nodes[next_kid].next_node_id = end_nix;} // close the gap of unused nodes
-		nodes[kid].next_node_id = end_nix;
+		nodes[kid].next_node_id = used_end_nixs[bix] = next_kid;
 	}
-	nodes.resize(cur_nix);
+	// close the gaps of unused nodes by moving each subtree down to the end of the previous one; this keeps the tree in
+	// depth-first order with no unreachable nodes, which is required for build_compact_nodes() and is better for cache usage
+	unsigned dest_nix(1);
+
+	for (unsigned bix = 0; bix < 8; ++bix) {
+		if (top_temp_bins[bix].empty()) continue; // empty bin
+		unsigned const src_nix(cur_nixs[bix]), sz(used_end_nixs[bix] - src_nix), delta(src_nix - dest_nix);
+
+		if (delta > 0) {
+			for (unsigned i = src_nix; i < src_nix+sz; ++i) { // Note: dest_nix < src_nix, so this won't overwrite unmoved nodes
+				nodes[i-delta] = nodes[i];
+				nodes[i-delta].next_node_id -= delta;
+			}
+		}
+		dest_nix += sz;
+	}
+	nodes.resize(dest_nix);
 	assert(cur == n.end);
 	n.start = n.end = 0; // branch node has no leaves
 }
@@ -749,6 +1117,359 @@ void cobj_bvh_tree::build_tree(unsigned nix, unsigned skip_dims, unsigned depth,
 }
 
 
+// *** SAH binned builder ***
+
+
+struct sah_bin_t {
+	cube_t bc;
+	unsigned count;
+	sah_bin_t() : count(0) {}
+
+	void add(cube_t const &c) {
+		if (count == 0) {bc = c;} else {bc.union_with_cube(c);}
+		++count;
+	}
+	void merge(sah_bin_t const &b) {
+		if (b.count == 0) return;
+		if (count == 0) {bc = b.bc;} else {bc.union_with_cube(b.bc);}
+		count += b.count;
+	}
+};
+
+inline unsigned get_sah_bin(float val, float vmin, float bin_scale) {
+	return min(NUM_SAH_BINS-1, unsigned(max(0.0f, (val - vmin)*bin_scale)));
+}
+
+
+// splits node bix of bnodes into two kids by binned SAH cost; returns false if it's a leaf;
+// a node over N prims at slot B owns slots [B, B+2N-1), so kids can be placed without synchronization between subtrees
+bool cobj_bvh_tree::split_sah_node(vector<sah_prim_t> &prims, vector<sah_build_node> &bnodes, unsigned bix) const {
+
+	assert(bix < bnodes.size());
+	sah_build_node &n(bnodes[bix]);
+	assert(n.start < n.end);
+	unsigned const num(n.end - n.start);
+	cube_t cbounds(prims[n.start].center, prims[n.start].center); // bounds of centers
+	n.copy_from(prims[n.start]);
+
+	for (unsigned i = n.start+1; i < n.end; ++i) {
+		n.union_with_cube(prims[i]);
+		cbounds.union_with_pt(prims[i].center);
+	}
+	if (num <= MAX_LEAF_SIZE) return 0; // base case
+	float best_cost(0.0);
+	unsigned best_dim(3), best_split(0);
+
+	for (unsigned dim = 0; dim < 3; ++dim) {
+		float const vmin(cbounds.d[dim][0]), extent(cbounds.d[dim][1] - vmin);
+		if (extent <= TOLERANCE) continue; // can't split in this dim
+		float const bin_scale(NUM_SAH_BINS/extent);
+		sah_bin_t bins[NUM_SAH_BINS];
+		for (unsigned i = n.start; i < n.end; ++i) {bins[get_sah_bin(prims[i].center[dim], vmin, bin_scale)].add(prims[i]);}
+		float right_area[NUM_SAH_BINS] = {0};
+		unsigned right_count[NUM_SAH_BINS] = {0};
+		sah_bin_t acc;
+
+		for (unsigned b = NUM_SAH_BINS-1; b > 0; --b) { // right sweep: right_*[b] is the union of bins [b, NUM_SAH_BINS)
+			acc.merge(bins[b]);
+			right_area [b] = ((acc.count > 0) ? acc.bc.get_area() : 0.0f);
+			right_count[b] = acc.count;
+		}
+		acc = sah_bin_t();
+
+		for (unsigned b = 0; b+1 < NUM_SAH_BINS; ++b) { // left sweep: split between bins b and b+1
+			acc.merge(bins[b]);
+			if (acc.count == 0 || right_count[b+1] == 0) continue; // both sides must be nonempty
+			float const cost(acc.bc.get_area()*acc.count + right_area[b+1]*right_count[b+1]);
+			if (best_dim == 3 || cost < best_cost) {best_cost = cost; best_dim = dim; best_split = b+1;}
+		}
+	}
+	if (best_dim == 3) return 0; // all centers are coincident, can't split
+	float const node_area(n.get_area());
+	if (num <= MAX_SAH_LEAF && (SAH_TRAV_COST*node_area + best_cost) >= node_area*num) return 0; // cheaper as a leaf
+	float const vmin(cbounds.d[best_dim][0]), bin_scale(NUM_SAH_BINS/(cbounds.d[best_dim][1] - vmin));
+	auto mid_it(std::partition((prims.begin() + n.start), (prims.begin() + n.end),
+		[&](sah_prim_t const &p) {return (get_sah_bin(p.center[best_dim], vmin, bin_scale) < best_split);}));
+	unsigned const mid(mid_it - prims.begin()), num_left(mid - n.start);
+	assert(mid > n.start && mid < n.end);
+	n.kids[0] = bix + 1;
+	n.kids[1] = bix + 2*num_left;
+	assert(n.kids[1] + 2*(n.end - mid) - 1 <= bnodes.size());
+	sah_build_node &left(bnodes[n.kids[0]]), &right(bnodes[n.kids[1]]);
+	left .start = n.start; left .end = mid;
+	right.start = mid;     right.end = n.end;
+	left.kids[0] = left.kids[1] = right.kids[0] = right.kids[1] = 0;
+	return 1;
+}
+
+
+void cobj_bvh_tree::build_sah_subtree(vector<sah_prim_t> &prims, vector<sah_build_node> &bnodes, unsigned bix) const {
+
+	if (!split_sah_node(prims, bnodes, bix)) return;
+	for (unsigned k = 0; k < 2; ++k) {build_sah_subtree(prims, bnodes, bnodes[bix].kids[k]);}
+}
+
+
+// converts the binary build tree into the depth-first node layout with next_node_id skip links used by all queries
+void cobj_bvh_tree::flatten_sah_tree(vector<sah_build_node> const &bnodes, unsigned bix, unsigned depth) {
+
+	sah_build_node const &b(bnodes[bix]);
+	unsigned const nix(nodes.size());
+	nodes.push_back(tree_node(b.start, b.end, b));
+	max_depth = max(max_depth, depth);
+
+	if (b.is_leaf()) {register_leaf(b.end - b.start);}
+	else {
+		for (unsigned k = 0; k < 2; ++k) {flatten_sah_tree(bnodes, b.kids[k], depth+1);}
+		nodes[nix].start = nodes[nix].end = 0; // branch node has no leaves
+	}
+	nodes[nix].next_node_id = nodes.size();
+}
+
+
+void cobj_bvh_tree::build_tree_sah(bool do_mt_build) {
+
+	max_depth = max_leaf_count = num_leaf_nodes = 0;
+	nodes.clear();
+	if (cixs.empty()) return;
+	unsigned const num(cixs.size());
+	vector<sah_prim_t> prims(num);
+	vector<sah_build_node> bnodes(2*num); // upper bound on binary tree size
+	bnodes[0].start = 0;
+	bnodes[0].end   = num;
+
+	#pragma omp parallel for schedule(static) if (do_mt_build)
+	for (int i = 0; i < (int)num; ++i) {prims[i] = sah_prim_t(get_cobj(i), cixs[i]);}
+
+	if (do_mt_build) {
+		// split the upper levels serially until there are enough independent subtrees, then build the subtrees in parallel
+		unsigned const min_task_objs(max(SAH_MT_MIN_NUM, num/64));
+		vector<unsigned> pending(1, 0), tasks;
+
+		while (!pending.empty()) {
+			unsigned const bix(pending.back());
+			pending.pop_back();
+			if (bnodes[bix].end - bnodes[bix].start < min_task_objs) {tasks.push_back(bix); continue;}
+			if (!split_sah_node(prims, bnodes, bix)) continue; // leaf
+			for (unsigned k = 0; k < 2; ++k) {pending.push_back(bnodes[bix].kids[k]);}
+		}
+		// largest subtrees first for better load balancing
+		sort(tasks.begin(), tasks.end(), [&](unsigned a, unsigned b) {return ((bnodes[a].end - bnodes[a].start) > (bnodes[b].end - bnodes[b].start));});
+		#pragma omp parallel for schedule(dynamic,1)
+		for (int t = 0; t < (int)tasks.size(); ++t) {build_sah_subtree(prims, bnodes, tasks[t]);}
+	}
+	else {
+		build_sah_subtree(prims, bnodes, 0);
+	}
+	for (unsigned i = 0; i < num; ++i) {cixs[i] = prims[i].cix;}
+	nodes.reserve(2*num);
+	flatten_sah_tree(bnodes, 0, 0);
+}
+
+
+// used for query cost stats; mirrors the traversal of check_coll_line() in exact mode without the alpha/movable filters
+unsigned cobj_bvh_tree::get_coll_line_nodes_visited(point const &p1, point const &p2, unsigned &num_leaf_tests) const {
+
+	if (is_empty()) return 0;
+	float t(0.0), tmin(0.0), tmax(1.0);
+	vector3d cnorm;
+	node_ix_mgr nixm(p1, p2);
+	unsigned const num_nodes(get_num_nodes());
+	tree_node tmp;
+	unsigned num_visited(0);
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(get_node(nix, tmp));
+		++num_visited;
+		if (!nixm.check_node(n, nix)) continue; // Note: modifies nix
+
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			coll_obj const &c(get_cobj(i));
+			if (!obj_ok(c)) continue;
+			++num_leaf_tests;
+			if (!c.line_int_exact(p1, p2, t, cnorm, tmin, tmax)) continue;
+			nixm.dinv = (p2 - p1)*t;
+			nixm.dinv.invert();
+			tmax = t;
+		}
+	}
+	return num_visited;
+}
+
+
+// compares build time and ray query cost of the split builders on this tree's cobjs, then rebuilds with the configured builder
+void cobj_bvh_tree::run_build_benchmark(unsigned num_rays) {
+
+	if (cixs.empty() || num_rays == 0) return;
+	typedef std::chrono::high_resolution_clock clock_type;
+	cube_t bcube;
+	get_root_bcube(bcube);
+	vector<pair<point, point>> rays(num_rays);
+	rand_gen_t rgen; // fixed seed so that all builders see the same rays
+	for (auto i = rays.begin(); i != rays.end(); ++i) {i->first = rgen.gen_rand_cube_point(bcube); i->second = rgen.gen_rand_cube_point(bcube);}
+	cout << "Cobj Tree Build Benchmark: cobjs: " << cixs.size() << ", rays: " << num_rays << endl;
+	cout << "builder mt build_ms nodes depth leaf_nodes max_leaf nodes/ray leaf_tests/ray query_ms" << endl;
+
+	for (unsigned use_sah = 0; use_sah < 2; ++use_sah) {
+		for (unsigned mt = 0; mt < 2; ++mt) {
+			auto const t0(clock_type::now());
+			build_tree_from_cixs((mt != 0), (use_sah != 0));
+			auto const t1(clock_type::now());
+			unsigned long long tot_visited(0), tot_leaf_tests(0);
+
+			#pragma omp parallel for schedule(static) reduction(+:tot_visited,tot_leaf_tests)
+			for (int r = 0; r < (int)num_rays; ++r) {
+				unsigned leaf_tests(0);
+				tot_visited    += get_coll_line_nodes_visited(rays[r].first, rays[r].second, leaf_tests);
+				tot_leaf_tests += leaf_tests;
+			}
+			auto const t2(clock_type::now());
+			cout << (use_sah ? "sah    " : "split  ") << " " << mt << " " << std::chrono::duration<double, std::milli>(t1 - t0).count() << " "
+				 << get_num_nodes() << " " << max_depth << " " << num_leaf_nodes << " " << max_leaf_count << " " << float(tot_visited)/num_rays << " "
+				 << float(tot_leaf_tests)/num_rays << " " << std::chrono::duration<double, std::milli>(t2 - t1).count() << endl;
+		}
+	}
+	build_tree_from_cixs((mt_cobj_tree_build && cixs.size() > 10000), sah_cobj_tree_build); // restore the default tree
+}
+
+
+// *** incremental refit for trees that are updated every frame ***
+
+
+// used in place of add_cobjs() for the dynamic tree
+void cobj_bvh_tree::update_cobjs() {
+
+	vector<unsigned> cids;
+	cids.swap(cixs); // save the current tree order
+	create_cixs(); // sorted because dynamic_ids is a set
+	cids.swap(cixs);
+	update_cobj_ids(cids);
+}
+
+
+// refits the existing tree if it was built over the same set of cobjs, otherwise does a full rebuild
+void cobj_bvh_tree::update_cobj_ids(vector<unsigned> cids) {
+
+	sort(cids.begin(), cids.end());
+
+	if (refit_dynamic_cobj_trees && !nodes.empty() && cids == build_cids) { // Note: compact nodes are never used with refit
+		refit();
+		return;
+	}
+	clear();
+	if (cids.empty()) return;
+	cixs = cids;
+	bool const do_mt_build(mt_cobj_tree_build && cixs.size() > 10000);
+
+	if (refit_dynamic_cobj_trees) {
+		build_nodes(do_mt_build, sah_cobj_tree_build);
+		build_cids.swap(cids);
+		record_build_state();
+		++refit_stats.full_rebuilds;
+	}
+	else {build_tree_from_cixs(do_mt_build);}
+}
+
+
+void cobj_bvh_tree::record_build_state() {
+
+	build_sa.resize(nodes.size());
+	for (unsigned nix = 0; nix < nodes.size(); ++nix) {build_sa[nix] = nodes[nix].get_area();}
+}
+
+
+// recomputes node bboxes bottom-up from the current cobj bcubes; kids always have higher indices than their parent
+void cobj_bvh_tree::refit_nodes(vector<pair<unsigned, unsigned>> &cix_ranges) {
+
+	cix_ranges.resize(nodes.size());
+
+	for (unsigned nix = nodes.size(); nix-- > 0;) {
+		tree_node &n(nodes[nix]);
+
+		if (n.start < n.end) { // leaf
+			calc_node_bbox(n);
+			cix_ranges[nix] = make_pair(n.start, n.end);
+			continue;
+		}
+		unsigned kid(nix+1);
+		assert(kid < n.next_node_id);
+		n.copy_from(nodes[kid]);
+		cix_ranges[nix] = cix_ranges[kid];
+
+		for (kid = nodes[kid].next_node_id; kid < n.next_node_id; kid = nodes[kid].next_node_id) {
+			n.union_with_cube(nodes[kid]);
+			cix_ranges[nix].second = cix_ranges[kid].second; // kids own consecutive ranges of cixs
+		}
+	}
+}
+
+
+void cobj_bvh_tree::refit() {
+
+	assert(build_sa.size() == nodes.size());
+	vector<pair<unsigned, unsigned>> cix_ranges;
+	refit_nodes(cix_ranges);
+	++refit_stats.refits;
+	float const min_sa(max(TOLERANCE, 1.0E-6f*build_sa[0])); // avoid rebuilding every frame when cobjs are flat or tiny
+
+	if (nodes[0].get_area() > REFIT_SA_RATIO*max(build_sa[0], min_sa)) { // the whole tree has degraded
+		vector<unsigned> cids;
+		cids.swap(build_cids);
+		nodes.clear(); // force a full rebuild
+		update_cobj_ids(cids);
+		return;
+	}
+	vector<unsigned> to_rebuild;
+
+	for (unsigned nix = 1; nix < nodes.size();) { // find the largest degraded subtrees
+		tree_node const &n(nodes[nix]);
+		
+		if (n.start == n.end && n.get_area() > REFIT_SA_RATIO*max(build_sa[nix], min_sa)) { // degraded branch
+			to_rebuild.push_back(nix);
+			nix = n.next_node_id;
+		}
+		else {++nix;}
+	}
+	for (auto i = to_rebuild.rbegin(); i != to_rebuild.rend(); ++i) {rebuild_subtree(*i, cix_ranges[*i]);} // back to front so that lower indices stay valid
+}
+
+
+// replaces the subtree rooted at nix with a newly built one over the same cobjs; ancestor bboxes are unchanged
+void cobj_bvh_tree::rebuild_subtree(unsigned nix, pair<unsigned, unsigned> const &cix_range) {
+
+	unsigned const old_end(nodes[nix].next_node_id), start(cix_range.first);
+	cobj_bvh_tree sub(cobjs, is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs);
+	sub.cixs.assign(cixs.begin()+start, cixs.begin()+cix_range.second);
+	sub.build_nodes(0, sah_cobj_tree_build);
+	copy(sub.cixs.begin(), sub.cixs.end(), cixs.begin()+start); // same cobjs in the new order
+	unsigned const delta(nix + sub.nodes.size() - old_end); // may wrap if the new subtree is smaller, which is fine for unsigned addition
+
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		if (i >= nix && i < old_end) continue; // node being replaced
+		if (nodes[i].next_node_id >= old_end) {nodes[i].next_node_id += delta;} // ancestors and later nodes
+	}
+	for (auto n = sub.nodes.begin(); n != sub.nodes.end(); ++n) {
+		n->next_node_id += nix;
+		if (n->start < n->end) {n->start += start; n->end += start;} // leaf
+	}
+	nodes.erase(nodes.begin()+nix, nodes.begin()+old_end);
+	nodes.insert(nodes.begin()+nix, sub.nodes.begin(), sub.nodes.end());
+	build_sa.erase(build_sa.begin()+nix, build_sa.begin()+old_end);
+	build_sa.insert(build_sa.begin()+nix, sub.nodes.size(), 0.0);
+	for (unsigned i = nix; i < nix+sub.nodes.size(); ++i) {build_sa[i] = nodes[i].get_area();}
+	++refit_stats.partial_rebuilds;
+	refit_stats.nodes_rebuilt += sub.nodes.size();
+}
+
+
+void cobj_bvh_tree::print_refit_stats(char const *name) const {
+
+	if (refit_stats.refits == 0 && refit_stats.full_rebuilds == 0) return;
+	cout << name << " BVH: refits: " << refit_stats.refits << ", full rebuilds: " << refit_stats.full_rebuilds << ", partial rebuilds: "
+		 << refit_stats.partial_rebuilds << ", nodes rebuilt: " << refit_stats.nodes_rebuilt << ", nodes: " << get_num_nodes() << endl;
+}
+
+
 // is_static is_dynamic occluders_only cubes_only inc_voxel_cobjs
 cobj_bvh_tree cobj_tree_static (&coll_objects, 1, 0, 0, 0, 0); // does not include voxels
 cobj_bvh_tree cobj_tree_dynamic(&coll_objects, 0, 1, 0, 0, 0);
@@ -763,7 +1484,6 @@ cobj_bvh_tree &get_tree(bool dynamic) {
 
 void build_static_moving_cobj_tree() {
 
-	cobj_tree_static_moving.clear();
 	vector<unsigned> moving_cids(falling_cobjs);
 		
 	for (auto i = moving_cobjs.begin(); i != moving_cobjs.end(); ++i) {
@@ -772,22 +1492,29 @@ void build_static_moving_cobj_tree() {
 	for (platform_cont::const_iterator i = platforms.begin(); i != platforms.end(); ++i) {
 		copy(i->cobjs.begin(), i->cobjs.end(), back_inserter(moving_cids));
 	}
-	if (!moving_cids.empty()) {
-		cobj_tree_static_moving.add_cobj_ids(moving_cids);
-		cobj_tree_static_moving.build_tree_from_cixs(0);
-	}
+	cobj_tree_static_moving.update_cobj_ids(moving_cids);
 }
 
-void build_cobj_tree(bool dynamic, bool verbose) {
-	
+void print_cobj_tree_refit_stats() {
+	cobj_tree_dynamic.print_refit_stats("Dynamic");
+	cobj_tree_static_moving.print_refit_stats("Static Moving");
+}
+
+void build_cobj_tree(bool dynamic, bool verbose, bool use_cache) {
+
+	PROFILE_SCOPE("Cobj BVH Build");
 	if (!dynamic) { // static
-		get_tree(0).add_cobjs(verbose);
-		cobj_tree_occlude.add_cobjs(verbose);
+		std::string const cache_fn((use_cache && cache_bvh_files && coll_obj_file) ? std::string(coll_obj_file) : std::string());
+		get_tree(0).add_cobjs(verbose, (cache_fn.empty() ? cache_fn : (cache_fn + ".bvh")));
+		if (cobj_tree_bench_rays > 0) {get_tree(0).run_build_benchmark(cobj_tree_bench_rays);}
+		cobj_tree_occlude.add_cobjs(verbose, (cache_fn.empty() ? cache_fn : (cache_fn + ".occluders.bvh")));
 		//cout << "occluders: " << cobj_tree_occlude.get_num_objs() << endl;
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
 	}
 	else { // dynamic
-		if (begin_motion) {get_tree(1).add_cobjs(verbose);}
+		if (begin_motion) {
+			if (refit_dynamic_cobj_trees) {get_tree(1).update_cobjs();} else {get_tree(1).add_cobjs(verbose);}
+		}
 		//build_static_moving_cobj_tree();
 	}
 }
@@ -804,6 +1531,23 @@ bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, v
 	return ret;
 }
 
+// packet version of check_coll_line_exact_tree() for static cobjs, used for lighting rays
+unsigned check_coll_line_exact_tree_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+	int test_alpha, bool skip_non_drawn, bool include_voxels, bool const *skip_init_colls, bool skip_movable, bool no_stat_moving)
+{
+	for (unsigned r = 0; r < num; ++r) {cindex[r] = -1;}
+	unsigned hit_mask(get_tree(0).check_coll_line_packet(num, p1, p2, cpos, cnorm, cindex, ignore_cobj, test_alpha, skip_non_drawn, skip_init_colls, skip_movable));
+
+	for (unsigned r = 0; r < num; ++r) { // the static moving tree and voxels are small and rarely hit, so they're tested one line at a time
+		bool ret((hit_mask & (1U << r)) != 0);
+		bool const sic(skip_init_colls && skip_init_colls[r]);
+		if (!no_stat_moving) {ret |= cobj_tree_static_moving.check_coll_line(p1[r], (ret ? cpos[r] : p2[r]), cpos[r], cnorm[r], cindex[r], ignore_cobj, 1, test_alpha, skip_non_drawn, sic, skip_movable);}
+		if (include_voxels)  {ret |= check_voxel_coll_line(p1[r], (ret ? cpos[r] : p2[r]), cpos[r], cnorm[r], cindex[r], ignore_cobj, 1);}
+		if (ret) {hit_mask |= (1U << r);}
+	}
+	return hit_mask;
+}
+
 // can use with snow shadows, grass shadows, tree leaf shadows
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic,
 	int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable)
@@ -7,6 +7,30 @@
 #include "physics_objects.h"
 
 
+unsigned const RAY_PACKET_SIZE = 4; // one SSE register of floats
+unsigned const CNODE_LEAF_FLAG = (1U << 31);
+unsigned const CNODES_PER_BLOCK = 3; // compact nodes per 64-byte block, after the 16-byte frame
+
+
+// std::allocator doesn't respect alignas() > 16 before C++17
+template<typename T, size_t ALIGN> struct aligned_allocator_t {
+	typedef T value_type;
+	template<typename U> struct rebind {typedef aligned_allocator_t<U, ALIGN> other;};
+	aligned_allocator_t() {}
+	template<typename U> aligned_allocator_t(aligned_allocator_t<U, ALIGN> const &) {}
+
+	T *allocate(size_t n) { // over-allocate and store the original pointer just before the aligned block
+		char *const p((char *)::operator new(n*sizeof(T) + ALIGN + sizeof(void *)));
+		char *const a((char *)(((uintptr_t)(p + sizeof(void *)) + ALIGN - 1) & ~uintptr_t(ALIGN - 1)));
+		((void **)a)[-1] = p;
+		return (T *)a;
+	}
+	void deallocate(T *a, size_t) {::operator delete(((void **)a)[-1]);}
+	template<typename U> bool operator==(aligned_allocator_t<U, ALIGN> const &) const {return 1;}
+	template<typename U> bool operator!=(aligned_allocator_t<U, ALIGN> const &) const {return 0;}
+};
+
+
 class cobj_tree_base {
 
 protected:
@@ -20,8 +44,51 @@ protected:
 		tree_node(unsigned s, unsigned e, cube_t const &cube) : cube_t(cube), start(s), end(e), next_node_id(0) {}
 	};
 
+	struct compact_tree_node { // size = 16; optional replacement for tree_node
+		uint16_t lo[3], hi[3]; // bounds quantized conservatively to 16 bits relative to the block's frame
+		unsigned ix; // branch: next_node_id; leaf: index into leaf_ranges | CNODE_LEAF_FLAG (next_node_id is always nix+1)
+	};
+	struct cnode_frame_t { // size = 16
+		float base[3]; // min corner of the union of the block's node bounds
+		uint8_t step_exp[3], pad; // quantization step per dim is 2^(step_exp - 127), which has the same bits as a float exponent
+
+		void set(cube_t const &bc);
+		float get_step(unsigned dim) const {uint32_t const bits(uint32_t(step_exp[dim]) << 23); float step; memcpy(&step, &bits, sizeof(float)); return step;}
+		float dequantize(uint16_t q, unsigned dim) const {return (base[dim] + float(q)*get_step(dim));}
+	};
+	// consecutive depth-first nodes are mostly a parent and its children, so a per-block frame has close to the precision of parent-relative
+	// quantization while still allowing random access by node index
+	struct alignas(64) compact_node_block_t { // size = 64, one cache line
+		cnode_frame_t frame;
+		compact_tree_node n[CNODES_PER_BLOCK];
+	};
+	typedef vector<compact_node_block_t, aligned_allocator_t<compact_node_block_t, 64>> cnode_block_vect_t;
+
 	vector<tree_node> nodes;
-	unsigned max_depth, max_leaf_count, num_leaf_nodes;
+	cnode_block_vect_t cblocks; // if nonempty, nodes is empty and all queries use this instead
+	vector<pair<unsigned, unsigned>> leaf_ranges; // {start, end} for compact leaf nodes
+	unsigned num_cnodes, max_depth, max_leaf_count, num_leaf_nodes;
+
+	void build_compact_nodes();
+	void clear_compact_nodes() {cblocks.clear(); leaf_ranges.clear(); num_cnodes = 0;}
+	unsigned get_num_nodes() const {return (cblocks.empty() ? nodes.size() : num_cnodes);}
+	size_t get_node_mem() const {return (nodes.size()*sizeof(tree_node) + cblocks.size()*sizeof(compact_node_block_t) + leaf_ranges.size()*sizeof(leaf_ranges.front()));}
+	compact_tree_node const &get_cnode(unsigned nix) const {return cblocks[nix/CNODES_PER_BLOCK].n[nix%CNODES_PER_BLOCK];}
+
+	// performance critical; returns either the stored node or tmp filled in from the compact node
+	tree_node const &get_node(unsigned nix, tree_node &tmp) const {
+		if (cblocks.empty()) {return nodes[nix];}
+		compact_node_block_t const &b(cblocks[nix/CNODES_PER_BLOCK]);
+		compact_tree_node const &c(b.n[nix%CNODES_PER_BLOCK]);
+		UNROLL_3X(tmp.d[i_][0] = b.frame.dequantize(c.lo[i_], i_); tmp.d[i_][1] = b.frame.dequantize(c.hi[i_], i_);)
+
+		if (c.ix & CNODE_LEAF_FLAG) {
+			pair<unsigned, unsigned> const &lr(leaf_ranges[c.ix & ~CNODE_LEAF_FLAG]);
+			tmp.start = lr.first; tmp.end = lr.second; tmp.next_node_id = nix+1;
+		}
+		else {tmp.start = tmp.end = 0; tmp.next_node_id = c.ix;}
+		return tmp;
+	}
 
 	inline void register_leaf(unsigned num) {
 		++num_leaf_nodes;
@@ -29,21 +96,31 @@ protected:
 	}
 	bool check_for_leaf(unsigned num, unsigned skip_dims);
 	unsigned get_conservative_num_nodes(unsigned num) const {return (3*num/2 + 8);}
+	bool nodes_valid(unsigned num_objs) const;
+	template<typename T> bool write_cache_file(std::string const &fn, uint64_t key, vector<T> const &leaf_data) const;
+	template<typename T> bool read_cache_file (std::string const &fn, uint64_t key, vector<T> &leaf_data);
 
 	struct node_ix_mgr {
 		point const p1, p2;
 		vector3d dinv;
-		vector<tree_node> const &nodes;
 
-		node_ix_mgr(vector<tree_node> const &nodes_, point const &p1_, point const &p2_);
-		bool check_node(unsigned &nix) const;
+		node_ix_mgr(point const &p1_, point const &p2_);
+		bool check_node(tree_node const &n, unsigned &nix) const;
 		bool (* get_line_clip_func) (point const &p1, vector3d const &dinv, float const d[3][2]); // function pointer
 	};
 
+	struct ray_packet_t { // SoA line segments for testing up to RAY_PACKET_SIZE lines against a node bbox at once
+		alignas(16) float org[3][RAY_PACKET_SIZE], dinv[3][RAY_PACKET_SIZE], tmax[RAY_PACKET_SIZE]; // tmax is the current closest hit
+		unsigned active_mask;
+
+		ray_packet_t(unsigned num, point const *p1, point const *p2);
+		unsigned get_node_hit_mask(float const d[3][2]) const;
+	};
+
 public:
-	cobj_tree_base() : max_depth(0), max_leaf_count(0), num_leaf_nodes(0) {}
-	bool is_empty() const {return nodes.empty();}
-	void clear() {nodes.resize(0);}
+	cobj_tree_base() : num_cnodes(0), max_depth(0), max_leaf_count(0), num_leaf_nodes(0) {}
+	bool is_empty() const {return (nodes.empty() && cblocks.empty());}
+	void clear() {nodes.resize(0); cblocks.resize(0); leaf_ranges.resize(0); num_cnodes = 0;}
 	bool get_root_bcube(cube_t &bc) const;
 };
 
@@ -55,6 +132,7 @@ protected:
 
 	virtual void calc_node_bbox(tree_node &n) const = 0;
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth);
+	uint64_t get_cache_key() const;
 
 public:
 	virtual ~cobj_tree_simple_type_t() {}
@@ -63,7 +141,7 @@ public:
 		cobj_tree_base::clear();
 		objects.clear(); // reserve(0)?
 	}
-	void build_tree_top(bool verbose);
+	void build_tree_top(bool verbose, std::string const &cache_fn="");
 };
 
 
@@ -109,6 +187,8 @@ class cobj_bvh_tree : public cobj_tree_base {
 
 	coll_obj_group const *cobjs;
 	vector<unsigned> cixs;
+	vector<unsigned> build_cids; // sorted cixs at the last full build; refit is only possible if this is unchanged
+	vector<float> build_sa; // per-node surface area at build time, used to detect subtrees that need to be rebuilt after refit
 	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
 
 	struct per_thread_data {
@@ -123,12 +203,42 @@ class cobj_bvh_tree : public cobj_tree_base {
 		void increment_node_ix() {assert(cur_nix >= start_nix); cur_nix++;}
 	};
 
+	struct sah_prim_t : public cube_t { // bcube copy of a cobj, for cache efficient binning
+		point center;
+		unsigned cix;
+		sah_prim_t() : cix(0) {}
+		sah_prim_t(cube_t const &c, unsigned cix_) : cube_t(c), center(c.get_cube_center()), cix(cix_) {}
+	};
+	struct refit_stats_t {
+		unsigned refits, full_rebuilds, partial_rebuilds, nodes_rebuilt;
+		refit_stats_t() : refits(0), full_rebuilds(0), partial_rebuilds(0), nodes_rebuilt(0) {}
+	};
+	refit_stats_t refit_stats;
+
+	struct sah_build_node : public cube_t { // temporary binary tree node; kids index into the build node array
+		unsigned start, end, kids[2];
+		sah_build_node() : start(0), end(0) {kids[0] = kids[1] = 0;}
+		bool is_leaf() const {return (kids[0] == 0);} // root is never a child, so 0 is an invalid kid index
+	};
+
 	void add_cobj(unsigned ix) {if (obj_ok((*cobjs)[ix])) {cixs.push_back(ix);}}
 	coll_obj const &get_cobj(unsigned ix) const {return (*cobjs)[cixs[ix]];}
 	bool create_cixs();
 	void calc_node_bbox(tree_node &n) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
+	void build_tree_from_cixs(bool do_mt_build, bool use_sah);
+	void build_nodes(bool do_mt_build, bool use_sah);
+	void record_build_state();
+	void refit_nodes(vector<pair<unsigned, unsigned>> &cix_ranges);
+	void refit();
+	void rebuild_subtree(unsigned nix, pair<unsigned, unsigned> const &cix_range);
+	void build_tree_sah(bool do_mt_build);
+	bool split_sah_node(vector<sah_prim_t> &prims, vector<sah_build_node> &bnodes, unsigned bix) const;
+	void build_sah_subtree(vector<sah_prim_t> &prims, vector<sah_build_node> &bnodes, unsigned bix) const;
+	void flatten_sah_tree(vector<sah_build_node> const &bnodes, unsigned bix, unsigned depth);
+	unsigned get_coll_line_nodes_visited(point const &p1, point const &p2, unsigned &num_leaf_tests) const;
+	uint64_t get_cache_key() const;
 
 	bool obj_ok(coll_obj const &c) const {
 		return (((is_static && c.status == COLL_STATIC) || (is_dynamic && c.status == COLL_DYNAMIC) || (!is_static && !is_dynamic)) &&
@@ -143,10 +253,16 @@ public:
 	unsigned get_num_objs() const {return cixs.size();}
 	void clear();
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
-	void add_cobjs(bool verbose);
+	void add_cobjs(bool verbose, std::string const &cache_fn="");
 	void build_tree_from_cixs(bool do_mt_build);
+	void update_cobjs();
+	void update_cobj_ids(vector<unsigned> cids);
+	void print_refit_stats(char const *name) const;
+	void run_build_benchmark(unsigned num_rays);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	unsigned check_coll_line_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+		int test_alpha, bool skip_non_drawn, bool const *skip_init_colls, bool skip_movable) const;
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
@@ -576,6 +576,7 @@ int coll_obj::add_coll_cobj() {
 
 	int cid(-1);
 	set_bit_flag_to(cp.flags, COBJ_DYNAMIC, (status == COLL_DYNAMIC));
+	register_cobj_lighting_change(*this);
 
 	switch (type) {
 	case COLL_CUBE:
@@ -724,6 +725,7 @@ int remove_coll_object(int index, bool reset_draw) {
 		return 0;
 	}
 	if (c.status == COLL_FREED) return 0;
+	register_cobj_lighting_change(c);
 	coll_objects.remove_index_from_ids(index);
 	if (reset_draw) {c.cp.draw = 0;}
 	c.status   = COLL_FREED;
@@ -45,7 +45,7 @@ colorRGBA cur_fog_color(GRAY), base_cloud_color(WHITE), base_sky_color(BACKGROUN
 
 extern bool combined_gu, have_sun, clear_landscape_vbo, show_lightning, spraypaint_mode, enable_depth_clamp, enable_multisample, water_is_lava;
 extern bool user_action_key, flashlight_on, enable_clip_plane_z, begin_motion, config_unlimited_weapons, start_maximized;
-extern unsigned inf_terrain_fire_mode, reflection_tid;
+extern unsigned inf_terrain_fire_mode, reflection_tid, benchmark_frames;
 extern int auto_time_adv, camera_flight, reset_timing, run_forward, window_width, window_height, voxel_editing, UNLIMITED_WEAPONS;
 extern int advanced, b2down, dynamic_mesh_scroll, spectate, animate2, used_objs, disable_inf_terrain, DISABLE_WATER;
 extern float TIMESTEP, NEAR_CLIP, FAR_CLIP, cloud_cover, univ_sun_rad, atmosphere, vegetation, zmin, zbottom, ztop, ocean_wave_height, brightness;
@@ -73,6 +73,7 @@ void play_camera_footstep_sound();
 void draw_voxel_edit_volume();
 void play_switch_weapon_sound();
 void toggle_fullscreen();
+void limit_omp_threads();
 
 vector3d calc_camera_direction();
 void draw_player_model(point const &pos, vector3d const &dir, int time);
@@ -739,6 +740,8 @@ void display(void) {
 	RESET_TIME;
 	static int init(0), frame_index(0), time_index(0), global_time(0), tticks(0);
 	static point old_spos(0.0, 0.0, 0.0);
+	timing_profiler_next_frame();
+	limit_omp_threads();
 	proc_kbd_events();
 
 	if (!init) { // the first frame
@@ -746,7 +749,7 @@ void display(void) {
 		fticks = 1.0;
 		time0  = timer1;
 	}
-	else if (animate && !DETERMINISTIC_TIME) {
+	else if (animate && !DETERMINISTIC_TIME && benchmark_frames == 0) { // benchmark mode uses a fixed timestep for reproducibility
 		double ftick(0.0);
 		static float carry(0.0);
 		double const time_delta((TICKS_PER_SECOND*(timer1 - time0))/1000.0f);
@@ -1150,6 +1153,7 @@ void display_inf_terrain() { // infinite terrain mode (Note: uses light params f
 
 	static int init_xx(1);
 	RESET_TIME;
+	PROFILE_SCOPE("Display Inf Terrain");
 	//timer_t timer("Display Inf Terrain"); // 6.9 no update / 10.6 1-thread / 8.0 2-threads / 7.6 3-threads
 
 	if (init_x || init_xx) {
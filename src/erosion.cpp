@@ -4,17 +4,73 @@
 
 #include "3DWorld.h"
 #include "mesh.h"
+#include "job_system.h"
 #include <cfloat> // for FLT_EPSILON
+#include <chrono>
 
 
+extern unsigned erosion_bench_droplets;
 extern float erode_amount, water_plane_z;
 
 
+unsigned const EROSION_BATCH_SIZE = 256; // droplets simulated in parallel against the same heightmap; must not depend on the thread count
+
+
+// per-droplet heightmap changes, stored in first-touched order so that they can be applied deterministically
+class erosion_delta_map_t {
+	vector<unsigned> ixs, slots;
+	vector<float> deltas;
+	vector<int> table; // open addressing hash table of indices into ixs, -1 = empty
+	unsigned mask;
+
+	unsigned hash_ix(unsigned ix) const {return ((ix*2654435761U) & mask);}
+
+	void grow() {
+		table.assign(2*table.size(), -1);
+		mask = table.size() - 1;
+
+		for (unsigned i = 0; i < ixs.size(); ++i) {
+			unsigned s(hash_ix(ixs[i]));
+			while (table[s] >= 0) {s = (s + 1) & mask;}
+			table[s] = i;
+			slots[i] = s;
+		}
+	}
+public:
+	erosion_delta_map_t() : table(1024, -1), mask(1023) {}
+	unsigned size() const {return ixs.size();}
+	unsigned get_ix   (unsigned i) const {return ixs  [i];}
+	float    get_delta(unsigned i) const {return deltas[i];}
+
+	void clear() {
+		for (auto i = slots.begin(); i != slots.end(); ++i) {table[*i] = -1;}
+		ixs.clear(); slots.clear(); deltas.clear();
+	}
+	float get(unsigned ix) const {
+		for (unsigned s = hash_ix(ix); table[s] >= 0; s = (s + 1) & mask) {
+			if (ixs[table[s]] == ix) {return deltas[table[s]];}
+		}
+		return 0.0;
+	}
+	void add(unsigned ix, float delta) {
+		unsigned s(hash_ix(ix));
+
+		for (; table[s] >= 0; s = (s + 1) & mask) {
+			if (ixs[table[s]] == ix) {deltas[table[s]] += delta; return;}
+		}
+		table[s] = ixs.size();
+		ixs.push_back(ix);
+		slots.push_back(s);
+		deltas.push_back(delta);
+		if (2*ixs.size() > table.size()) {grow();} // keep load factor <= 0.5
+	}
+};
+
+
 // see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+// simulates one droplet; reads the heightmap as of the start of the batch plus this droplet's own changes, and writes only to dmap
+void simulate_erosion_droplet(float const *mh_padded, int NX, int NY, int xsize, int ysize, int PAD, unsigned iter, unsigned seed, erosion_delta_map_t &dmap) {
 
-	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
-	RESET_TIME;
 	// Kq and minSlope are for soil carry capacity.
 	// Kw is water evaporation speed.
 	// Kr is erosion speed (how fast the soil is removed).
@@ -22,28 +78,13 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	// Ki is direction inertia. Higher values make channel turns smoother.
 	// g is gravity that accelerates the flows.
 	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
-	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
 	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
-	vector<float> mh_padded(NX*NY);
-
-	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
-	for (int y = 0; y < NY; ++y) {
-		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
-
-		for (int x = 0; x < NX; ++x) {
-			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
-		}
-	}
 
 #define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
-#define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
+#define HMAP(x, y) (mh_padded[HMAP_INDEX(x, y)] + dmap.get(HMAP_INDEX(x, y)))
 
 #define DEPOSIT_AT(X, Z, W) { \
-	float const delta = ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	erosion[ix].y += delta; \
-	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {mh_padded[ix] += delta;} \
+	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {dmap.add(HMAP_INDEX((X), (Z)), ds*erode_amount*(W));} \
 }
 
 #define DEPOSIT(H) \
@@ -53,106 +94,142 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	DEPOSIT_AT(xi+1, zi+1,    xf *   zf ) \
 	(H)+=ds;
 
-#define ERODE(X, Z, W) { \
-	float const delta=ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	mh_padded[ix]-=delta; \
-	vector2d &e=erosion[ix]; \
-	float r=e.x, d=e.y; \
-	if (delta<=d) {d-=delta;} else {r+=delta-d; d=0;} \
-	e.x=r; e.y=d; \
-}
+#define ERODE(X, Z, W) {dmap.add(HMAP_INDEX((X), (Z)), -ds*erode_amount*(W));}
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
-		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
-
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
-			// calc gradient
-			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
-			// calc next pos
-			dx=(dx-gx)*Ki+gx;
-			dz=(dz-gz)*Ki+gz;
-
-			float dl=sqrtf(dx*dx+dz*dz);
-			if (dl<=FLT_EPSILON) { // pick random dir
-				float a=rgen.rand_float()*TWO_PI;
-				dx=cosf(a); dz=sinf(a);
-			}
-			else {
-				dx/=dl; dz/=dl;
+	rand_gen_t rgen;
+	rgen.set_state(iter+11, ((79*iter+121) ^ seed));
+	int xi = PAD + (rgen.rand()%xsize);
+	int zi = PAD + (rgen.rand()%ysize);
+	float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
+	float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
+
+	unsigned numMoves=0;
+	for (; numMoves<MAX_PATH_LEN; ++numMoves) {
+		// calc gradient
+		float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
+		// calc next pos
+		dx=(dx-gx)*Ki+gx;
+		dz=(dz-gz)*Ki+gz;
+
+		float dl=sqrtf(dx*dx+dz*dz);
+		if (dl<=FLT_EPSILON) { // pick random dir
+			float a=rgen.rand_float()*TWO_PI;
+			dx=cosf(a); dz=sinf(a);
+		}
+		else {
+			dx/=dl; dz/=dl;
+		}
+		float nxp=xp+dx, nzp=zp+dz;
+		// sample next height
+		int nxi=floor(nxp), nzi=floor(nzp);
+		float nxf=nxp-nxi, nzf=nzp-nzi;
+		float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+		float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
+		// adjust by HALF_DXY = average mesh texel size - this is river depth
+		if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+
+		// if higher than current, try to deposit sediment up to neighbour height
+		bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
+		if (nh>=h || outside) {
+			float ds=(nh-h)+0.001f;
+
+			if (ds>=s || outside) {
+				ds=s;
+				DEPOSIT(h) // deposit all sediment
+				s=0;
+				break; // stop
 			}
-			float nxp=xp+dx, nzp=zp+dz;
-			// sample next height
-			int nxi=floor(nxp), nzi=floor(nzp);
-			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
-			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
-			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
-
-			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
-			if (nh>=h || outside) {
-				float ds=(nh-h)+0.001f;
-
-				if (ds>=s || outside) {
-					ds=s;
-					DEPOSIT(h) // deposit all sediment
-					s=0;
-					break; // stop
+			DEPOSIT(h)
+			s-=ds;
+			v=0;
+		}
+		// compute transport capacity
+		float dh=h-nh;
+		float slope=dh;
+		//float slope=dh/sqrtf(dh*dh+1);
+		float q=max(slope, minSlope)*v*w*Kq;
+
+		// deposit/erode (don't erode more than dh)
+		float ds=s-q;
+		if (ds>=0) { // deposit
+			ds*=Kd;
+			//ds=minval(ds, 1.0f);
+			DEPOSIT(dh)
+			s-=ds;
+		}
+		else { // erode
+			ds*=-Kr;
+			ds=min(ds, dh*0.99f);
+			ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+
+			for (int z=zi-1; z<=zi+2; ++z) {
+				float zo=z-zp, zo2=zo*zo;
+
+				for (int x=xi-1; x<=xi+2; ++x) {
+					float xo=x-xp;
+					float w=1-(xo*xo+zo2)*0.25f;
+					if (w<=0) continue;
+					w*=0.1591549430918953f;
+					ERODE(x, z, w)
 				}
-				DEPOSIT(h)
-				s-=ds;
-				v=0;
-			}
-			// compute transport capacity
-			float dh=h-nh;
-			float slope=dh;
-			//float slope=dh/sqrtf(dh*dh+1);
-			float q=max(slope, minSlope)*v*w*Kq;
-
-			// deposit/erode (don't erode more than dh)
-			float ds=s-q;
-			if (ds>=0) { // deposit
-				ds*=Kd;
-				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
-				s-=ds;
 			}
-			else { // erode
-				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
-				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
-
-				for (int z=zi-1; z<=zi+2; ++z) {
-					float zo=z-zp, zo2=zo*zo;
-
-					for (int x=xi-1; x<=xi+2; ++x) {
-						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
-					}
+			dh-=ds;
+			s+=ds;
+		}
+		// move to the neighbor
+		v=sqrtf(v*v+Kg*dh);
+		w*=1-Kw;
+		xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
+		h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
+	} // for numMoves
+	if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
+#undef HMAP_INDEX
+#undef HMAP
+#undef DEPOSIT_AT
+#undef DEPOSIT
+#undef ERODE
+}
+
+// Droplets are run in fixed size batches: each droplet in a batch sees the heightmap from the start of the batch plus its own changes,
+// then the changes are applied in droplet order, so the result is bit-identical for any number of threads;
+// seed selects the droplet start positions, for example per tiled terrain tile
+void erode_heightmap(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters, unsigned seed, bool enable_mt) {
+
+	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
+	vector<float> mh_padded(NX*NY);
+
+	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
+	for (int y = 0; y < NY; ++y) {
+		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
+
+		for (int x = 0; x < NX; ++x) {
+			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
+		}
+	}
+	vector<erosion_delta_map_t> dmaps(min(num_iters, EROSION_BATCH_SIZE));
+	unsigned const num_cells(NX*NY), num_ranges(enable_mt ? get_job_system().get_num_threads() : 1), range_sz((num_cells + num_ranges - 1)/num_ranges);
+
+	for (unsigned batch_start = 0; batch_start < num_iters; batch_start += EROSION_BATCH_SIZE) {
+		unsigned const batch_sz(min(EROSION_BATCH_SIZE, num_iters - batch_start));
+
+		parallel_for(0, batch_sz, [&](int i) {
+			dmaps[i].clear();
+			simulate_erosion_droplet(&mh_padded.front(), NX, NY, xsize, ysize, PAD, (batch_start + i), seed, dmaps[i]);
+		}, enable_mt, 1);
+		// apply changes; each thread owns a range of cells and applies its updates in droplet order
+		parallel_for(0, num_ranges, [&](int r) {
+			unsigned const start(r*range_sz), end(min(num_cells, start + range_sz));
+
+			for (unsigned d = 0; d < batch_sz; ++d) {
+				erosion_delta_map_t const &dmap(dmaps[d]);
+
+				for (unsigned i = 0; i < dmap.size(); ++i) {
+					unsigned const ix(dmap.get_ix(i));
+					if (ix >= start && ix < end) {mh_padded[ix] += dmap.get_delta(i);}
 				}
-				dh-=ds;
-				s+=ds;
 			}
-			// move to the neighbor
-			v=sqrtf(v*v+Kg*dh);
-			w*=1-Kw;
-			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
-			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
+		}, enable_mt, 1);
+	} // for batch_start
 
 	// remove padding and clamp to min_zval
 	for (int y = 0; y < ysize; ++y) {
@@ -160,6 +237,36 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 			heightmap[y*xsize + x] = max(min_zval, mh_padded[(y+PAD)*NX + x+PAD]);
 		}
 	}
-	PRINT_TIME("Erosion");
 }
 
+// runs erosion_bench_droplets droplets serially and with all threads, and checks that the results match
+void run_erosion_benchmark(float const *heightmap, int xsize, int ysize, float min_zval) {
+
+	typedef std::chrono::high_resolution_clock clock_type;
+	unsigned const num_iters(erosion_bench_droplets);
+	unsigned const num_threads(get_job_system().get_num_threads());
+	vector<float> results[2];
+	cout << "Erosion Benchmark: " << xsize << "x" << ysize << ", droplets: " << num_iters << ", threads: " << num_threads << endl;
+
+	for (unsigned mt = 0; mt < 2; ++mt) {
+		results[mt].assign(heightmap, heightmap + xsize*ysize);
+		auto const t0(clock_type::now());
+		erode_heightmap(&results[mt].front(), xsize, ysize, min_zval, num_iters, 0, (mt != 0));
+		double const secs(std::chrono::duration<double>(clock_type::now() - t0).count());
+		cout << (mt ? "parallel: " : "serial:   ") << 1000.0*secs << " ms, " << num_iters/max(secs, 1.0E-6) << " droplets/sec" << endl;
+	}
+	cout << "Erosion results " << ((results[0] == results[1]) ? "match" : "DIFFER") << endl;
+}
+
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters, unsigned seed) {
+
+	static std::atomic<bool> bench_done(0); // may be called from multiple tile generation jobs
+
+	if (erosion_bench_droplets > 0 && !bench_done.exchange(1)) {
+		run_erosion_benchmark(heightmap, xsize, ysize, min_zval);
+	}
+	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
+	RESET_TIME;
+	erode_heightmap(heightmap, xsize, ysize, min_zval, num_iters, seed, 1);
+	PRINT_TIME("Erosion");
+}
@@ -21,10 +21,13 @@ protected:
 	char buffer[MAX_CHARS] = {0};
 	char file_buf[FILE_BUF_SZ] = {0};
 	unsigned file_buf_pos, file_buf_end;
+	char const *mem_pos, *mem_end; // if mem_pos is set, characters are read from this range of memory rather than from the file
 
 	bool open_file(bool binary=0);
 	void close_file();
-	int get_next_char() {assert(fp); return get_char(fp);}
+	int get_next_char() {assert(fp || mem_pos); return get_char(fp);}
+	void set_mem_range(char const *begin, char const *end) {assert(begin <= end); mem_pos = begin; mem_end = end;}
+	bool read_file_to_mem(std::vector<char> &data) const;
 	void unget_last_char(int c);
 	static bool fast_isspace(char c) {return (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r');}
 	static bool fast_isdigit(char c) {return (c >= '0' && c <= '9');}
@@ -71,7 +74,7 @@ protected:
 	bool read_string(char *s, unsigned max_len);
 
 public:
-	base_file_reader(std::string const &fn) : filename(fn), fp(NULL), verbose(0), file_buf_pos(0), file_buf_end(0) {assert(!fn.empty());}
+	base_file_reader(std::string const &fn) : filename(fn), fp(NULL), verbose(0), file_buf_pos(0), file_buf_end(0), mem_pos(NULL), mem_end(NULL) {assert(!fn.empty());}
 	~base_file_reader() {close_file();}
 };
 
@@ -48,6 +48,128 @@ extern pt_line_drawer particle_pld;
 extern point_sprite_drawer_sized glow_psd, smoke_psd;
 
 
+// ************ HANDLES AND POOLS ************
+
+
+free_obj_slot_t *fobj_slot_chunks[FOBJ_MAX_SLOT_CHUNKS] = {0};
+unsigned num_fobj_slots(1); // slot 0 is reserved for NULL handles
+vector<unsigned> free_fobj_slots;
+std::mutex fobj_slot_mutex;
+
+free_obj_pool_t<uparticle>       uparticle_pool ("Particles");
+free_obj_pool_t<us_projectile>   projectile_pool("Projectiles");
+free_obj_pool_t<uparticle_cloud> part_cloud_pool("Particle Clouds");
+
+
+unsigned alloc_fobj_slot(free_obj *obj) {
+
+	std::lock_guard<std::mutex> lock(fobj_slot_mutex);
+	unsigned slot(0);
+
+	if (!free_fobj_slots.empty()) {
+		slot = free_fobj_slots.back();
+		free_fobj_slots.pop_back();
+	}
+	else {
+		slot = num_fobj_slots++;
+		unsigned const chunk(slot >> FOBJ_SLOT_CHUNK_BITS);
+		assert(chunk < FOBJ_MAX_SLOT_CHUNKS);
+		if (fobj_slot_chunks[chunk] == NULL) {fobj_slot_chunks[chunk] = new free_obj_slot_t[FOBJ_SLOT_CHUNK_SIZE];}
+	}
+	fobj_slot_chunks[slot >> FOBJ_SLOT_CHUNK_BITS][slot & (FOBJ_SLOT_CHUNK_SIZE-1)].obj = obj;
+	return slot;
+}
+
+void free_fobj_slot(unsigned slot) {
+
+	assert(slot > 0);
+	std::lock_guard<std::mutex> lock(fobj_slot_mutex);
+	free_obj_slot_t &s(fobj_slot_chunks[slot >> FOBJ_SLOT_CHUNK_BITS][slot & (FOBJ_SLOT_CHUNK_SIZE-1)]);
+	s.obj = NULL;
+	++s.gen; // invalidate all handles to this object
+	free_fobj_slots.push_back(slot);
+}
+
+
+vector<free_obj_pool_base_t *> &get_free_obj_pools() {
+	static vector<free_obj_pool_base_t *> pools; // constructed on first use, since pools are globals in multiple files
+	return pools;
+}
+
+free_obj_pool_base_t::free_obj_pool_base_t(char const *name_, size_t obj_size) : name(name_), num_live(0), max_live(0), num_allocs(0) {
+
+	slot_size       = ((obj_size + 15) & ~size_t(15)); // keep slots 16-byte aligned
+	slots_per_block = max(16U, unsigned((256 << 10)/slot_size)); // about 256KB per block
+	get_free_obj_pools().push_back(this);
+}
+
+void *free_obj_pool_base_t::alloc_mem() {
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (free_list.empty()) { // allocate a new block
+		char *const block(new char[slots_per_block*slot_size]);
+		blocks.push_back(block);
+		for (unsigned i = slots_per_block; i > 0; --i) {free_list.push_back(block + (i-1)*slot_size);} // allocate in memory order
+	}
+	void *const mem(free_list.back());
+	free_list.pop_back();
+	++num_allocs;
+	max_live = max(max_live, ++num_live);
+	return mem;
+}
+
+void free_obj_pool_base_t::free(free_obj *obj) {
+
+	assert(obj != NULL && obj->get_pool() == this);
+	void *const mem(dynamic_cast<void *>(obj)); // start of the most derived object, which may not be the free_obj base
+	obj->~free_obj();
+	std::lock_guard<std::mutex> lock(mutex);
+	assert(num_live > 0);
+	--num_live;
+	pending_free.push_back(mem);
+}
+
+void free_obj_pool_base_t::next_frame() {
+
+	std::lock_guard<std::mutex> lock(mutex);
+	free_list.insert(free_list.end(), pending_free.begin(), pending_free.end());
+	pending_free.clear();
+}
+
+void free_obj_pool_base_t::print_stats() const {
+
+	size_t const live_kb((size_t(num_live)*slot_size) >> 10), total_kb((blocks.size()*slots_per_block*slot_size) >> 10);
+	cout << name << ": Live: " << num_live << ", Max: " << max_live << ", Allocs: " << num_allocs << ", Size: " << slot_size
+		 << ", Mem: " << live_kb << "/" << total_kb << " KB" << endl;
+}
+
+
+uparticle *alloc_uparticle() {return uparticle_pool.alloc();}
+us_projectile *alloc_projectile(unsigned type) {return projectile_pool.alloc(type);}
+
+// Note: this is the *only* place where free objects are deleted, and it's only called from purge_old_objs()
+void delete_uobj(free_obj *obj) {
+
+	assert(obj != NULL && !obj->is_player_ship());
+	free_obj_pool_base_t *const pool(obj->get_pool());
+	if (pool != NULL) {pool->free(obj); return;}
+	assert(obj->is_ship() || obj->is_stationary() || obj->is_part_cloud()); // sanity check
+	delete obj;
+}
+
+// freed pool memory becomes reusable one purge after the object was deleted
+void free_obj_pools_next_frame() {
+	vector<free_obj_pool_base_t *> const &pools(get_free_obj_pools());
+	for (auto i = pools.begin(); i != pools.end(); ++i) {(*i)->next_frame();}
+}
+
+void print_free_obj_pool_stats() {
+	vector<free_obj_pool_base_t *> const &pools(get_free_obj_pools());
+	for (auto i = pools.begin(); i != pools.end(); ++i) {(*i)->print_stats();}
+}
+
+
 // ************ FREE_OBJ ************
 
 
@@ -819,14 +941,6 @@ void uparticle::set_params(unsigned ptype_, point const &pos_, vector3d const &v
 }
 
 
-bool uparticle::dec_ref() {
-	
-	if (alloc_block == NULL) return 0;
-	alloc_block->free_object();
-	return 1;
-}
-
-
 vector3d uparticle::get_tot_vel_at(point const &cpos) const {
 
 	return free_obj::get_tot_vel_at(cpos) + calc_angular_vel(cpos, axis, 0.1*rrate);
@@ -921,7 +1035,7 @@ void uparticle::draw_obj(uobj_draw_data &ddata) const {
 void add_uparticle_cloud(point const &pos, float rmin, float rmax, colorRGBA const &ci1, colorRGBA const &co1,
 	colorRGBA const &ci2, colorRGBA const &co2, unsigned lt, float damage, float expand_exp, float noise_scale)
 {
-	uparticle_cloud *upc(new uparticle_cloud(pos, rmin, rmax, ci1, co1, ci2, co2, lt, damage, expand_exp, noise_scale));
+	uparticle_cloud *upc(part_cloud_pool.alloc(pos, rmin, rmax, ci1, co1, ci2, co2, lt, damage, expand_exp, noise_scale));
 	bool const coll(add_uobj(upc, 0));
 	assert(!coll);
 }
@@ -978,7 +1092,7 @@ void uparticle_cloud::draw_obj(uobj_draw_data &ddata) const { // Note: assumes G
 // ************ US_PROJECTILE ************
 
 
-us_projectile::us_projectile(unsigned type) : tup_time(0), alloc_block(NULL) {
+us_projectile::us_projectile(unsigned type) : tup_time(0), lock_warning(0) {
 
 	flags = (OBJ_FLAGS_TARG | OBJ_FLAGS_PROJ);
 	set_type(type);
@@ -1001,14 +1115,6 @@ void us_projectile::set_type(unsigned type) {
 }
 
 
-bool us_projectile::dec_ref() {
-	
-	if (alloc_block == NULL) return 0;
-	alloc_block->free_object();
-	return 1;
-}
-
-
 us_weapon const &us_projectile::specs() const {
 
 	assert(wclass < NUM_UWEAP);
@@ -1022,8 +1128,9 @@ inline unsigned us_projectile::get_eflags() const {
 }
 
 
-void us_projectile::ai_action() {
+void us_projectile::ai_plan() { // runs in parallel across objects, so the missile lock warning is deferred to ai_action()
 
+	lock_warning = 0;
 	if (!is_ok() || !specs().seeking || time < PROJ_ARM_T || !begin_motion) return;
 	if (rot_rate != 0.0) {rot_rate *= pow(PROJ_ROT_ATTEN, fticks);} // stabilize
 	float const max_dist(specs().seek_dist), target_dist((target_obj == NULL) ? 0.0 : p2p_dist(pos, target_obj->get_pos()));
@@ -1054,9 +1161,7 @@ void us_projectile::ai_action() {
 		}
 	}
 	if (target_obj != NULL) { // target acquired
-		if (target_obj->is_player_ship() && missile_lock) {
-			send_warning_message(string("Missile Lock Warning: ") + get_name());
-		}
+		lock_warning = (target_obj->is_player_ship() && missile_lock);
 		vector3d const seek_dir(target_obj->get_pos(), pos);
 		
 		if (dot_product(seek_dir, dir) > 0.0) { // only seek if in the same direction
@@ -1077,6 +1182,13 @@ void us_projectile::ai_action() {
 }
 
 
+void us_projectile::ai_action() {
+
+	if (lock_warning) {send_warning_message(string("Missile Lock Warning: ") + get_name());}
+	lock_warning = 0;
+}
+
+
 void us_projectile::apply_physics() {
 
 	if (!is_ok()) return;
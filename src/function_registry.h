@@ -327,6 +327,8 @@ float eval_mesh_sin_terms(float xv, float yv);
 float get_exact_zval(float xval, float yval);
 void reset_offsets();
 float get_median_height(float distribution_pos);
+uint64_t get_mesh_gen_params_hash();
+bool using_gpu_mesh_noise();
 float get_water_z_height();
 float get_cur_temperature();
 void update_mesh(float dms, bool do_regen_trees);
@@ -337,7 +339,7 @@ bool load_state(const char *filename);
 bool save_state(const char *filename);
 
 // function prototypes - erosion
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters);
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters, unsigned seed=0);
 
 // function prototypes - city_gen
 template<typename T> bool check_bcubes_sphere_coll(vector<T> const &bcubes, point const &sc, float radius, bool xy_only);
@@ -445,9 +447,12 @@ void free_cobj_draw_group_vbos();
 
 // function prototypes - coll_cell_search
 void build_static_moving_cobj_tree();
-void build_cobj_tree(bool dynamic=0, bool verbose=1);
+void build_cobj_tree(bool dynamic=0, bool verbose=1, bool use_cache=0);
+void print_cobj_tree_refit_stats();
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic=0, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0, bool no_stat_moving=0);
+unsigned check_coll_line_exact_tree_packet(unsigned num, point const *p1, point const *p2, point *cpos, vector3d *cnorm, int *cindex, int ignore_cobj,
+	int test_alpha, bool skip_non_drawn, bool include_voxels, bool const *skip_init_colls, bool skip_movable, bool no_stat_moving);
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic=0, int test_alpha=0,
 	bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0);
 bool cobj_contained_tree(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj);
@@ -877,6 +882,7 @@ float get_scene_radius();
 void kill_current_raytrace_threads();
 void check_update_global_lighting(unsigned lights);
 void check_all_platform_cobj_lighting_update();
+void register_cobj_lighting_change(coll_obj const &cobj);
 
 // function prototypes - voxels
 void gen_voxel_landscape();
@@ -1011,6 +1017,12 @@ bool any_cube_contains_pt_xy(vect_cube_t const &cubes, vector3d const &pos);
 bool line_int_cubes_xy(point const &p1, point const &p2, vect_cube_t const &cubes);
 bool remove_cube_if_contains_pt_xy(vect_cube_t &cubes, vector3d const &pos, unsigned start=0);
 
+// function prototypes - benchmark
+void run_benchmark();
+
+// function prototypes - job_system
+void shutdown_job_system();
+
 #include "inlines.h"
 
 
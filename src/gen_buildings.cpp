@@ -9,6 +9,7 @@
 #include "buildings.h"
 #include "mesh.h"
 #include "draw_utils.h" // for point_sprite_drawer_sized
+#include "job_system.h"
 
 using std::string;
 
@@ -1526,8 +1527,7 @@ public:
 			timer_t timer("Gen Building Zvals", !is_tile);
 			bool const do_flatten(using_tiled_terrain_hmap_tex());
 
-#pragma omp parallel for schedule(static,1) if (!is_tile)
-			for (int i = 0; i < (int)buildings.size(); ++i) {
+			parallel_for(0, buildings.size(), [&](int i) {
 				building_t &b(buildings[i]);
 
 				if (do_flatten) {
@@ -1557,15 +1557,14 @@ public:
 						assert(b.parts.back().dz() > 0.0);
 					}
 				}
-			} // for i
+			}, !is_tile); // for i
 			if (do_flatten) { // use conservative zmin for grid
 				for (auto i = grid.begin(); i != grid.end(); ++i) {i->bcube.d[2][0] = def_water_level;}
 			}
 		} // if flatten_mesh
 		{ // open a scope
 			timer_t timer2("Gen Building Geometry", !is_tile);
-#pragma omp parallel for schedule(static,1) if (!is_tile)
-			for (int i = 0; i < (int)buildings.size(); ++i) {buildings[i].gen_geometry(i, 1337*i+rseed);}
+			parallel_for(0, buildings.size(), [&](int i) {buildings[i].gen_geometry(i, 1337*i+rseed);}, !is_tile);
 		} // close the scope
 		for (auto g = grid.begin(); g != grid.end(); ++g) { // update grid bcube zvals to include building roofs
 			for (auto b = g->bc_ixs.begin(); b != g->bc_ixs.end(); ++b) {
@@ -2172,13 +2171,13 @@ public:
 		return -1;
 	}
 
-	bool check_ped_coll(point const &pos, float radius, unsigned plot_id, unsigned &building_id) const { // Note: not thread safe due to static points
+	bool check_ped_coll(point const &pos, float radius, unsigned plot_id, unsigned &building_id) const { // Note: thread safe; called from parallel ped updates
 		if (empty()) return 0;
 		assert(plot_id < bix_by_plot.size());
 		vector<unsigned> const &bixes(bix_by_plot[plot_id]); // should be populated in gen()
 		if (bixes.empty()) return 0;
 		cube_t bcube; bcube.set_from_sphere(pos, radius);
-		static vector<point> points; // reused across calls
+		static thread_local vector<point> points; // reused across calls
 
 		// Note: assumes buildings are separated so that only one ped collision can occur
 		for (auto b = bixes.begin(); b != bixes.end(); ++b) {
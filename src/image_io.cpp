@@ -100,6 +100,7 @@ void texture_t::load(int index, bool allow_diff_width_height, bool allow_two_byt
 				exit(1);
 			}
 		}
+		if (load_from_cache(index, allow_diff_width_height, allow_two_byte_grayscale, ignore_word_alignment)) return;
 		unsigned const want_alpha_channel(ncolors == 4), want_luminance(ncolors == 1);
 
 		switch (format) {
@@ -135,6 +136,7 @@ void texture_t::load(int index, bool allow_diff_width_height, bool allow_two_byt
 				for (unsigned i = 0; i < npixels; ++i) {data[4*i+3] = (255 - data[4*i+3]);}
 			}
 		}
+		write_to_cache();
 	} // end non-generated texture case
 #if 0
 	if (name.size() > 4 && name.front() != '@') {
@@ -0,0 +1,230 @@
+// 3D World - Work Stealing Job System
+// by Frank Gennari
+// 10/17/26
+#include "job_system.h"
+#include <deque>
+#include <chrono>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using std::cout;
+using std::endl;
+
+unsigned num_job_threads(0); // 0 = number of cores - 1
+
+thread_local int job_worker_ix(-1); // -1 = not a worker thread
+
+
+struct job_system_t::job_queue_t {
+	std::mutex mutex;
+	std::deque<job_handle_t> jobs[NUM_JOB_PRI];
+};
+
+
+job_system_t::job_system_t(unsigned num_workers) : num_queued(0), num_bg_running(0), num_waiting(0), version(0), stop(0) {
+
+	num_workers    = std::max(num_workers, 1U); // need at least one worker for background jobs
+	max_bg_running = std::max(num_workers, 2U) - 1; // leave one worker free for frame-critical jobs
+	for (unsigned i = 0; i <= num_workers; ++i) {queues.emplace_back(new job_queue_t);} // last queue is for non-worker threads
+	for (unsigned i = 0; i < num_workers; ++i) {workers.emplace_back(&job_system_t::worker_loop, this, i);}
+}
+
+job_system_t::~job_system_t() {shutdown();}
+
+void job_system_t::shutdown() {
+
+	if (workers.empty()) return; // already shut down
+	bool bg_reserved(0);
+
+	while (num_queued > 0) { // help finish any queued jobs
+		unsigned const prev_version(version);
+		job_handle_t const job(pop_job(get_queue_ix(), JOB_PRI_BACKGROUND, 0, bg_reserved));
+		if (job) {run_job(job, bg_reserved);} else {wait_for_work(prev_version);}
+	}
+	stop = 1;
+	notify(1);
+	for (auto i = workers.begin(); i != workers.end(); ++i) {i->join();}
+	workers.clear();
+	job_queue_t &ext_q(*queues.back());
+
+	for (unsigned i = 0; i+1 < queues.size(); ++i) { // move any jobs enqueued by workers after the final drain to the non-worker queue
+		for (unsigned p = 0; p < NUM_JOB_PRI; ++p) {ext_q.jobs[p].insert(ext_q.jobs[p].end(), queues[i]->jobs[p].begin(), queues[i]->jobs[p].end());}
+	}
+	queues.erase(queues.begin(), queues.end()-1); // only the non-worker queue remains
+}
+
+unsigned job_system_t::get_queue_ix() const {
+	return ((job_worker_ix >= 0 && job_worker_ix < (int)workers.size()) ? unsigned(job_worker_ix) : unsigned(queues.size() - 1));
+}
+
+void job_system_t::notify(bool all) {
+	{std::lock_guard<std::mutex> lock(wait_mutex);} // sync with wait_for_work() so that the wakeup isn't lost
+	if (all) {wait_cv.notify_all();} else {wait_cv.notify_one();}
+}
+
+void job_system_t::enqueue(job_handle_t const &job) {
+
+	assert(job && !job->done);
+	job_queue_t &q(*queues[get_queue_ix()]);
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.jobs[job->pri].push_back(job);
+	}
+	++num_queued;
+	++version;
+	notify(0);
+}
+
+// owner pops from the back of its own queue (LIFO, cache warm); thieves take from the front of other queues (FIFO, oldest/largest)
+job_handle_t job_system_t::pop_job(unsigned qix, job_priority_t max_pri, bool limit_bg, bool &bg_reserved) {
+
+	bg_reserved = 0;
+	if (num_queued == 0) return job_handle_t();
+	unsigned const nq(queues.size());
+
+	for (unsigned p = 0; p <= (unsigned)max_pri; ++p) {
+		if (p == JOB_PRI_BACKGROUND && limit_bg) { // reserve a background slot
+			if (num_bg_running.fetch_add(1) >= max_bg_running) {--num_bg_running; continue;}
+			bg_reserved = 1;
+		}
+		for (unsigned n = 0; n < nq; ++n) {
+			unsigned const ix((qix + n) % nq);
+			job_queue_t &q(*queues[ix]);
+			std::lock_guard<std::mutex> lock(q.mutex);
+			std::deque<job_handle_t> &jobs(q.jobs[p]);
+			if (jobs.empty()) continue;
+			job_handle_t job;
+			if (n == 0) {job = jobs.back(); jobs.pop_back();} // own queue
+			else {job = jobs.front(); jobs.pop_front();} // steal
+			--num_queued;
+			return job;
+		}
+		if (bg_reserved) {--num_bg_running; bg_reserved = 0;}
+	} // for p
+	return job_handle_t();
+}
+
+void job_system_t::run_job(job_handle_t const &job, bool bg_reserved) {
+
+	job->func();
+	job->func = nullptr; // free any captured data
+	std::vector<job_handle_t> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->dep_mutex);
+		job->done = 1;
+		dependents.swap(job->dependents);
+	}
+	if (bg_reserved) {--num_bg_running;}
+	for (auto i = dependents.begin(); i != dependents.end(); ++i) {
+		if (--(*i)->num_deps == 0) {enqueue(*i);}
+	}
+	++version;
+	if (num_waiting > 0 || bg_reserved) {notify(1);} // wake any threads waiting on this job, and workers blocked on the background limit
+}
+
+void job_system_t::wait_for_work(unsigned prev_version, job_t const *job) {
+	std::unique_lock<std::mutex> lock(wait_mutex);
+	wait_cv.wait_for(lock, std::chrono::milliseconds(10), [&]() {return (stop || version != prev_version || (job && job->done));});
+}
+
+void job_system_t::worker_loop(unsigned wix) {
+
+	job_worker_ix = wix;
+	bool bg_reserved(0);
+#ifdef _OPENMP
+	omp_set_num_threads(1); // OpenMP loops inside jobs run serially on this worker rather than nesting another thread team
+#endif
+
+	while (!stop) {
+		unsigned const prev_version(version);
+		job_handle_t const job(pop_job(wix, JOB_PRI_BACKGROUND, 1, bg_reserved));
+		if (job) {run_job(job, bg_reserved);} else {wait_for_work(prev_version);}
+	}
+}
+
+void job_system_t::add_dependency(job_handle_t const &job, job_handle_t const &prereq) {
+
+	assert(job && prereq && job != prereq);
+	assert(job->num_deps > 0); // not yet submitted
+	std::lock_guard<std::mutex> lock(prereq->dep_mutex);
+	if (prereq->done) return; // already satisfied
+	++job->num_deps;
+	prereq->dependents.push_back(job);
+	job->prereqs.push_back(prereq);
+}
+
+void job_system_t::submit(job_handle_t const &job) {
+	assert(job && job->num_deps > 0);
+	if (--job->num_deps == 0) {enqueue(job);} // else enqueued when the last prerequisite finishes
+}
+
+job_handle_t job_system_t::run_after(std::function<void()> const &func, job_handle_t const &prereq, job_priority_t pri) {
+
+	job_handle_t const job(create_job(func, pri));
+	if (prereq) {add_dependency(job, prereq);}
+	submit(job);
+	return job;
+}
+
+// returns the lowest priority of job and its unfinished prerequisites, since job can't run until they do
+job_priority_t job_system_t::get_wait_pri(job_t const &job) {
+
+	job_priority_t pri(job.pri);
+
+	for (auto i = job.prereqs.begin(); i != job.prereqs.end(); ++i) {
+		job_handle_t const prereq(i->lock());
+		if (prereq && !prereq->done) {pri = std::max(pri, get_wait_pri(*prereq));}
+	}
+	return pri;
+}
+
+void job_system_t::wait(job_handle_t const &job) {
+
+	if (!job) return;
+	bool bg_reserved(0);
+
+	while (!job->done) {
+		// only help with jobs at least as important as the one we're waiting on so that a frame-critical wait doesn't pick up a long lighting job;
+		// lower priority prerequisites of that job must also be run to avoid priority inversion; once the workers are gone, the waiting thread must run everything
+		job_priority_t const max_pri(workers.empty() ? JOB_PRI_BACKGROUND : get_wait_pri(*job));
+		unsigned const prev_version(version);
+		job_handle_t const job2(pop_job(get_queue_ix(), max_pri, 0, bg_reserved)); // the waiting thread is already counted, so no background limit
+		if (job2) {run_job(job2, bg_reserved); continue;}
+		++num_waiting;
+		wait_for_work(prev_version, job.get());
+		--num_waiting;
+	}
+}
+
+
+std::atomic<job_system_t *> job_system(nullptr); // never deleted, since it may be used from global destructors
+
+job_system_t *create_job_system() {
+
+	unsigned const num_cores(std::max(std::thread::hardware_concurrency(), 1U));
+	job_system_t *const js(new job_system_t(num_job_threads ? num_job_threads : (num_cores - 1)));
+	cout << "Job system using " << js->get_num_threads() << " threads" << endl;
+	job_system = js;
+	return js;
+}
+
+job_system_t &get_job_system() {
+	static job_system_t *const js(create_job_system()); // thread safe init
+	return *js;
+}
+
+void shutdown_job_system() {
+	if (job_system) {job_system.load()->shutdown();}
+}
+
+void limit_omp_threads() {
+#ifdef _OPENMP
+	static int const num_procs(omp_get_num_procs());
+	job_system_t *const js(job_system);
+	unsigned const num_bg(js ? js->get_num_bg_running() : 0); // workers busy with long background jobs
+	omp_set_num_threads(std::max(1, num_procs - int(num_bg)));
+#endif
+}
+
@@ -0,0 +1,114 @@
+// 3D World - Work Stealing Job System
+// by Frank Gennari
+// 10/17/26
+#ifndef _JOB_SYSTEM_H_
+#define _JOB_SYSTEM_H_
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cassert>
+
+// high = needed this frame, I/O = file/video writes (not limited by max_bg_running, so they don't queue behind lighting), background = lighting, etc.
+enum job_priority_t {JOB_PRI_HIGH=0, JOB_PRI_NORMAL, JOB_PRI_IO, JOB_PRI_BACKGROUND, NUM_JOB_PRI};
+
+
+struct job_t {
+	std::function<void()> func;
+	job_priority_t pri;
+	std::atomic<unsigned> num_deps; // unfinished prerequisites + 1 for the submit() hold
+	std::atomic<bool> done;
+	std::mutex dep_mutex; // guards dependents and done transition
+	std::vector<std::shared_ptr<job_t>> dependents;
+	std::vector<std::weak_ptr<job_t>> prereqs; // set before submit() and not modified after; used by wait() to help run them
+
+	job_t(std::function<void()> const &func_, job_priority_t pri_) : func(func_), pri(pri_), num_deps(1), done(0) {}
+};
+typedef std::shared_ptr<job_t> job_handle_t;
+
+
+// Note: jobs may wait on other jobs; a waiting thread runs queued jobs of equal or higher priority rather than blocking
+class job_system_t {
+	struct job_queue_t;
+	std::vector<std::unique_ptr<job_queue_t>> queues; // one per worker + one shared queue for non-worker threads
+	std::vector<std::thread> workers;
+	std::atomic<unsigned> num_queued, num_bg_running, num_waiting, version;
+	unsigned max_bg_running;
+	std::atomic<bool> stop;
+	std::mutex wait_mutex;
+	std::condition_variable wait_cv;
+
+	void enqueue(job_handle_t const &job);
+	job_handle_t pop_job(unsigned qix, job_priority_t max_pri, bool limit_bg, bool &bg_reserved);
+	void run_job(job_handle_t const &job, bool bg_reserved);
+	void notify(bool all);
+	void worker_loop(unsigned wix);
+	void wait_for_work(unsigned prev_version, job_t const *job=nullptr);
+	unsigned get_queue_ix() const;
+	static job_priority_t get_wait_pri(job_t const &job);
+public:
+	job_system_t(unsigned num_workers);
+	~job_system_t();
+	void shutdown();
+	unsigned get_num_threads() const {return unsigned(workers.size()) + 1;} // workers + calling thread
+	unsigned get_num_bg_running() const {return num_bg_running;}
+	job_handle_t create_job(std::function<void()> const &func, job_priority_t pri=JOB_PRI_NORMAL) const {return std::make_shared<job_t>(func, pri);}
+	void add_dependency(job_handle_t const &job, job_handle_t const &prereq); // must be called before submit(job)
+	void submit(job_handle_t const &job);
+	job_handle_t run(std::function<void()> const &func, job_priority_t pri=JOB_PRI_NORMAL) {job_handle_t const job(create_job(func, pri)); submit(job); return job;}
+	job_handle_t run_after(std::function<void()> const &func, job_handle_t const &prereq, job_priority_t pri=JOB_PRI_NORMAL);
+	static bool is_done(job_handle_t const &job) {return (!job || job->done);}
+	void wait(job_handle_t const &job);
+	void wait_all(std::vector<job_handle_t> const &jobs) {for (auto i = jobs.begin(); i != jobs.end(); ++i) {wait(*i);}}
+
+	// runs func(i) for i in [begin, end) and returns when all iterations are complete; enable=0 runs serially, similar to OpenMP's if clause
+	template<typename F> void parallel_for(int begin, int end, F const &func, bool enable=1, unsigned grain=0, job_priority_t pri=JOB_PRI_HIGH) {
+		if (end <= begin) return;
+		unsigned const num(end - begin);
+		if (grain == 0) {grain = std::max(1U, num/(4*get_num_threads()));} // ~4 chunks per thread for load balancing
+		if (!enable || workers.empty() || num <= grain) {for (int i = begin; i < end; ++i) {func(i);} return;}
+		std::vector<job_handle_t> jobs;
+
+		for (int i = begin + grain; i < end; i += grain) { // first chunk is run by the calling thread
+			int const cend(std::min(end, int(i + grain)));
+			jobs.push_back(run([&func, i, cend]() {for (int j = i; j < cend; ++j) {func(j);}}, pri));
+		}
+		for (int i = begin; i < begin + (int)grain; ++i) {func(i);}
+		wait_all(jobs);
+	}
+	// returns reduce(...reduce(reduce(init, map(begin)), map(begin+1))...); chunk results are combined in order, so the result is deterministic
+	template<typename T, typename M, typename R> T parallel_reduce(int begin, int end, T const &init, M const &map, R const &reduce, bool enable=1, unsigned grain=0) {
+		if (end <= begin) return init;
+		unsigned const num(end - begin);
+		if (grain == 0) {grain = std::max(1U, num/(4*get_num_threads()));}
+		unsigned const num_chunks((num + grain - 1)/grain);
+		struct partial_t {T val; partial_t(T const &v) : val(v) {}}; // wrapped so that T=bool doesn't use the packed (racy) vector<bool>
+		std::vector<partial_t> partial(num_chunks, partial_t(init));
+		parallel_for(0, num_chunks, [&](int c) {
+			int const cbegin(begin + c*grain), cend(std::min(end, int(cbegin + grain)));
+			T val(map(cbegin));
+			for (int j = cbegin+1; j < cend; ++j) {val = reduce(val, map(j));}
+			partial[c].val = val;
+		}, enable, 1);
+		T ret(init);
+		for (auto i = partial.begin(); i != partial.end(); ++i) {ret = reduce(ret, i->val);}
+		return ret;
+	}
+};
+
+job_system_t &get_job_system(); // created on first use with num_job_threads workers
+void shutdown_job_system(); // finishes all queued jobs and joins the workers; later jobs run on the waiting thread
+void limit_omp_threads(); // call on the main thread once per frame so that OpenMP loops don't oversubscribe cores used by background jobs
+
+template<typename F> void parallel_for(int begin, int end, F const &func, bool enable=1, unsigned grain=0) {get_job_system().parallel_for(begin, end, func, enable, grain);}
+
+template<typename T, typename M, typename R> T parallel_reduce(int begin, int end, T const &init, M const &map, R const &reduce, bool enable=1, unsigned grain=0) {
+	return get_job_system().parallel_reduce(begin, end, init, map, reduce, enable, grain);
+}
+
+#endif // _JOB_SYSTEM_H_
@@ -40,6 +40,7 @@ indir_dlight_group_manager_t indir_dlight_group_manager;
 
 
 extern int animate2, display_mode, frame_counter, camera_coll_id, scrolling, read_light_files[], write_light_files[];
+extern bool lmap_brick_compress;
 extern unsigned create_voxel_landscape;
 extern float czmin, czmax, fticks, zbottom, ztop, XY_SCENE_SIZE, FAR_CLIP, CAMERA_RADIUS, indir_light_exp, light_int_scale[], force_czmin, force_czmax;
 extern colorRGB cur_ambient, cur_diffuse;
@@ -203,74 +204,331 @@ void lmcell::set_outside_colors() {
 
 
 inline bool is_inside_lmap(int x, int y, int z) {return (z >= 0 && z < MESH_SIZE[2] && !point_outside_mesh(x, y));}
-bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && vlmap[y][x] != NULL);}
+bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && is_column_allocated(x, y));}
 
 // Note: only intended to work in ground mode where sizes are MESH_X_SIZE and MESH_Y_SIZE
-lmcell *lmap_manager_t::get_lmcell_round_down(point const &p) { // round down
+lmcell *lmap_manager_t::get_lmcell_round_down(point const &p) { // round down; used for ray tracing, so cells outside the rebake bounds are excluded
 	int const x(get_xpos_round_down(p.x)), y(get_ypos_round_down(p.y)), z(get_zpos(p.z));
-	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
+	if (!is_valid_cell(x, y, z) || (has_rebake_bounds() && !in_rebake_bounds(x, y, z))) return NULL;
+	return &get_lmcell(x, y, z);
 }
 lmcell *lmap_manager_t::get_lmcell(point const &p) { // round to center
 	int const x(get_xpos(p.x)), y(get_ypos(p.y)), z(get_zpos(p.z));
-	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
+	return (is_valid_cell(x, y, z) ? &get_lmcell(x, y, z) : NULL);
+}
+
+
+// lmcell_packed
+
+void encode_shared_exp_block(float const v[4], unsigned &w0, unsigned &w1) {
+
+	float const vmax(max(max(fabs(v[0]), fabs(v[1])), max(fabs(v[2]), fabs(v[3]))));
+	unsigned long long bits(0);
+
+	if (vmax > 0.0f) { // else exponent=0 => all zeros
+		int exp(0);
+		frexp(vmax, &exp); // vmax = [0.5, 1.0) * 2^exp
+		exp = max(-127, min(127, exp));
+		float const scale(ldexp(1.0f, 13-exp));
+		bits = (unsigned long long)(exp + 128);
+
+		for (unsigned i = 0; i < 4; ++i) {
+			long const m(max(-8191L, min(8191L, lrint(v[i]*scale))));
+			bits |= ((unsigned long long)(m & 0x3FFF) << (8 + 14*i));
+		}
+	}
+	w0 = unsigned(bits);
+	w1 = unsigned(bits >> 32);
+}
+
+void decode_shared_exp_block(unsigned w0, unsigned w1, float v[4]) {
+
+	unsigned long long const bits((unsigned long long)w0 | ((unsigned long long)w1 << 32));
+	unsigned const biased_exp(bits & 0xFF);
+	if (biased_exp == 0) {v[0] = v[1] = v[2] = v[3] = 0.0f; return;}
+	float const scale(ldexp(1.0f, int(biased_exp) - 128 - 13));
+
+	for (unsigned i = 0; i < 4; ++i) {
+		int m(int((bits >> (8 + 14*i)) & 0x3FFF));
+		if (m & 0x2000) {m -= 0x4000;} // sign extend
+		v[i] = m*scale;
+	}
+}
+
+// sc, gc, and lc are each followed by their weight in memory, so each group of 4 floats is contiguous
+void lmcell_packed::encode(lmcell const &lmc) {
+	encode_shared_exp_block(lmc.sc, blocks[0], blocks[1]);
+	encode_shared_exp_block(lmc.gc, blocks[2], blocks[3]);
+	encode_shared_exp_block(lmc.lc, blocks[4], blocks[5]);
+	UNROLL_3X(pflow[i_] = lmc.pflow[i_];)
+}
+void lmcell_packed::decode(lmcell &lmc) const {
+	decode_shared_exp_block(blocks[0], blocks[1], lmc.sc);
+	decode_shared_exp_block(blocks[2], blocks[3], lmc.gc);
+	decode_shared_exp_block(blocks[4], blocks[5], lmc.lc);
+	UNROLL_3X(lmc.pflow[i_] = pflow[i_];)
+}
+void lmcell_packed::update(lmcell const &lmc) { // re-encodes only the blocks that changed since decode(), so unchanged values aren't quantized again
+
+	float const *const src[3] = {lmc.sc, lmc.gc, lmc.lc};
+
+	for (unsigned b = 0; b < 3; ++b) {
+		float v[4];
+		decode_shared_exp_block(blocks[2*b], blocks[2*b+1], v);
+		if (memcmp(v, src[b], sizeof(v)) != 0) {encode_shared_exp_block(src[b], blocks[2*b], blocks[2*b+1]);}
+	}
+	UNROLL_3X(pflow[i_] = lmc.pflow[i_];)
+}
+
+
+// lmap_brick_t
+
+void lmap_brick_t::copy_from(lmap_brick_t const &b) {
+
+	lmcell const *const src_cells(b.full.load());
+	lmcell *cells(full.load());
+
+	if (src_cells) {
+		if (!cells) {cells = new lmcell[LMAP_BRICK_CELLS]; full = cells;}
+		std::copy(src_cells, src_cells+LMAP_BRICK_CELLS, cells);
+	}
+	else if (cells) {
+		delete [] cells;
+		full = nullptr;
+	}
+	state   = b.state;
+	uniform = b.uniform;
+	packed  = b.packed;
+}
+
+void lmap_brick_t::expand_to(lmcell *cells) const {
+
+	if (state == PACKED) {
+		assert(packed.size() == LMAP_BRICK_CELLS);
+		for (unsigned i = 0; i < LMAP_BRICK_CELLS; ++i) {packed[i].decode(cells[i]);}
+	}
+	else {
+		for (unsigned i = 0; i < LMAP_BRICK_CELLS; ++i) {cells[i] = uniform;}
+	}
+}
+
+void lmap_brick_t::compact() { // convert expanded cells to a single uniform cell, or to packed cells if they differ
+
+	lmcell *const cells(full.load());
+	if (cells == nullptr) return; // already compact
+
+	for (unsigned i = 0; i < LMAP_BRICK_CELLS; ++i) {
+		if (cells[i].smoke != 0.0) return; // smoke is updated every frame, so leave the brick expanded
+	}
+	bool is_uniform(1);
+
+	for (unsigned i = 1; i < LMAP_BRICK_CELLS && is_uniform; ++i) {is_uniform = cells[i].same_as(cells[0]);}
+
+	if (is_uniform) {
+		state   = UNIFORM;
+		uniform = cells[0];
+		packed.clear();
+		packed.shrink_to_fit();
+	}
+	else if (packed.size() == LMAP_BRICK_CELLS) { // expanded from this packed data; keep the original encoding of unchanged values
+		state = PACKED;
+		for (unsigned i = 0; i < LMAP_BRICK_CELLS; ++i) {packed[i].update(cells[i]);}
+	}
+	else {
+		state = PACKED;
+		packed.resize(LMAP_BRICK_CELLS);
+		for (unsigned i = 0; i < LMAP_BRICK_CELLS; ++i) {packed[i].encode(cells[i]);}
+	}
+	full = nullptr;
+	delete [] cells;
+}
+
+lmcell lmap_brick_t::get_cell(unsigned cix) const {
+
+	assert(cix < LMAP_BRICK_CELLS);
+	lmcell const *const cells(full.load(std::memory_order_acquire));
+	if (cells != nullptr) return cells[cix];
+	if (state != PACKED ) return uniform; // uniform or empty
+	lmcell lmc;
+	packed[cix].decode(lmc);
+	return lmc;
+}
+
+
+// lmap_manager_t
+
+// Note: may be called concurrently by ray tracing threads; packed data is left in place so that readers of other cells in this brick
+// that loaded full before it was set are unaffected, and so that compact() can reuse it for values that weren't modified
+lmcell *lmap_manager_t::expand_brick(unsigned bix) {
+
+	lmap_brick_t &brick(bricks[bix]);
+	std::lock_guard<std::mutex> lock(expand_mutex);
+	lmcell *cells(brick.full.load(std::memory_order_acquire));
+	if (cells != nullptr) return cells; // another thread expanded it first
+	cells = new lmcell[LMAP_BRICK_CELLS];
+	brick.expand_to(cells);
+	brick.full.store(cells, std::memory_order_release);
+	if (brick.state == lmap_brick_t::PACKED) {expanded_bricks.push_back(bix);}
+	return cells;
+}
+
+void lmap_manager_t::free_expanded_packed() {
+
+	for (auto i = expanded_bricks.begin(); i != expanded_bricks.end(); ++i) {
+		lmap_brick_t &brick(bricks[*i]);
+		if (brick.full.load() == nullptr) continue; // already compacted
+		brick.packed.clear(); // full takes precedence, so the packed state with no packed data is never read
+		brick.packed.shrink_to_fit();
+	}
+	expanded_bricks.clear();
+}
+
+void lmap_manager_t::compact_brick_rows(unsigned by_start, unsigned by_end) {
+
+	if (!bricks) return;
+	if (!lmap_brick_compress) {free_expanded_packed(); return;}
+	assert(by_start <= by_end && by_end <= bsize[1]);
+	int const nrows(by_end - by_start), nbricks(nrows*bsize[0]*bsize[2]);
+
+	#pragma omp parallel for schedule(dynamic,16)
+	for (int i = 0; i < nbricks; ++i) {
+		unsigned const bx(i % bsize[0]), by(by_start + (i/bsize[0])%nrows), bz(i/(bsize[0]*nrows));
+		bricks[(bz*bsize[1] + by)*bsize[0] + bx].compact();
+	}
+	auto is_compact([this](unsigned bix) {return (bricks[bix].full.load() == nullptr);}); // bricks left expanded keep their packed data
+	expanded_bricks.erase(std::remove_if(expanded_bricks.begin(), expanded_bricks.end(), is_compact), expanded_bricks.end());
+}
+
+size_t lmap_manager_t::get_mem_usage() const {
+
+	if (!bricks) return 0;
+	unsigned const nb(num_bricks());
+	size_t mem(nb*sizeof(lmap_brick_t) + col_alloc.capacity());
+
+	for (unsigned i = 0; i < nb; ++i) {
+		mem += bricks[i].packed.capacity()*sizeof(lmcell_packed);
+		if (bricks[i].full.load()) {mem += LMAP_BRICK_CELLS*sizeof(lmcell);}
+	}
+	return mem;
+}
+
+void lmap_manager_t::alloc_bricks(lmcell const &init_lmcell) {
+
+	bsize[0] = (lm_xsize + LMAP_BRICK_MASK) >> LMAP_BRICK_BITS;
+	bsize[1] = (lm_ysize + LMAP_BRICK_MASK) >> LMAP_BRICK_BITS;
+	bsize[2] = (lm_zsize + LMAP_BRICK_MASK) >> LMAP_BRICK_BITS;
+	bricks.reset(new lmap_brick_t[num_bricks()]);
+	expanded_bricks.clear();
+
+	// bricks with at least one allocated column start out uniform; bricks with no allocated columns stay empty
+	for (unsigned y = 0; y < lm_ysize; ++y) {
+		for (unsigned x = 0; x < lm_xsize; ++x) {
+			if (!is_column_allocated(x, y)) continue;
+
+			for (unsigned bz = 0; bz < bsize[2]; ++bz) {
+				lmap_brick_t &brick(bricks[get_brick_ix(x, y, (bz << LMAP_BRICK_BITS))]);
+				if (brick.state != lmap_brick_t::EMPTY) continue;
+				brick.state   = lmap_brick_t::UNIFORM;
+				brick.uniform = init_lmcell;
+			}
+		}
+	}
 }
 
 template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell) {
 
 	lm_xsize = xsize; lm_ysize = ysize; lm_zsize = zsize;
-	if (vlmap == NULL) {matrix_gen_2d(vlmap, lm_xsize, lm_ysize);} // create column headers once
-	vldata_alloc.resize(max(nbins, 1U), init_lmcell); // make size at least 1, even if there are no bins, so we can test on emptiness
+	num_cells = max(nbins, 1U); // make size at least 1, even if there are no bins, so we can test on emptiness
+	col_alloc.resize(lm_xsize*lm_ysize);
 	unsigned cur_v(0);
 
 	// initialize light volume
 	for (unsigned i = 0; i < lm_ysize; ++i) {
 		for (unsigned j = 0; j < lm_xsize; ++j) {
-			if (nonempty_bins != nullptr && !nonempty_bins[i][j]) { // nonempty_bins is used for sparse mode
-				vlmap[i][j] = NULL;
-				continue;
-			}
-			assert(cur_v + lm_zsize <= vldata_alloc.size());
-			vlmap[i][j] = &vldata_alloc[cur_v];
-			cur_v      += lm_zsize;
+			bool const nonempty(nonempty_bins == nullptr || nonempty_bins[i][j]); // nonempty_bins is used for sparse mode
+			col_alloc[i*lm_xsize + j] = nonempty;
+			if (nonempty) {cur_v += lm_zsize;}
 		}
 	}
 	assert(cur_v == nbins);
+	alloc_bricks(init_lmcell);
 }
 
 template void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, unsigned char **nonempty_bins, lmcell const &init_lmcell); // explicit instantiation
 
 
-void lmap_manager_t::init_from(lmap_manager_t const &src) {
+void lmap_manager_t::set_rebake_bounds(cube_t const &bcube) {
+
+	assert(!bcube.is_all_zeros());
+	rebake_bcube = bcube;
+	rebake_bnds[0][0] = max(get_xpos_round_down(bcube.x1()), 0); rebake_bnds[0][1] = min(get_xpos_round_down(bcube.x2()), int(lm_xsize)-1);
+	rebake_bnds[1][0] = max(get_ypos_round_down(bcube.y1()), 0); rebake_bnds[1][1] = min(get_ypos_round_down(bcube.y2()), int(lm_ysize)-1);
+	rebake_bnds[2][0] = max(get_zpos(bcube.z1()), 0);            rebake_bnds[2][1] = min(get_zpos(bcube.z2()), int(lm_zsize)-1);
+	// expand the cube to the bounds of the cells it overlaps so that rays clipping only part of a cell still reach it
+	rebake_bcube.expand_by(vector3d(DX_VAL, DY_VAL, DZ_VAL2));
+}
+
+bool lmap_manager_t::ray_can_reach_rebake_bounds(point const &p1, point const &p2) const {
+	return (!has_rebake_bounds() || check_line_clip(p1, p2, rebake_bcube.d));
+}
+
+
+void lmap_manager_t::init_from(lmap_manager_t const &src, cube_t const *const rebake_bc) { // if rebake_bc is set, only bricks overlapping it are copied
 
-	//assert(!is_allocated());
-	//clear_cells(); // probably unnecessary
-	alloc(src.vldata_alloc.size(), src.lm_xsize, src.lm_ysize, src.lm_zsize, src.vlmap, lmcell());
-	copy_data(src);
+	rebake_bcube.set_to_zeros();
+	lm_xsize  = src.lm_xsize; lm_ysize = src.lm_ysize; lm_zsize = src.lm_zsize;
+	num_cells = src.num_cells;
+	col_alloc = src.col_alloc;
+	alloc_bricks(lmcell());
+	if (rebake_bc == nullptr) {copy_data(src); return;}
+	set_rebake_bounds(*rebake_bc); // cells outside the bounds are never read or written
+	int bb[3][2];
+	UNROLL_3X(bb[i_][0] = (rebake_bnds[i_][0] >> LMAP_BRICK_BITS); bb[i_][1] = (rebake_bnds[i_][1] >> LMAP_BRICK_BITS);)
+
+	for (int bz = bb[2][0]; bz <= bb[2][1]; ++bz) {
+		for (int by = bb[1][0]; by <= bb[1][1]; ++by) {
+			for (int bx = bb[0][0]; bx <= bb[0][1]; ++bx) {
+				unsigned const bix((bz*bsize[1] + by)*bsize[0] + bx);
+				bricks[bix].copy_from(src.bricks[bix]);
+			}
+		}
+	}
 }
 
 
 // *this = blend_weight*dest + (1.0 - blend_weight)*(*this)
 void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 
-	assert(vlmap && src.vlmap);
+	assert(bricks && src.bricks);
 	assert(src.lm_xsize == lm_xsize && src.lm_ysize == lm_ysize && src.lm_zsize == lm_zsize);
-	assert(src.vldata_alloc.size() == vldata_alloc.size());
+	assert(src.num_cells == num_cells);
 	assert(blend_weight >= 0.0);
 	if (blend_weight == 0.0) return; // keep existing dest
 
-	if (blend_weight == 1.0) {
-		vldata_alloc = src.vldata_alloc; // deep copy all lmcell data
-		return;
-	}
-	for (unsigned i = 0; i < lm_ysize; ++i) { // openmp?
-		for (unsigned j = 0; j < lm_xsize; ++j) {
-			if (!vlmap[i][j]) {assert(!src.vlmap[i][j]); continue;}
-			assert(src.vlmap[i][j]);
-			
-			for (unsigned z = 0; z < lm_zsize; ++z) {
-				vlmap[i][j][z].mix_lighting_with(src.vlmap[i][j][z], blend_weight);
+	if (src.has_rebake_bounds()) { // only the cells in the rebake bounds were updated; copy lighting but not smoke, which may have changed since
+		int const (&rb)[3][2](src.rebake_bnds);
+
+		for (int y = rb[1][0]; y <= rb[1][1]; ++y) {
+			for (int x = rb[0][0]; x <= rb[0][1]; ++x) {
+				if (!is_column_allocated(x, y)) continue;
+				for (int z = rb[2][0]; z <= rb[2][1]; ++z) {get_lmcell(x, y, z).mix_lighting_with(src.get_lmcell_val(x, y, z), blend_weight);}
 			}
 		}
+		return;
+	}
+	int const nb(num_bricks());
+
+	if (blend_weight == 1.0) { // deep copy all brick data
+		#pragma omp parallel for schedule(dynamic,16)
+		for (int i = 0; i < nb; ++i) {bricks[i].copy_from(src.bricks[i]);}
+		return;
+	}
+	#pragma omp parallel for schedule(dynamic,16)
+	for (int i = 0; i < nb; ++i) {
+		lmap_brick_t const &sb(src.bricks[i]);
+		if (bricks[i].state == lmap_brick_t::EMPTY) {assert(sb.state == lmap_brick_t::EMPTY); continue;}
+		lmcell *const cells(expand_brick(i));
+		for (unsigned c = 0; c < LMAP_BRICK_CELLS; ++c) {cells[c].mix_lighting_with(sb.get_cell(c), blend_weight);}
 	}
 }
 
@@ -531,8 +789,8 @@ void clear_lightmap() {
 void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, float zstep) {
 
 	assert(zstep > 0.0);
-	lmcell *vldata(lmap_manager.get_column(j, i));
-	if (vldata == NULL) return;
+	lmcell_column_t const vldata(lmap_manager.get_column(j, i));
+	if (!vldata) return;
 	float const bbz[2][2] = {{get_xval(j), get_xval(j+1)}, {get_yval(i), get_yval(i+1)}}; // X x Y
 	vector<pair<float, unsigned> > cobj_z;
 
@@ -722,7 +980,7 @@ void build_lightmap(bool verbose) {
 
 			for (int y = bnds[1][0]; y <= bnds[1][1]; ++y) {
 				for (int x = bnds[0][0]; x <= bnds[0][1]; ++x) {
-					assert(lmap_manager.get_column(x, y));
+					assert(lmap_manager.is_column_allocated(x, y));
 					float const xv(get_xval(x)), yv(get_yval(y));
 
 					for (int z = bnds[2][0]; z <= bnds[2][1]; ++z) {
@@ -746,6 +1004,9 @@ void build_lightmap(bool verbose) {
 			} // for y
 		} // for i
 	}
+	lmap_manager.compact(); // flow and static light values were written to every cell
+	if (verbose) {cout << "Lightmap memory: " << lmap_manager.get_mem_usage() << " bytes for " << nbins << " cells" << endl;}
+
 	if (nbins > 0) {
 		if (verbose) PRINT_TIME(" Lighting Setup + XYZ Passes");
 		// Note: sky and global lighting use the same data structure for reading/writing, so they should have the same filename if used together
@@ -758,6 +1019,7 @@ void build_lightmap(bool verbose) {
 			}
 		}
 	}
+	lmap_manager.compact();
 	reset_cobj_counters();
 	matrix_delete_2d(need_lmcell);
 	if (!scrolling) {PRINT_TIME(" Lighting Total");}
@@ -1258,8 +1520,8 @@ void get_indir_light(colorRGBA &a, point const &p) { // used for particle clouds
 	if (!point_outside_mesh(x, y) && p.z > czmin0) { // inside the mesh range and above the lowest cobj
 		float val(get_voxel_terrain_ao_lighting_val(p));
 		
-		if (using_lightmap && p.z < czmax && lmap_manager.get_column(x, y) != NULL) { // not above all collision objects and not empty cell
-			lmap_manager.get_lmcell(x, y, z).get_final_color(cscale, 0.5, val);
+		if (using_lightmap && p.z < czmax && lmap_manager.is_column_allocated(x, y)) { // not above all collision objects and not empty cell
+			lmap_manager.get_lmcell_val(x, y, z).get_final_color(cscale, 0.5, val);
 		}
 		else if (val < 1.0) {
 			cscale *= val;
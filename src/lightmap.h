@@ -7,6 +7,8 @@
 
 #include "3DWorld.h"
 #include "trigger.h"
+#include <atomic>
+#include <mutex>
 
 extern int MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[3];
 
@@ -40,40 +42,141 @@ struct lmcell { // size = 52
 	void get_final_color(colorRGB &color, float max_indir, float indir_scale=1.0, float extra_ambient=0.0) const;
 	void set_outside_colors();
 	void mix_lighting_with(lmcell const &lmc, float val);
+	bool same_as(lmcell const &lmc) const {return (memcmp(sc, lmc.sc, 12*sizeof(float)) == 0 && pflow[0] == lmc.pflow[0] && pflow[1] == lmc.pflow[1] && pflow[2] == lmc.pflow[2]);}
+};
+
+
+struct lmcell_packed { // size = 28; {sc, sv}, {gc, gv}, {lc, smoke} as 64-bit blocks of an 8-bit shared exponent + 4x14-bit signed mantissas
+
+	unsigned blocks[6];
+	unsigned char pflow[3];
+
+	lmcell_packed() {}
+	explicit lmcell_packed(lmcell const &lmc) {encode(lmc);}
+	void encode(lmcell const &lmc);
+	void update(lmcell const &lmc);
+	void decode(lmcell &lmc) const;
+};
+
+
+unsigned const LMAP_BRICK_BITS  = 3;
+unsigned const LMAP_BRICK_SZ    = (1 << LMAP_BRICK_BITS); // 8x8x8 cells
+unsigned const LMAP_BRICK_MASK  = (LMAP_BRICK_SZ - 1);
+unsigned const LMAP_BRICK_CELLS = LMAP_BRICK_SZ*LMAP_BRICK_SZ*LMAP_BRICK_SZ;
+
+struct lmap_brick_t {
+
+	enum {EMPTY=0, UNIFORM, PACKED};
+	std::atomic<lmcell *> full; // uncompressed cells, created on first write; takes precedence over the other representations
+	unsigned char state;
+	lmcell uniform;
+	vector<lmcell_packed> packed;
+
+	lmap_brick_t() : full(nullptr), state(EMPTY) {}
+	~lmap_brick_t() {delete [] full.load();}
+	void copy_from(lmap_brick_t const &b);
+	void expand_to(lmcell *cells) const;
+	void compact();
+	lmcell get_cell(unsigned cix) const;
+};
+
+
+class lmap_manager_t;
+struct binary_file_reader;
+struct binary_file_writer;
+
+class lmcell_column_t { // one {x, y} column of the lightmap; cells aren't contiguous in z, so this replaces the old lmcell pointer
+	lmap_manager_t *lmgr;
+	int x, y;
+public:
+	lmcell_column_t(lmap_manager_t *lmgr_, int x_, int y_) : lmgr(lmgr_), x(x_), y(y_) {}
+	explicit operator bool() const {return (lmgr != nullptr);}
+	lmcell &operator[](int z) const;
+};
+
+class lmcell_const_column_t { // read-only version that doesn't expand compressed bricks
+	lmap_manager_t const *lmgr;
+	int x, y;
+public:
+	lmcell_const_column_t(lmap_manager_t const *lmgr_, int x_, int y_) : lmgr(lmgr_), x(x_), y(y_) {}
+	explicit operator bool() const {return (lmgr != nullptr);}
+	lmcell operator[](int z) const;
 };
 
 
 class lmap_manager_t {
 
-	vector<lmcell> vldata_alloc;
-	unsigned lm_xsize, lm_ysize, lm_zsize;
-	lmcell ***vlmap; // y, x, z (size is determined by {MESH_Y_SIZE, MESH_X_SIZE, MESH_Z_SIZE}
+	unsigned lm_xsize, lm_ysize, lm_zsize, num_cells, bsize[3]; // bsize is the number of bricks in {x, y, z}
+	int rebake_bnds[3][2]; // inclusive cell index range of rebake_bcube
+	cube_t rebake_bcube; // if nonzero, ray tracing only updates cells overlapping this cube
+	vector<unsigned char> col_alloc; // y, x
+	std::unique_ptr<lmap_brick_t[]> bricks; // z, y, x
+	std::mutex expand_mutex;
+	vector<unsigned> expanded_bricks; // bricks expanded from packed data that hasn't been freed yet; guarded by expand_mutex
 
 	lmap_manager_t(lmap_manager_t const &) = delete; // forbidden
 	void operator=(lmap_manager_t const &) = delete; // forbidden
+	unsigned num_bricks() const {return bsize[0]*bsize[1]*bsize[2];}
+	unsigned get_brick_ix(int x, int y, int z) const {return ((z >> LMAP_BRICK_BITS)*bsize[1] + (y >> LMAP_BRICK_BITS))*bsize[0] + (x >> LMAP_BRICK_BITS);}
+	static unsigned get_cell_ix(int x, int y, int z) {return (((z & LMAP_BRICK_MASK) << (2*LMAP_BRICK_BITS)) | ((y & LMAP_BRICK_MASK) << LMAP_BRICK_BITS) | (x & LMAP_BRICK_MASK));}
+	lmcell *expand_brick(unsigned bix);
+	void alloc_bricks(lmcell const &init_lmcell);
+	void compact_brick_rows(unsigned by_start, unsigned by_end);
 
 public:
 	bool was_updated;
 	cube_t update_bcube;
 
-	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), vlmap(NULL), was_updated(0) {update_bcube.set_to_zeros();}
-	void clear_cells() {vldata_alloc.clear();} // vlmap matrix headers are not cleared
-	bool is_allocated() const {return (vlmap != NULL && !vldata_alloc.empty());}
-	size_t size() const {return vldata_alloc.size();}
+	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), num_cells(0), was_updated(0) {UNROLL_3X(bsize[i_] = 0;); update_bcube.set_to_zeros(); rebake_bcube.set_to_zeros();}
+	void clear_cells() {bricks.reset(); num_cells = 0; rebake_bcube.set_to_zeros(); expanded_bricks.clear();}
+	bool is_allocated() const {return (num_cells > 0);}
+	size_t size() const {return num_cells;}
+	size_t get_mem_usage() const;
 	bool read_data_from_file(char const *const fn, int ltype);
 	bool write_data_to_file(char const *const fn, int ltype) const;
-	void clear_lighting_values(int ltype);
+	bool read_data(binary_file_reader &reader, char const *const fn, int ltype, bool compact_bricks=1);
+	bool write_data(binary_file_writer &writer, char const *const fn, int ltype) const;
+	void scale_lighting_values(int ltype, float scale);
+	void clear_lighting_values(int ltype) {scale_lighting_values(ltype, 0.0);}
 	bool is_valid_cell(int x, int y, int z) const;
-	lmcell const *get_column(int x, int y) const {return vlmap[y][x];} // Note: no bounds checking
-	lmcell *get_column(int x, int y) {return vlmap[y][x];} // Note: no bounds checking
-	lmcell &get_lmcell(int x, int y, int z) {return get_column(x, y)[z];} // Note: no bounds checking
+	bool is_column_allocated(int x, int y) const {return (col_alloc[y*lm_xsize + x] != 0);} // Note: no bounds checking
+	lmcell_const_column_t get_column(int x, int y) const {return lmcell_const_column_t((is_column_allocated(x, y) ? this : nullptr), x, y);} // Note: no bounds checking
+	lmcell_column_t get_column(int x, int y) {return lmcell_column_t((is_column_allocated(x, y) ? this : nullptr), x, y);} // Note: no bounds checking
+
+	lmcell &get_lmcell(int x, int y, int z) { // Note: no bounds checking; expands the brick for writing
+		unsigned const bix(get_brick_ix(x, y, z));
+		lmcell *cells(bricks[bix].full.load(std::memory_order_acquire));
+		if (cells == nullptr) {cells = expand_brick(bix);}
+		return cells[get_cell_ix(x, y, z)];
+	}
+	lmcell get_lmcell_val(int x, int y, int z) const {return bricks[get_brick_ix(x, y, z)].get_cell(get_cell_ix(x, y, z));} // Note: no bounds checking
+
+	template<typename F> void for_each_cell(F f) const { // allocated cells in file order: y, x, z
+		for (unsigned y = 0; y < lm_ysize; ++y) {
+			for (unsigned x = 0; x < lm_xsize; ++x) {
+				if (!is_column_allocated(x, y)) continue;
+				for (unsigned z = 0; z < lm_zsize; ++z) {f(get_lmcell_val(x, y, z));}
+			}
+		}
+	}
 	lmcell *get_lmcell_round_down(point const &p);
 	lmcell *get_lmcell(point const &p);
 	template<typename T> void alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell);
-	void init_from(lmap_manager_t const &src);
+	void init_from(lmap_manager_t const &src, cube_t const *const rebake_bc=nullptr);
 	void copy_data(lmap_manager_t const &src, float blend_weight=1.0);
+	void compact() {compact_brick_rows(0, bsize[1]);} // Note: not thread safe; call only when no ray tracing threads are writing
+	void free_expanded_packed(); // Note: not thread safe; call only when no threads are reading or writing
+	void set_rebake_bounds(cube_t const &bcube);
+	bool has_rebake_bounds() const {return !rebake_bcube.is_all_zeros();}
+	bool in_rebake_bounds(int x, int y, int z) const {
+		return (x >= rebake_bnds[0][0] && x <= rebake_bnds[0][1] && y >= rebake_bnds[1][0] && y <= rebake_bnds[1][1] && z >= rebake_bnds[2][0] && z <= rebake_bnds[2][1]);
+	}
+	bool ray_can_reach_rebake_bounds(point const &p1, point const &p2) const;
 };
 
+inline lmcell &lmcell_column_t::operator[](int z) const {return lmgr->get_lmcell(x, y, z);}
+inline lmcell lmcell_const_column_t::operator[](int z) const {return lmgr->get_lmcell_val(x, y, z);}
+
 
 struct lmcell_local { // size = 12 (must be packed)
 	float lc[3];
@@ -322,6 +425,7 @@ public:
 
 
 void check_for_lighting_finished();
+void check_lighting_rebake();
 void compute_ray_trace_lighting(unsigned ltype, bool verbose);
 
 
@@ -38,6 +38,7 @@ class mesh_xy_grid_cache_t {
 
 	void run_gpu_simplex();
 	void cache_gpu_simplex_vals();
+	void cache_cpu_noise_vals();
 
 public:
 	mesh_xy_grid_cache_t() : cur_nx(0), cur_ny(0), yterms_start(0), tid(0), mx0(0.0), my0(0.0), mdx(0.0), mdy(0.0), sine_offset(0.0),
@@ -9,7 +9,8 @@
 #include "heightmap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
-#include <glm/gtc/noise.hpp>
+#include "simd_noise.h"
+#include "job_system.h"
 
 
 int      const NUM_FREQ_COMP      = 9;
@@ -49,7 +50,7 @@ vector<float> height_histogram;
 hmap_params_t hmap_params;
 
 
-extern bool combined_gu;
+extern bool combined_gu, force_cpu_mesh_noise;
 extern int xoff, yoff, xoff2, yoff2, world_mode, rand_gen_index, mesh_rgen_index, mesh_scale_change, display_mode;
 extern int read_heightmap, read_landscape, do_read_mesh, mesh_seed, scrolling, camera_mode, invert_mh_image;
 extern unsigned erosion_iters;
@@ -576,6 +577,22 @@ void apply_noise_shape_per_term(float &noise, int shape) { // inputs and outputs
 	}
 }
 
+// hash of all state that affects procedural heights, for cache keys; doesn't include heightmap file contents
+uint64_t get_mesh_gen_params_hash() {
+
+	fnv_hash_t hash;
+	hash.add(sinTable);
+	hash.add(hmap_params);
+	int const ivals[8] = {start_eval_sin, mesh_gen_mode, mesh_gen_shape, GLACIATE, mesh_seed, mesh_rgen_index, MESH_X_SIZE, MESH_Y_SIZE};
+	float const fvals[9] = {mesh_scale, mesh_scale_z_inv, mesh_height_scale, MESH_HEIGHT, zmax_est, zmax_est2, custom_glaciate_exp, DX_VAL, DY_VAL};
+	hash.add(ivals);
+	hash.add(fvals);
+	hash.add(using_gpu_mesh_noise()); // GPU and CPU noise results differ slightly
+	return hash.get();
+}
+
+bool using_gpu_mesh_noise() {return (mesh_gen_mode >= MGEN_SIMPLEX_GPU && !force_cpu_mesh_noise);}
+
 void gen_rx_ry(float &rx, float &ry) {
 	rand_gen_t rgen;
 	apply_mesh_rand_seed(rgen);
@@ -595,13 +612,17 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 	do_glaciate = 0; // must set enable_glaciate() after this call if needed
 	cached_vals.clear();
 
-	if (gen_mode >= MGEN_SIMPLEX_GPU) { // GPU simplex noise - always cache values
+	if (gen_mode >= MGEN_SIMPLEX_GPU && !force_cpu_mesh_noise) { // GPU simplex noise - always cache values
 		bool const is_running(cshader && cshader->get_is_running());
 		if (!is_running) {run_gpu_simplex();} // launch the job
 		if (no_wait && !is_running) return 0; // just started, results not yet available
 		cache_gpu_simplex_vals();
 		return 1; // results are available
 	}
+	if (gen_mode != MGEN_SINE) { // CPU perlin/simplex noise - always cache values, since evaluating whole rows is much faster
+		cache_cpu_noise_vals();
+		return 1;
+	}
 	yterms_start = nx*F_TABLE_SIZE;
 	xyterms.resize((nx + ny)*F_TABLE_SIZE, 0.0);
 	float const msx(mesh_scale*DX_VAL_INV), msy(mesh_scale*DY_VAL_INV), ms2(0.5*mesh_scale);
@@ -702,30 +723,10 @@ void mesh_xy_grid_cache_t::free_cshader() { // don't make any GPU calls - hard r
 }
 
 
-float gen_noise(float xv, float yv, int mode, int shape) {
-
-	float zval(0.0), mag(1.0), freq(1.0), rx, ry;
-	unsigned const end_octave(NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);
-	float const lacunarity(1.92), gain(0.5);
+noise_fbm_params_t get_noise_fbm_params(int mode, int shape) {
+	float rx, ry;
 	gen_rx_ry(rx, ry);
-
-	//#pragma omp parallel for schedule(static,1)
-	for (unsigned i = 0; i < end_octave; ++i) {
-		glm::vec2 const pos((freq*xv + rx), (freq*yv + ry));
-		float noise((mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU) ? glm::simplex(pos) : glm::perlin(pos));
-		switch (shape) {
-		case 0: break; // linear - do nothing
-		case 1: noise = fabs(noise) - 0.40; break; // billowy
-		case 2: noise = 0.45 - fabs(noise); break; // ridged
-		//abs(0.5-abs(noise)*2.0)*2.0-0.5
-		}
-		zval += mag*noise;
-		mag  *= gain;
-		freq *= lacunarity;
-		rx   *= 1.5;
-		ry   *= 1.5;
-	}
-	return zval;
+	return noise_fbm_params_t((mode == MGEN_PERLIN), shape, (NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2), rx, ry);
 }
 
 // mode: 0=sine tables, 1=simplex, 2=perlin, 3=GPU simplex, 4=GPU domain warp
@@ -734,28 +735,36 @@ float get_noise_zval(float xval, float yval, int mode, int shape) {
 
 	assert(mode != MGEN_SINE); // mode 0 not supported by this function
 	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale);
-	float xv(xy_scale*xval), yv(xy_scale*yval);
-
-	if (mode == MGEN_DWARP_GPU) { // domain warping
-		float const scale(0.2);
-		float const dx1(gen_noise(xv+0.0, yv+0.0, mode, shape));
-		float const dy1(gen_noise(xv+5.2, yv+1.3, mode, shape));
-		float const dx2(gen_noise((xv + scale*dx1 + 1.7), (yv + scale*dy1 + 9.2), mode, shape));
-		float const dy2(gen_noise((xv + scale*dx1 + 8.3), (yv + scale*dy1 + 2.8), mode, shape));
-		xv += scale*dx2; yv += scale*dy2;
-	}
-	float zval(gen_noise(xv, yv, mode, shape));
+	float zval(eval_fbm_noise(get_noise_fbm_params(mode, shape), xy_scale*xval, xy_scale*yval, (mode == MGEN_DWARP_GPU)));
 	postproc_noise_zval(zval);
 	return zval*get_hmap_scale(mode);
 }
 
+// same values as get_noise_zval(), but evaluates entire rows using SIMD
+void mesh_xy_grid_cache_t::cache_cpu_noise_vals() {
+
+	noise_fbm_params_t const params(get_noise_fbm_params(gen_mode, gen_shape));
+	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale), zscale(get_hmap_scale(gen_mode));
+	bool const domain_warp(gen_mode == MGEN_DWARP_GPU);
+	vector<float> xvals(cur_nx);
+	for (unsigned x = 0; x < cur_nx; ++x) {xvals[x] = xy_scale*((x*mdx + mx0)*DX_VAL_INV);}
+	cached_vals.resize(cur_nx*cur_ny);
+
+	// use the job system rather than OpenMP since this is called from tile generation jobs; a waiting worker helps run the rows
+	parallel_for(0, cur_ny, [&](int y) {
+		float *const row(&cached_vals[y*cur_nx]);
+		eval_fbm_noise_row(params, &xvals.front(), xy_scale*((y*mdy + my0)*DY_VAL_INV), row, cur_nx, domain_warp);
+		for (unsigned x = 0; x < cur_nx; ++x) {postproc_noise_zval(row[x]); row[x] *= zscale;}
+	}, (cur_nx*cur_ny >= 1024));
+}
+
 
 float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin, bool use_cache) const {
 
 	assert(x < cur_nx && y < cur_ny);
 	float zval(0.0);
 
-	if ((use_cache || gen_mode >= MGEN_SIMPLEX_GPU) && !cached_vals.empty()) {
+	if ((use_cache || gen_mode != MGEN_SINE) && !cached_vals.empty()) {
 		zval += cached_vals[y*cur_nx + x];
 	}
 	else if (gen_mode != MGEN_SINE) { // perlin/simplex
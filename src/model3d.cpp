@@ -25,7 +25,7 @@ bool model_calc_tan_vect(1); // slower and more memory but sometimes better qual
 extern bool group_back_face_cull, enable_model3d_tex_comp, disable_shader_effects, texture_alpha_in_red_comp, use_model2d_tex_mipmaps, enable_model3d_bump_maps;
 extern bool two_sided_lighting, have_indir_smoke_tex, use_core_context, model3d_wn_normal, invert_model_nmap_bscale, use_z_prepass, all_model3d_ref_update;
 extern bool use_interior_cube_map_refl, enable_model3d_custom_mipmaps, enable_tt_model_indir, no_subdiv_model, auto_calc_tt_model_zvals, use_model_lod_blocks;
-extern bool flatten_tt_mesh_under_models, no_store_model_textures_in_memory, disable_model_textures, allow_model3d_quads;
+extern bool flatten_tt_mesh_under_models, no_store_model_textures_in_memory, disable_model_textures, allow_model3d_quads, cache_bvh_files;
 extern unsigned shadow_map_sz, reflection_tid;
 extern int display_mode;
 extern float model3d_alpha_thresh, model3d_texture_anisotropy, model_triplanar_tc_scale, model_mat_lod_thresh, cobj_z_bias, light_int_scale[];
@@ -147,21 +147,12 @@ unsigned texture_manager::get_gpu_mem() const {
 
 // ************ read/write code ************
 
-void write_uint(ostream &out, unsigned val) {
-	out.write((const char *)&val, sizeof(unsigned));
-}
-
 unsigned read_uint(istream &in) {
 	unsigned val;
 	in.read((char *)&val, sizeof(unsigned));
 	return val;
 }
 
-template<typename V> void write_vector(ostream &out, V const &v) {
-	write_uint(out, (unsigned)v.size());
-	out.write((const char *)&v.front(), (std::streamsize)v.size()*sizeof(typename V::value_type));
-}
-
 template<typename V> void read_vector(istream &in, V &v) {
 	v.clear();
 	v.resize(read_uint(in));
@@ -169,6 +160,137 @@ template<typename V> void read_vector(istream &in, V &v) {
 }
 
 
+// ************ model3d file version 2 ************
+
+// layout: header, section table, meta section (materials and geometry headers), transforms section, page aligned data section (vertex and index arrays)
+unsigned const MODEL3D_V2_MAGIC   = 0x3244334D; // "M3D2"
+unsigned const MODEL3D_V2_VERSION = 3; // increment when the meta layout changes
+unsigned const MODEL3D_PAGE_SIZE  = 4096; // vertex and index arrays are aligned to this so that they can be mapped and uploaded to the GPU in place
+
+enum {M3D_SECT_META=0, M3D_SECT_XFORMS, M3D_SECT_DATA, NUM_M3D_SECTS};
+enum {M3D_FLAG_LOD_BLOCKS=0x01, M3D_FLAG_NO_SUBDIV=0x02}; // settings that determine the stored blocks/lod_blocks layout
+
+unsigned get_model3d_build_flags() {return ((use_model_lod_blocks ? M3D_FLAG_LOD_BLOCKS : 0) | (no_subdiv_model ? M3D_FLAG_NO_SUBDIV : 0));}
+
+struct model3d_file_header_t {
+	struct section_t {
+		uint64_t offset, size;
+	};
+	unsigned magic, version, num_sects, type_sizes[5]; // sizes of the stored structs, to reject files written with a different layout
+	unsigned build_flags, pad; // M3D_FLAG_* values at write time
+	uint64_t file_size, checksum; // checksum of everything after the header
+	section_t sects[NUM_M3D_SECTS];
+
+	model3d_file_header_t() : magic(MODEL3D_V2_MAGIC), version(MODEL3D_V2_VERSION), num_sects(NUM_M3D_SECTS), build_flags(get_model3d_build_flags()), pad(0), file_size(0), checksum(0) {
+		unsigned const sizes[5] = {sizeof(material_params_t), sizeof(vert_norm_tc), sizeof(vert_norm_tc_tan), sizeof(model3d_xform_t), sizeof(cube_t)};
+		for (unsigned i = 0; i < 5; ++i) {type_sizes[i] = sizes[i];}
+		for (unsigned i = 0; i < NUM_M3D_SECTS; ++i) {sects[i].offset = sects[i].size = 0;}
+	}
+	bool same_layout(model3d_file_header_t const &h) const {
+		static_assert((sizeof(model3d_file_header_t) % 8) == 0, "model3d header must be a multiple of 8 bytes for the checksum");
+		return (magic == h.magic && version == h.version && num_sects == h.num_sects && memcmp(type_sizes, h.type_sizes, sizeof(type_sizes)) == 0);
+	}
+};
+
+size_t align_to_page(size_t sz) {return MODEL3D_PAGE_SIZE*((sz + MODEL3D_PAGE_SIZE - 1)/MODEL3D_PAGE_SIZE);}
+
+
+class model3d_file_writer_t {
+	vector<char> meta, data;
+
+	static void append(vector<char> &buf, void const *ptr, size_t sz) {buf.insert(buf.end(), (char const *)ptr, ((char const *)ptr + sz));}
+public:
+	template<typename T> void add(T const &v) {append(meta, &v, sizeof(T));}
+	void add_str(string const &s) {add(unsigned(s.size())); append(meta, s.data(), s.size());}
+
+	template<typename T> void add_vect(vector<T> const &v) {
+		add(unsigned(v.size()));
+		if (!v.empty()) {append(meta, v.data(), v.size()*sizeof(T));}
+	}
+	template<typename T> void add_data(vector<T> const &v) { // written to the data section; only the offset and size go into the meta section
+		data.resize(align_to_page(data.size()), 0);
+		add(uint64_t(data.size()));
+		add(unsigned(v.size()));
+		if (!v.empty()) {append(data, v.data(), v.size()*sizeof(T));}
+	}
+	bool write(string const &fn, vector<model3d_xform_t> const &xforms) const {
+		ofstream out(fn, ios::out | ios::binary);
+		
+		if (!out.good()) {
+			cerr << "Error opening model3d file for write: " << fn << endl;
+			return 0;
+		}
+		model3d_file_header_t header;
+		size_t const xf_sz(xforms.size()*sizeof(model3d_xform_t));
+		header.sects[M3D_SECT_META  ].offset = sizeof(model3d_file_header_t);
+		header.sects[M3D_SECT_META  ].size   = meta.size();
+		header.sects[M3D_SECT_XFORMS].offset = header.sects[M3D_SECT_META].offset + meta.size();
+		header.sects[M3D_SECT_XFORMS].size   = xf_sz;
+		header.sects[M3D_SECT_DATA  ].offset = align_to_page(header.sects[M3D_SECT_XFORMS].offset + xf_sz);
+		header.sects[M3D_SECT_DATA  ].size   = data.size();
+		header.file_size = header.sects[M3D_SECT_DATA].offset + data.size();
+		// everything before the data section is combined so that the checksum is computed on the same 8 byte words as when reading
+		vector<char> pre_data(meta);
+		append(pre_data, xforms.data(), xf_sz);
+		pre_data.resize(header.sects[M3D_SECT_DATA].offset - sizeof(model3d_file_header_t), 0); // pad to a page boundary
+		fnv_hash_t hash;
+		hash.add_words(pre_data.data(), pre_data.size());
+		hash.add_words(data.data(), data.size());
+		header.checksum = hash.get();
+		out.write((char const *)&header, sizeof(model3d_file_header_t));
+		out.write(pre_data.data(), pre_data.size());
+		out.write(data.data(), data.size());
+		return out.good();
+	}
+};
+
+
+class model3d_file_reader_t {
+	char const *meta, *meta_end, *data;
+	uint64_t data_size;
+	bool ok;
+
+	void get_bytes(void *ptr, size_t sz) {
+		if (!ok || size_t(meta_end - meta) < sz) {ok = 0; return;} // truncated
+		memcpy(ptr, meta, sz);
+		meta += sz;
+	}
+public:
+	model3d_file_reader_t(vector<char> const &buf, model3d_file_header_t const &header) : ok(1) {
+		model3d_file_header_t::section_t const &ms(header.sects[M3D_SECT_META]), &ds(header.sects[M3D_SECT_DATA]);
+		meta = buf.data() + ms.offset; meta_end = meta + ms.size;
+		data = buf.data() + ds.offset; data_size = ds.size;
+	}
+	bool is_ok() const {return ok;}
+	template<typename T> void get(T &v) {get_bytes(&v, sizeof(T));}
+
+	void get_str(string &s) {
+		unsigned sz(0);
+		get(sz);
+		if (ok && size_t(meta_end - meta) < sz) {ok = 0;}
+		if (ok) {s.assign(meta, sz); meta += sz;}
+	}
+	template<typename T> void get_vect(vector<T> &v) {
+		unsigned sz(0);
+		get(sz);
+		if (ok && size_t(meta_end - meta)/sizeof(T) < sz) {ok = 0;}
+		if (!ok) return;
+		v.resize(sz);
+		get_bytes(v.data(), sz*sizeof(T));
+	}
+	template<typename T> void get_data(vector<T> &v) { // copy from the data section; could be used directly if the file was mapped into memory
+		uint64_t offset(0);
+		unsigned sz(0);
+		get(offset);
+		get(sz);
+		if (ok && (offset > data_size || (data_size - offset)/sizeof(T) < sz)) {ok = 0;}
+		if (!ok) return;
+		v.resize(sz);
+		if (sz > 0) {memcpy(v.data(), (data + offset), sz*sizeof(T));}
+	}
+};
+
+
 // ************ vntc_vect_t/indexed_vntc_vect_t ************
 
 // explicit template instantiations of vert_norm case, used for voxel_model, where tc=0.0
@@ -540,11 +662,7 @@ template<> void indexed_vntc_vect_t<vert_norm_tc_tan>::calc_tangents(unsigned np
 }
 
 
-template<typename T> void vntc_vect_t<T>::write(ostream &out) const {
-	write_vector(out, *this);
-}
-
-template<typename T> void vntc_vect_t<T>::read(istream &in) {
+template<typename T> void vntc_vect_t<T>::read(istream &in) { // legacy model3d file format
 
 	// Note: it would be nice to write/read without the tangent vectors and recalculate them later,
 	// but knowing which materials require tangents requires loading the material file first, but that requires the model,
@@ -647,16 +765,12 @@ template<typename T> unsigned indexed_vntc_vect_t<T>::add_vertex(T const &v, ver
 
 	T v2(v);
 	if (vmap.get_average_normals()) {v2.n = zero_vector;}
-	auto it(vmap.find(v2));
-	unsigned ix;
+	unsigned const ix(vmap.find_or_insert(v2, (unsigned)size()));
 
-	if (it == vmap.end()) { // not found
-		ix = (unsigned)size();
+	if (ix == size()) { // not found, was inserted
 		this->push_back(v);
-		vmap[v2] = ix;
 	}
 	else { // found
-		ix = it->second;
 		assert(ix < size());
 
 		if (vmap.get_average_normals()) {
@@ -765,16 +879,49 @@ template<typename T> void indexed_vntc_vect_t<T>::invert_tcy() {
 	for (auto i = begin(); i != end(); ++i) {invert_vert_tcy(*i);}
 }
 
-template<typename T> void indexed_vntc_vect_t<T>::write(ostream &out) const {
-	vntc_vect_t<T>::write(out);
-	write_vector(out, indices);
-}
-
 template<typename T> void indexed_vntc_vect_t<T>::read(istream &in) {
 	vntc_vect_t<T>::read(in);
 	read_vector(in, indices);
 }
 
+// stores the finalized state (subdivided blocks and LOD blocks) so that finalize() isn't needed after reading
+template<typename T> void indexed_vntc_vect_t<T>::write(model3d_file_writer_t &w) const {
+	w.add_data<T>(*this);
+	w.add_data(indices);
+	w.add(this->obj_id);
+	w.add(bsphere);
+	w.add(bcube);
+	w.add(finalized);
+	w.add(optimized);
+	w.add(amin);
+	w.add(amax);
+	w.add(need_normalize);
+	w.add_vect(blocks);
+	w.add_vect(lod_blocks);
+}
+
+template<typename T> bool indexed_vntc_vect_t<T>::read(model3d_file_reader_t &r) {
+	r.get_data<T>(*this);
+	r.get_data(indices);
+	r.get(this->obj_id);
+	r.get(bsphere);
+	r.get(bcube);
+	r.get(finalized);
+	r.get(optimized);
+	r.get(amin);
+	r.get(amax);
+	r.get(need_normalize);
+	r.get_vect(blocks);
+	r.get_vect(lod_blocks);
+	this->has_tangents = (sizeof(T) == sizeof(vert_norm_tc_tan)); // HACK to get the type
+
+	if (need_normalize) { // written before finalize(), so normalize here
+		for (auto i = begin(); i != end(); ++i) {i->n.normalize();}
+		need_normalize = 0;
+	}
+	return r.is_ok();
+}
+
 
 // ************ polygon_t ************
 
@@ -903,10 +1050,23 @@ template<typename T> void vntc_vect_block_t<T>::simplify_indices(float reduce_ta
 	for (auto i = begin(); i != end(); ++i) {i->simplify_indices(reduce_target);}
 }
 
-template<typename T> bool vntc_vect_block_t<T>::write(ostream &out) const {
+template<typename T> void vntc_vect_block_t<T>::write(model3d_file_writer_t &w) const {
 
-	write_uint(out, (unsigned)this->size());
-	for (auto i = begin(); i != end(); ++i) {i->write(out);}
+	w.add(unsigned(this->size()));
+	for (auto i = begin(); i != end(); ++i) {i->write(w);}
+}
+
+template<typename T> bool vntc_vect_block_t<T>::read(model3d_file_reader_t &r) {
+
+	unsigned sz(0);
+	r.get(sz);
+	this->clear();
+	if (!r.is_ok()) return 0;
+	this->resize(sz);
+
+	for (auto i = begin(); i != end(); ++i) {
+		if (!i->read(r)) return 0;
+	}
 	return 1;
 }
 
@@ -1202,12 +1362,22 @@ bool material_t::add_poly(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t
 }
 
 
-bool material_t::write(ostream &out) const {
+void material_t::write(model3d_file_writer_t &w) const {
+
+	w.add(static_cast<material_params_t const &>(*this));
+	w.add_str(name);
+	w.add_str(filename);
+	geom.write(w);
+	geom_tan.write(w);
+}
+
+
+bool material_t::read(model3d_file_reader_t &r) {
 
-	out.write((char const *)this, sizeof(material_params_t));
-	write_vector(out, name);
-	write_vector(out, filename);
-	return (geom.write(out) && geom_tan.write(out));
+	r.get(static_cast<material_params_t &>(*this));
+	r.get_str(name);
+	r.get_str(filename);
+	return (r.is_ok() && geom.read(r) && geom_tan.read(r));
 }
 
 
@@ -1948,13 +2118,12 @@ void model3d::create_indir_texture() {
 	for (unsigned y = 0; y < ysize; ++y) {
 		for (unsigned x = 0; x < xsize; ++x) {
 			unsigned const off(zsize*(y*xsize + x));
-			lmcell const *const vlm(local_lmap_manager.get_column(x, y));
-			assert(vlm != nullptr); // not supported in this flow
+			assert(local_lmap_manager.is_column_allocated(x, y)); // not supported in this flow
 
 			for (unsigned z = 0; z < zsize; ++z) {
 				unsigned const off2(ncomp*(off + z));
 				colorRGB color;
-				vlm[z].get_final_color(color, 1.0, 1.0);
+				local_lmap_manager.get_lmcell_val(x, y, z).get_final_color(color, 1.0, 1.0);
 				//color = colorRGBA(float(y)/ysize, float(x)/xsize, float(z)/zsize, 1.0); // for debugging
 				UNROLL_3X(tex_data[off2+i_] = (unsigned char)(255*CLIP_TO_01(color[i_]));)
 			} // for z
@@ -2063,7 +2232,7 @@ void model3d::build_cobj_tree(bool verbose) {
 	RESET_TIME;
 	get_polygons(coll_tree.get_tquads_ref());
 	PRINT_TIME(" Get Model3d Polygons");
-	coll_tree.build_tree_top(verbose);
+	coll_tree.build_tree_top(verbose, ((cache_bvh_files && !filename.empty()) ? (filename + ".bvh") : string()));
 	PRINT_TIME(" Cobj Tree Create (from model3d)");
 }
 
@@ -2132,31 +2301,86 @@ void model3d::show_stats() const {
 }
 
 
-bool model3d::write_to_disk(string const &fn) const { // Note: transforms not written
+bool model3d::write_to_disk(string const &fn) const { // Note: always writes the current (v2) format
 
-	ofstream out(fn, ios::out | ios::binary);
-	
-	if (!out.good()) {
-		cerr << "Error opening model3d file for write: " << fn << endl;
+	cout << "Writing model3d file " << fn << endl;
+	model3d_file_writer_t w;
+	w.add(bcube);
+	unbound_geom.write(w);
+	w.add(unsigned(materials.size()));
+	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {m->write(w);}
+	return w.write(fn, transforms);
+}
+
+
+bool model3d::read_from_disk_v2(string const &fn, istream &in) { // the whole file is read and validated before anything is used
+
+	in.seekg(0, ios::end);
+	vector<char> buf(size_t(max(std::streamoff(in.tellg()), std::streamoff(0))));
+	in.seekg(0, ios::beg);
+	if (!buf.empty()) {in.read(buf.data(), buf.size());}
+	model3d_file_header_t const cur_header;
+	model3d_file_header_t header;
+
+	if (!in.good() || buf.size() < sizeof(model3d_file_header_t)) {
+		cerr << "Error reading model3d file " << fn << ": file is truncated." << endl;
 		return 0;
 	}
-	cout << "Writing model3d file " << fn << endl;
-	write_uint(out, MAGIC_NUMBER);
-	out.write((char const *)&bcube, sizeof(cube_t));
-	if (!unbound_geom.write(out)) return 0;
-	write_uint(out, (unsigned)materials.size());
+	memcpy(&header, buf.data(), sizeof(model3d_file_header_t));
+
+	if (!header.same_layout(cur_header)) {
+		cerr << "Error reading model3d file " << fn << ": file was written by a different version of 3DWorld and must be regenerated." << endl;
+		return 0;
+	}
+	if (header.build_flags != cur_header.build_flags) { // blocks/lod_blocks were built with different settings
+		cerr << "Error reading model3d file " << fn << ": file was written with use_model_lod_blocks=" << bool(header.build_flags & M3D_FLAG_LOD_BLOCKS)
+			 << " and no_subdiv_model=" << bool(header.build_flags & M3D_FLAG_NO_SUBDIV) << "; change these settings or regenerate the file." << endl;
+		return 0;
+	}
+	bool valid(header.file_size == buf.size());
+
+	for (unsigned i = 0; i < NUM_M3D_SECTS && valid; ++i) {
+		model3d_file_header_t::section_t const &s(header.sects[i]);
+		valid = (s.offset >= sizeof(model3d_file_header_t) && s.offset <= buf.size() && s.size <= buf.size() - s.offset);
+	}
+	valid &= (header.sects[M3D_SECT_XFORMS].size % sizeof(model3d_xform_t)) == 0;
+	char const *const base(buf.data() + sizeof(model3d_file_header_t));
+	fnv_hash_t hash;
+	hash.add_words(base, (buf.size() - sizeof(model3d_file_header_t)));
+	valid &= (hash.get() == header.checksum);
+
+	if (!valid) {
+		cerr << "Error reading model3d file " << fn << ": file is corrupted (checksum or section table check failed)." << endl;
+		return 0;
+	}
+	cout << "Reading model3d file " << fn << endl;
+	from_model3d_file = 1;
+	model3d_file_reader_t r(buf, header);
+	unsigned num_materials(0);
+	r.get(bcube);
+	bool ok(unbound_geom.read(r));
+	r.get(num_materials);
+	ok &= r.is_ok();
+	if (ok) {materials.resize(num_materials);}
 	
-	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {
-		if (!m->write(out)) {
-			cerr << "Error writing material" << endl;
-			return 0;
-		}
+	for (deque<material_t>::iterator m = materials.begin(); m != materials.end() && ok; ++m) {
+		ok &= m->read(r);
+		mat_map[m->name] = (m - materials.begin());
 	}
-	return out.good();
+	if (!ok) {
+		cerr << "Error reading model3d file " << fn << ": invalid geometry or material data." << endl;
+		clear();
+		return 0;
+	}
+	model3d_file_header_t::section_t const &xs(header.sects[M3D_SECT_XFORMS]);
+	transforms.resize(xs.size/sizeof(model3d_xform_t));
+	if (!transforms.empty()) {memcpy(transforms.data(), (buf.data() + xs.offset), xs.size);}
+	for (auto i = transforms.begin(); i != transforms.end(); ++i) {i->clear_bcube();} // cached value, recomputed on use
+	return 1;
 }
 
 
-bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
+bool model3d::read_from_disk(string const &fn) { // reads both v2 and legacy (v1) files; Note: v1 files don't contain transforms
 
 	ifstream in(fn, ios::in | ios::binary);
 	
@@ -2166,12 +2390,13 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 	}
 	clear(); // ???
 	unsigned const magic_number_comp(read_uint(in));
+	if (in.good() && magic_number_comp == MODEL3D_V2_MAGIC) {return read_from_disk_v2(fn, in);}
 
 	if (magic_number_comp != MAGIC_NUMBER) {
 		cerr << "Error reading model3d file " << fn << ": Invalid file format (magic number check failed)." << endl;
 		return 0;
 	}
-	cout << "Reading model3d file " << fn << endl;
+	cout << "Reading legacy model3d file " << fn << endl;
 	from_model3d_file = 1;
 	in.read((char *)&bcube, sizeof(cube_t));
 	if (!unbound_geom.read(in)) return 0;
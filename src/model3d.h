@@ -10,7 +10,6 @@
 #include "cobj_bsp_tree.h" // for cobj_tree_tquads_t
 #include "shadow_map.h" // for smap_data_t and rotation_t
 #include "gl_ext_arb.h"
-//#include <unordered_map>
 
 using namespace std;
 
@@ -167,37 +166,89 @@ struct weighted_normal : public vector3d { // size = 16
 };
 
 
-template<typename T> uint32_t jenkins_one_at_a_time_hash(const T* key, size_t length) { // T is an unsigned integer type
-
-	size_t i = 0;
-	uint32_t hash = 0;
-	while (i != length) {hash += key[i++]; hash += hash << 10; hash ^= hash >> 6;}
-	hash += hash << 3;
-	hash ^= hash >> 11;
-	hash += hash << 15;
-	return hash;
-}
-
-template<typename T> struct hash_by_bytes { // should work with all packed vertex types
-	uint32_t operator()(T const &v) const {return jenkins_one_at_a_time_hash((const uint8_t*)&v, sizeof(T));} // slower but better quality hash
-	//uint32_t operator()(T const &v) const {return jenkins_one_at_a_time_hash((const uint32_t*)&v, sizeof(T)>>2);} // faster but lower quality hash
+template<typename T> struct vertex_hash_t { // for packed vertex types made of floats; hashes 4 words at a time in independent lanes so that it vectorizes
+	uint32_t operator()(T const &v) const {
+		static_assert((sizeof(T) & 3) == 0, "vertex size must be a multiple of 4 bytes");
+		unsigned const nwords(sizeof(T) >> 2);
+		float const *const f((float const *)&v);
+		uint32_t h[4] = {0x811C9DC5U, 0x9E3779B1U, 0x85EBCA77U, 0xC2B2AE3DU};
+
+		for (unsigned i = 0; i < nwords; i += 4) {
+			for (unsigned l = 0; l < 4; ++l) {
+				float const val((i+l < nwords) ? (f[i+l] + 0.0f) : 0.0f); // adding 0.0 maps -0.0 to 0.0 so that hashing agrees with operator==
+				uint32_t bits;
+				memcpy(&bits, &val, sizeof(uint32_t));
+				h[l] = (h[l] ^ bits)*0x01000193U;
+			}
+		}
+		uint32_t hash(h[0] ^ (h[1] << 7 | h[1] >> 25) ^ (h[2] << 13 | h[2] >> 19) ^ (h[3] << 19 | h[3] >> 13));
+		hash ^= hash >> 16; hash *= 0x85EBCA6BU; hash ^= hash >> 13; hash *= 0xC2B2AE35U; hash ^= hash >> 16; // final avalanche
+		return hash;
+	}
 };
 
-//template<typename T> class vertex_map_t : public unordered_map<T, unsigned, hash_by_bytes<T>> {
-template<typename T> class vertex_map_t : public map<T, unsigned> {
+// maps unique vertices to their index, used to weld vertices when loading models;
+// open addressing with linear probing; clear() is O(1) and keeps the storage so that it can be reused across materials
+template<typename T> class vertex_map_t {
 
+	struct slot_t {
+		uint32_t hash, gen, key_ix; // slot is in use if gen == cur_gen
+		slot_t() : hash(0), gen(0), key_ix(0) {}
+	};
+	vector<slot_t> table; // size is a power of 2
+	vector<T> keys;
+	vector<unsigned> vals;
+	uint32_t cur_gen;
 	int last_mat_id;
 	unsigned last_obj_id;
 	bool average_normals;
 
+	void grow() {
+		vector<slot_t> old_table;
+		old_table.swap(table);
+		table.resize(max(size_t(256), 2*old_table.size()));
+		uint32_t const mask(table.size() - 1);
+
+		for (auto i = old_table.begin(); i != old_table.end(); ++i) {
+			if (i->gen != cur_gen) continue; // unused or cleared
+			uint32_t pos(i->hash & mask);
+			while (table[pos].gen == cur_gen) {pos = (pos + 1) & mask;}
+			table[pos] = *i;
+		}
+	}
 public:
-	vertex_map_t(bool average_normals_=0) : last_mat_id(-1), last_obj_id(0), average_normals(average_normals_) {}
+	vertex_map_t(bool average_normals_=0) : cur_gen(1), last_mat_id(-1), last_obj_id(0), average_normals(average_normals_) {}
 	bool get_average_normals() const {return average_normals;}
-	
+	size_t size() const {return keys.size();}
+	bool empty() const {return keys.empty();}
+
+	void clear() {
+		keys.clear();
+		vals.clear();
+		if (++cur_gen == 0) {table.assign(table.size(), slot_t()); cur_gen = 1;} // gen wraparound: reset all slots
+	}
+	// returns the index of v if already present, otherwise inserts v with new_ix and returns new_ix
+	unsigned find_or_insert(T const &v, unsigned new_ix) {
+		if (2*(keys.size() + 1) > table.size()) {grow();} // max load factor of 0.5
+		uint32_t const hash(vertex_hash_t<T>()(v)), mask(table.size() - 1);
+		uint32_t pos(hash & mask);
+
+		for (; table[pos].gen == cur_gen; pos = (pos + 1) & mask) {
+			slot_t const &s(table[pos]);
+			if (s.hash == hash && keys[s.key_ix] == v) return vals[s.key_ix]; // found
+		}
+		slot_t &s(table[pos]);
+		s.hash   = hash;
+		s.gen    = cur_gen;
+		s.key_ix = keys.size();
+		keys.push_back(v);
+		vals.push_back(new_ix);
+		return new_ix;
+	}
 	void check_for_clear(int mat_id) {
-		if (mat_id != last_mat_id || this->size() >= MAX_VMAP_SIZE) {
+		if (mat_id != last_mat_id || size() >= MAX_VMAP_SIZE) {
 			last_mat_id = mat_id;
-			this->clear();
+			clear();
 		}
 	}
 };
@@ -216,6 +267,9 @@ struct get_polygon_args_t {
 		: polygons(polygons_), color(color_), quads_only(quads_only_), lod_level(lod_level_) {}
 };
 
+class model3d_file_writer_t; // forward declaration
+class model3d_file_reader_t; // forward declaration
+
 
 template<typename T> cube_t get_polygon_bbox(vector<T> const &p) {
 	if (p.empty()) return all_zeros_cube;
@@ -248,7 +302,6 @@ public:
 	unsigned get_gpu_mem() const {return (vbo_valid() ? size()*sizeof(T) : 0);}
 	void optimize(unsigned npts) {remove_excess_cap();}
 	void remove_excess_cap() {if (20*vector<T>::size() < 19*vector<T>::capacity()) {vector<T>::shrink_to_fit();}}
-	void write(ostream &out) const;
 	void read(istream &in);
 };
 
@@ -313,8 +366,9 @@ public:
 	void get_polygons(get_polygon_args_t &args, unsigned npts) const;
 	unsigned get_gpu_mem() const {return (vntc_vect_t<T>::get_gpu_mem() + (this->ivbo_valid() ? indices.size()*sizeof(unsigned) : 0));}
 	void invert_tcy();
-	void write(ostream &out) const;
 	void read(istream &in);
+	void write(model3d_file_writer_t &w) const;
+	bool read(model3d_file_reader_t &r);
 	bool indexing_enabled() const {return !indices.empty();}
 	void mark_need_normalize() {need_normalize = 1;}
 };
@@ -338,8 +392,9 @@ template<typename T> struct vntc_vect_block_t : public deque<indexed_vntc_vect_t
 	void get_polygons(get_polygon_args_t &args, unsigned npts) const;
 	void invert_tcy();
 	void simplify_indices(float reduce_target);
-	bool write(ostream &out) const;
 	bool read(istream &in);
+	void write(model3d_file_writer_t &w) const;
+	bool read(model3d_file_reader_t &r);
 };
 
 
@@ -364,8 +419,9 @@ template<typename T> struct geometry_t {
 	void get_stats(model3d_stats_t &stats) const;
 	void calc_area(float &area, unsigned &ntris);
 	void simplify_indices(float reduce_target);
-	bool write(ostream &out) const {return (triangles.write(out) && quads.write(out));}
-	bool read(istream &in)         {return (triangles.read (in ) && quads.read (in ));}
+	bool read(istream &in) {return (triangles.read(in) && quads.read(in));}
+	void write(model3d_file_writer_t &w) const {triangles.write(w); quads.write(w);}
+	bool read(model3d_file_reader_t &r) {return (triangles.read(r) && quads.read(r));}
 };
 
 
@@ -398,7 +454,7 @@ public:
 };
 
 
-struct material_params_t { // Warning: changing this struct will invalidate the model3d file format
+struct material_params_t { // Warning: changing this struct will invalidate existing model3d files
 
 	colorRGB ka, kd, ks, ke, tf;
 	float ns, ni, alpha, tr;
@@ -442,8 +498,9 @@ struct material_t : public material_params_t {
 	void render(shader_t &shader, texture_manager const &tmgr, int default_tid, bool is_shadow_pass, bool is_z_prepass, bool enable_alpha_mask, bool is_bmap_pass, point const *const xlate);
 	colorRGBA get_ad_color() const;
 	colorRGBA get_avg_color(texture_manager const &tmgr, int default_tid=-1) const;
-	bool write(ostream &out) const;
 	bool read(istream &in);
+	void write(model3d_file_writer_t &w) const;
+	bool read(model3d_file_reader_t &r);
 };
 
 
@@ -499,6 +556,7 @@ class model3d {
 
 	void update_bbox(polygon_t const &poly);
 	void create_indir_texture();
+	bool read_from_disk_v2(string const &fn, istream &in);
 
 public:
 	texture_manager &tmgr; // stores all textures
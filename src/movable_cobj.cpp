@@ -1333,6 +1333,7 @@ bool proc_movable_cobj(point const &orig_pos, point &player_pos, unsigned index,
 
 void proc_moving_cobjs() {
 
+	PROFILE_SCOPE("Moving Cobjs");
 	vector<pair<float, unsigned>> by_z1;
 	set<unsigned> seen;
 
@@ -50,6 +50,79 @@ struct comp_co_fast_x {
 };
 
 
+// uniform grid spatial hash over object centers, used to accelerate radius queries on a vector of cached_objs;
+// the vector isn't reordered since queries return indices into it, so the grid must be rebuilt whenever the vector changes;
+// the owner passes a generation number that it increments when refilling the vector, since the pointer and size may be unchanged
+class cached_obj_grid_t {
+
+	struct cell_t {
+		uint64_t key;
+		unsigned start, num; // range in ixs; num == 0 is an empty hash table slot
+		cell_t() : key(0), start(0), num(0) {}
+	};
+	vector<cell_t> table; // open addressing hash table, size is a power of 2
+	vector<unsigned> ixs; // object indices sorted by cell
+	vector<pair<uint64_t, unsigned> > keys; // reused across builds
+	vector<cached_obj> const *objs;
+	size_t num_objs;
+	unsigned gen; // generation of objs when built
+	point origin;
+	float cell_sz, inv_cell_sz;
+	int dims[3];
+	unsigned table_bits;
+
+	static uint64_t get_key(int x, int y, int z) {return ((uint64_t(x) << 42) | (uint64_t(y) << 21) | uint64_t(z));}
+	int get_cell(float v, unsigned d) const {return max(0, min(dims[d]-1, int(max(0.0f, (v - origin[d])*inv_cell_sz))));}
+	cell_t const *find_cell(uint64_t key) const;
+public:
+	cached_obj_grid_t() : objs(NULL), num_objs(0), gen(0), origin(all_zeros), cell_sz(0.0), inv_cell_sz(0.0), table_bits(0) {UNROLL_3X(dims[i_] = 0;)}
+	void build(vector<cached_obj> const &objs_, bool parallel, unsigned gen_=0);
+	void clear() {objs = NULL; num_objs = 0; table.clear(); ixs.clear();}
+	bool valid_for(vector<cached_obj> const *const v, unsigned cur_gen) const {return (v == objs && v != NULL && v->size() == num_objs && num_objs > 0 && gen == cur_gen);}
+
+	// calls visit(ix) for objects in cells overlapping the cube of half-width radius around pos, in order of increasing cell ring distance;
+	// get_radius() is re-evaluated before each ring so that closest object queries can stop early; visit() returns 0 to end the query;
+	// returns 0 without visiting anything if the cube covers too many cells, in which case the caller should fall back to a linear search
+	template<typename R, typename V> bool query(point const &pos, R get_radius, V visit) const {
+		float const radius(get_radius());
+		int lo[3], hi[3], c[3];
+
+		for (unsigned d = 0; d < 3; ++d) {
+			float const pmin((pos[d] - radius - origin[d])*inv_cell_sz), pmax((pos[d] + radius - origin[d])*inv_cell_sz);
+			if (!(pmax >= 0.0f && pmin < float(dims[d]))) return 1; // no overlap with any object, or NaN
+			lo[d] = get_cell(pos[d] - radius, d);
+			hi[d] = get_cell(pos[d] + radius, d);
+			c [d] = get_cell(pos[d], d); // clamped to the grid, which is conservative for the ring distance test
+		}
+		uint64_t const num_cells(uint64_t(hi[0] - lo[0] + 1)*uint64_t(hi[1] - lo[1] + 1)*uint64_t(hi[2] - lo[2] + 1));
+		if (num_cells > max(uint64_t(64), 2*uint64_t(num_objs))) return 0; // too many cells, linear search is faster
+		int const max_ring(max(max(max(c[0]-lo[0], hi[0]-c[0]), max(c[1]-lo[1], hi[1]-c[1])), max(c[2]-lo[2], hi[2]-c[2])));
+
+		for (int r = 0; r <= max_ring; ++r) {
+			if (r > 1 && (r-1)*cell_sz > get_radius()) break; // all remaining cells are further than the search radius
+
+			for (int x = max(lo[0], c[0]-r); x <= min(hi[0], c[0]+r); ++x) {
+				for (int y = max(lo[1], c[1]-r); y <= min(hi[1], c[1]+r); ++y) {
+					bool const xy_edge(abs(x - c[0]) == r || abs(y - c[1]) == r);
+					int const zstep(xy_edge ? 1 : 2*r); // interior of the ring's xy range only has the two z end caps
+
+					for (int z = c[2]-r; z <= c[2]+r; z += max(zstep, 1)) {
+						if (z < lo[2] || z > hi[2]) continue;
+						cell_t const *const cell(find_cell(get_key(x, y, z)));
+						if (cell == NULL) continue;
+
+						for (unsigned i = cell->start; i < cell->start + cell->num; ++i) {
+							if (!visit(ixs[i])) return 1;
+						}
+					} // for z
+				} // for y
+			} // for x
+		} // for r
+		return 1;
+	}
+};
+
+
 
 #endif
 
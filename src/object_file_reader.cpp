@@ -10,9 +10,10 @@
 #include <algorithm> // for transform()
 #include <cctype> // for tolower()
 #include "fast_atof.h"
+#include "job_system.h"
 
 
-extern bool use_obj_file_bump_grayscale;
+extern bool use_obj_file_bump_grayscale, parallel_obj_file_parse;
 extern float model_auto_tc_scale, model_mat_lod_thresh;
 extern model3ds all_models;
 
@@ -36,7 +37,20 @@ void base_file_reader::close_file() {
 	fp = NULL;
 }
 
+bool base_file_reader::read_file_to_mem(vector<char> &data) const {
+	FILE *const fp_(fopen(filename.c_str(), "rb")); // binary mode so that the size matches; '\r' is treated as whitespace
+	if (!fp_) {cerr << "Error: Could not open object file " << filename << endl; return 0;}
+	bool ok(fseek(fp_, 0, SEEK_END) == 0);
+	long const sz(ok ? ftell(fp_) : -1);
+	ok &= (sz >= 0 && fseek(fp_, 0, SEEK_SET) == 0);
+	if (ok) {data.resize(sz); ok = (sz == 0 || fread(data.data(), 1, sz, fp_) == (size_t)sz);}
+	fclose(fp_);
+	if (!ok) {cerr << "Error reading object file " << filename << endl;}
+	return ok;
+}
+
 void base_file_reader::unget_last_char(int c) {
+	if (mem_pos) {if (c != EOF) {--mem_pos;} return;}
 	if (FILE_BUF_SZ == 0) {assert(fp != nullptr); _ungetc_nolock(c, fp); return;}
 	if (c == EOF) return; // can't unget EOF
 	assert(file_buf_pos > 0); // can't unget without previous get
@@ -45,6 +59,7 @@ void base_file_reader::unget_last_char(int c) {
 
 int base_file_reader::get_char(FILE *fp_) {
 
+	if (mem_pos) {return ((mem_pos < mem_end) ? *(mem_pos++) : EOF);}
 	if (FILE_BUF_SZ == 0) {return _getc_nolock(fp_);}
 
 	if (file_buf_pos == file_buf_end) { // fill file buffer
@@ -116,6 +131,8 @@ class object_file_reader : public base_file_reader {
 	bool invalid_index_warned;
 
 protected:
+	static int const OBJ_NO_IX = INT_MIN; // index not specified in the file
+
 	void handle_invalid_zero_ref_index(int &ix) {
 		if (ix == -1) {
 			if (!invalid_index_warned) {
@@ -169,6 +186,25 @@ protected:
 		c.R = val;
 		return ((read_float(c.G) && read_float(c.B)) ? 1 : 2); // success or error
 	}
+	void read_face_ixs(vector<int> &ixs) { // appends {vertex, tex coord, normal} for each face vertex; unspecified indices are OBJ_NO_IX
+		int vix(0);
+
+		while (read_int(vix)) { // read vertex index
+			int tix(OBJ_NO_IX), nix(OBJ_NO_IX);
+			int const c(get_next_char());
+
+			if (c == '/') {
+				if (!read_int(tix)) {tix = OBJ_NO_IX;} // text coord index
+				int const c2(get_next_char());
+				if (c2 == '/') {if (!read_int(nix)) {nix = OBJ_NO_IX;}} // normal index
+				else {unget_last_char(c2);}
+			}
+			else {unget_last_char(c);}
+			ixs.push_back(vix);
+			ixs.push_back(tix);
+			ixs.push_back(nix);
+		}
+	}
 
 public:
 	object_file_reader(string const &fn) : base_file_reader(fn), invalid_index_warned(0) {}
@@ -279,10 +315,99 @@ bool endswith(string const &value, string const &ending) {
 	return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
 }
 
+struct obj_chunk_t {
+	enum {REC_V=0, REC_VT, REC_VN, REC_F, REC_COMMENT, REC_CMD};
+	struct record_t {
+		unsigned char type;
+		unsigned data; // V: color_ret; F: num verts; CMD: offset of the command from begin
+		record_t(unsigned char type_, unsigned data_=0) : type(type_), data(data_) {}
+	};
+	char const *begin, *end;
+	vector<record_t> recs;
+	vector<point> pts; // V, VT, and VN values in record order
+	vector<colorRGB> colors; // one per V record with color_ret == 1
+	vector<int> face_ixs; // {vertex, tex coord, normal} triples, not yet normalized
+
+	obj_chunk_t() : begin(nullptr), end(nullptr) {}
+};
+
+// tokenizes a line aligned chunk of an object file into records that can be added to the model in file order;
+// Note: has no access to the model or vertex counts, so any command other than v/vt/vn/f is deferred to the serial pass
+class obj_chunk_reader_t : public object_file_reader {
+public:
+	obj_chunk_reader_t(string const &fn) : object_file_reader(fn) {}
+
+	void parse(obj_chunk_t &chunk) {
+		set_mem_range(chunk.begin, chunk.end);
+		char s[MAX_CHARS];
+
+		while (1) {
+			unsigned const cmd_start(unsigned(mem_pos - chunk.begin));
+			if (!read_string(s, MAX_CHARS)) break; // end of chunk
+			bool ok(1);
+
+			if (s[0] == '#') { // comment
+				read_to_newline(fp); // ignore
+				chunk.recs.emplace_back(obj_chunk_t::REC_COMMENT);
+			}
+			else if (strcmp(s, "f") == 0) { // face
+				size_t const prev_sz(chunk.face_ixs.size());
+				read_face_ixs(chunk.face_ixs);
+				chunk.recs.emplace_back(obj_chunk_t::REC_F, unsigned((chunk.face_ixs.size() - prev_sz)/3));
+			}
+			else if (strcmp(s, "v") == 0) { // vertex
+				point pt;
+				colorRGB color;
+				int color_ret(0);
+				ok = (read_point(pt) && (color_ret = read_optional_color_RGB(color)) != 2);
+
+				if (ok) {
+					chunk.pts.push_back(pt);
+					if (color_ret == 1) {chunk.colors.push_back(color);}
+					chunk.recs.emplace_back(obj_chunk_t::REC_V, color_ret);
+				}
+			}
+			else if (strcmp(s, "vt") == 0 || strcmp(s, "vn") == 0) { // tex coord or normal
+				bool const is_tc(s[1] == 't');
+				point pt;
+				ok = read_point(pt, (is_tc ? 2 : 3));
+
+				if (ok) {
+					chunk.pts.push_back(pt);
+					chunk.recs.emplace_back((is_tc ? obj_chunk_t::REC_VT : obj_chunk_t::REC_VN));
+				}
+			}
+			else {ok = 0;}
+
+			if (!ok) { // other command or error; the serial pass will re-read it from the start and report any errors
+				chunk.recs.emplace_back(obj_chunk_t::REC_CMD, cmd_start);
+				read_to_newline(fp);
+			}
+		} // while
+	}
+};
+
+
 class object_file_reader_model : public object_file_reader, public model_from_file_t {
 
 	bool had_empty_mat_error;
 
+	// state used while reading the object file
+	geom_xform_t const *xf;
+	int recalc_normals, cur_mat_id;
+	unsigned smoothing_group, prev_smoothing_group, num_objects, num_groups, obj_group_id, approx_line;
+	bool is_textured, had_npts_error;
+	vector<point> v; // vertices
+	vector<vector3d> n; // normals
+	// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
+	vector<counted_normal> vn; // vertex normals
+	vector<point2d<float> > tc; // texture coords
+	vector<colorRGB> colors; // vertex colors
+	vector<int> face_ixs;
+	deque<poly_data_block> pblocks;
+	set<string> loaded_mat_libs;
+	string material_name, mat_lib, group_name, object_name;
+
 	bool read_map_name(ifstream &in, string &name, float *scale=nullptr) {
 		if (!(in >> name)) {return 0;} // no name read (EOF?)
 		assert(!name.empty());
@@ -316,8 +441,257 @@ class object_file_reader_model : public object_file_reader, public model_from_fi
 		return 1;
 	}
 
+	void add_vertex(point const &pt, int color_ret, colorRGB const &color) {
+		v.push_back(pt);
+		if (recalc_normals) {vn.push_back(counted_normal());} // vertex normal
+
+		if (color_ret == 1) {
+			if (colors.empty()) {colors.resize(v.size()-1, WHITE);} // pad colors up to this point with white
+			colors.push_back(color);
+		}
+		else if (!colors.empty()) {colors.push_back(WHITE);} // color not specified, and in colors mode, pad with white
+		xf->xform_pos(v.back());
+	}
+	void add_normal(vector3d normal) {
+		if (recalc_normals) return;
+		xf->xform_pos_rm(normal);
+		n.push_back(normal);
+	}
+	void add_face(int const *ixs, unsigned num_verts) { // ixs are {vertex, tex coord, normal} triples as read from the file
+		unsigned const block_size = (1 << 18); // 256K
+		model.mark_mat_as_used(cur_mat_id);
+
+		if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
+			if (!pblocks.empty()) {
+				remove_excess_cap(pblocks.back().polys);
+				remove_excess_cap(pblocks.back().pts);
+			}
+			pblocks.push_back(poly_data_block());
+			prev_smoothing_group = smoothing_group;
+		}
+		poly_data_block &pb(pblocks.back());
+		pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
+		unsigned &npts(pb.polys.back().npts);
+		unsigned const pix((unsigned)pb.pts.size()), pts_start(pb.pts.size());
+
+		for (unsigned i = 0; i < num_verts; ++i) {
+			int vix(ixs[3*i]), tix(ixs[3*i+1]), nix(ixs[3*i+2]);
+			normalize_index(vix, (unsigned)v.size());
+			vntc_ix_t vntc_ix(vix, 0, 0);
+
+			if (tix != OBJ_NO_IX) {
+				normalize_index(tix, (unsigned)tc.size()-1); // account for tc[0]
+				vntc_ix.tix = tix+1; // account for tc[0]
+			}
+			if (nix != OBJ_NO_IX && !recalc_normals) {
+				normalize_index(nix, (unsigned)n.size()-1); // account for n[0]
+				vntc_ix.nix = nix+1; // account for n[0]
+			} // else the normal will be recalculated later
+			pb.pts.push_back(vntc_ix);
+			++npts;
+		} // for i
+		if (npts < 3) {
+			if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
+			pb.pts.resize(pts_start);
+			pb.polys.pop_back(); // remove pts and polygon
+			return; // skip it
+		}
+		vector3d &normal(pb.polys.back().n);
+				
+		for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
+			normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
+			// if we disable this normalize() we will weight normal contributions by polygon area,
+			// but we have to change the code below and it causes problems with vertex uniquing
+			normal.normalize();
+			if (normal != zero_vector) break; // got a good normal
+		}
+		if (recalc_normals) {
+			bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
+			float face_area(0.0);
+
+			if (face_weight_avg) {
+				point face_pts[4];
+				for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
+				face_area = polygon_area(face_pts, npts);
+			}
+			for (unsigned i = pix; i < pix+npts; ++i) {
+				unsigned const vix(pb.pts[i].vix);
+				assert((unsigned)vix < vn.size());
+				bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
+
+				if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
+					vn[vix] = zero_vector; // zero it out so that it becomes invalid later
+				}
+				else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
+				else {vn[vix].add_normal(normal);} // unweighted average of normals
+			}
+		}
+	}
+
+	// processes one command whose name has already been read into s; returns 0 on fatal error
+	bool proc_cmd(char *s) {
+		++approx_line;
+
+		if (s[0] == 0) {
+			cout << "empty/unparseable line?" << endl;
+		}
+		else if (s[0] == '#') { // comment
+			read_to_newline(fp); // ignore
+		}
+		else if (strcmp(s, "f") == 0) { // face
+			face_ixs.clear();
+			read_face_ixs(face_ixs);
+			add_face(face_ixs.data(), unsigned(face_ixs.size()/3));
+		}
+		else if (strcmp(s, "v") == 0) { // vertex
+			point pt;
+			
+			if (!read_point(pt)) {
+				cerr << "Error reading vertex from object file " << filename << " near line " << approx_line << endl;
+				return 0;
+			}
+			colorRGB color;
+			int const color_ret(read_optional_color_RGB(color));
+			if (color_ret == 2) {cerr << "Error reading vertex color from object file " << filename << " near line " << approx_line << endl; return 0;}
+			add_vertex(pt, color_ret, color);
+		}
+		else if (strcmp(s, "vt") == 0) { // tex coord
+			point tc3d;
+			
+			if (!read_point(tc3d, 2)) {
+				cerr << "Error reading texture coord from object file " << filename << " near line " << approx_line << endl;
+				return 0;
+			}
+			tc.push_back(point2d<float>(tc3d.x, tc3d.y)); // discard tc3d.z
+		}
+		else if (strcmp(s, "vn") == 0) { // normal
+			vector3d normal;
+			
+			if (!read_point(normal)) {
+				cerr << "Error reading normal from object file " << filename << " near line " << approx_line << endl;
+				return 0;
+			}
+			add_normal(normal);
+		}
+		else if (strcmp(s, "l") == 0) { // line
+			read_to_newline(fp); // ignore
+		}
+		else if (strcmp(s, "o") == 0) { // object definition
+			read_str_to_newline(fp, object_name); // can be empty?
+			++num_objects;
+			++obj_group_id;
+		}
+		else if (strcmp(s, "g") == 0) { // group
+			read_str_to_newline(fp, group_name); // can be empty
+			++num_groups;
+			++obj_group_id;
+		}
+		else if (strcmp(s, "s") == 0) { // smoothing/shading (off/on or 0/1)
+			if (!read_uint(smoothing_group)) {
+				if (!read_string(s, MAX_CHARS) || strcmp(s, "off") != 0) {
+					cerr << "Error reading smoothing group from object file " << filename << " near line " << approx_line << endl;
+					return 0;
+				}
+				smoothing_group = 0;
+			}
+		}
+		else if (strcmp(s, "usemtl") == 0) { // use material
+			read_str_to_newline(fp, material_name);
+
+			if (material_name.empty()) {
+				if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
+				had_empty_mat_error = 1;
+				return 0;
+			}
+			cur_mat_id = model.find_material(material_name);
+				
+			if (cur_mat_id >= 0) { // material was valid
+				int const tid(model.get_material(cur_mat_id).d_tid);
+				is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
+			}
+		}
+		else if (strcmp(s, "mtllib") == 0) { // material library
+			read_str_to_newline(fp, mat_lib);
+
+			if (mat_lib.empty()) {
+				cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
+				return 0;
+			}
+			if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
+				//return 0; // nonfatal
+			}
+		}
+		else {
+			cerr << "Error: Undefined entry '" << s << "' in object file " << filename << " near line " << approx_line << endl;
+			read_to_newline(fp); // ignore this line
+			//return 0;
+		}
+		return 1;
+	}
+
+	bool read_chunked() { // tokenizes line aligned chunks of the file in parallel, then adds them to the model in file order
+		vector<char> data;
+		if (!read_file_to_mem(data)) return 0;
+		if (data.empty()) return 1; // empty file
+		char const *const dbegin(data.data()), *const dend(dbegin + data.size());
+		unsigned const max_chunks(4*get_job_system().get_num_threads()), num_chunks(max(1U, min(max_chunks, unsigned(data.size() >> 20)))); // ~1MB per chunk
+		vector<obj_chunk_t> chunks(num_chunks);
+		char const *cur(dbegin);
+
+		for (unsigned i = 0; i < num_chunks; ++i) { // split at line boundaries, skipping escaped newlines
+			char const *end((i+1 == num_chunks) ? dend : max(cur, dbegin + (data.size()*(i+1))/num_chunks));
+			while (end < dend && (*end != '\n' || (end > dbegin && end[-1] == '\\'))) {++end;}
+			if (end < dend) {++end;} // include the newline
+			chunks[i].begin = cur;
+			chunks[i].end   = cur = end;
+		}
+		parallel_for(0, num_chunks, [&](int i) {obj_chunk_reader_t(filename).parse(chunks[i]);}, (num_chunks > 1), 1);
+		char s[MAX_CHARS];
+		bool ret(1);
+
+		for (auto c = chunks.begin(); c != chunks.end() && ret; ++c) {
+			unsigned pix(0), cix(0), fix(0);
+
+			for (auto r = c->recs.begin(); r != c->recs.end() && ret; ++r) {
+				switch (r->type) {
+				case obj_chunk_t::REC_V:
+					++approx_line;
+					add_vertex(c->pts[pix++], r->data, ((r->data == 1) ? c->colors[cix++] : colorRGB()));
+					break;
+				case obj_chunk_t::REC_VT:
+					++approx_line;
+					tc.push_back(point2d<float>(c->pts[pix].x, c->pts[pix].y)); // discard z
+					++pix;
+					break;
+				case obj_chunk_t::REC_VN:
+					++approx_line;
+					add_normal(c->pts[pix++]);
+					break;
+				case obj_chunk_t::REC_F:
+					++approx_line;
+					add_face(c->face_ixs.data() + 3*fix, r->data);
+					fix += r->data;
+					break;
+				case obj_chunk_t::REC_COMMENT:
+					++approx_line;
+					break;
+				case obj_chunk_t::REC_CMD: // everything else is handled serially by re-reading the command from memory
+					set_mem_range(c->begin + r->data, c->end);
+					if (read_string(s, MAX_CHARS)) {ret = proc_cmd(s);}
+					break;
+				default: assert(0);
+				}
+			} // for r
+			clear_cont(c->recs); clear_cont(c->pts); clear_cont(c->colors); clear_cont(c->face_ixs);
+		} // for c
+		mem_pos = mem_end = NULL;
+		return ret;
+	}
+
 public:
-	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0) {}
+	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0),
+		xf(nullptr), recalc_normals(0), cur_mat_id(-1), smoothing_group(0), prev_smoothing_group(0), num_objects(0), num_groups(0), obj_group_id(0),
+		approx_line(0), is_textured(0), had_npts_error(0) {}
 
 	bool load_mat_lib(string const &fn) { // Note: could cache filename, but seems to never be included more than once
 		ifstream mat_in;
@@ -529,209 +903,27 @@ public:
 		return 1;
 	}
 
-	bool read(geom_xform_t const &xf, int recalc_normals, bool verbose) {
+	bool read(geom_xform_t const &xf_, int recalc_normals_, bool verbose) {
 		RESET_TIME;
-		if (!open_file()) return 0;
-		cout << "Reading object file " << filename << endl;
-		unsigned const block_size = (1 << 18); // 256K
-		int cur_mat_id(-1);
-		unsigned smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0);
-		vector<point> v; // vertices
-		vector<vector3d> n; // normals
-		// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
-		vector<counted_normal> vn; // vertex normals
-		vector<point2d<float> > tc; // texture coords
-		vector<colorRGB> colors; // vertex colors
-		deque<poly_data_block> pblocks;
-		set<string> loaded_mat_libs;
-		char s[MAX_CHARS];
-		string material_name, mat_lib, group_name, object_name;
+		xf = &xf_;
+		recalc_normals = recalc_normals_;
+		unsigned num_faces(0);
 		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
 		n.push_back(zero_vector); // default normal
-		unsigned approx_line(0);
-		bool is_textured(0), had_npts_error(0);
-
-		while (read_string(s, MAX_CHARS)) {
-			++approx_line;
-
-			if (s[0] == 0) {
-				cout << "empty/unparseable line?" << endl;
-				continue;
-			}
-			else if (s[0] == '#') { // comment
-				read_to_newline(fp); // ignore
-			}
-			else if (strcmp(s, "f") == 0) { // face
-				model.mark_mat_as_used(cur_mat_id);
-
-				if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
-					if (!pblocks.empty()) {
-						remove_excess_cap(pblocks.back().polys);
-						remove_excess_cap(pblocks.back().pts);
-					}
-					pblocks.push_back(poly_data_block());
-					prev_smoothing_group = smoothing_group;
-				}
-				poly_data_block &pb(pblocks.back());
-				pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
-				unsigned &npts(pb.polys.back().npts);
-				unsigned const pix((unsigned)pb.pts.size()), pts_start(pb.pts.size());
-				int vix(0), tix(0), nix(0);
-
-				while (read_int(vix)) { // read vertex index
-					normalize_index(vix, (unsigned)v.size());
-					vntc_ix_t vntc_ix(vix, 0, 0);
-					int const c(get_next_char());
-
-					if (c == '/') {
-						if (read_int(tix)) { // read text coord index
-							normalize_index(tix, (unsigned)tc.size()-1); // account for tc[0]
-							vntc_ix.tix = tix+1; // account for tc[0]
-						}
-						int const c2(get_next_char());
 
-						if (c2 == '/') {
-							if (read_int(nix) && !recalc_normals) { // read normal index
-								normalize_index(nix, (unsigned)n.size()-1); // account for n[0]
-								vntc_ix.nix = nix+1; // account for n[0]
-							} // else the normal will be recalculated later
-						}
-						else {unget_last_char(c2);}
-					}
-					else {unget_last_char(c);}
-					pb.pts.push_back(vntc_ix);
-					++npts;
-				} // end while vertex
-				if (npts < 3) {
-					if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
-					pb.pts.resize(pts_start);
-					pb.polys.pop_back(); // remove pts and polygon
-					continue; // skip it
-				}
-				vector3d &normal(pb.polys.back().n);
-				
-				for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
-					normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
-					// if we disable this normalize() we will weight normal contributions by polygon area,
-					// but we have to change the code below and it causes problems with vertex uniquing
-					normal.normalize();
-					if (normal != zero_vector) break; // got a good normal
-				}
-				if (recalc_normals) {
-					bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
-					float face_area(0.0);
-
-					if (face_weight_avg) {
-						point face_pts[4];
-						for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
-						face_area = polygon_area(face_pts, npts);
-					}
-					for (unsigned i = pix; i < pix+npts; ++i) {
-						unsigned const vix(pb.pts[i].vix);
-						assert((unsigned)vix < vn.size());
-						bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
-
-						if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
-							vn[vix] = zero_vector; // zero it out so that it becomes invalid later
-						}
-						else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
-						else {vn[vix].add_normal(normal);} // unweighted average of normals
-					}
-				}
-			}
-			else if (strcmp(s, "v") == 0) { // vertex
-				v.push_back(point());
-				if (recalc_normals) {vn.push_back(counted_normal());} // vertex normal
-			
-				if (!read_point(v.back())) {
-					cerr << "Error reading vertex from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				colorRGB color;
-				int const color_ret(read_optional_color_RGB(color));
-				if (color_ret == 2) {cerr << "Error reading vertex color from object file " << filename << " near line " << approx_line << endl; return 0;}
-				else if (color_ret == 1) {
-					if (colors.empty()) {colors.resize(v.size()-1, WHITE);} // pad colors up to this point with white
-					colors.push_back(color);
-				}
-				else if (!colors.empty()) {colors.push_back(WHITE);} // color not specified, and in colors mode, pad with white
-				xf.xform_pos(v.back());
-			}
-			else if (strcmp(s, "vt") == 0) { // tex coord
-				point tc3d;
-			
-				if (!read_point(tc3d, 2)) {
-					cerr << "Error reading texture coord from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				tc.push_back(point2d<float>(tc3d.x, tc3d.y)); // discard tc3d.z
-			}
-			else if (strcmp(s, "vn") == 0) { // normal
-				vector3d normal;
-			
-				if (!read_point(normal)) {
-					cerr << "Error reading normal from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				if (!recalc_normals) {
-					xf.xform_pos_rm(normal);
-					n.push_back(normal);
-				}
-			}
-			else if (strcmp(s, "l") == 0) { // line
-				read_to_newline(fp); // ignore
-			}
-			else if (strcmp(s, "o") == 0) { // object definition
-				read_str_to_newline(fp, object_name); // can be empty?
-				++num_objects;
-				++obj_group_id;
-			}
-			else if (strcmp(s, "g") == 0) { // group
-				read_str_to_newline(fp, group_name); // can be empty
-				++num_groups;
-				++obj_group_id;
-			}
-			else if (strcmp(s, "s") == 0) { // smoothing/shading (off/on or 0/1)
-				if (!read_uint(smoothing_group)) {
-					if (!read_string(s, MAX_CHARS) || strcmp(s, "off") != 0) {
-						cerr << "Error reading smoothing group from object file " << filename << " near line " << approx_line << endl;
-						return 0;
-					}
-					smoothing_group = 0;
-				}
-			}
-			else if (strcmp(s, "usemtl") == 0) { // use material
-				read_str_to_newline(fp, material_name);
-
-				if (material_name.empty()) {
-					if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
-					had_empty_mat_error = 1;
-					return 0;
-				}
-				cur_mat_id = model.find_material(material_name);
-				
-				if (cur_mat_id >= 0) { // material was valid
-					int const tid(model.get_material(cur_mat_id).d_tid);
-					is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
-				}
-			}
-			else if (strcmp(s, "mtllib") == 0) { // material library
-				read_str_to_newline(fp, mat_lib);
+		if (parallel_obj_file_parse) {
+			cout << "Reading object file " << filename << endl;
+			if (!read_chunked()) return 0;
+		}
+		else {
+			if (!open_file()) return 0;
+			cout << "Reading object file " << filename << endl;
+			char s[MAX_CHARS];
 
-				if (mat_lib.empty()) {
-					cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
-					//return 0; // nonfatal
-				}
+			while (read_string(s, MAX_CHARS)) {
+				if (!proc_cmd(s)) return 0;
 			}
-			else {
-				cerr << "Error: Undefined entry '" << s << "' in object file " << filename << " near line " << approx_line << endl;
-				read_to_newline(fp); // ignore this line
-				//return 0;
-			}
-		} // while
+		}
 		remove_excess_cap(v);
 		remove_excess_cap(n);
 		remove_excess_cap(tc);
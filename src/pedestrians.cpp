@@ -3,6 +3,7 @@
 // 12/6/18
 #include "city.h"
 #include "shaders.h"
+#include "job_system.h"
 
 float const PED_WIDTH_SCALE  = 0.5; // ratio of collision radius to model radius (x/y)
 float const PED_HEIGHT_SCALE = 2.5; // ratio of collision radius to model height (z)
@@ -123,53 +124,77 @@ void register_ped_coll(pedestrian_t &p1, pedestrian_t &p2, unsigned pid1, unsign
 	p2.collided = p2.ped_coll = 1; p2.colliding_ped = pid1;
 }
 
-bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force) {
+// returns 1 if colliding with the other ped, otherwise accumulates an avoidance force if the peds are converging
+bool pedestrian_t::add_ped_avoid_force(point const &opos, vector3d const &ovel, float oradius, float prox_radius_sq, vector3d &force) const {
+	float const dist_sq(p2p_dist_xy_sq(pos, opos));
+	if (dist_sq > prox_radius_sq) return 0; // proximity test
+	float const r_sum(0.6f*(radius + oradius)); // using a smaller radius to allow peds to get close to each other
+	if (dist_sq < r_sum*r_sum) return 1; // collision
+	if (speed < TOLERANCE) return 0;
+	vector3d const delta_v(vel - ovel), delta_p((pos.x - opos.x), (pos.y - opos.y), 0.0);
+	float const dp(-dot_product_xy(delta_v, delta_p));
+	if (dp <= 0.0) return 0; // diverging, no avoidance needed
+	float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
+	if (dv_mag < TOLERANCE) return 0;
+	vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
+	float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
+	if (rmag < TOLERANCE) return 0;
+	float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
+	force += rejection*(rel_vel*force_mult*fmag/rmag);
+	//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
+	return 0;
+}
+
+bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned ped_end, unsigned target_plot, float prox_radius, vector3d &force) {
+	assert(ped_end <= peds.size());
 	float const prox_radius_sq(prox_radius*prox_radius);
 
-	for (auto i = peds.begin()+ped_start; i != peds.end(); ++i) { // check every ped until we exit target_plot
-		if (i->plot != target_plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
-		float const dist_sq(p2p_dist_xy_sq(pos, i->pos));
-		if (dist_sq > prox_radius_sq) continue; // proximity test
-		float const r_sum(0.6f*(radius + i->radius)); // using a smaller radius to allow peds to get close to each other
-		if (dist_sq < r_sum*r_sum) {register_ped_coll(*this, *i, pid, (i - peds.begin())); return 1;} // collision
-		if (speed < TOLERANCE) continue;
-		vector3d const delta_v(vel - i->vel), delta_p((pos.x - i->pos.x), (pos.y - i->pos.y), 0.0);
-		float const dp(-dot_product_xy(delta_v, delta_p));
-		if (dp <= 0.0) continue; // diverging, no avoidance needed
-		float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
-		if (dv_mag < TOLERANCE) continue;
-		vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
-		float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
-		if (rmag < TOLERANCE) continue;
-		float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
-		force += rejection*(rel_vel*force_mult*fmag/rmag);
-		//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
-	} // for i
+	for (unsigned i = ped_start; i < ped_end; ++i) { // check every ped until we exit target_plot
+		pedestrian_t &ped(peds[i]);
+		if (ped.plot != target_plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
+		if (add_ped_avoid_force(ped.pos, ped.vel, ped.radius, prox_radius_sq, force)) {register_ped_coll(*this, ped, pid, i); return 1;} // collision
+	}
+	return 0;
+}
+
+// peds in other plots may be updated concurrently, so use their state from the start of the frame and defer collision updates to them
+bool pedestrian_t::check_ped_ped_coll_adj_plot(ped_update_ctx_t &ctx, unsigned pid, unsigned ped_start, unsigned ped_end, unsigned target_plot, float prox_radius, vector3d &force) {
+	assert(ped_end <= ctx.snapshot.size());
+	float const prox_radius_sq(prox_radius*prox_radius);
+
+	for (unsigned i = ped_start; i < ped_end; ++i) {
+		ped_snapshot_t const &ped(ctx.snapshot[i]);
+		if (ped.plot != target_plot) break; // moved to a new plot, done
+		if (!add_ped_avoid_force(ped.pos, ped.vel, ped.radius, prox_radius_sq, force)) continue;
+		collided = ped_coll = 1; colliding_ped = i;
+		ctx.deferred_colls.emplace_back(i, pid);
+		return 1;
+	}
 	return 0;
 }
 
-bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir) {
+bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, ped_update_ctx_t &ctx, float delta_dir) {
 	assert(pid < peds.size());
 	float const timestep(2.0*TICKS_PER_SECOND), lookahead_dist(timestep*speed); // how far we can travel in 2s
 	float const prox_radius(1.2*radius + lookahead_dist); // assume other ped has a similar radius
 	vector3d force(zero_vector);
-	if (check_ped_ped_coll_range(peds, pid, pid+1, plot, prox_radius, force)) return 1;
+	if (check_ped_ped_coll_range(peds, pid, pid+1, ctx.ped_end, plot, prox_radius, force)) return 1;
 
 	if (in_the_road && next_plot != plot) {
 		// need to check for coll between two peds crossing the street from different sides, since they won't be in the same plot while in the street
-		unsigned const ped_ix(ped_mgr.get_first_ped_at_plot(next_plot));
-		assert(ped_ix <= peds.size()); // could be at the end
-		if (check_ped_ped_coll_range(peds, pid, ped_ix, next_plot, prox_radius, force)) return 1;
+		unsigned const ped_ix(ped_mgr.get_first_ped_at_plot(next_plot)), ped_end(ped_mgr.get_first_ped_at_plot(next_plot+1));
+		assert(ped_ix <= ped_end && ped_end <= peds.size()); // could be at the end
+		if (check_ped_ped_coll_adj_plot(ctx, pid, ped_ix, ped_end, next_plot, prox_radius, force)) return 1;
 	}
 	if (force != zero_vector) {set_velocity((0.1*delta_dir)*force + ((1.0 - delta_dir)/speed)*vel);} // apply ped repulsive force
 	return 0;
 }
 
-bool pedestrian_t::check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid) {
-	assert(pid < peds.size());
+bool pedestrian_t::check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_end) {
+	assert(pid < peds.size() && ped_end <= peds.size());
 
 	// Note: shouldn't have to check peds in the next plot, assuming that if we're stopped, they likely are as well, and won't be walking toward us
-	for (auto i = peds.begin()+pid+1; i != peds.end(); ++i) { // check every ped until we exit target_plot
+	for (auto i = peds.begin()+pid+1; i != peds.begin()+ped_end; ++i) { // check every ped until we exit target_plot
 		if (i->plot != plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
 		if (!dist_xy_less_than(pos, i->pos, 0.6f*(radius + i->radius))) continue; // no collision
 		i->collided = i->ped_coll = 1; i->colliding_ped = pid;
@@ -469,17 +494,11 @@ void pedestrian_t::move(ped_manager_t const &ped_mgr, cube_t const &plot_bcube,
 	anim_time += timestep*speed;
 }
 
-void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, rand_gen_t &rgen, float delta_dir) {
+// Note: destination and crosswalk updates, which modify shared state, are done serially by the caller
+void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, ped_update_ctx_t &ctx, float delta_dir) {
 	if (destroyed) return; // destroyed
 	if (speed == 0.0) return; // not moving, no update needed
 	//assert(!is_nan(pos));
-
-	// navigation with destination
-	if (at_dest) {
-		register_at_dest();
-		ped_mgr.choose_new_ped_plot_pos(*this);
-	}
-	if (at_crosswalk) {ped_mgr.mark_crosswalk_in_use(*this);}
 	// movement logic
 	cube_t const &plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, plot));
 	cube_t const &next_plot_bcube(ped_mgr.get_city_plot_bcube_for_peds(city, next_plot));
@@ -492,7 +511,7 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			go(); // back up or turn so that we don't walk forward into the street? move() should attempt to rotate in place
 		}
 		else {
-			check_ped_ped_coll_stopped(peds, pid); // still need to check for other peds colliding with us; this doesn't always work
+			check_ped_ped_coll_stopped(peds, pid, ctx.ped_end); // still need to check for other peds colliding with us; this doesn't always work
 			collided = ped_coll = 0;
 			return;
 		}
@@ -505,7 +524,7 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 	else if (!check_inside_plot(ped_mgr, prev_pos, plot_bcube, next_plot_bcube)) {collided = outside_plot = 1;} // outside the plot, treat as a collision with the plot bounds
 	else if (!is_valid_pos(colliders, at_dest, &ped_mgr)) {collided = 1;} // collided with a static collider
 	else if (check_road_coll(ped_mgr, plot_bcube, next_plot_bcube)) {collided = 1;} // collided with something in the road (stoplight, streetlight, etc.)
-	else if (check_ped_ped_coll(ped_mgr, peds, pid, delta_dir)) {collided = 1;} // collided with another pedestrian
+	else if (check_ped_ped_coll(ped_mgr, peds, pid, ctx, delta_dir)) {collided = 1;} // collided with another pedestrian
 	else { // no collisions
 		//cout << TXT(pid) << TXT(plot) << TXT(dest_plot) << TXT(next_plot) << TXT(at_dest) << TXT(delta_dir) << TXT((unsigned)stuck_count) << TXT(collided) << endl;
 		vector3d dest_pos(get_dest_pos(plot_bcube, next_plot_bcube, ped_mgr));
@@ -520,12 +539,12 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			}
 			// run only every several frames to reduce runtime; also run when at dest and when close to the current target pos or at the destination
 			if (at_dest || update_path) {
-				get_avoid_cubes(ped_mgr, colliders, dest_pos, ped_mgr.path_finder.get_avoid_vector());
+				get_avoid_cubes(ped_mgr, colliders, dest_pos, ctx.path_finder.get_avoid_vector());
 				target_pos = all_zeros;
 				cube_t union_plot_bcube(plot_bcube);
 				union_plot_bcube.union_with_cube(next_plot_bcube); // this is the area the ped is constrained to (both plots + road in between)
 				// run path finding between pos and dest_pos using avoid cubes
-				if (ped_mgr.path_finder.run(pos, dest_pos, union_plot_bcube, 0.1*radius, dest_pos)) {target_pos = dest_pos;}
+				if (ctx.path_finder.run(pos, dest_pos, union_plot_bcube, 0.1*radius, dest_pos)) {target_pos = dest_pos;}
 			}
 			else if (target_valid()) {dest_pos = target_pos;} // use previous frame's dest if valid
 			vector3d dest_dir((dest_pos.x - pos.x), (dest_pos.y - pos.y), 0.0); // zval=0, not normalized
@@ -552,16 +571,16 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 		if (++stuck_count > 8) {
 			if (target_valid()) {pos += (0.1*radius)*(target_pos - pos).get_norm();} // move toward target_pos if it's valid since this should be a good direction
 			else if (stuck_count > 100) {pos += (0.1*radius)*(get_dest_pos(plot_bcube, next_plot_bcube, ped_mgr) - pos).get_norm();} // move toward dest if stuck count is high
-			else {pos += rgen.signed_rand_vector_spherical_xy()*(0.1*radius); } // shift randomly by 10% radius to get unstuck
+			else {pos += ctx.rgen.signed_rand_vector_spherical_xy()*(0.1*radius); } // shift randomly by 10% radius to get unstuck
 		}
 		if (ped_coll) {
-			assert(colliding_ped < peds.size());
-			vector3d const coll_dir(peds[colliding_ped].pos - pos);
+			assert(colliding_ped < ctx.snapshot.size());
+			vector3d const coll_dir(ctx.snapshot[colliding_ped].pos - pos); // the colliding ped may be in another plot
 			new_dir = cross_product(vel, plus_z);
 			if (dot_product_xy(new_dir, coll_dir) > 0.0) {new_dir = -new_dir;} // orient away from the other ped
 		}
 		else { // static object collision (should be rare if path_finder does a good job)
-			new_dir = rgen.signed_rand_vector_spherical_xy(); // try a random new direction
+			new_dir = ctx.rgen.signed_rand_vector_spherical_xy(); // try a random new direction
 			if (dot_product_xy(vel, new_dir) > 0.0) {new_dir *= -1.0;} // negate if pointing in the same dir
 		}
 		set_velocity(new_dir);
@@ -757,14 +776,31 @@ void ped_manager_t::register_ped_new_plot(pedestrian_t const &ped) {
 	if (!need_to_sort_city.empty()) {need_to_sort_city[ped.city] = 1;}
 	need_to_sort_peds = 1;
 }
-void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) {
+void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) { // Note: called in parallel; the move is registered by next_frame() after the update
 	if (ped.next_plot == ped.plot) return; // already there (error?)
-	ped.plot = ped.next_plot; // assumes plot is adjacent; doesn't actually do any moving, only registers the move
-	register_ped_new_plot(ped);
+	ped.plot = ped.next_plot; // assumes plot is adjacent; doesn't actually do any moving
+}
+
+void ped_manager_t::update_peds_in_plot(unsigned plot, unsigned frame_seed, float delta_dir) {
+	static thread_local path_finder_t path_finder; // path finding state is reused across peds
+	unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
+	deferred_ped_colls[plot].clear();
+	if (ped_start == ped_end) return; // no peds
+	ped_update_ctx_t ctx(peds_snapshot, deferred_ped_colls[plot], path_finder, ped_end);
+	ctx.rgen.set_state(frame_seed, plot+1); // seed by plot so that results don't depend on the number of threads
+	ctx.rgen.rand_mix();
+	bool changed(0);
+
+	for (unsigned i = ped_start; i < ped_end; ++i) {
+		peds[i].next_frame(*this, peds, i, ctx, delta_dir);
+		changed |= (peds[i].plot != plot);
+	}
+	plot_changed[plot] = changed;
 }
 
 void ped_manager_t::next_frame() {
 	if (!animate2 || peds.empty()) return; // nothing to do
+	PROFILE_SCOPE("City Peds Update");
 	//timer_t timer("Ped Update"); // ~3.9ms for 10K peds
 
 	// Note: should make sure this is after sorting cars, so that road_ix values are actually in order; however, that makes things slower, and is unlikely to make a difference
@@ -778,7 +814,31 @@ void ped_manager_t::next_frame() {
 	if (first_frame) { // choose initial ped destinations (must be after building setup, etc.)
 		for (auto i = peds.begin(); i != peds.end(); ++i) {choose_dest_building_or_parked_car(*i);}
 	}
-	for (auto i = peds.begin(); i != peds.end(); ++i) {i->next_frame(*this, peds, (i - peds.begin()), rgen, delta_dir);}
+	for (auto i = peds.begin(); i != peds.end(); ++i) { // serial pass for updates that use rgen or modify city state
+		if (i->destroyed || i->speed == 0.0) continue;
+
+		if (i->at_dest) { // navigation with destination
+			i->register_at_dest();
+			choose_new_ped_plot_pos(*i);
+		}
+		if (i->at_crosswalk) {mark_crosswalk_in_use(*i);}
+	}
+	// parallel update by plot; peds read other plots from the snapshot and only write to their own plot
+	unsigned const num_plots(by_plot.size() - 1), frame_seed(rgen.rand());
+	peds_snapshot.resize(peds.size());
+	for (unsigned i = 0; i < peds.size(); ++i) {peds_snapshot[i] = ped_snapshot_t(peds[i]);}
+	deferred_ped_colls.resize(num_plots);
+	plot_changed.resize(num_plots, 0);
+	parallel_for(0, num_plots, [&](int plot) {update_peds_in_plot(plot, frame_seed, delta_dir);}, (peds.size() >= 1000)); // only for larger ped counts
+
+	for (unsigned plot = 0; plot < num_plots; ++plot) { // apply updates to other plots serially in plot order
+		for (auto i = deferred_ped_colls[plot].begin(); i != deferred_ped_colls[plot].end(); ++i) {
+			pedestrian_t &ped(peds[i->first]);
+			ped.collided = ped.ped_coll = 1; ped.colliding_ped = i->second; // handled in the next frame
+		}
+		if (!plot_changed[plot]) continue;
+		for (unsigned i = by_plot[plot]; i < by_plot[plot+1]; ++i) {if (peds[i].plot != plot) {register_ped_new_plot(peds[i]);}}
+	}
 	if (need_to_sort_peds) {sort_by_city_and_plot();}
 	first_frame = 0;
 }
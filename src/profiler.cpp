@@ -3,8 +3,22 @@
 // 4/20/13
 
 #include "3DWorld.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
 
 using std::string;
+using std::multimap;
+
+unsigned const PROF_MAX_THREADS  = 64;    // threads that record zones; buffers of exited threads are reused
+unsigned const PROF_RING_SIZE    = 16384; // zone events per thread between frame collections; older events are dropped
+unsigned const PROF_MAX_DEPTH    = 32;    // deeper zones are counted for nesting but not recorded
+unsigned const PROF_MAX_TRACE_EV = (1<<20); // max zone events kept for trace export, about 40MB
+
+bool profiler_zones_enabled(0);
+extern string profiler_trace_fn;
 
 
 class timing_profiler {
@@ -17,6 +31,7 @@ class timing_profiler {
 	};
 
 	map<string, entry_t> entries;
+	std::mutex entries_mutex; // may be called from job threads
 
 public:
 	bool enabled;
@@ -25,6 +40,8 @@ public:
 	void clear() {entries.clear();}
 
 	void register_time(const char *str, int delta_time) {
+		std::lock_guard<std::mutex> lock(entries_mutex);
+
 		if (enabled) {
 			entries[str].add(delta_time);
 		}
@@ -48,17 +65,309 @@ public:
 timing_profiler global_profiler;
 
 
+// *** hierarchical zone profiler ***
+
+
+typedef std::chrono::steady_clock prof_clock_t;
+prof_clock_t::time_point const prof_epoch(prof_clock_t::now());
+
+uint64_t get_prof_time_ns() {return std::chrono::duration_cast<std::chrono::nanoseconds>(prof_clock_t::now() - prof_epoch).count();}
+
+
+struct zone_event_t {
+	char const *name;
+	uint64_t start_ns, end_ns, path, parent_path; // path is a hash of the names of this zone and all of its parents on this thread
+};
+
+uint64_t get_zone_path(uint64_t parent_path, char const *name) { // FNV-1a
+	uint64_t h(parent_path ^ 14695981039346656037ULL);
+	for (char const *c = name; *c; ++c) {h ^= (uint8_t)*c; h *= 1099511628211ULL;}
+	return (h ? h : 1); // 0 is reserved for the root
+}
+
+struct zone_thread_buf_t { // ring buffer with a single producer (the owning thread) and a single consumer (the thread that calls timing_profiler_next_frame())
+	zone_event_t events[PROF_RING_SIZE];
+	std::atomic<uint64_t> write_pos;
+	std::atomic<bool> in_use;
+	uint64_t read_pos; // consumer only
+	unsigned depth, tid; // producer only
+	char const *names[PROF_MAX_DEPTH];
+	uint64_t start_times[PROF_MAX_DEPTH], paths[PROF_MAX_DEPTH];
+
+	zone_thread_buf_t(unsigned tid_) : write_pos(0), in_use(1), read_pos(0), depth(0), tid(tid_) {}
+
+	void push(zone_event_t const &e) {
+		uint64_t const wpos(write_pos.load(std::memory_order_relaxed));
+		events[wpos % PROF_RING_SIZE] = e;
+		write_pos.store(wpos+1, std::memory_order_release);
+	}
+	// appends events written since the last call to out; returns the number of events dropped because the producer got too far ahead
+	uint64_t drain(vector<zone_event_t> &out) {
+		uint64_t const wpos(write_pos.load(std::memory_order_acquire)), first(max(read_pos, ((wpos > PROF_RING_SIZE) ? (wpos - PROF_RING_SIZE) : 0)));
+		size_t const out_start(out.size());
+		for (uint64_t i = first; i < wpos; ++i) {out.push_back(events[i % PROF_RING_SIZE]);}
+		// events that were overwritten by the producer during the copy are invalid
+		uint64_t const wpos2(write_pos.load(std::memory_order_acquire)), valid_start((wpos2 > PROF_RING_SIZE) ? (wpos2 - PROF_RING_SIZE) : 0);
+		uint64_t const num_invalid((valid_start > first) ? min((valid_start - first), (wpos - first)) : 0);
+		out.erase(out.begin()+out_start, out.begin()+out_start+num_invalid);
+		uint64_t const num_dropped((first - read_pos) + num_invalid);
+		read_pos = wpos;
+		return num_dropped;
+	}
+};
+
+std::atomic<zone_thread_buf_t *> thread_bufs[PROF_MAX_THREADS]; // allocated on first use and never freed
+std::atomic<unsigned> num_thread_bufs(0);
+
+struct thread_buf_owner_t { // releases the thread's buffer for reuse when the thread exits
+	zone_thread_buf_t *buf;
+	thread_buf_owner_t() : buf(nullptr) {}
+	~thread_buf_owner_t() {if (buf) {buf->in_use.store(0);}}
+};
+thread_local thread_buf_owner_t thread_buf_owner;
+
+zone_thread_buf_t *get_thread_buf() {
+
+	zone_thread_buf_t *&buf(thread_buf_owner.buf);
+	if (buf) return buf;
+	unsigned const num(min(num_thread_bufs.load(), PROF_MAX_THREADS));
+
+	for (unsigned i = 0; i < num; ++i) { // try to reuse the buffer of an exited thread
+		zone_thread_buf_t *const b(thread_bufs[i].load(std::memory_order_acquire));
+		bool expected(0);
+		if (b && b->in_use.compare_exchange_strong(expected, 1)) {buf = b; return buf;}
+	}
+	unsigned const tid(num_thread_bufs.fetch_add(1));
+	if (tid >= PROF_MAX_THREADS) return nullptr; // too many threads; this thread's zones are ignored
+	buf = new zone_thread_buf_t(tid);
+	thread_bufs[tid].store(buf, std::memory_order_release);
+	return buf;
+}
+
+void profile_zone_begin(char const *name) {
+
+	zone_thread_buf_t *const buf(get_thread_buf());
+	if (!buf) return;
+
+	unsigned const d(buf->depth);
+
+	if (d < PROF_MAX_DEPTH) {
+		buf->names      [d] = name;
+		buf->paths      [d] = get_zone_path(((d > 0) ? buf->paths[d-1] : 0), name);
+		buf->start_times[d] = get_prof_time_ns();
+	}
+	++buf->depth;
+}
+
+void profile_zone_end() {
+
+	zone_thread_buf_t *const buf(get_thread_buf());
+	if (!buf || buf->depth == 0) return;
+	unsigned const d(--buf->depth);
+	if (d >= PROF_MAX_DEPTH) return;
+	zone_event_t const e = {buf->names[d], buf->start_times[d], get_prof_time_ns(), buf->paths[d], ((d > 0) ? buf->paths[d-1] : 0)};
+	buf->push(e);
+}
+
+
+void write_json_str(std::ostream &out, char const *str) {
+	out << '"';
+	for (char const *c = str; *c; ++c) {if (*c == '"' || *c == '\\') {out << '\\';} out << *c;}
+	out << '"';
+}
+
+
+class zone_profiler_t {
+
+	struct zone_stats_t {
+		string name;
+		unsigned count;
+		uint64_t parent_path, total_ns, max_ns, frame_ns;
+		vector<float> frame_ms; // per-frame totals for the frames this zone was active in
+		zone_stats_t() : count(0), parent_path(0), total_ns(0), max_ns(0), frame_ns(0) {}
+	};
+	struct trace_event_t {
+		char const *name;
+		uint64_t start_ns, dur_ns;
+		unsigned tid;
+	};
+	map<uint64_t, zone_stats_t> zones; // indexed by path, so zones with the same name under different parents are separate
+	vector<float> frame_ms;
+	vector<trace_event_t> trace;
+	vector<zone_event_t> events; // temp space
+	uint64_t last_frame_ns, num_dropped;
+
+	static void get_percentiles(vector<float> &v, float &p50, float &p95, float &vmax) {
+		if (v.empty()) {p50 = p95 = vmax = 0.0; return;}
+		sort(v.begin(), v.end());
+		p50  = v[v.size()/2];
+		p95  = v[min(v.size()-1, (95*v.size())/100)];
+		vmax = v.back();
+	}
+	void print_zone(uint64_t path, zone_stats_t &z, multimap<uint64_t, uint64_t> const &kids, unsigned depth) {
+		float p50(0.0), p95(0.0), vmax(0.0);
+		get_percentiles(z.frame_ms, p50, p95, vmax);
+		cout << string(2*depth, ' ') << z.name << ": " << z.count << "\t" << 1.0E-6*z.total_ns << "\t" << 1.0E-6*z.max_ns << "\t"
+			 << 1.0E-6*z.total_ns/z.count << "\t" << p50 << "\t" << p95 << "\t" << vmax << endl;
+		auto const range(kids.equal_range(path));
+		for (auto i = range.first; i != range.second; ++i) {print_zone(i->second, zones[i->second], kids, depth+1);}
+	}
+
+public:
+	zone_profiler_t() : last_frame_ns(0), num_dropped(0) {}
+
+	void next_frame(bool record_trace) {
+		uint64_t const now(get_prof_time_ns());
+		events.clear();
+		unsigned const num_bufs(min(num_thread_bufs.load(), PROF_MAX_THREADS));
+
+		for (unsigned t = 0; t < num_bufs; ++t) {
+			zone_thread_buf_t *const buf(thread_bufs[t].load(std::memory_order_acquire));
+			if (!buf) continue;
+			size_t const start(events.size());
+			num_dropped += buf->drain(events);
+
+			if (record_trace) {
+				for (auto e = events.begin()+start; e != events.end() && trace.size() < PROF_MAX_TRACE_EV; ++e) {
+					trace_event_t const te = {e->name, e->start_ns, (e->end_ns - e->start_ns), buf->tid};
+					trace.push_back(te);
+				}
+			}
+		}
+		for (auto e = events.begin(); e != events.end(); ++e) {
+			zone_stats_t &z(zones[e->path]);
+			uint64_t const dur(e->end_ns - e->start_ns);
+			if (z.count == 0) {z.name = e->name; z.parent_path = e->parent_path;}
+			++z.count;
+			z.total_ns += dur;
+			z.frame_ns += dur;
+			z.max_ns    = max(z.max_ns, dur);
+		}
+		for (auto i = zones.begin(); i != zones.end(); ++i) {
+			if (i->second.frame_ns == 0) continue;
+			i->second.frame_ms.push_back(1.0E-6*i->second.frame_ns);
+			i->second.frame_ns = 0;
+		}
+		if (last_frame_ns > 0) {
+			frame_ms.push_back(1.0E-6*(now - last_frame_ns));
+
+			if (record_trace && trace.size() < PROF_MAX_TRACE_EV) {
+				trace_event_t const te = {"Frame", last_frame_ns, (now - last_frame_ns), PROF_MAX_THREADS}; // frames go on their own row
+				trace.push_back(te);
+			}
+		}
+		last_frame_ns = now;
+	}
+	void reset_frame() {last_frame_ns = 0;} // called when disabled so that the next frame time isn't the time since it was disabled
+
+	void stats() {
+		if (frame_ms.empty() && zones.empty()) return;
+		float p50(0.0), p95(0.0), vmax(0.0);
+		get_percentiles(frame_ms, p50, p95, vmax);
+		cout << "frames: " << frame_ms.size() << ", frame ms p50: " << p50 << ", p95: " << p95 << ", max: " << vmax << ", dropped zones: " << num_dropped << endl;
+		cout << "zone count total_ms max_ms avg_ms frame_p50 frame_p95 frame_max" << endl;
+		multimap<uint64_t, uint64_t> kids; // parent path => child path
+		for (auto i = zones.begin(); i != zones.end(); ++i) {kids.insert(make_pair(i->second.parent_path, i->first));}
+		auto const roots(kids.equal_range(0));
+		for (auto i = roots.first; i != roots.second; ++i) {print_zone(i->second, zones[i->second], kids, 0);}
+	}
+	bool write_trace(string const &fn) const {
+		std::ofstream out(fn);
+
+		if (!out.good()) {
+			std::cerr << "Error opening profiler trace file for write: " << fn << endl;
+			return 0;
+		}
+		out << std::fixed << std::setprecision(3); // avoid scientific notation for large timestamps
+		out << "{\"traceEvents\":[\n";
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << PROF_MAX_THREADS << ",\"args\":{\"name\":\"Frames\"}}";
+
+		for (auto i = trace.begin(); i != trace.end(); ++i) { // timestamps are in microseconds
+			out << ",\n{\"name\":";
+			write_json_str(out, i->name);
+			out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << i->tid << ",\"ts\":" << 0.001*i->start_ns << ",\"dur\":" << 0.001*i->dur_ns << "}";
+		}
+		out << "\n]}\n";
+
+		if (!out.good()) {
+			std::cerr << "Error writing profiler trace file " << fn << endl;
+			return 0;
+		}
+		cout << "Wrote " << trace.size() << " zone events to profiler trace file " << fn << endl;
+		return 1;
+	}
+	string get_path_str(uint64_t path) const { // "parent/child" names
+		auto it(zones.find(path));
+		if (it == zones.end()) return "?"; // parent zone hasn't completed yet
+		if (it->second.parent_path == 0) return it->second.name;
+		return get_path_str(it->second.parent_path) + "/" + it->second.name;
+	}
+	bool write_json_stats(string const &fn) { // machine-readable version of stats()
+		std::ofstream out(fn);
+
+		if (!out.good()) {
+			std::cerr << "Error opening profiler stats file for write: " << fn << endl;
+			return 0;
+		}
+		float p50(0.0), p95(0.0), vmax(0.0), total(0.0);
+		for (auto i = frame_ms.begin(); i != frame_ms.end(); ++i) {total += *i;}
+		get_percentiles(frame_ms, p50, p95, vmax);
+		out << std::fixed << std::setprecision(4);
+		out << "{\n\"frames\": " << frame_ms.size() << ",\n\"dropped_zones\": " << num_dropped << ",\n";
+		out << "\"frame_ms\": {\"avg\": " << (frame_ms.empty() ? 0.0 : total/frame_ms.size()) << ", \"p50\": " << p50 << ", \"p95\": " << p95 << ", \"max\": " << vmax << "},\n";
+		out << "\"zones\": [";
+
+		for (auto i = zones.begin(); i != zones.end(); ++i) {
+			zone_stats_t &z(i->second);
+			get_percentiles(z.frame_ms, p50, p95, vmax);
+			out << ((i == zones.begin()) ? "\n" : ",\n") << "{\"path\": ";
+			write_json_str(out, get_path_str(i->first).c_str());
+			out << ", \"name\": ";
+			write_json_str(out, z.name.c_str());
+			out << ", \"count\": " << z.count << ", \"total_ms\": " << 1.0E-6*z.total_ns << ", \"avg_ms\": " << 1.0E-6*z.total_ns/z.count << ", \"max_ms\": " << 1.0E-6*z.max_ns
+				<< ", \"frames_active\": " << z.frame_ms.size() << ", \"frame_p50_ms\": " << p50 << ", \"frame_p95_ms\": " << p95 << ", \"frame_max_ms\": " << vmax << "}";
+		}
+		out << "\n]\n}\n";
+
+		if (!out.good()) {
+			std::cerr << "Error writing profiler stats file " << fn << endl;
+			return 0;
+		}
+		cout << "Wrote profiler stats for " << zones.size() << " zones to " << fn << endl;
+		return 1;
+	}
+	void clear() {
+		zones.clear();
+		frame_ms.clear();
+		trace.clear();
+		num_dropped = 0;
+	}
+};
+
+zone_profiler_t zone_profiler;
+
+
 void toggle_timing_profiler() {
 	global_profiler.enabled ^= 1;
+	profiler_zones_enabled = global_profiler.enabled;
+}
+
+void timing_profiler_next_frame() {
+	if (profiler_zones_enabled) {zone_profiler.next_frame(!profiler_trace_fn.empty());} else {zone_profiler.reset_frame();}
 }
 
 void register_timing_value(const char *str, int delta_time) {
 	global_profiler.register_time(str, delta_time);
 }
 
+bool write_timing_profiler_json(string const &fn) {return zone_profiler.write_json_stats(fn);}
+
 void timing_profiler_stats() {
 	global_profiler.stats();
 	global_profiler.clear();
+	zone_profiler.stats();
+	if (!profiler_trace_fn.empty()) {zone_profiler.write_trace(profiler_trace_fn);}
+	zone_profiler.clear();
 }
 
 
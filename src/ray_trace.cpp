@@ -6,8 +6,9 @@
 #include "mesh.h"
 #include "model3d.h"
 #include "binary_file_io.h"
+#include "cobj_bsp_tree.h" // for RAY_PACKET_SIZE
+#include "job_system.h"
 #include <atomic>
-#include <thread>
 
 
 bool const COLOR_FROM_COBJ_TEX = 0; // 0 = fast/average color, 1 = true color
@@ -21,13 +22,17 @@ float const ICE_ALBEDO    = 0.8;
 bool keep_beams(0); // debugging mode
 bool kill_raytrace(0);
 bool no_stat_moving(0); // generally not thread safe for dynamic lighting update, since BVH is rebuilt per-frame; also, wrong to cache lighting for moving cobjs
+unsigned lighting_rebake_margin(4); // in lightmap cells
+unsigned lighting_bake_passes(1), lighting_bake_checkpoint_secs(60);
+float lighting_bake_noise_thresh(0.0); // relative standard error for stopping a progressive bake early; 0 = run all passes
+int const REBAKE_SETTLE_FRAMES = 8; // wait for cobj changes to stop before starting an incremental rebake
 unsigned NPTS(50000), NRAYS(40000), LOCAL_RAYS(1000000), GLOBAL_RAYS(1000000), DYNAMIC_RAYS(1000000), NUM_THREADS(1), MAX_RAY_BOUNCES(20);
 std::atomic<unsigned long long> tot_rays(0), num_hits(0), cells_touched(0);
 unsigned const NUM_RAY_SPLITS [NUM_LIGHTING_TYPES] = {1, 1, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 unsigned const INIT_RAY_SPLITS[NUM_LIGHTING_TYPES] = {1, 4, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 
-extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked;
-extern int read_light_files[], write_light_files[], display_mode, DISABLE_WATER;
+extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked, lighting_ray_packets, incremental_lighting_rebake;
+extern int read_light_files[], write_light_files[], display_mode, DISABLE_WATER, frame_counter;
 extern float water_plane_z, temperature, snow_depth, indir_light_exp, ray_step_size_mult, first_ray_weight[];
 extern char *lighting_file[];
 extern point sun_pos, moon_pos;
@@ -237,6 +242,7 @@ void add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const
 	}
 	else { // use the lmgr
 		assert(lmgr != nullptr && lmgr->is_allocated());
+		if (!lmgr->ray_can_reach_rebake_bounds(p1, p2)) return; // incremental rebake, and this segment doesn't cross the updated region (later bounces may)
 
 		for (unsigned s = 0; s < nsteps; ++s) {
 			lmcell *lmc(lmgr->get_lmcell_round_down(p1));
@@ -259,11 +265,22 @@ void add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const
 }
 
 
+struct pre_ray_hit_t { // first cobj intersection of a ray, computed by a packet query before the call to cast_light_ray()
+	point cpos;
+	vector3d cnorm;
+	int cindex;
+	pre_ray_hit_t() : cindex(-1) {}
+};
+
+
 void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length,
-	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr)
+	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr, pre_ray_hit_t const *pre_hit=nullptr)
 {
 	if (depth > MAX_RAY_BOUNCES) return;
 	if (ltype == LIGHTING_DYNAMIC && depth > 4) return; // use a sensible default since this is running during rendering
+	// incremental rebake: reflected and transmitted weights are at most this weight, so a ray below the threshold has no bounces
+	// and only lights the cells along its own path; this is exact, since any later bounces that could reach the region are still traced
+	if (lmgr != nullptr && fabs(weight) < WEIGHT_THRESH*weight0 && !lmgr->ray_can_reach_rebake_bounds(p1, p2)) return;
 	//assert(!is_nan(p1) && !is_nan(p2));
 	++tot_rays;
 
@@ -277,7 +294,16 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 	float t(0.0), zval(0.0);
 	bool snow_coll(0), ice_coll(0), water_coll(0), mesh_coll(0);
 	vector3d const dir((p2 - p1).get_norm());
-	bool coll(check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving)); // fast=1, exclude voxels, maybe skip init colls
+	bool coll(0);
+
+	if (pre_hit) { // already computed for the same clipped line
+		cindex = pre_hit->cindex;
+		coll   = (cindex >= 0);
+		if (coll) {cpos = pre_hit->cpos; cnorm = pre_hit->cnorm;}
+	}
+	else {
+		coll = check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving); // fast=1, exclude voxels, maybe skip init colls
+	}
 	assert(coll ? (cindex >= 0 && cindex < (int)coll_objects.size()) : (cindex == -1));
 
 	// find the intersection point with the model3ds
@@ -491,6 +517,66 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 }
 
 
+// batches the initial rays from a light source so that up to RAY_PACKET_SIZE of them share one static cobj BVH traversal;
+// rays are still cast in the order they were added, so results are the same as calling cast_light_ray() directly
+class light_ray_packet_t {
+
+	lmap_manager_t *lmgr;
+	rand_gen_t &rgen;
+	cobj_ray_accum_map_t *accum_map;
+	float line_length;
+	int ignore_cobj, ltype;
+	unsigned num;
+	point p1[RAY_PACKET_SIZE], p2[RAY_PACKET_SIZE];
+	float weight[RAY_PACKET_SIZE];
+	colorRGBA color[RAY_PACKET_SIZE];
+
+public:
+	light_ray_packet_t(lmap_manager_t *lmgr_, rand_gen_t &rgen_, cobj_ray_accum_map_t *accum_map_, float line_length_, int ignore_cobj_, int ltype_)
+		: lmgr(lmgr_), rgen(rgen_), accum_map(accum_map_), line_length(line_length_), ignore_cobj(ignore_cobj_), ltype(ltype_), num(0) {}
+	~light_ray_packet_t() {assert(num == 0);} // caller must flush
+
+	void add(point const &start_pt, point const &end_pt, float weight_, colorRGBA const &color_) {
+		if (!lighting_ray_packets) { // packets disabled
+			cast_light_ray(lmgr, start_pt, end_pt, weight_, weight_, color_, line_length, ignore_cobj, ltype, 0, rgen, accum_map);
+			return;
+		}
+		assert(num < RAY_PACKET_SIZE);
+		p1[num] = start_pt; p2[num] = end_pt; weight[num] = weight_; color[num] = color_;
+		if (++num == RAY_PACKET_SIZE) {flush();}
+	}
+	void flush() {
+		if (num == 0) return;
+		point q1[RAY_PACKET_SIZE], q2[RAY_PACKET_SIZE], cpos[RAY_PACKET_SIZE];
+		vector3d cnorm[RAY_PACKET_SIZE];
+		int cindex[RAY_PACKET_SIZE];
+		bool skip_init_colls[RAY_PACKET_SIZE];
+		unsigned qix[RAY_PACKET_SIZE], nq(0);
+		pre_ray_hit_t hits[RAY_PACKET_SIZE];
+
+		for (unsigned r = 0; r < num; ++r) { // clip the same way as cast_light_ray(); rays that are clipped away are skipped there as well
+			point c1(p1[r]), c2(p2[r]);
+			if (!do_line_clip_scene(c1, c2, min(zbottom, czmin), max(ztop, czmax))) continue;
+			if ((display_mode & 0x01) && is_under_mesh(c1)) continue;
+			q1[nq] = c1; q2[nq] = c2; skip_init_colls[nq] = (c1 == p1[r]); qix[nq++] = r;
+		}
+		if (nq > 0 && world_mode == WMODE_GROUND) {
+			check_coll_line_exact_tree_packet(nq, q1, q2, cpos, cnorm, cindex, ignore_cobj, 0, 0, 1, skip_init_colls, 0, no_stat_moving);
+
+			for (unsigned q = 0; q < nq; ++q) {
+				pre_ray_hit_t &hit(hits[qix[q]]);
+				hit.cindex = cindex[q];
+				if (hit.cindex >= 0) {hit.cpos = cpos[q]; hit.cnorm = cnorm[q];}
+			}
+		}
+		for (unsigned r = 0; r < num; ++r) {
+			cast_light_ray(lmgr, p1[r], p2[r], weight[r], weight[r], color[r], line_length, ignore_cobj, ltype, 0, rgen, accum_map, nullptr, (hits + r));
+		}
+		num = 0;
+	}
+};
+
+
 struct rt_data {
 	unsigned ix, num, job_id, checksum;
 	int rseed, ltype;
@@ -516,41 +602,40 @@ struct rt_data {
 };
 
 
+// runs each lighting partition as a background job so that bakes share the job system's cores rather than adding threads
 template<typename T> class thread_manager_t {
 
-	vector<std::thread> threads;
+	vector<job_handle_t> jobs;
 
 public:
 	vector<T> data; // to be filled in by the caller
 
-	bool is_active() const {return (!threads.empty());}
+	bool is_active() const {return (!data.empty());}
 
-	bool any_threads_running() const {
-		for (auto i = data.begin(); i != data.end(); ++i) {if (i->is_running) return 1;}
+	bool any_threads_running() const { // Note: a job that hasn't started yet is still running
+		for (auto i = jobs.begin(); i != jobs.end(); ++i) {if (!job_system_t::is_done(*i)) return 1;}
 		return 0;
 	}
 
 	void clear() {
 		data.clear();
-		threads.clear();
+		jobs.clear();
 	}
 
 	void create(unsigned num_threads) {
 		assert(!is_active());
 		data.resize(num_threads);
-		threads.resize(num_threads);
 	}
 
 	void run(void (*func)(rt_data *)) {
-		assert(threads.size() == data.size());
-		for (unsigned t = 0; t < threads.size(); ++t) {threads[t] = std::thread(func, (rt_data *)(&data[t]));}
+		assert(jobs.empty());
+		job_system_t &js(get_job_system());
+		for (unsigned t = 0; t < data.size(); ++t) {jobs.push_back(js.run([this, func, t]() {func((rt_data *)(&data[t]));}, JOB_PRI_BACKGROUND));}
 	}
 
 	void join() {
-		for (unsigned t = 0; t < threads.size(); ++t) {
-			threads[t].join();
-			//cout << "checksum[" << t << "]: " << data[t].checksum << endl;
-		}
+		get_job_system().wait_all(jobs); // the calling thread helps run lighting jobs while waiting
+		//for (unsigned t = 0; t < data.size(); ++t) {cout << "checksum[" << t << "]: " << data[t].checksum << endl;}
 	}
 	void join_and_clear() {join(); clear();}
 };
@@ -558,6 +643,32 @@ public:
 thread_manager_t<rt_data> thread_manager;
 lmap_manager_t thread_temp_lmap;
 
+
+// tracks regions where static cobjs were added or removed so that lighting can be rebaked there rather than over the whole scene
+struct lighting_rebake_t {
+
+	cube_t dirty_bcube, cur_bcube; // changes not yet rebaked, region currently being rebaked
+	int last_change_frame;
+	unsigned ltype_ix;
+	bool running, saved_no_stat_moving, prev_no_stat_moving; // no_stat_moving is set while rebaking and restored once all regions are done
+	vector<int> ltypes; // lighting types to rebake, in order
+
+	lighting_rebake_t() : dirty_bcube(all_zeros), cur_bcube(all_zeros), last_change_frame(0), ltype_ix(0), running(0), saved_no_stat_moving(0), prev_no_stat_moving(0) {}
+
+	void add_dirty(cube_t const &bc) {
+		if (dirty_bcube.is_all_zeros()) {dirty_bcube = bc;} else {dirty_bcube.union_with_cube(bc);}
+		last_change_frame = frame_counter;
+	}
+	void abort() { // current region must be redone, possibly merged with newer changes
+		if (!running) return;
+		add_dirty(cur_bcube);
+		cur_bcube.set_to_zeros();
+		running = 0;
+	}
+};
+
+lighting_rebake_t lighting_rebake;
+
 bool indir_lighting_updated() {return (global_lighting_update && (lmap_manager.was_updated || thread_temp_lmap.was_updated));} // only for global updates
 
 
@@ -569,6 +680,12 @@ void kill_current_raytrace_threads() {
 		thread_manager.join_and_clear();
 		assert(!thread_manager.is_active());
 		kill_raytrace = 0;
+
+		if (lighting_rebake.running) { // partial results are discarded
+			lighting_rebake.abort();
+			thread_temp_lmap.clear_cells();
+			thread_temp_lmap.was_updated = 0;
+		}
 	}
 }
 
@@ -578,6 +695,8 @@ void update_lmap_from_temp_copy() {
 	if (!thread_temp_lmap.was_updated) return; // no updates
 	float const blend_weight = 1.0; // FIXME: slow blend over time to reduce popping
 	lmap_manager.copy_data(thread_temp_lmap, blend_weight);
+	lmap_manager.compact();
+	thread_temp_lmap.clear_cells(); // will be reallocated from lmap_manager on the next launch
 	thread_temp_lmap.was_updated = 0;
 	lmap_manager.was_updated     = 1;
 }
@@ -589,12 +708,14 @@ void check_for_lighting_finished() { // to be called about once per frame
 	if (thread_manager.any_threads_running()) return; // still running
 	thread_manager.join_and_clear(); // clear() or join_and_clear()?
 	update_lmap_from_temp_copy();
+	lmap_manager.compact(); // threads are done writing, so bricks expanded by ray tracing can be recompressed
 }
 
 
-// see https://computing.llnl.gov/tutorials/pthreads/ (for old pthread implementation - now using std::thread)
-void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool blocking, bool use_temp_lmap, bool randomized, int ltype, unsigned job_id=0) {
-
+// see https://computing.llnl.gov/tutorials/pthreads/ (for old pthread implementation - now using the job system)
+void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool blocking, bool use_temp_lmap, bool randomized, int ltype,
+	unsigned job_id=0, cube_t const *rebake_bcube=nullptr, unsigned pass=0, unsigned num_passes=1)
+{
 	kill_current_raytrace_threads();
 	assert(num_threads > 0 && num_threads < 100);
 	assert(!keep_beams || num_threads == 1); // could use a mutex instead to make this legal
@@ -602,11 +723,18 @@ void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bo
 	if (verbose) cout << "Computing lighting on " << num_threads << " threads." << endl;
 	thread_manager.create(num_threads);
 	vector<rt_data> &data(thread_manager.data);
-	if (use_temp_lmap) {thread_temp_lmap.init_from(lmap_manager);}
+	if (use_temp_lmap) {thread_temp_lmap.init_from(lmap_manager, rebake_bcube);} // only bricks in the rebake cube are copied
+
+	if (rebake_bcube) { // rays that may bounce into this cube are traced, but only cells within it are cleared and updated
+		assert(use_temp_lmap); // the results are merged into lmap_manager when finished
+		thread_temp_lmap.clear_lighting_values(ltype);
+		thread_temp_lmap.was_updated = 1; // cleared cells must be merged even if no rays reach them
+	}
 
 	for (unsigned t = 0; t < data.size(); ++t) {
 		// create a custom lmap_manager_t for each thread then merge them together?
-		data[t] = rt_data(t, num_threads, 234323*(t+1), !single_thread, (verbose && t == 0), randomized, ltype, job_id);
+		// progressive bake passes each trace 1/num_passes of the rays with a different seed; weights are unchanged, so the passes sum to a full bake
+		data[t] = rt_data(t, num_threads*num_passes, 234323*(t+1) + 7919*pass, !single_thread, (verbose && t == 0), randomized, ltype, job_id);
 		data[t].lmgr = (use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
 	}
 	if (single_thread && blocking) { // threads disabled
@@ -628,6 +756,10 @@ void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bo
 			}
 		}
 		thread_manager.clear();
+
+		if (!use_temp_lmap) {
+			if (num_passes <= 1) {lmap_manager.compact();} // else progressive bake; the caller compacts after the last pass
+		}
 	}
 	//cout << "total rays: " << tot_rays << ", hits: " << num_hits << ", cells touched: " << cells_touched << endl;
 	//tot_rays = num_hits = cells_touched = 0;
@@ -776,6 +908,7 @@ void trace_ray_block_sky(rt_data *data) {
 		}
 		sort(pts.begin(), pts.end());
 		if (data->verbose) {cout << "Sky light source progress (of " << block_npts << "): 0";}
+		light_ray_packet_t packet(data->lmgr, rgen, &data->accum_map, line_length, -1, LIGHTING_SKY);
 
 		for (unsigned p = 0; p < block_npts; ++p) {
 			if (kill_raytrace) break;
@@ -794,9 +927,10 @@ void trace_ray_block_sky(rt_data *data) {
 				if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
 				point const end_pt(pt + dirs[r]*line_length);
 				if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
-				cast_light_ray(data->lmgr, pt, end_pt, ray_wt, ray_wt, WHITE, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
+				packet.add(pt, end_pt, ray_wt, WHITE); // sorted dirs from the same point are coherent
 				++start_rays;
 			}
+			packet.flush();
 		}
 		if (data->verbose) {cout << endl;}
 	}
@@ -961,6 +1095,8 @@ void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls,
 	check_coll_line(lpos, lpos2, init_cobj, -1, 1, 2); // find most opaque (max alpha) containing object
 	assert(init_cobj < (int)coll_objects.size());
 
+	light_ray_packet_t packet(lmgr, rgen, nullptr, line_length, init_cobj, ltype);
+
 	for (unsigned n = 0; n < num_rays; ++n) {
 		if (kill_raytrace) break;
 		vector3d dir;
@@ -996,8 +1132,9 @@ void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls,
 			if (line_light) {start_pt += n*delta;} // fixed spacing along the length of the line
 		}
 		point const end_pt(start_pt + dir*line_length);
-		cast_light_ray(lmgr, start_pt, end_pt, weight, weight, lcolor, line_length, init_cobj, ltype, 0, rgen, nullptr);
+		packet.add(start_pt, end_pt, weight, lcolor); // Note: changes the order of rgen calls vs. unbatched rays
 	} // for n
+	packet.flush();
 }
 
 
@@ -1050,8 +1187,168 @@ typedef void (*ray_trace_func)(rt_data *);
 ray_trace_func const rt_funcs[NUM_LIGHTING_TYPES] = {trace_ray_block_sky, trace_ray_block_global, trace_ray_block_local, trace_ray_block_cobj_accum, trace_ray_block_dynamic};
 
 
+// progressive bakes
+
+unsigned const BAKE_CKPT_MAGIC   = 0x4B434C42; // "BLCK"
+unsigned const BAKE_CKPT_VERSION = 1;
+
+struct bake_checkpoint_header_t {
+	unsigned magic, version, ltype, num_passes, passes_done, num_cells;
+	uint64_t config_hash;
+};
+
+float get_bake_stat_val(lmcell const &lmc, int ltype) {
+	float const *const c(lmc.get_offset(ltype));
+	return (c[0] + c[1] + c[2]);
+}
+
+// per-cell sums of squared pass contributions, used to estimate noise from the variation between passes
+class bake_stats_t {
+
+	vector<float> last_val, sum_sq; // in lmap file order
+
+public:
+	void init(lmap_manager_t const &lmgr, int ltype) { // from the current lighting values, which are the sum of all previous passes
+		last_val.clear();
+		lmgr.for_each_cell([&](lmcell const &lmc) {last_val.push_back(get_bake_stat_val(lmc, ltype));});
+		if (sum_sq.size() != last_val.size()) {sum_sq.clear(); sum_sq.resize(last_val.size(), 0.0);}
+	}
+	void add_pass(lmap_manager_t const &lmgr, int ltype) {
+		unsigned ix(0);
+
+		lmgr.for_each_cell([&](lmcell const &lmc) {
+			float const val(get_bake_stat_val(lmc, ltype)), delta(val - last_val[ix]); // this pass's contribution
+			sum_sq[ix] += delta*delta;
+			last_val[ix++] = val;
+		});
+		assert(ix == last_val.size());
+	}
+	// returns the brightness weighted mean of the per-cell relative standard error of the summed passes
+	float calc_rel_error(unsigned npasses, float &max_rel_err) const {
+		max_rel_err = 0.0;
+		if (npasses < 2) return 1.0; // unknown
+		double tot_err(0.0), tot_val(0.0);
+		float max_val(0.0);
+		for (auto i = last_val.begin(); i != last_val.end(); ++i) {max_val = max(max_val, *i);}
+
+		for (unsigned i = 0; i < last_val.size(); ++i) {
+			if (last_val[i] <= 0.0) continue; // unlit
+			float const mean(last_val[i]/npasses), var(max(0.0f, (sum_sq[i] - npasses*mean*mean)/(npasses - 1)));
+			float const err(sqrt(npasses*var)); // standard error of the sum
+			tot_err += err;
+			tot_val += last_val[i];
+			if (last_val[i] > 0.1*max_val) {max_rel_err = max(max_rel_err, err/last_val[i]);} // ignore dim cells, which are always noisy
+		}
+		return ((tot_val > 0.0) ? float(tot_err/tot_val) : 0.0f);
+	}
+	bool write(binary_file_writer &writer) const {return (sum_sq.empty() || writer.write(&sum_sq.front(), sizeof(float), sum_sq.size()));}
+	bool read (binary_file_reader &reader) {sum_sq.resize(last_val.size()); return (sum_sq.empty() || reader.read(&sum_sq.front(), sizeof(float), sum_sq.size()));} // call after init()
+};
+
+uint64_t get_bake_config_hash(unsigned ltype) { // checkpoints are only valid if the rays, lights, and scene geometry are unchanged
+	fnv_hash_t hash;
+	hash.add(ltype);
+	hash.add(NPTS); hash.add(NRAYS); hash.add(LOCAL_RAYS); hash.add(GLOBAL_RAYS); hash.add(MAX_RAY_BOUNCES);
+	hash.add(czmin); hash.add(czmax); hash.add(X_SCENE_SIZE); hash.add(Y_SCENE_SIZE); hash.add(coll_objects.size()); hash.add(light_sources_a.size());
+	hash.add(sun_pos); hash.add(moon_pos);
+
+	for (auto i = light_sources_a.begin(); i != light_sources_a.end(); ++i) {
+		hash.add(i->get_pos()); hash.add(i->get_pos2()); hash.add(i->get_color()); hash.add(i->get_radius());
+	}
+	for (auto i = coll_objects.begin(); i != coll_objects.end(); ++i) { // only static cobjs affect baked lighting
+		if (i->status != COLL_STATIC) continue;
+		hash.add(i->type); hash.add(i->d); hash.add(i->cp.color);
+	}
+	return hash.get();
+}
+
+string get_bake_checkpoint_fn(unsigned ltype) {return (string(lighting_file[ltype]) + ".ckpt");}
+
+bool write_bake_checkpoint(unsigned ltype, unsigned passes_done, bake_stats_t const &stats) {
+
+	string const fn(get_bake_checkpoint_fn(ltype)), tmp_fn(fn + ".tmp");
+	bake_checkpoint_header_t const header = {BAKE_CKPT_MAGIC, BAKE_CKPT_VERSION, ltype, lighting_bake_passes, passes_done, (unsigned)lmap_manager.size(), get_bake_config_hash(ltype)};
+	{
+		binary_file_writer writer;
+		if (!writer.open(tmp_fn)) return 0;
+
+		if (!writer.write(&header, sizeof(header), 1) || !lmap_manager.write_data(writer, tmp_fn.c_str(), ltype) || !stats.write(writer)) {
+			cerr << "Error writing lighting checkpoint file " << tmp_fn << endl;
+			return 0;
+		}
+	} // close the file
+	remove(fn.c_str()); // rename() fails on windows if the file exists
+	if (rename(tmp_fn.c_str(), fn.c_str()) != 0) {cerr << "Error renaming lighting checkpoint file " << tmp_fn << " to " << fn << endl; return 0;}
+	return 1;
+}
+
+unsigned read_bake_checkpoint(unsigned ltype, bake_stats_t &stats) { // returns the number of passes completed, or 0 if there's no usable checkpoint
+
+	string const fn(get_bake_checkpoint_fn(ltype));
+	FILE *fp(fopen(fn.c_str(), "rb")); // check existence first so that we don't print an error when there's no checkpoint
+	if (fp == nullptr) return 0;
+	fclose(fp);
+	binary_file_reader reader;
+	if (!reader.open(fn)) return 0;
+	bake_checkpoint_header_t header;
+	if (!reader.read(&header, sizeof(header), 1)) return 0;
+
+	if (header.magic != BAKE_CKPT_MAGIC || header.version != BAKE_CKPT_VERSION || header.ltype != ltype || header.num_passes != lighting_bake_passes ||
+		header.num_cells != lmap_manager.size() || header.config_hash != get_bake_config_hash(ltype) || header.passes_done >= header.num_passes)
+	{
+		cerr << "Lighting checkpoint file " << fn << " doesn't match the current bake; starting from the beginning." << endl;
+		return 0;
+	}
+	cout << "Resuming lighting bake from " << fn << " after " << header.passes_done << " of " << header.num_passes << " passes" << endl;
+	// partial sums are kept at full precision until the final pass, so don't compact here
+	if (!lmap_manager.read_data(reader, fn.c_str(), ltype, 0)) {lmap_manager.clear_lighting_values(ltype); return 0;}
+	stats.init(lmap_manager, ltype);
+	if (!stats.read(reader)) {lmap_manager.clear_lighting_values(ltype); return 0;}
+	return header.passes_done;
+}
+
+bool use_progressive_bake(unsigned ltype) {
+	if (lighting_bake_passes <= 1 || ltype >= LIGHTING_COBJ_ACCUM) return 0; // sky, global, and local only
+	// platform ray accumulation is rebuilt by each launch, so it only works with a single pass
+	return !(enable_platform_lights(ltype) && !coll_objects.platform_ids.empty());
+}
+
+void run_progressive_bake(unsigned ltype, bool verbose) {
+
+	bool const checkpoints(write_light_files[ltype] && lighting_bake_checkpoint_secs > 0);
+	unsigned const num_passes(lighting_bake_passes);
+	bake_stats_t stats;
+	unsigned pass(checkpoints ? read_bake_checkpoint(ltype, stats) : 0);
+	if (pass == 0) {stats.init(lmap_manager, ltype);}
+	int last_ckpt_time(GET_TIME_MS());
+
+	for (; pass < num_passes; ++pass) {
+		launch_threaded_job(NUM_THREADS, rt_funcs[ltype], (verbose && pass == 0), 1, 0, 0, ltype, 0, nullptr, pass, num_passes); // blocking; not compacted
+		stats.add_pass(lmap_manager, ltype);
+		float max_rel_err(0.0);
+		float const rel_err(stats.calc_rel_error(pass+1, max_rel_err));
+		cout << "Lighting pass " << (pass+1) << " of " << num_passes;
+		if (pass > 0) {cout << ": relative error " << rel_err << " (max " << max_rel_err << ")";}
+		cout << endl;
+
+		if (pass > 0 && lighting_bake_noise_thresh > 0.0 && rel_err < lighting_bake_noise_thresh) { // converged
+			++pass;
+			cout << "Lighting converged after " << pass << " passes" << endl;
+			break;
+		}
+		if (checkpoints && pass+1 < num_passes && (GET_TIME_MS() - last_ckpt_time) >= 1000*int(lighting_bake_checkpoint_secs)) {
+			if (write_bake_checkpoint(ltype, pass+1, stats)) {last_ckpt_time = GET_TIME_MS();}
+		}
+	}
+	// each pass has 1/num_passes of the total ray weight, so rescale if we stopped early
+	if (pass < num_passes) {lmap_manager.scale_lighting_values(ltype, float(num_passes)/pass);}
+	lmap_manager.compact(); // once at the end, since compressing the partial sums after each pass would add quantization error to every pass
+}
+
+
 void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 
+	PROFILE_SCOPE("Lighting Ray Trace");
 	bool const dynamic(is_ltype_dynamic(ltype));
 	unsigned const c_ltype(clamp_ltype_range(ltype));
 	assert(c_ltype < NUM_LIGHTING_TYPES);
@@ -1072,7 +1369,8 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 		if (c_ltype != LIGHTING_LOCAL && !dynamic) {cout << X_SCENE_SIZE << " " << Y_SCENE_SIZE << " " << Z_SCENE_SIZE << " " << czmin << " " << czmax << endl;}
 		all_models.build_cobj_trees(1);
 		if (enable_platform_lights(ltype)) {pre_rt_bvh_build_hook();}
-		launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);
+		if (!dynamic && use_progressive_bake(c_ltype)) {run_progressive_bake(c_ltype, verbose);}
+		else {launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);}
 		if (enable_platform_lights(ltype)) {post_rt_bvh_build_hook();}
 	}
 	if (!dynamic && write_light_files[c_ltype]) {
@@ -1084,7 +1382,9 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 				lmap_manager.write_data_to_file(lighting_file[LIGHTING_SKY], LIGHTING_SKY);
 			}
 		}
-		else {lmap_manager.write_data_to_file(fn, c_ltype);}
+		else if (lmap_manager.write_data_to_file(fn, c_ltype) && use_progressive_bake(c_ltype)) {
+			remove(get_bake_checkpoint_fn(c_ltype).c_str()); // bake is complete
+		}
 	}
 }
 
@@ -1134,6 +1434,66 @@ void check_all_platform_cobj_lighting_update() {
 }
 
 
+bool rebake_enabled() {return (incremental_lighting_rebake && lmap_manager.is_allocated());}
+
+// called before a static cobj is added or removed
+void register_cobj_lighting_change(coll_obj const &cobj) {
+
+	if (!rebake_enabled()) return;
+	if (cobj.status != COLL_STATIC || cobj.platform_id >= 0 || cobj.is_movable()) return; // not included in baked lighting, or handled elsewhere
+	// the threads read cobjs, so stop them before the cobj changes; the current region will be rebaked along with this one
+	if (lighting_rebake.running) {kill_current_raytrace_threads();}
+	lighting_rebake.add_dirty(cobj);
+}
+
+void launch_next_rebake_ltype() {
+
+	int const ltype(lighting_rebake.ltypes[lighting_rebake.ltype_ix++]);
+	launch_threaded_job(max(1U, NUM_THREADS-1), rt_funcs[ltype], 0, 0, 1, 0, ltype, 0, &lighting_rebake.cur_bcube); // non-blocking, temp lmap; reserve a thread for rendering
+	lighting_rebake.running = 1;
+}
+
+void check_lighting_rebake() { // to be called once per frame, after check_for_lighting_finished()
+
+	lighting_rebake_t &lr(lighting_rebake);
+
+	if (lr.running) {
+		if (thread_manager.is_active()) return; // still running
+		// this ltype finished and was merged into lmap_manager by check_for_lighting_finished()
+		if (lr.ltype_ix < lr.ltypes.size()) {launch_next_rebake_ltype(); return;}
+		lr.running = 0;
+		lr.cur_bcube.set_to_zeros();
+	}
+	if (lr.saved_no_stat_moving && (lr.dirty_bcube.is_all_zeros() || !rebake_enabled()) && !thread_manager.is_active()) { // done rather than aborted, and no threads are reading it
+		no_stat_moving = lr.prev_no_stat_moving;
+		lr.saved_no_stat_moving = 0;
+	}
+	if (lr.dirty_bcube.is_all_zeros() || !rebake_enabled()) return; // nothing to do
+	if (frame_counter - lr.last_change_frame < REBAKE_SETTLE_FRAMES) return; // wait for changes to stop
+	if (thread_manager.is_active()) return; // another lighting update is running; wait for it to finish
+	if (!pre_lighting_update()) return;
+	lr.ltypes.clear();
+
+	for (int ltype = 0; ltype < LIGHTING_COBJ_ACCUM; ++ltype) { // sky, global, and local: the types that were ray traced rather than computed directly
+		if (read_light_files[ltype] || write_light_files[ltype]) {lr.ltypes.push_back(ltype);}
+	}
+	if (lr.ltypes.empty()) {lr.dirty_bcube.set_to_zeros(); return;} // no ray traced lighting
+	// indirect light spreads beyond the changed cobjs, so expand the region by a margin
+	float const margin(lighting_rebake_margin);
+	lr.cur_bcube = lr.dirty_bcube;
+	lr.cur_bcube.expand_by(vector3d(margin*DX_VAL, margin*DY_VAL, margin*DZ_VAL2));
+	lr.dirty_bcube.set_to_zeros();
+	lr.ltype_ix = 0;
+
+	if (!lr.saved_no_stat_moving) {
+		lr.prev_no_stat_moving  = no_stat_moving;
+		lr.saved_no_stat_moving = 1;
+	}
+	no_stat_moving = 1; // see check_update_global_lighting()
+	launch_next_rebake_ltype();
+}
+
+
 // lmap_manager_t
 
 
@@ -1143,12 +1503,17 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 	binary_file_reader reader;
 	if (!reader.open(fn)) return 0;
 	cout << "Reading lighting file from " << fn << endl;
+	return read_data(reader, fn, ltype);
+}
+
+bool lmap_manager_t::read_data(binary_file_reader &reader, char const *const fn, int ltype, bool compact_bricks) {
+
 	unsigned data_size(0);
 	if (!reader.read(&data_size, sizeof(unsigned), 1)) return 0;
 
-	if (data_size != vldata_alloc.size()) {
+	if (data_size != num_cells) {
 		cerr << "Error: Lighting file " << fn << " data size of " << data_size
-			 << " does not equal the expected size of " << vldata_alloc.size() << ". Ignoring file." << endl;
+			 << " does not equal the expected size of " << num_cells << ". Ignoring file." << endl;
 		return 0;
 	}
 	unsigned const sz = lmcell::get_dsz(ltype);
@@ -1159,11 +1524,19 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 		cerr << "Error reading data from ligthing file " << fn << endl;
 		return 0;
 	}
-	for (vector<lmcell>::iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
-		float *ptr(i->get_offset(ltype));
-		for (unsigned n = 0; n < sz; ++n) {ptr[n] = data[pos++];}
+	for (unsigned y = 0; y < lm_ysize; ++y) { // file is in column order: y, x, z
+		for (unsigned x = 0; x < lm_xsize; ++x) {
+			if (!is_column_allocated(x, y)) continue;
+
+			for (unsigned z = 0; z < lm_zsize; ++z) {
+				float *ptr(get_lmcell(x, y, z).get_offset(ltype));
+				for (unsigned n = 0; n < sz; ++n) {ptr[n] = data[pos++];}
+			}
+		}
+		unsigned const by(y >> LMAP_BRICK_BITS);
+		if (compact_bricks && ((y & LMAP_BRICK_MASK) == LMAP_BRICK_MASK || y+1 == lm_ysize)) {compact_brick_rows(by, by+1);} // compact each row of bricks once filled in
 	}
-	assert(pos == data.size());
+	assert(pos == data.size() || (pos == 0 && data_size == 1)); // the single placeholder cell of an empty lightmap is ignored
 	return 1;
 }
 
@@ -1174,28 +1547,65 @@ bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
 	binary_file_writer writer;
 	if (!writer.open(fn)) return 0;
 	cout << "Writing lighting file to " << fn << endl;
-	unsigned const data_size((unsigned)vldata_alloc.size()); // should be size_t?
+	return write_data(writer, fn, ltype);
+}
+
+bool lmap_manager_t::write_data(binary_file_writer &writer, char const *const fn, int ltype) const {
+
+	unsigned const data_size(num_cells); // should be size_t?
 	if (!writer.write(&data_size, sizeof(unsigned), 1)) return 0;
 	unsigned const sz(lmcell::get_dsz(ltype));
-
-	for (vector<lmcell>::const_iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) { // const_iterator?
-		if (!writer.write(i->get_offset(ltype), sizeof(float), sz)) {
-			cerr << "Error writing data to ligthing file " << fn << endl;
-			return 0;
-		}
+	vector<float> data;
+	data.reserve(data_size*sz);
+	for_each_cell([&](lmcell const &lmc) {data.insert(data.end(), lmc.get_offset(ltype), lmc.get_offset(ltype)+sz);});
+	if (data.empty()) {data.resize(sz, 0.0);} // placeholder cell of an empty lightmap
+	assert(data.size() == data_size*sz);
+
+	if (!writer.write(&data.front(), sizeof(float), data.size())) {
+		cerr << "Error writing data to ligthing file " << fn << endl;
+		return 0;
 	}
 	return 1;
 }
 
 
-void lmap_manager_t::clear_lighting_values(int ltype) {
+void scale_lmcell_values(lmcell &lmc, int ltype, float scale) {
+	float *color(lmc.get_offset(ltype));
+	for (unsigned j = 0; j < lmcell::get_dsz(ltype); ++j) {color[j] = ((scale == 0.0) ? 0.0 : scale*color[j]);}
+}
+
+void lmap_manager_t::scale_lighting_values(int ltype, float scale) { // Note: if rebake bounds are set, only cells within them are modified
 
 	assert(ltype < NUM_LIGHTING_TYPES && !is_ltype_dynamic(ltype));
-	unsigned const num(lmcell::get_dsz(ltype));
 
-	for (vector<lmcell>::iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
-		float *color(i->get_offset(ltype));
-		for (unsigned j = 0; j < num; ++j) {color[j] = 0.0;}
+	if (has_rebake_bounds()) {
+		for (int y = rebake_bnds[1][0]; y <= rebake_bnds[1][1]; ++y) {
+			for (int x = rebake_bnds[0][0]; x <= rebake_bnds[0][1]; ++x) {
+				if (!is_column_allocated(x, y)) continue;
+				for (int z = rebake_bnds[2][0]; z <= rebake_bnds[2][1]; ++z) {scale_lmcell_values(get_lmcell(x, y, z), ltype, scale);}
+			}
+		}
+		return;
+	}
+	int const nb(num_bricks());
+
+	#pragma omp parallel for schedule(dynamic,16)
+	for (int i = 0; i < nb; ++i) { // operate on bricks in their current representation
+		lmap_brick_t &brick(bricks[i]);
+		lmcell *const cells(brick.full.load());
+
+		if (cells) {
+			for (unsigned c = 0; c < LMAP_BRICK_CELLS; ++c) {scale_lmcell_values(cells[c], ltype, scale);}
+		}
+		if (brick.state == lmap_brick_t::PACKED) {
+			for (auto p = brick.packed.begin(); p != brick.packed.end(); ++p) {
+				lmcell lmc;
+				p->decode(lmc);
+				scale_lmcell_values(lmc, ltype, scale);
+				p->encode(lmc);
+			}
+		}
+		else {scale_lmcell_values(brick.uniform, ltype, scale);}
 	}
 }
 
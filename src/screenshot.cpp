@@ -13,6 +13,7 @@
 #include <sstream>
 #include <algorithm>
 #include "gl_includes.h"
+#include "job_system.h"
 
 using namespace std;
 
@@ -72,27 +73,29 @@ void read_pixels(unsigned window_width, unsigned window_height, vector<unsigned
 }
 
 
+// Note: pixels are read on the calling (GL) thread, while encoding and writing are done in a background job; returns 1 if the write was started
 int screenshot(unsigned window_width, unsigned window_height, char const *const file_path, bool write_bmp) {
 
 	static unsigned ss_id(0);
 	FILE *fp = open_screenshot_file(file_path, (write_bmp ? "bmp" : "raw"), ss_id);
 	if (fp == NULL) return 0;
-	vector<unsigned char> buf;
-	read_pixels(window_width, window_height, buf);
-	bool ret(1);
+	shared_ptr<vector<unsigned char>> buf(new vector<unsigned char>);
+	read_pixels(window_width, window_height, *buf);
 
-	if (write_bmp) { // bmp
-		ret = write_rgb_bmp_image(fp, "<screenshot>", &buf.front(), window_width, window_height, 3); // RGB
-	}
-	else { // raw
-		for (unsigned i = 0; i < window_height; ++i) {
-			unsigned const offset((window_height-i-1)*window_width);
-			int const num_write(fwrite(&buf[3*offset], 3, window_width, fp));
-			assert(num_write == (int)window_width);
+	get_job_system().run([=]() {
+		if (write_bmp) { // bmp
+			if (!write_rgb_bmp_image(fp, "<screenshot>", &buf->front(), window_width, window_height, 3)) {cerr << "Error writing screenshot bmp image" << endl;} // RGB
 		}
-	}
-	fclose(fp);
-	return ret;
+		else { // raw
+			for (unsigned i = 0; i < window_height; ++i) {
+				unsigned const offset((window_height-i-1)*window_width);
+				int const num_write(fwrite(&(*buf)[3*offset], 3, window_width, fp));
+				assert(num_write == (int)window_width);
+			}
+		}
+		fclose(fp);
+	}, JOB_PRI_IO);
+	return 1;
 }
 
 
@@ -101,8 +104,11 @@ int write_jpeg(unsigned window_width, unsigned window_height, char const *const
 	static unsigned ss_id(0);
 	FILE *fp = open_screenshot_file(file_path, "jpg", ss_id);
 	if (fp == NULL) return 0;
-	vector<unsigned char> buf((window_width+1)*(window_height+1)*3);
-	read_pixels(window_width, window_height, buf);
-	int const ret(write_jpeg_data(window_width, window_height, fp, &buf.front(), 1));
-	return ret;
+	shared_ptr<vector<unsigned char>> buf(new vector<unsigned char>((window_width+1)*(window_height+1)*3));
+	read_pixels(window_width, window_height, *buf);
+
+	get_job_system().run([=]() {
+		if (!write_jpeg_data(window_width, window_height, fp, &buf->front(), 1)) {cerr << "Error writing screenshot jpeg image" << endl;}
+	}, JOB_PRI_IO);
+	return 1;
 }
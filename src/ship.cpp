@@ -10,6 +10,7 @@
 #include "shaders.h"
 #include "draw_utils.h"
 #include "gl_ext_arb.h"
+#include "job_system.h"
 
 
 bool const TIMETEST          = (GLOBAL_TIMETEST || 0);
@@ -20,7 +21,7 @@ unsigned const NUM_EXTRA_DAM = 4;
 
 bool player_autopilot(0), player_auto_stop(0), hold_fighters(0), dock_fighters(0);
 int onscreen_display(0);
-unsigned alloced_fobjs[3] = {0}; // testing
+unsigned alloced_fobjs[2] = {0}; // testing
 float uobj_rmax(0.0), urm_ship(0.0), urm_static(0.0), urm_proj(0.0);
 point player_death_pos(all_zeros), universe_origin(all_zeros);
 vector<free_obj *> uobjs; // ships, projectiles, etc.
@@ -31,8 +32,11 @@ vector<cached_obj> coll_proj; // collision enabled projectiles, for point defens
 vector<cached_obj> decoys;    // decoy projectiles, for projectile seeking
 vector<cached_obj> c_uobjs_lit; // lit objects, used for lighting
 vector<ship_explosion> exploding;
-vector<free_obj const *> a_targets(NUM_ALIGNMENT, NULL), attackers(NUM_ALIGNMENT, NULL);
+vector<free_obj_handle_t> a_targets(NUM_ALIGNMENT), attackers(NUM_ALIGNMENT);
 vector<cached_obj> c_uobjs;
+free_obj_pool_t<u_ship> u_ship_pool("Ships");
+free_obj_pool_t<multipart_ship> multipart_ship_pool("Multipart Ships");
+free_obj_pool_t<rand_spawn_ship> rand_spawn_ship_pool("Rand Spawn Ships");
 usw_ray_group trail_rays, beam_rays; // engine trails, beams
 vector<temp_source> temp_sources;
 vector<hyper_inhibit_t> hyper_inhibits;
@@ -57,7 +61,7 @@ unsigned align_t_kills[NUM_ALIGNMENT] = {0};
 unsigned friendly_kills[NUM_ALIGNMENT]= {0};
 
 
-extern bool allow_shader_invariants;
+extern bool allow_shader_invariants, uobj_spatial_hash, uobj_parallel_update;
 extern int show_framerate, frame_counter, display_mode, animate2, do_run, show_scores;
 extern float fticks, player_sensor_dist_mult;
 extern double tfticks;
@@ -69,6 +73,9 @@ extern vector<us_weapon> us_weapons;
 
 
 void collision_detect_objects(vector<cached_obj> &objs0, unsigned t);
+void build_uobj_grids();
+void update_c_uobjs_grid();
+void uobj_vects_refilled(bool c_uobjs_only);
 void draw_and_update_engine_trails(line_tquad_draw_t &drawer);
 void add_nearby_uobj_text(text_drawer_t &text_drawer);
 void print_univ_owner_stats();
@@ -265,8 +272,8 @@ void show_stats() {
 		cout << endl;
 	}
 	print_univ_owner_stats();
-	cout << "Alloced: Ships: " << alloced_fobjs[0] << " - " << alloced_fobjs[1] << " = " <<
-		(alloced_fobjs[0] - alloced_fobjs[1]) << ", Proj+Part: " << alloced_fobjs[2] << " (x100)" << endl;
+	cout << "Alloced: Ships: " << alloced_fobjs[0] << " - " << alloced_fobjs[1] << " = " << (alloced_fobjs[0] - alloced_fobjs[1]) << endl;
+	print_free_obj_pool_stats();
 }
 
 
@@ -456,13 +463,13 @@ u_ship *create_ship(unsigned sclass, point const &pos0, unsigned align, unsigned
 
 	if (spawn_mode > 0) {
 		assert(!sclasses[sclass].dynamic_cobjs); // currently abomination and reaper
-		ship = new rand_spawn_ship(sclass, pos0, align, ai_type, target_mode, rand_orient, (spawn_mode > 1));
+		ship = rand_spawn_ship_pool.alloc(sclass, pos0, align, ai_type, target_mode, rand_orient, (spawn_mode > 1));
 	}
 	else if (sclasses[sclass].dynamic_cobjs) {
-		ship = new multipart_ship(sclass, pos0, align, ai_type, target_mode, rand_orient);
+		ship = multipart_ship_pool.alloc(sclass, pos0, align, ai_type, target_mode, rand_orient);
 	}
 	else {
-		ship = new u_ship(sclass, pos0, align, ai_type, target_mode, rand_orient);
+		ship = u_ship_pool.alloc(sclass, pos0, align, ai_type, target_mode, rand_orient);
 	}
 	add_uobj_ship(ship);
 	return ship;
@@ -500,6 +507,7 @@ void apply_univ_physics() {
 	purge_old_objs();
 	if (TIMETEST) PRINT_TIME("  Purge");
 	get_cached_objs(uobjs, c_uobjs);
+	uobj_vects_refilled(0); // the per-type vectors are refilled below
 	if (TIMETEST) PRINT_TIME("  Get Cached");
 	unsigned const nobjs((unsigned)c_uobjs.size());
 	assert(uobjs.size() == nobjs);
@@ -556,10 +564,19 @@ void apply_univ_physics() {
 	}
 	//if (TIMETEST) cout << "  nobj: " << nobjs << " ship: " << nsh << " proj: " << npr << " part: " << npa << endl;
 	if (TIMETEST) PRINT_TIME("  Rmax + Ship Vector Creation");
+	build_uobj_grids();
+	if (TIMETEST) PRINT_TIME("  Spatial Hash Build");
 
 	if (animate2) {
 		// before or after advance time and collision detection?
-		for (unsigned i = 0; i < nobjs; ++i) { // can create new objects here
+		{
+			PROFILE_SCOPE("Univ AI Plan");
+			// parallel phase: target selection and projectile guidance; objects only read each other's state from before this phase
+			parallel_for(0, nobjs, [](int i) {
+				if (c_uobjs[i].flags & (OBJ_FLAGS_SHIP | OBJ_FLAGS_PROJ)) {c_uobjs[i].obj->ai_plan();}
+			}, uobj_parallel_update, 16);
+		}
+		for (unsigned i = 0; i < nobjs; ++i) { // serial phase in sorted order: can create new objects and apply damage here
 			if (c_uobjs[i].flags & (OBJ_FLAGS_SHIP | OBJ_FLAGS_PROJ)) {c_uobjs[i].obj->ai_action();}
 		}
 		if (player_autopilot) {update_cpos();}
@@ -570,20 +587,29 @@ void apply_univ_physics() {
 		for (unsigned i = 0; i < nobjs; ++i) {uobjs[i]->apply_physics();}
 		if (TIMETEST) PRINT_TIME("  Apply Physics");
 		float const timestep(fticks/NUM_TIMESTEPS);
+		static vector<free_obj *> serial_objs;
 
 		for (unsigned t = 0; t < NUM_TIMESTEPS; ++t) { // here is where the objects move
 			collision_detect_objects(coll_objs, t);
 			if (t == 0) {remove_bad_cobjs_and_particles(coll_objs);}
 
-			for (unsigned i = 0; i < nobjs; ++i) {
-				if (!uobjs[i]->is_ok()) {
+			auto advance_obj([t, timestep](free_obj *const uobj) {
+				if (!uobj->is_ok()) {
 					// nothing
 				}
-				else if (uobjs[i]->get_flags() & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT)) {
-					if (t == 0) {uobjs[i]->advance_time(fticks);}
+				else if (uobj->get_flags() & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT)) {
+					if (t == 0) {uobj->advance_time(fticks);}
 				}
-				else {uobjs[i]->advance_time(timestep);}
-			}
+				else {uobj->advance_time(timestep);}
+			});
+			serial_objs.clear();
+			for (unsigned i = 0; i < nobjs; ++i) {if (!uobjs[i]->parallel_advance_ok()) {serial_objs.push_back(uobjs[i]);}}
+
+			parallel_for(0, nobjs, [&advance_obj](int i) { // objects only update their own state here
+				if (uobjs[i]->parallel_advance_ok()) {advance_obj(uobjs[i]);}
+			}, uobj_parallel_update, 256);
+
+			for (auto i = serial_objs.begin(); i != serial_objs.end(); ++i) {advance_obj(*i);} // the rest are run serially in a fixed order for determinism
 		}
 		if (TIMETEST) PRINT_TIME("  Advance + Collision");
 	}
@@ -599,11 +625,13 @@ void apply_univ_physics() {
 void sort_uobjects() { // originally part of apply_univ_physics()
 
 	get_cached_objs(uobjs, c_uobjs); // re-validate since new objects may have been added and old ones may have moved
+	uobj_vects_refilled(1);
 	sort(c_uobjs.begin(), c_uobjs.end(), comp_co_fast_x()); // re-sort
 	unsigned const ncuo((unsigned)c_uobjs.size());
 
 	// update uobjs to have the same sort order
 	for (unsigned i = 0; i < ncuo; ++i) {uobjs[i] = c_uobjs[i].obj;} // what about objects with time == 0? exclude them?
+	update_c_uobjs_grid();
 }
 
 
@@ -629,15 +657,41 @@ bool proc_coll(free_obj *o1, free_obj *o2) {
 }
 
 
+unsigned get_coll_bad_flags(unsigned flags) {
+
+	unsigned bad_flags(OBJ_FLAGS_BAD_);
+	if ( flags & OBJ_FLAGS_PART) {bad_flags |= OBJ_FLAGS_PART;} // skip particle-particle collisions
+	if ( flags & OBJ_FLAGS_NOC2) {bad_flags |= OBJ_FLAGS_NOC2;} // both objects have their C2 flags set, skip the collision
+	if ((flags & OBJ_FLAGS_PROJ) && (flags & OBJ_FLAGS_NOPC)) {bad_flags |= OBJ_FLAGS_PROJ;} // no projectile-projectile collision
+	return bad_flags;
+}
+
+void check_coll_pair(cached_obj &o1, cached_obj &o2, unsigned bad_flags) {
+
+	if (o2.flags & bad_flags) return;
+	float const radius(o1.radius + o2.radius);
+	if (fabs(o1.pos.y - o2.pos.y) > radius || !dist_less_than(o1.pos, o2.pos, radius)) return; // no intersection
+
+	if (proc_coll(o1.obj, o2.obj)) {
+		o1.refresh(); // ???
+		o2.refresh(); // ???
+	}
+}
+
+
 void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 
 	//RESET_TIME;
+	PROFILE_SCOPE("Univ Collision");
 	unsigned const size((unsigned)objs.size());
 	static vector<interval> intervals;
+	static vector<float> coll_radius; // radius at the start of collision detection, 0 if skipped
 	intervals.clear();
-	intervals.reserve(2*size);
+	coll_radius.resize(size);
+	if (!uobj_spatial_hash) {intervals.reserve(2*size);}
 
 	for (unsigned i = 0; i < size; ++i) {
+		coll_radius[i] = 0.0;
 		if (objs[i].flags & OBJ_FLAGS_BAD_) continue;
 
 		if (t > 0 && (objs[i].flags & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT))) {
@@ -650,9 +704,34 @@ void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 		assert(radius > 0.0);
 		if (left == right) continue; // floating point precision limitation or bug?
 		assert(left < right);
+		coll_radius[i] = objs[i].radius;
+		if (uobj_spatial_hash) continue;
 		intervals.push_back(interval(left,  i, 1));
 		intervals.push_back(interval(right, i, 0));
 	}
+	if (uobj_spatial_hash) {
+		// each colliding pair is tested once by the larger object, which only needs to search out to twice its own radius
+		static cached_obj_grid_t grid;
+		grid.build(objs, 1);
+
+		for (unsigned i = 0; i < size; ++i) {
+			float const radius_i(coll_radius[i]);
+			if (radius_i == 0.0) continue;
+			unsigned const bad_flags(get_coll_bad_flags(objs[i].flags));
+
+			auto test_obj([&](unsigned j) {
+				float const radius_j(coll_radius[j]);
+				if (radius_j == 0.0 || radius_j > radius_i || (radius_j == radius_i && j >= i)) return 1; // skipped, or tested by obj j
+				check_coll_pair(objs[i], objs[j], bad_flags);
+				return 1;
+			});
+			if (!grid.query(objs[i].pos, [radius_i]() {return 2.0f*radius_i;}, test_obj)) { // large object, test all objects
+				for (unsigned j = 0; j < size; ++j) {test_obj(j);}
+			}
+		}
+		grid.clear();
+		return;
+	}
 	unsigned const size2((unsigned)intervals.size());
 	static vector<unsigned> locs, work;
 	locs.resize(size);
@@ -660,31 +739,11 @@ void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 	sort(intervals.begin(), intervals.end());
 
 	for (unsigned i = 0; i < size2; ++i) {
-		unsigned const ix(intervals[i].ix & ~LEFT_EDGE_BIT), ix_flags(objs[ix].flags);
-		unsigned bad_flags(OBJ_FLAGS_BAD_);
-		if ( ix_flags & OBJ_FLAGS_PART) {bad_flags |= OBJ_FLAGS_PART;} // skip particle-particle collisions
-		if ( ix_flags & OBJ_FLAGS_NOC2) {bad_flags |= OBJ_FLAGS_NOC2;} // both objects have their C2 flags set, skip the collision
-		if ((ix_flags & OBJ_FLAGS_PROJ) && (ix_flags & OBJ_FLAGS_NOPC)) {bad_flags |= OBJ_FLAGS_PROJ;} // no projectile-projectile collision
+		unsigned const ix(intervals[i].ix & ~LEFT_EDGE_BIT);
 		
 		if (intervals[i].ix & LEFT_EDGE_BIT) { // start a new sphere
-			unsigned const wsize((unsigned)work.size());
-
-			if (wsize > 0) {
-				point const pos_i(objs[ix].pos);
-				float const c_radius_i(objs[ix].radius), pisd(pos_i.y);
-
-				for (unsigned k = 0; k < wsize; ++k) {
-					cached_obj &obj(objs[work[k]]);
-					if (obj.flags & bad_flags) continue;
-					float const radius(c_radius_i + obj.radius);
-					if (fabs(pisd - obj.pos.y) > radius || !dist_less_than(pos_i, obj.pos, radius)) continue; // no intersection
-
-					if (proc_coll(objs[ix].obj, obj.obj)) {
-						objs[ix].refresh(); // ???
-						obj.refresh(); // ???
-					}
-				}
-			}
+			unsigned const wsize((unsigned)work.size()), bad_flags(get_coll_bad_flags(objs[ix].flags));
+			for (unsigned k = 0; k < wsize; ++k) {check_coll_pair(objs[ix], objs[work[k]], bad_flags);}
 			locs[ix] = wsize;
 			work.push_back(ix);
 		}
@@ -705,8 +764,7 @@ void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 uparticle *gen_particle(unsigned type, colorRGBA const &c1, colorRGBA const &c2, unsigned lt, point const &pos,
 						vector3d const &vel, float size, float damage, unsigned align, bool coll, int texture_id)
 {
-	static free_obj_allocator<uparticle> allocator;
-	uparticle *part = allocator.alloc(type);
+	uparticle *part = alloc_uparticle();
 	part->set_params(type, pos, vel, signed_rand_vector_norm(), size, c1, c2, lt, damage, align, coll, texture_id);
 	if (type == PTYPE_GLOW) {part->add_flag(OBJ_FLAGS_NOLT);} // no lights on a glow particle
 	uobjs.push_back(part);
@@ -759,8 +817,7 @@ void add_parts_projs(point const &pos, float radius, vector3d const &dir, colorR
 us_projectile *create_projectile(unsigned type, free_obj const *const parent, unsigned align, point const &pos,
 								 vector3d const &vel, vector3d const &dir, vector3d const &upv)
 {
-	static free_obj_allocator<us_projectile> allocator;
-	us_projectile *proj(allocator.alloc(type));
+	us_projectile *proj(alloc_projectile(type));
 	proj->set_parent(parent);
 	proj->set_align(align);
 	proj->set_pos(pos);
@@ -1086,6 +1143,7 @@ void purge_old_objs() {
 	unsigned nbad(0);
 	unsigned const nobjs((unsigned)uobjs.size());
 	check_explosion_refs();
+	free_obj_pools_next_frame(); // objects deleted in the previous purge can now be reused
 
 	for (unsigned i = 0; i < a_targets.size(); ++i) {
 		if (a_targets[i] != NULL && a_targets[i]->not_a_target()) a_targets[i] = NULL;
@@ -1105,12 +1163,8 @@ void purge_old_objs() {
 
 	for (unsigned i = 0; i < nobjs; ++i) { // rebuild uobjs vector
 		if (uobjs[i]->to_be_removed()) {
-			if (!uobjs[i]->dec_ref()) { // all ships and stationary objects should be deleted through this point and nowhere else, can't allocate on the stack
-				assert(!uobjs[i]->is_player_ship());
-				assert(uobjs[i]->is_ship() || uobjs[i]->is_stationary() || uobjs[i]->is_part_cloud()); // sanity check
-				if (uobjs[i]->is_ship()) {++alloced_fobjs[1];}
-				delete uobjs[i]; // Note: this is the *only* place where ships, stationary objects, and particle clouds are deleted
-			}
+			if (uobjs[i]->is_ship()) {++alloced_fobjs[1];}
+			delete_uobj(uobjs[i]); // returns pooled objects to their pool
 		}
 		else {
 			uobjs[i]->next_frame();
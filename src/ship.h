@@ -130,8 +130,7 @@ string    const align_names[NUM_ALIGNMENT] = {"Neutral", "Player", "Government",
 
 
 // forward references
-template<typename T> class free_obj_block;
-template<typename T> class free_obj_allocator;
+class free_obj_pool_base_t;
 
 class s_object;
 class urev_body;
@@ -141,6 +140,42 @@ class u_ship;
 class ship_weapon;
 
 
+struct free_obj_slot_t {
+	free_obj *obj;
+	unsigned gen; // incremented when the object is deleted so that old handles become invalid
+	free_obj_slot_t() : obj(NULL), gen(0) {}
+};
+
+unsigned const FOBJ_SLOT_CHUNK_BITS = 12;
+unsigned const FOBJ_SLOT_CHUNK_SIZE = (1 << FOBJ_SLOT_CHUNK_BITS);
+unsigned const FOBJ_MAX_SLOT_CHUNKS = 4096; // 16M live objects
+extern free_obj_slot_t *fobj_slot_chunks[FOBJ_MAX_SLOT_CHUNKS]; // chunks are never moved or freed, so lookups don't need a lock
+
+inline free_obj_slot_t const &get_fobj_slot(unsigned slot) {return fobj_slot_chunks[slot >> FOBJ_SLOT_CHUNK_BITS][slot & (FOBJ_SLOT_CHUNK_SIZE-1)];}
+unsigned alloc_fobj_slot(free_obj *obj);
+void free_fobj_slot(unsigned slot);
+
+
+// generation counted weak reference to a free_obj; returns NULL once the object has been deleted or returned to its pool
+class free_obj_handle_t {
+
+	unsigned slot, gen; // slot 0 is NULL
+public:
+	free_obj_handle_t() : slot(0), gen(0) {}
+	free_obj_handle_t(free_obj const *const obj) {set(obj);}
+	free_obj_handle_t &operator=(free_obj const *const obj) {set(obj); return *this;}
+	inline void set(free_obj const *const obj); // defined after free_obj
+
+	free_obj const *get() const {
+		if (slot == 0) return NULL;
+		free_obj_slot_t const &s(get_fobj_slot(slot));
+		return ((s.gen == gen) ? s.obj : NULL);
+	}
+	operator free_obj const *() const {return get();}
+	free_obj const *operator->() const {free_obj const *const obj(get()); assert(obj != NULL); return obj;}
+};
+
+
 extern bool player_enemy, begin_motion; // required for efficiency
 extern u_ship *player_ship_ptr;
 
@@ -667,10 +702,12 @@ protected:
 	float speed_factor, max_sfactor, temperature, extra_mass, rot_rate, sobj_dist, draw_rscale, ambient_scale;
 	point reset_pos;
 	vector3d velocity, upv, dir, dvel, rot_axis, gvect;
-	free_obj const *target_obj, *parent;
+	free_obj_handle_t target_obj;
+	free_obj const *parent;
 	unsigned exp_lights[NUM_EXP_LIGHTS], num_exp_lights;
-	unsigned alignment;
+	unsigned alignment, handle_slot;
 	float c_radius;
+	free_obj_pool_base_t *pool; // NULL if allocated with new
 
 	static unsigned next_obj_id;
 
@@ -688,7 +725,7 @@ protected:
 
 public:
 	free_obj(point const &init_pos=all_zeros) : flags(OBJ_FLAGS_TARG), speed_factor(1.0), max_sfactor(1.0),
-		reset_pos(init_pos), alignment(ALIGN_NEUTRAL), c_radius(0.0) {reset();}
+		reset_pos(init_pos), alignment(ALIGN_NEUTRAL), handle_slot(alloc_fobj_slot(this)), c_radius(0.0), pool(NULL) {reset();}
 	
 	void fix_upv();
 	void accelerate(float speed, float accel);
@@ -709,6 +746,7 @@ public:
 	void reset_after(unsigned nticks) {if (reset_timer == 0) reset_timer = nticks;}
 	void reset_lights() {num_exp_lights = 0;}
 	void set_parent(free_obj const *p) {parent = p;}
+	void set_pool(free_obj_pool_base_t *pool_) {pool = pool_;}
 	void add_light(unsigned index);
 	vector3d get_orient() const;
 	void calc_rotation_vectors() const;
@@ -757,7 +795,9 @@ public:
 	unsigned        get_time()     const {return time;}
 	unsigned        get_flags()    const {return flags;}
 	int          get_shadow_val()  const {return shadow_val;}
-	free_obj const *get_target()   const {return target_obj;}
+	free_obj const *get_target()   const {return target_obj.get();}
+	free_obj_pool_base_t *get_pool() const {return pool;}
+	unsigned get_handle_slot()     const {return handle_slot;}
 	free_obj const *get_parent()   const {return parent;}
 	free_obj const *get_root_parent() const;
 	int get_owner() const {return alignment;}
@@ -788,7 +828,7 @@ public:
 	bool is_parent_of_docking_fighter(free_obj const *const fobj) const {return (fobj != NULL && fobj->get_parent() == this && fobj->get_target() == this);}
 	unsigned get_obj_id() const {return obj_id;}
 
-	virtual ~free_obj() {verify_status(); invalidate_permanently();}
+	virtual ~free_obj() {verify_status(); invalidate_permanently(); free_fobj_slot(handle_slot);}
 	virtual void reset();
 	virtual void check_ref_objs();
 	virtual void move_by(point const &pos_) {pos += pos_;} // reset_pos?
@@ -807,13 +847,14 @@ public:
 	virtual void draw_obj(uobj_draw_data &ddata) const = 0;
 	virtual void draw_flares_only() const {assert(0);}
 	virtual void set_temp(float temp, point const &tcenter, free_obj const *source=NULL);
+	virtual void ai_plan() {} // thread safe part of the AI, called in parallel before ai_action(); may read other objects, but only writes to this one
 	virtual void ai_action() {} // default: no AI
 	virtual void first_frame_hook() {}
 	virtual void apply_physics();
 	virtual void advance_time(float timestep);
+	virtual bool parallel_advance_ok() const {return 1;} // advance_time() only modifies this object and doesn't use the global RNG
 	virtual int get_gravity(vector3d &vgravity, point const &mpos) const {return 0;}
 	virtual bool fire_weapon(vector3d const &fire_dir, float target_dist) {return 0;} // default - do nothing (should this be here?)
-	virtual bool dec_ref() {return 0;} // could be const?
 	virtual void reset_target() {target_obj = NULL;}
 	virtual bool source_is_player()            const {return ((parent == NULL) ? 0 : parent->source_is_player());}
 	virtual u_ship_base const *get_ship_base() const {assert(0); return NULL;} // sort of a hack
@@ -872,6 +913,12 @@ public:
 }; // end free_obj
 
 
+inline void free_obj_handle_t::set(free_obj const *const obj) {
+	slot = ((obj == NULL) ? 0 : obj->get_handle_slot());
+	gen  = ((slot == 0) ? 0 : get_fobj_slot(slot).gen);
+}
+
+
 class stationary_obj : public free_obj { // a free_obj that doesn't actually move?
 
 	unsigned type, lifetime;
@@ -942,6 +989,7 @@ public:
 	//float damage(float val, int type, point const &hit_pos, free_obj const *source, int wc);
 	void explode(float damage, float bradius, int etype, vector3d const &edir, int exp_time, int wclass, int align, unsigned eflags, free_obj const *parent_);
 	void advance_time(float timestep);
+	bool parallel_advance_ok() const {return pos_valid;} // respawning uses rand()
 };
 
 
@@ -973,22 +1021,16 @@ class uparticle : public free_obj {
 	float angle, rrate, damage_v;
 	vector3d axis;
 	colorRGBA color1, color2;
-	free_obj_block<uparticle> *alloc_block;
 
 public:
-	friend class free_obj_allocator<uparticle>;
-	static unsigned const max_type = NUM_PTYPES;
-
-	uparticle() : ptype(0), lifetime(0), texture_id(-1), angle(0), rrate(0), damage_v(0), alloc_block(NULL) {}
+	uparticle() : ptype(0), lifetime(0), texture_id(-1), angle(0), rrate(0), damage_v(0) {}
 	uparticle(unsigned ptype_, point const &pos_, vector3d const &vel, vector3d const &d, float radius_, colorRGBA const &c1,
-		colorRGBA const &c2, unsigned lt, float damage_, unsigned align, bool coll_, int tid) : alloc_block(NULL) {
+		colorRGBA const &c2, unsigned lt, float damage_, unsigned align, bool coll_, int tid) {
 		set_params(ptype_, pos_, vel, d, radius_, c1, c2, lt, damage_, align, coll_, tid);
 	}
-	void reset() {alloc_block = NULL; free_obj::reset();}
 	void set_params(unsigned ptype_, point const &pos_, vector3d const &vel, vector3d const &d, float radius_,
 		colorRGBA const &c1, colorRGBA const &c2, unsigned lt, float damage_, unsigned align, bool coll_, int tid);
 	void set_type(unsigned type) {ptype = type;}
-	bool dec_ref();
 	vector3d get_tot_vel_at(point const &cpos) const;
 	void apply_physics();
 	bool collision(point const &copos, vector3d const &vcoll, float obj_mass, float obj_radius, free_obj *source, float elastic);
@@ -1042,20 +1084,16 @@ private:
 	unsigned wclass;
 	unsigned tup_time;
 	float armor;
-	free_obj_block<us_projectile> *alloc_block;
+	bool lock_warning;
 
 public:
-	friend class free_obj_allocator<us_projectile>;
-	static unsigned const max_type = NUM_UWEAP;
-
 	us_projectile(unsigned type=UWEAP_NONE);
-	void reset() {alloc_block = NULL; free_obj::reset();}
 	void set_type(unsigned type);
-	bool dec_ref();
 	us_weapon const &specs() const;
 	float get_max_t() const {return specs().max_t;}
 	float get_mass()  const {return (specs().mass + extra_mass);} // more mass than a ship to give higher collision impact
 	unsigned get_eflags() const;
+	void ai_plan();
 	void ai_action();
 	void apply_physics();
 	free_obj const *get_src() const {return ((parent == NULL) ? NULL : parent->get_src());}
@@ -1181,6 +1219,15 @@ public:
 };
 
 
+struct ai_target_plan_t { // target acquisition result, computed by ai_plan() and applied by ai_action()
+	free_obj const *target, *prev_target;
+	float min_dist;
+	unsigned tup_time, retarg_time;
+	bool valid, target_set, warn;
+	ai_target_plan_t() : target(NULL), prev_target(NULL), min_dist(0.0), tup_time(0), retarg_time(0), valid(0), target_set(0), warn(0) {}
+};
+
+
 class u_ship : public free_obj, public u_ship_base {
 
 	unsigned ai_type; // us_class of this ship
@@ -1192,6 +1239,8 @@ class u_ship : public free_obj, public u_ship_base {
 	vector3d hit_dir, obs_orient, target_dir;
 	string name;
 	mesh2d surface_mesh;
+	rand_gen_t ai_rgen; // per-ship so that AI decisions made in parallel are deterministic
+	ai_target_plan_t targ_plan;
 
 	u_ship(u_ship const &) = delete; // forbidden
 	void operator=(u_ship const &) = delete; // forbidden
@@ -1229,7 +1278,9 @@ public:
 	int get_move_dir();
 	vector3d get_tot_vel_at(point const &cpos) const;
 	bool do_multi_target() const;
-	free_obj const *find_closest_target(point const &pos0, float min_dist, float max_dist, bool req_shields) const;
+	free_obj const *find_closest_target(point const &pos0, float min_dist, float max_dist, bool req_shields, free_obj const *cur_targ, rand_gen_t &rgen) const;
+	float get_ai_min_dist() const;
+	void plan_target(float min_dist, ai_target_plan_t &plan);
 	void acquire_target(float min_dist);
 	free_obj *get_closest_dock(float max_dist) const;
 	int get_line_query_obj_types(float qdist) const {return ((sobj_dist < qdist) ? OBJ_TYPE_LGU : OBJ_TYPE_LARGE);} // only test planets, etc. if close to sobj
@@ -1251,12 +1302,14 @@ public:
 	float get_fast_target_dist(free_obj const *const target=NULL) const;
 	bool has_slow_fighters() const;
 	void fire_at_target(free_obj const *const targ_obj, float min_dist);
+	virtual void ai_plan();
 	virtual void ai_action();
 	void fire_point_defenses();
 	bool find_coll_enemy_proj(float dmax, point &p_int) const;
 	virtual bool has_clear_line_of_fire(us_weapon const &weap, vector3d const &fire_dir, float target_dist) const;
 	void ai_fire(vector3d const &targ_dir, float target_dist, float min_dist, int move_dir);
 	void get_fighter_target(u_ship const *ship);
+	free_obj const *find_fighter_target(u_ship const *ship) const;
 	void set_temp(float temp, point const &tcenter, free_obj const *source);
 	virtual void apply_physics();
 	void set_ship_max_speed(float ms_scale=1.0);
@@ -6,12 +6,18 @@
 #include "ship_util.h"
 #include "explosion.h"
 #include "obj_sort.h"
+#include "job_system.h"
 
 
 bool const EXPLODE_LIGHTING = 1;
 
+enum {GRID_C_UOBJS=0, GRID_C_UOBJS_LIT, GRID_ALL_SHIPS, GRID_STAT_OBJS, GRID_COLL_PROJ, GRID_DECOYS, GRID_SHIPS, NUM_UOBJ_GRIDS=GRID_SHIPS+NUM_ALIGNMENT};
+
 float uobjs_lit_rmax(0.0);
+cached_obj_grid_t uobj_grids[NUM_UOBJ_GRIDS];
+unsigned uobj_vect_gen[NUM_UOBJ_GRIDS] = {0}; // incremented when the vector is refilled, which invalidates its grid
 
+extern bool uobj_spatial_hash;
 extern int display_mode;
 extern float uobj_rmax, urm_ship, urm_static, urm_proj;
 extern vector<cached_obj> ships[], all_ships, stat_objs, coll_proj, decoys, c_uobjs, c_uobjs_lit;
@@ -33,6 +39,119 @@ unsigned binary_search_pos(vector<cached_obj> const &objs, point const &pos) { /
 }
 
 
+// *********************** SPATIAL HASH *******************************
+
+
+unsigned get_hash_slot(uint64_t key, unsigned table_bits) {return unsigned((key*0x9E3779B97F4A7C15ULL) >> (64 - table_bits));} // Fibonacci hashing
+
+cached_obj_grid_t::cell_t const *cached_obj_grid_t::find_cell(uint64_t key) const {
+
+	if (table.empty()) return NULL;
+	unsigned const mask((1U << table_bits) - 1);
+
+	for (unsigned h = get_hash_slot(key, table_bits); ; h = ((h + 1) & mask)) { // linear probing; the table always has empty slots
+		cell_t const &cell(table[h]);
+		if (cell.num == 0)   return NULL;
+		if (cell.key == key) return &cell;
+	}
+	return NULL; // never gets here
+}
+
+
+void cached_obj_grid_t::build(vector<cached_obj> const &objs_, bool parallel, unsigned gen_) {
+
+	clear();
+	if (objs_.empty()) return;
+	gen      = gen_;
+	objs     = &objs_;
+	num_objs = objs_.size();
+	cube_t bcube(objs_.front().pos, objs_.front().pos);
+	float rsum(0.0);
+
+	for (auto i = objs_.begin(); i != objs_.end(); ++i) {
+		bcube.union_with_pt(i->pos);
+		rsum += i->radius;
+	}
+	// cells should be about the size of a typical object, but no smaller than the average object spacing
+	float const max_dim(max(max(bcube.dx(), bcube.dy()), bcube.dz())), vol_per_obj(bcube.get_volume()/num_objs);
+	cell_sz     = max(2.0f*rsum/num_objs, (float)pow(vol_per_obj, 1.0f/3.0f));
+	cell_sz     = max(cell_sz, max_dim/float((1<<21) - 1)); // keep cell coords within 21 bits
+	if (!(cell_sz > 0.0f)) {cell_sz = 1.0;} // a single point or NaN
+	inv_cell_sz = 1.0/cell_sz;
+	origin      = bcube.get_llc();
+	UNROLL_3X(dims[i_] = min((1<<21), (int(bcube.get_sz_dim(i_)*inv_cell_sz) + 1));)
+	keys.resize(num_objs);
+
+	parallel_for(0, (int)num_objs, [&](int i) {
+		point const &p(objs_[i].pos);
+		keys[i] = make_pair(get_key(get_cell(p.x, 0), get_cell(p.y, 1), get_cell(p.z, 2)), unsigned(i));
+	}, (parallel && num_objs > 4096));
+	sort(keys.begin(), keys.end()); // sort by cell, then by index so that objects within a cell are visited in vector order
+	unsigned num_cells(0);
+
+	for (size_t i = 0; i < num_objs; ++i) {
+		if (i == 0 || keys[i].first != keys[i-1].first) {++num_cells;}
+	}
+	for (table_bits = 4; (1U << table_bits) < 2*num_cells; ++table_bits) {} // at most 50% full
+	table.resize(1U << table_bits);
+	ixs.resize(num_objs);
+	unsigned const mask((1U << table_bits) - 1);
+
+	for (unsigned i = 0; i < num_objs;) {
+		uint64_t const key(keys[i].first);
+		unsigned const start(i);
+		for (; i < num_objs && keys[i].first == key; ++i) {ixs[i] = keys[i].second;}
+		unsigned h(get_hash_slot(key, table_bits));
+		while (table[h].num > 0) {h = ((h + 1) & mask);}
+		table[h].key   = key;
+		table[h].start = start;
+		table[h].num   = i - start;
+	}
+}
+
+
+vector<cached_obj> const &get_uobj_grid_objs(unsigned ix) {
+
+	switch (ix) {
+	case GRID_C_UOBJS:     return c_uobjs;
+	case GRID_C_UOBJS_LIT: return c_uobjs_lit;
+	case GRID_ALL_SHIPS:   return all_ships;
+	case GRID_STAT_OBJS:   return stat_objs;
+	case GRID_COLL_PROJ:   return coll_proj;
+	case GRID_DECOYS:      return decoys;
+	}
+	assert(ix >= GRID_SHIPS && ix < NUM_UOBJ_GRIDS);
+	return ships[ix - GRID_SHIPS];
+}
+
+void build_uobj_grid(unsigned ix, bool parallel) {
+	if (uobj_spatial_hash) {uobj_grids[ix].build(get_uobj_grid_objs(ix), parallel, uobj_vect_gen[ix]);} else {uobj_grids[ix].clear();}
+}
+
+void build_uobj_grids() { // all except the lit objects, which are updated in calc_lit_uobjects()
+
+	PROFILE_SCOPE("Univ Obj Grid Build");
+	parallel_for(0, NUM_UOBJ_GRIDS, [](int ix) {if (ix != GRID_C_UOBJS_LIT) {build_uobj_grid(ix, 1);}}, 1, 1);
+}
+
+// called when c_uobjs (and the per-type vectors if !c_uobjs_only) are refilled, before their grids are rebuilt
+void uobj_vects_refilled(bool c_uobjs_only) {
+	for (unsigned i = 0; i < NUM_UOBJ_GRIDS; ++i) {
+		if ((c_uobjs_only ? (i == GRID_C_UOBJS) : (i != GRID_C_UOBJS_LIT))) {++uobj_vect_gen[i];}
+	}
+}
+
+void update_c_uobjs_grid() {build_uobj_grid(GRID_C_UOBJS, 1);} // called after c_uobjs is refreshed and re-sorted
+
+cached_obj_grid_t const *get_uobj_grid(vector<cached_obj> const *const objs) {
+
+	for (unsigned i = 0; i < NUM_UOBJ_GRIDS; ++i) {
+		if (uobj_grids[i].valid_for(objs, uobj_vect_gen[i])) return &uobj_grids[i];
+	}
+	return NULL; // not a grid vector, or modified since the grid was built
+}
+
+
 void line_intersect_fo_vector(line_int_data &li_data, vector<cached_obj> const &objs, free_obj *&fobj, float urm, bool find_ships) {
 
 	unsigned const nobjs((unsigned)objs.size());
@@ -348,10 +467,27 @@ inline bool query_func_wrap(all_query_data &qdata, all_query query_func, unsigne
 }
 
 
+float get_query_radius(query_data     const &qdata) {return (qdata.radius + qdata.urm);}
+float get_query_radius(closeness_data const &qdata) {return qdata.dmin;} // shrinks as closer objects are found
+float get_query_radius(all_query_data const &qdata) {return qdata.max_search_dist;}
+
+// returns 0 if there's no valid grid for this vector or the query radius is too large for the grid to help
+template<typename data_t, typename query> bool find_close_objects_grid(data_t &qdata, query query_func, unsigned bad_flags) {
+
+	cached_obj_grid_t const *const grid(get_uobj_grid(qdata.objs));
+	if (grid == NULL) return 0;
+	// the x-distance early exit returned by query_func_wrap() only applies to the sorted linear search, so it's ignored here
+	return grid->query(qdata.pos, [&qdata]() {return get_query_radius(qdata);},
+		[&](unsigned ix) {query_func_wrap(qdata, query_func, bad_flags, ix); return !qdata.exit_query;});
+}
+
+
 template<typename data_t, typename query> void find_close_objects(data_t &qdata, query query_func, unsigned bad_flags=0) {
 
 	assert(qdata.objs != NULL);
 	if (qdata.objs->empty()) return;
+	PROFILE_SCOPE("Univ Obj Query");
+	if (find_close_objects_grid(qdata, query_func, bad_flags)) return;
 	unsigned const start(binary_search_pos(*(qdata.objs), qdata.pos)), nobjs((unsigned)qdata.objs->size());
 	assert(start <= nobjs);
 
@@ -386,6 +522,7 @@ void calc_lit_uobjects() {
 
 	//RESET_TIME;
 	c_uobjs_lit.resize(0);
+	++uobj_vect_gen[GRID_C_UOBJS_LIT];
 	uobjs_lit_rmax = 0.0;
 
 	for (vector<cached_obj>::const_iterator i = c_uobjs.begin(); i != c_uobjs.end(); ++i) {
@@ -394,6 +531,7 @@ void calc_lit_uobjects() {
 			uobjs_lit_rmax = max(uobjs_lit_rmax, i->radius);
 		}
 	}
+	build_uobj_grid(GRID_C_UOBJS_LIT, 0);
 	//PRINT_TIME("Calc Lit Uobjects");
 }
 
@@ -9,8 +9,7 @@
 #include "ship.h"
 #include "obj_sort.h"
 #include "draw_utils.h" // for line_tquad_draw_t
-
-unsigned const BLOCK_SIZE = 1000;
+#include <mutex>
 
 extern unsigned alloced_fobjs[]; // testing
 
@@ -146,73 +145,36 @@ struct line_int_data {
 };
 
 
-template<typename T> class free_obj_block {
+// arena of fixed size slots for one free_obj type; memory is never returned to the system, and freed slots are only reused
+// after the next purge so that a stale pointer sees a dead object rather than a new one (use free_obj_handle_t to hold references)
+class free_obj_pool_base_t {
+
+	std::mutex mutex; // objects may be created from multiple threads
+	vector<char *> blocks;
+	vector<void *> free_list, pending_free;
+	char const *name;
+	size_t slot_size;
+	unsigned slots_per_block, num_live, max_live, num_allocs;
 
-	T objs[BLOCK_SIZE];
-	unsigned used, freed;
-	bool in_use, valid;
+	free_obj_pool_base_t(free_obj_pool_base_t const &) = delete; // forbidden
+	void operator=(free_obj_pool_base_t const &) = delete; // forbidden
+protected:
+	void *alloc_mem();
 public:
-	free_obj_block() : used(0), freed(0), in_use(0), valid(1) {}
-
-	T *alloc(unsigned type) {
-		assert(valid);
-		if (used == BLOCK_SIZE) return NULL;
-		assert(used < BLOCK_SIZE);
-		assert(type < T::max_type);
-		assert(objs[used].status == 0);
-		objs[used].set_type(type);
-		if (VERIFY_REFS) objs[used].verify_status();
-		return &objs[used++];
-	}
-	bool free_object() {
-		assert(valid);
-		if (++freed == BLOCK_SIZE) {
-			if (in_use) {
-				for (unsigned i = 0; i < BLOCK_SIZE; ++i) objs[i].reset(); // is this necessary?
-				used = freed = 0; // re-initialize
-			}
-			else {
-				valid = 0; // in case someone tries to use this deleted block
-				assert(alloced_fobjs[2] > 0);
-				--alloced_fobjs[2];
-				delete this; // is this legal?
-			}
-			return 0;
-		}
-		return 1;
-	}
-	void set_in_use(bool val) {assert(valid); in_use = val;}
+	free_obj_pool_base_t(char const *name_, size_t obj_size);
+	void free(free_obj *obj);
+	void next_frame();
+	void print_stats() const;
 };
 
-
-template<typename T> class free_obj_allocator {
-
-	free_obj_block<T> *last;
-	free_obj_allocator(free_obj_allocator const &) = delete; // forbidden
-	void operator=(free_obj_allocator const &) = delete; // forbidden
+template<typename T> class free_obj_pool_t : public free_obj_pool_base_t {
 public:
-	free_obj_allocator() : last(new free_obj_block<T>) {last->set_in_use(1);}
-
-	T *alloc(unsigned type) {
-		assert(last != NULL);
-		T *ptr(last->alloc(type));
-		
-		if (ptr == NULL) {
-			last->set_in_use(0); // unlock so that it can be freed
-			last = new free_obj_block<T>;
-			++alloced_fobjs[2];
-			assert(last != NULL);
-			last->set_in_use(1); // lock so that it can't be freed
-			ptr = last->alloc(type);
-			assert(ptr != NULL);
-		}
-		ptr->alloc_block = last;
-		if (VERIFY_REFS) ptr->verify_status();
-		return ptr;
-	}
+	free_obj_pool_t(char const *name_) : free_obj_pool_base_t(name_, sizeof(T)) {}
 
-	~free_obj_allocator() { // Note: last should free itself when its reference count drops to zero
-	  //delete last; // what about the other pointers?
+	template<typename... A> T *alloc(A&&... args) {
+		T *const obj(new(alloc_mem()) T(std::forward<A>(args)...));
+		obj->set_pool(this);
+		return obj;
 	}
 };
 
@@ -285,6 +247,11 @@ void add_lightning_wray(float width, point const &p1, point const &p2);
 // free_obj.cpp
 void add_uparticle_cloud(point const &pos, float rmin, float rmax, colorRGBA const &ci1, colorRGBA const &co1,
 	colorRGBA const &ci2, colorRGBA const &co2, unsigned lt, float damage, float expand_exp, float noise_scale);
+uparticle *alloc_uparticle();
+us_projectile *alloc_projectile(unsigned type);
+void delete_uobj(free_obj *obj);
+void free_obj_pools_next_frame();
+void print_free_obj_pool_stats();
 
 
 #endif
@@ -0,0 +1,229 @@
+// 3D World - SIMD Simplex/Perlin Terrain Noise
+// by Frank Gennari
+// 10/17/26
+
+#include "simd_noise.h"
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+// AVX is enabled with -mavx/-mavx2/-march=native or /arch:AVX2; SSE2 is always available on x64
+#if defined(__AVX__)
+#include <immintrin.h>
+#define USE_AVX_NOISE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#define USE_SSE_NOISE
+#endif
+
+extern bool use_simd_noise;
+
+
+noise_fbm_params_t::noise_fbm_params_t(bool perlin_, int shape_, unsigned num_octaves_, float rx0, float ry0, float lacunarity, float gain) :
+	perlin(perlin_), shape(shape_), num_octaves(num_octaves_)
+{
+	assert(num_octaves <= MAX_NOISE_OCTAVES);
+	float m(1.0f), f(1.0f);
+
+	for (unsigned i = 0; i < num_octaves; ++i) {
+		freq[i] = f; mag[i] = m; rx[i] = rx0; ry[i] = ry0;
+		m   *= gain;
+		f   *= lacunarity;
+		rx0 *= 1.5f;
+		ry0 *= 1.5f;
+	}
+}
+
+
+// ************ vector types ************
+// Note: only exactly rounded ops (+ - * / floor abs max compare) are used so that each lane matches the scalar result
+
+inline float vfloor(float v) {return floorf(v);}
+inline float vabs  (float v) {return fabsf(v);}
+inline float vmax  (float a, float b) {return ((a > b) ? a : b);} // same as _mm_max_ps()
+inline float vselect_gt(float a, float b, float t, float f) {return ((a > b) ? t : f);}
+
+#ifdef USE_AVX_NOISE
+struct vfloat_t {
+	__m256 v;
+	static unsigned const SIZE = 8;
+	vfloat_t() {}
+	vfloat_t(__m256 v_) : v(v_) {}
+	vfloat_t(float f) : v(_mm256_set1_ps(f)) {}
+	static vfloat_t load(float const *p) {return _mm256_loadu_ps(p);}
+	void store(float *p) const {_mm256_storeu_ps(p, v);}
+};
+inline vfloat_t operator+(vfloat_t const &a, vfloat_t const &b) {return _mm256_add_ps(a.v, b.v);}
+inline vfloat_t operator-(vfloat_t const &a, vfloat_t const &b) {return _mm256_sub_ps(a.v, b.v);}
+inline vfloat_t operator*(vfloat_t const &a, vfloat_t const &b) {return _mm256_mul_ps(a.v, b.v);}
+inline vfloat_t operator/(vfloat_t const &a, vfloat_t const &b) {return _mm256_div_ps(a.v, b.v);}
+inline vfloat_t vfloor(vfloat_t const &a) {return _mm256_floor_ps(a.v);}
+inline vfloat_t vabs  (vfloat_t const &a) {return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);}
+inline vfloat_t vmax  (vfloat_t const &a, vfloat_t const &b) {return _mm256_max_ps(a.v, b.v);}
+inline vfloat_t vselect_gt(vfloat_t const &a, vfloat_t const &b, vfloat_t const &t, vfloat_t const &f) {return _mm256_blendv_ps(f.v, t.v, _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ));}
+#define HAS_SIMD_NOISE
+
+#elif defined(USE_SSE_NOISE)
+struct vfloat_t {
+	__m128 v;
+	static unsigned const SIZE = 4;
+	vfloat_t() {}
+	vfloat_t(__m128 v_) : v(v_) {}
+	vfloat_t(float f) : v(_mm_set1_ps(f)) {}
+	static vfloat_t load(float const *p) {return _mm_loadu_ps(p);}
+	void store(float *p) const {_mm_storeu_ps(p, v);}
+};
+inline vfloat_t operator+(vfloat_t const &a, vfloat_t const &b) {return _mm_add_ps(a.v, b.v);}
+inline vfloat_t operator-(vfloat_t const &a, vfloat_t const &b) {return _mm_sub_ps(a.v, b.v);}
+inline vfloat_t operator*(vfloat_t const &a, vfloat_t const &b) {return _mm_mul_ps(a.v, b.v);}
+inline vfloat_t operator/(vfloat_t const &a, vfloat_t const &b) {return _mm_div_ps(a.v, b.v);}
+inline vfloat_t vabs  (vfloat_t const &a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);}
+inline vfloat_t vmax  (vfloat_t const &a, vfloat_t const &b) {return _mm_max_ps(a.v, b.v);}
+
+inline vfloat_t vselect_gt(vfloat_t const &a, vfloat_t const &b, vfloat_t const &t, vfloat_t const &f) {
+	__m128 const mask(_mm_cmpgt_ps(a.v, b.v));
+	return _mm_or_ps(_mm_and_ps(mask, t.v), _mm_andnot_ps(mask, f.v));
+}
+inline vfloat_t vfloor(vfloat_t const &a) {
+#ifdef __SSE4_1__
+	return _mm_floor_ps(a.v);
+#else // truncate and adjust negative values; values >= 2^23 are already integers and may not fit in an int
+	__m128 const t(_mm_cvtepi32_ps(_mm_cvttps_epi32(a.v)));
+	__m128 const f(_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f))));
+	__m128 const is_int(_mm_cmpge_ps(vabs(a).v, _mm_set1_ps(8388608.0f)));
+	return _mm_or_ps(_mm_and_ps(is_int, a.v), _mm_andnot_ps(is_int, f));
+#endif
+}
+#define HAS_SIMD_NOISE
+#endif
+
+
+// ************ noise kernels ************
+// ports of glm::simplex(vec2) and glm::perlin(vec2) operating on one point per lane, with the same op order
+
+template<typename V> V vfract(V const &x) {return x - vfloor(x);}
+template<typename V> V vmod  (V const &x, float y) {return x - vfloor(x/y)*y;}
+template<typename V> V mod289(V const &x) {return x - vfloor(x*(1.0f/289.0f))*289.0f;}
+template<typename V> V permute(V const &x) {return mod289((x*34.0f + 1.0f)*x);}
+template<typename V> V taylor_inv_sqrt(V const &r) {return 1.79284291400159f - 0.85373472095314f*r;}
+template<typename V> V fade(V const &t) {return (t*t*t)*(t*(t*6.0f - 15.0f) + 10.0f);}
+template<typename V> V mix(V const &x, V const &y, V const &a) {return x + a*(y - x);}
+
+template<typename V> V simplex_noise(V const &vx, V const &vy) {
+
+	float const C0(0.211324865405187f), C1(0.366025403784439f), C2(-0.577350269189626f), C3(0.024390243902439f);
+	// first corner
+	V const d(vx*C1 + vy*C1);
+	V ix(vfloor(vx + d)), iy(vfloor(vy + d));
+	V const di(ix*C0 + iy*C0);
+	V const x0x((vx - ix) + di), x0y((vy - iy) + di);
+	// other corners
+	V const i1x(vselect_gt(x0x, x0y, 1.0f, 0.0f)), i1y(vselect_gt(x0x, x0y, 0.0f, 1.0f));
+	V const x1x((x0x + C0) - i1x), x1y((x0y + C0) - i1y), x2x(x0x + C2), x2y(x0y + C2);
+	// permutations
+	ix = vmod(ix, 289.0f);
+	iy = vmod(iy, 289.0f);
+	V const p[3] = {permute((permute(iy) + ix)), permute((permute(iy + i1y) + ix) + i1x), permute((permute(iy + 1.0f) + ix) + 1.0f)};
+	V const xs[3] = {x0x, x1x, x2x}, ys[3] = {x0y, x1y, x2y};
+	V g[3];
+
+	for (unsigned n = 0; n < 3; ++n) {
+		V m(vmax((0.5f - (xs[n]*xs[n] + ys[n]*ys[n])), 0.0f));
+		m = m*m;
+		m = m*m;
+		// gradients: 41 points uniformly over a line, mapped onto a diamond
+		V const x(2.0f*vfract(p[n]*C3) - 1.0f), h(vabs(x) - 0.5f), ox(vfloor(x + 0.5f)), a0(x - ox);
+		m = m*taylor_inv_sqrt(a0*a0 + h*h); // normalize gradients implicitly by scaling m
+		g[n] = m*(a0*xs[n] + h*ys[n]);
+	}
+	return 130.0f*((g[0] + g[1]) + g[2]);
+}
+
+template<typename V> V perlin_noise(V const &px, V const &py) {
+
+	V const fx(vfloor(px)), fy(vfloor(py));
+	V const ix0(vmod(fx, 289.0f)), iy0(vmod(fy, 289.0f)), ix1(vmod((fx + 1.0f), 289.0f)), iy1(vmod((fy + 1.0f), 289.0f));
+	V const fx0(vfract(px)), fy0(vfract(py)), fx1(fx0 - 1.0f), fy1(fy0 - 1.0f);
+	V const pix0(permute(ix0)), pix1(permute(ix1));
+	V const corner_ix[4] = {permute(pix0 + iy0), permute(pix1 + iy0), permute(pix0 + iy1), permute(pix1 + iy1)}; // 00, 10, 01, 11
+	V const cfx[4] = {fx0, fx1, fx0, fx1}, cfy[4] = {fy0, fy0, fy1, fy1};
+	V n[4];
+
+	for (unsigned c = 0; c < 4; ++c) {
+		V gx(2.0f*vfract(corner_ix[c]/41.0f) - 1.0f);
+		V const gy(vabs(gx) - 0.5f), tx(vfloor(gx + 0.5f));
+		gx = gx - tx;
+		V const norm(taylor_inv_sqrt(gx*gx + gy*gy));
+		n[c] = (gx*norm)*cfx[c] + (gy*norm)*cfy[c];
+	}
+	V const fade_x(fade(fx0)), fade_y(fade(fy0));
+	return 2.3f*mix(mix(n[0], n[1], fade_x), mix(n[2], n[3], fade_x), fade_y);
+}
+
+template<typename V> V fbm_noise(noise_fbm_params_t const &params, V const &x, V const &y) {
+
+	V zval(0.0f);
+
+	for (unsigned i = 0; i < params.num_octaves; ++i) {
+		V const px(x*params.freq[i] + params.rx[i]), py(y*params.freq[i] + params.ry[i]);
+		V noise(params.perlin ? perlin_noise(px, py) : simplex_noise(px, py));
+		if      (params.shape == 1) {noise = vabs(noise) - 0.40f;} // billowy
+		else if (params.shape == 2) {noise = 0.45f - vabs(noise);} // ridged
+		zval = zval + noise*params.mag[i];
+	}
+	return zval;
+}
+
+template<typename V> V eval_noise(noise_fbm_params_t const &params, V x, V y, bool domain_warp) {
+
+	if (domain_warp) { // two levels of domain warping; 5 noise evaluations per point
+		float const scale(0.2f);
+		V const dx1(fbm_noise(params, x, y)), dy1(fbm_noise(params, (x + 5.2f), (y + 1.3f)));
+		V const wx(x + dx1*scale), wy(y + dy1*scale);
+		V const dx2(fbm_noise(params, (wx + 1.7f), (wy + 9.2f))), dy2(fbm_noise(params, (wx + 8.3f), (wy + 2.8f)));
+		x = x + dx2*scale;
+		y = y + dy2*scale;
+	}
+	return fbm_noise(params, x, y);
+}
+
+
+// ************ interface ************
+
+unsigned get_simd_noise_width() {
+#ifdef HAS_SIMD_NOISE
+	if (use_simd_noise) {return vfloat_t::SIZE;}
+#endif
+	return 1;
+}
+
+float eval_fbm_noise(noise_fbm_params_t const &params, float xv, float yv, bool domain_warp) {
+	return eval_noise(params, xv, yv, domain_warp);
+}
+
+// evaluates noise for num points along a row with the same y value; performance critical
+void eval_fbm_noise_row(noise_fbm_params_t const &params, float const *xv, float yv, float *zv, unsigned num, bool domain_warp) {
+
+#ifdef HAS_SIMD_NOISE
+	if (use_simd_noise) {
+		unsigned const W(vfloat_t::SIZE), num_full(num - num%W);
+		vfloat_t const y(yv);
+
+		for (unsigned i = 0; i < num_full; i += W) {
+			eval_noise(params, vfloat_t::load(xv + i), y, domain_warp).store(zv + i);
+		}
+		if (num_full < num) { // partial last vector: pad with the last x value
+			float xt[vfloat_t::SIZE], zt[vfloat_t::SIZE];
+			for (unsigned i = 0; i < W; ++i) {xt[i] = xv[std::min(num_full + i, num-1)];}
+			eval_noise(params, vfloat_t::load(xt), y, domain_warp).store(zt);
+			for (unsigned i = num_full; i < num; ++i) {zv[i] = zt[i - num_full];}
+		}
+		return;
+	}
+#endif
+	for (unsigned i = 0; i < num; ++i) {zv[i] = eval_noise(params, xv[i], yv, domain_warp);}
+}
+
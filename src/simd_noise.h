@@ -0,0 +1,24 @@
+// 3D World - SIMD Simplex/Perlin Terrain Noise
+// by Frank Gennari
+// 10/17/26
+#ifndef _SIMD_NOISE_H_
+#define _SIMD_NOISE_H_
+
+unsigned const MAX_NOISE_OCTAVES = 16;
+
+
+struct noise_fbm_params_t { // per-octave frequency, magnitude, and offsets for fractal noise
+	bool perlin; // else simplex
+	int shape; // 0=linear, 1=billowy, 2=ridged
+	unsigned num_octaves;
+	float freq[MAX_NOISE_OCTAVES], mag[MAX_NOISE_OCTAVES], rx[MAX_NOISE_OCTAVES], ry[MAX_NOISE_OCTAVES];
+
+	noise_fbm_params_t(bool perlin_, int shape_, unsigned num_octaves_, float rx0, float ry0, float lacunarity=1.92f, float gain=0.5f);
+};
+
+// the SIMD and scalar paths perform the same sequence of float ops, so results are bitwise identical between them and across SSE/AVX builds
+float eval_fbm_noise(noise_fbm_params_t const &params, float xv, float yv, bool domain_warp);
+void eval_fbm_noise_row(noise_fbm_params_t const &params, float const *xv, float yv, float *zv, unsigned num, bool domain_warp);
+unsigned get_simd_noise_width();
+
+#endif // _SIMD_NOISE_H_
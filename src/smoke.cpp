@@ -142,10 +142,9 @@ void add_smoke(point const &pos, float val) {
 void diffuse_smoke_xy(int x, int y, int z, lmcell &adj, float rate, int dim, int dir) {
 
 	float delta(0.0); // Note: not using fticks due to instability
-	lmcell *vldata(point_outside_mesh(x, y) ? nullptr : lmap_manager.get_column(x, y));
 
-	if (vldata) {
-		lmcell &lmc(vldata[z]);
+	if (!point_outside_mesh(x, y) && lmap_manager.is_column_allocated(x, y)) {
+		lmcell &lmc(lmap_manager.get_lmcell(x, y, z));
 		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
 		if (flow == 0) return;
 		float const cur_smoke(lmc.smoke);
@@ -160,7 +159,7 @@ void diffuse_smoke_xy(int x, int y, int z, lmcell &adj, float rate, int dim, int
 	adjust_smoke_val(adj.smoke, -delta);
 }
 
-void diffuse_smoke_z(int x, int y, int z, lmcell &adj, lmcell *vldata, float pos_rate, float neg_rate, int dim, int dir) {
+void diffuse_smoke_z(int x, int y, int z, lmcell &adj, lmcell_column_t const &vldata, float pos_rate, float neg_rate, int dim, int dir) {
 
 	float delta(0.0); // Note: not using fticks due to instability
 
@@ -208,8 +207,8 @@ void distribute_smoke() { // called at most once per frame
 	// openmp doesn't really help here
 	for (int y = cur_skip; y < MESH_Y_SIZE; y += SMOKE_SKIPVAL) { // split the computation across several frames
 		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			lmcell *vldata(lmap_manager.get_column(x, y));
-			if (vldata == NULL) continue;
+			lmcell_column_t const vldata(lmap_manager.get_column(x, y));
+			if (!vldata) continue;
 			smoke_entry_t &zrange(smoke_grid.get_z_range(x, y));
 			//smoke_entry_t zrange; zrange.zmin = 0; zrange.zmax = MESH_Z_SIZE;
 			if (!zrange.valid()) continue;
@@ -254,8 +253,7 @@ float get_smoke_at_pos(point const &pos) {
 	if (pos.z <= czmin0 || pos.z >= czmax) return 0.0;
 	int const x(get_xpos(pos.x)), y(get_ypos(pos.y)), z(get_zpos(pos.z));
 	if (point_outside_mesh(x, y) || z < 0 || z >= MESH_SIZE[2]) return 0.0;
-	lmcell const *const vldata(lmap_manager.get_column(x, y));
-	return ((vldata == NULL) ? 0.0 : vldata[z].smoke);
+	return (lmap_manager.is_column_allocated(x, y) ? lmap_manager.get_lmcell_val(x, y, z).smoke : 0.0);
 }
 
 
@@ -274,8 +272,8 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 	default_lmc.get_final_color(default_color, 1.0);
 
 	for (unsigned x = x_start; x < x_end; ++x) {
-		lmcell const *const vlm(lmap_manager.get_column(x, y));
-		if (vlm == NULL && !update_lighting) continue; // x/y pairs that get into here should also be constant
+		lmcell_const_column_t const vlm(static_cast<lmap_manager_t const &>(lmap_manager).get_column(x, y));
+		if (!vlm && !update_lighting) continue; // x/y pairs that get into here should also be constant
 		unsigned const off(zsize*(y*MESH_X_SIZE + x));
 		bool const check_z_thresh((display_mode & 0x01) && !is_mesh_disabled(x, y));
 		float const mh(mesh_height[y][x]);
@@ -300,8 +298,9 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 		}
 		for (unsigned z = z_start; z < z_end; ++z) {
 			unsigned const off2(ncomp*(off + z));
-			if (vlm == NULL || vlm[z].smoke == 0.0) {data[off2+3] = 0;}
-			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*vlm[z].smoke));} // alpha: smoke
+			lmcell const lmc(vlm ? vlm[z] : default_lmc);
+			if (!vlm || lmc.smoke == 0.0) {data[off2+3] = 0;}
+			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*lmc.smoke));} // alpha: smoke
 			if (!do_lighting) continue; // lighting not needed
 				
 			if (check_z_thresh && get_zval(z+1) < mh) { // adjust by one because GPU will interpolate the texel
@@ -312,10 +311,10 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 
 				if (create_voxel_landscape) {
 					float const indir_scale(get_voxel_terrain_ao_lighting_val(get_xyz_pos(x, y, z)));
-					if (vlm == NULL) {color = default_color*indir_scale;} else {vlm[z].get_final_color(color, 1.0, 1.0, indir_scale);}
+					if (!vlm) {color = default_color*indir_scale;} else {lmc.get_final_color(color, 1.0, 1.0, indir_scale);}
 				}
 				else {
-					if (vlm == NULL) {color = default_color;} else {vlm[z].get_final_color(color, 1.0, 1.0);}
+					if (!vlm) {color = default_color;} else {lmc.get_final_color(color, 1.0, 1.0);}
 				}
 				for (unsigned i = llv_ix_s; i < llv_ix_e; ++i) {local_light_volumes[llvol_ixs[i]]->add_lighting(color, x, y, z);} // add local light volumes
 				UNROLL_3X(data[off2+i_] = (unsigned char)(255*CLIP_TO_01(color[i_]));) // lmc.pflow[i_]
@@ -387,6 +386,7 @@ bool upload_smoke_indir_texture() {
 		assert(smoke_tex_data.size() == ncomp*sz); // sz should be constant (per config file/3DWorld session)
 	}
 	check_for_lighting_finished();
+	check_lighting_rebake();
 	static colorRGB last_cur_ambient(BLACK), last_cur_diffuse(BLACK);
 	bool lighting_changed(cur_ambient != last_cur_ambient || cur_diffuse != last_cur_diffuse);
 	
@@ -0,0 +1,363 @@
+// 3D World - Texture Preprocessing Cache
+// by Frank Gennari
+// 10/17/26
+
+#include "3DWorld.h"
+#include "binary_file_io.h"
+#include "file_utils.h"
+#include "job_system.h"
+#include <iomanip>
+#include <mutex>
+
+unsigned const TEX_CACHE_MAGIC   = 0x31435854; // "TXC1"
+unsigned const TEX_CACHE_VERSION = 1; // increment when texture_t::load() post-processing, mipmap generation, or block compression changes
+
+extern string texture_cache_dir;
+
+string append_texture_dir(string const &filename);
+
+std::mutex tex_cache_write_mutex; // serializes writes, including duplicate textures that share a cache file
+
+
+// file layout: header, base level data (the output of texture_t::load()), level offsets, level data
+struct tex_cache_header_t {
+	unsigned magic, version, width, height, ncolors, is_16_bit_gray, gl_format, num_levels;
+	uint64_t load_key, data_hash, mip_key, base_size, levels_size, checksum; // checksum of everything after the header
+
+	tex_cache_header_t() : magic(TEX_CACHE_MAGIC), version(TEX_CACHE_VERSION), width(0), height(0), ncolors(0), is_16_bit_gray(0), gl_format(0), num_levels(0),
+		load_key(0), data_hash(0), mip_key(0), base_size(0), levels_size(0), checksum(0) {}
+};
+
+uint64_t calc_tex_cache_checksum(unsigned char const *base, size_t base_size, tex_cache_levels_t const &levels) {
+	fnv_hash_t hash;
+	hash.add_words(base, base_size);
+	hash.add_words(levels.offsets.data(), levels.offsets.size()*sizeof(unsigned));
+	hash.add_words(levels.data.data(), levels.data.size());
+	return hash.get();
+}
+
+// Note: caller must hold tex_cache_write_mutex
+bool write_tex_cache_file(string const &fn, tex_cache_header_t header, unsigned char const *base, tex_cache_levels_t const &levels) {
+
+	header.gl_format   = levels.gl_format;
+	header.num_levels  = levels.offsets.size();
+	header.data_hash   = levels.data_hash;
+	header.mip_key     = levels.mip_key;
+	header.levels_size = levels.data.size();
+	header.checksum    = calc_tex_cache_checksum(base, header.base_size, levels);
+	binary_file_writer w;
+	if (!w.open(fn)) return 0;
+	bool const ok(w.write(&header, sizeof(tex_cache_header_t), 1) && w.write(base, 1, header.base_size) &&
+		(levels.empty() || (w.write(levels.offsets.data(), sizeof(unsigned), levels.offsets.size()) && w.write(levels.data.data(), 1, levels.data.size()))));
+	if (!ok) {std::cerr << "Error writing texture cache file " << fn << endl;}
+	return ok;
+}
+
+// returns 0 without printing an error if the file doesn't exist, is for a different source file/params, or is incomplete
+bool read_tex_cache_file(string const &fn, uint64_t load_key, tex_cache_header_t &header, vector<unsigned char> &base, tex_cache_levels_t &levels) {
+
+	if (!check_file_exists(fn)) return 0;
+	binary_file_reader r;
+	if (!r.open(fn) || !r.read(&header, sizeof(tex_cache_header_t), 1)) return 0;
+	if (header.magic != TEX_CACHE_MAGIC || header.version != TEX_CACHE_VERSION || header.load_key != load_key) return 0; // old version or hash collision
+	if (header.width == 0 || header.height == 0 || header.ncolors == 0 || header.ncolors > 4) return 0;
+	if (header.base_size != uint64_t(header.width)*header.height*header.ncolors || header.num_levels > 64) return 0; // invalid
+	base.resize(header.base_size);
+	levels.offsets.resize(header.num_levels);
+	levels.data.resize(header.levels_size);
+	if (!r.read(base.data(), 1, base.size())) return 0;
+	if (!levels.offsets.empty() && !r.read(levels.offsets.data(), sizeof(unsigned), levels.offsets.size())) return 0;
+	if (!levels.data.empty() && !r.read(levels.data.data(), 1, levels.data.size())) return 0;
+	if (calc_tex_cache_checksum(base.data(), base.size(), levels) != header.checksum) return 0; // partially written or corrupted
+
+	for (auto i = levels.offsets.begin(); i != levels.offsets.end(); ++i) {
+		if (*i > levels.data.size() || (i != levels.offsets.begin() && *i < *(i-1))) return 0; // invalid
+	}
+	levels.gl_format = header.gl_format;
+	levels.data_hash = header.data_hash;
+	levels.mip_key   = header.mip_key;
+	return 1;
+}
+
+// replaces the mipmap levels in an existing cache file; run as a background job
+void update_tex_cache_file_levels(string const &fn, uint64_t load_key, tex_cache_levels_t const &levels) {
+
+	std::lock_guard<std::mutex> lock(tex_cache_write_mutex);
+	tex_cache_header_t header;
+	vector<unsigned char> base;
+	tex_cache_levels_t old_levels;
+	if (!read_tex_cache_file(fn, load_key, header, base, old_levels)) return; // base level was never written
+	write_tex_cache_file(fn, header, base.data(), levels);
+}
+
+bool hash_texture_file(string const &name, fnv_hash_t &hash) {
+
+	FILE *fp(fopen(append_texture_dir(name).c_str(), "rb")); // same search order as open_texture_file()
+	if (fp == nullptr) {fp = fopen(name.c_str(), "rb");}
+	if (fp == nullptr) return 0;
+	vector<char> buf(1 << 20);
+	size_t num_read(0);
+
+	while ((num_read = fread(buf.data(), 1, buf.size(), fp)) > 0) {
+		hash.add(num_read); // so that block boundaries don't affect collisions
+		hash.add_words(buf.data(), num_read);
+	}
+	fclose(fp);
+	return 1;
+}
+
+string get_tex_cache_filename(uint64_t load_key) {
+	std::ostringstream oss;
+	oss << texture_cache_dir << "/tex_" << std::hex << std::setw(16) << std::setfill('0') << load_key << ".tcache";
+	return oss.str();
+}
+
+uint64_t get_load_key_from_cache_fn(string const &fn) {
+	size_t const pos(fn.rfind("/tex_"));
+	assert(pos != string::npos);
+	return strtoull(fn.c_str() + pos + 5, nullptr, 16);
+}
+
+
+// ************ block compression ************
+
+unsigned get_bc_gl_format(int ncolors) { // BC4, BC5, BC1, BC3
+	assert(ncolors >= 1 && ncolors <= 4);
+	unsigned const formats[4] = {GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT};
+	return formats[ncolors-1];
+}
+
+unsigned get_bc_block_bytes(unsigned gl_format) {
+	return ((gl_format == GL_COMPRESSED_RED_RGTC1 || gl_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16);
+}
+
+unsigned short pack_565(int const c[3]) {return (unsigned short)(((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));}
+
+void unpack_565(unsigned short v, int c[3]) {
+	c[0] = (v >> 11) & 31; c[0] = (c[0] << 3) | (c[0] >> 2);
+	c[1] = (v >>  5) & 63; c[1] = (c[1] << 2) | (c[1] >> 4);
+	c[2] =  v        & 31; c[2] = (c[2] << 3) | (c[2] >> 2);
+}
+
+// BC1 color block with endpoints from the inset bounding box of the block colors (range fit); always uses 4 color mode so that it's valid for BC3
+void encode_bc1_block(unsigned char const px[16][4], unsigned char *out) {
+
+	int cmin[3] = {255, 255, 255}, cmax[3] = {0, 0, 0};
+
+	for (unsigned i = 0; i < 16; ++i) {
+		UNROLL_3X(cmin[i_] = min(cmin[i_], int(px[i][i_])); cmax[i_] = max(cmax[i_], int(px[i][i_]));)
+	}
+	UNROLL_3X(int const inset((cmax[i_] - cmin[i_]) >> 4); cmin[i_] += inset; cmax[i_] -= inset;)
+	unsigned short c0(pack_565(cmax)), c1(pack_565(cmin));
+	if (c0 < c1) {swap(c0, c1);}
+	int pal[4][3];
+	unpack_565(c0, pal[0]);
+	unpack_565(c1, pal[1]);
+	UNROLL_3X(pal[2][i_] = (2*pal[0][i_] + pal[1][i_])/3; pal[3][i_] = (pal[0][i_] + 2*pal[1][i_])/3;)
+	unsigned indices(0);
+
+	if (c0 != c1) {
+		for (unsigned i = 0; i < 16; ++i) {
+			unsigned best(0);
+			int best_dist(0);
+
+			for (unsigned n = 0; n < 4; ++n) {
+				int dist(0);
+				UNROLL_3X(int const d(int(px[i][i_]) - pal[n][i_]); dist += d*d;)
+				if (n == 0 || dist < best_dist) {best = n; best_dist = dist;}
+			}
+			indices |= (best << (2*i));
+		}
+	}
+	out[0] = (unsigned char)(c0 & 0xFF); out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF); out[3] = (unsigned char)(c1 >> 8);
+	for (unsigned i = 0; i < 4; ++i) {out[4+i] = (unsigned char)((indices >> (8*i)) & 0xFF);}
+}
+
+// BC4 single channel block, also used for BC3 alpha and the two channels of BC5; uses the 8 value mode
+void encode_bc4_block(unsigned char const px[16][4], unsigned chan, unsigned char *out) {
+
+	int vmin(255), vmax(0);
+
+	for (unsigned i = 0; i < 16; ++i) {
+		vmin = min(vmin, int(px[i][chan]));
+		vmax = max(vmax, int(px[i][chan]));
+	}
+	int pal[8] = {vmax, vmin};
+	for (int i = 2; i < 8; ++i) {pal[i] = ((8 - i)*vmax + (i - 1)*vmin)/7;}
+	uint64_t indices(0);
+
+	if (vmax != vmin) {
+		for (unsigned i = 0; i < 16; ++i) {
+			unsigned best(0);
+
+			for (unsigned n = 1; n < 8; ++n) {
+				if (abs(int(px[i][chan]) - pal[n]) < abs(int(px[i][chan]) - pal[best])) {best = n;}
+			}
+			indices |= (uint64_t(best) << (3*i));
+		}
+	}
+	out[0] = (unsigned char)vmax;
+	out[1] = (unsigned char)vmin;
+	for (unsigned i = 0; i < 6; ++i) {out[2+i] = (unsigned char)((indices >> (8*i)) & 0xFF);}
+}
+
+// appends the compressed image to out
+void compress_image(unsigned char const *data, unsigned width, unsigned height, unsigned ncolors, unsigned gl_format, vector<unsigned char> &out) {
+
+	unsigned const bw((width + 3)/4), bh((height + 3)/4), block_bytes(get_bc_block_bytes(gl_format)), start(out.size());
+	out.resize(start + bw*bh*block_bytes);
+
+	parallel_for(0, bh, [&](int by) {
+		unsigned char px[16][4] = {{0}};
+
+		for (unsigned bx = 0; bx < bw; ++bx) {
+			for (unsigned i = 0; i < 16; ++i) { // gather, clamping to the image edge
+				unsigned const x(min(4*bx + (i & 3), width-1)), y(min(4*by + (i >> 2), height-1));
+				unsigned char const *const p(data + ncolors*(y*width + x));
+				for (unsigned c = 0; c < ncolors; ++c) {px[i][c] = p[c];}
+			}
+			unsigned char *const dest(out.data() + start + (by*bw + bx)*block_bytes);
+
+			switch (gl_format) {
+			case GL_COMPRESSED_RED_RGTC1: encode_bc4_block(px, 0, dest); break;
+			case GL_COMPRESSED_RG_RGTC2:  encode_bc4_block(px, 0, dest); encode_bc4_block(px, 1, dest+8); break;
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:  encode_bc1_block(px, dest); break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: encode_bc4_block(px, 3, dest); encode_bc1_block(px, dest+8); break;
+			default: assert(0);
+			}
+		} // for bx
+	}, (bw*bh >= 1024), 4);
+}
+
+
+// ************ texture_t ************
+
+// called from load() for file textures; on a cache miss, sets cache_fn so that write_to_cache() can write the decoded data
+bool texture_t::load_from_cache(int index, bool allow_diff_width_height, bool allow_two_byte_grayscale, bool ignore_word_alignment) {
+
+	cache_fn.clear();
+	cached_levels.clear();
+	if (texture_cache_dir.empty() || format == 10) return 0; // disabled, or DDS, which is already preprocessed
+	fnv_hash_t hash;
+	if (!hash_texture_file(name, hash)) return 0; // let the decoder report the error
+	hash.add(TEX_CACHE_VERSION);
+	hash.add_str(name);
+	hash.add((index < NUM_PREDEF_TEXTURES) ? index : -1); // some predefined textures are special cased in auto_insert_alpha_channel()
+	hash.add(format);
+	hash.add(width);
+	hash.add(height);
+	hash.add(ncolors);
+	hash.add(invert_y);
+	hash.add(invert_alpha);
+	hash.add(no_avg_color_alpha_fill);
+	hash.add(allow_diff_width_height);
+	hash.add(allow_two_byte_grayscale);
+	hash.add(ignore_word_alignment);
+	uint64_t const load_key(hash.get());
+	cache_fn = get_tex_cache_filename(load_key);
+	tex_cache_header_t header;
+	vector<unsigned char> base;
+	if (!read_tex_cache_file(cache_fn, load_key, header, base, cached_levels)) {cached_levels.clear(); return 0;}
+	width          = header.width;
+	height         = header.height;
+	ncolors        = header.ncolors;
+	is_16_bit_gray = (header.is_16_bit_gray != 0);
+	alloc();
+	memcpy(data, base.data(), base.size());
+	return 1;
+}
+
+void texture_t::write_to_cache() const {
+
+	if (cache_fn.empty() || !is_allocated()) return;
+	tex_cache_header_t header;
+	header.width          = width;
+	header.height         = height;
+	header.ncolors        = ncolors;
+	header.is_16_bit_gray = is_16_bit_gray;
+	header.load_key       = get_load_key_from_cache_fn(cache_fn);
+	header.base_size      = num_bytes();
+	std::lock_guard<std::mutex> lock(tex_cache_write_mutex);
+	write_tex_cache_file(cache_fn, header, data, tex_cache_levels_t()); // levels are added on the first upload
+}
+
+uint64_t texture_t::get_cache_mip_key() const {
+
+	fnv_hash_t hash;
+	hash.add(TEX_CACHE_VERSION);
+	hash.add((use_mipmaps == 2) ? 1 : int(use_mipmaps)); // 1 and 2 both use a box filter
+	hash.add(is_compressed());
+	hash.add(width);
+	hash.add(height);
+	hash.add(ncolors);
+	hash.add(mipmap_alpha_weight);
+	if (use_mipmaps == 4) {hash.add(color);} // used for transparent texels
+	return hash.get();
+}
+
+void texture_t::build_cache_levels(unsigned gl_format) {
+
+	int const mip_mode((use_mipmaps == 2) ? 1 : use_mipmaps);
+	cached_levels.data.clear();
+	cached_levels.offsets.clear();
+	cached_levels.gl_format = gl_format;
+	vector<unsigned char> idata(data, data+num_bytes()), odata;
+
+	if (gl_format) { // level 0
+		cached_levels.offsets.push_back(0);
+		compress_image(idata.data(), width, height, ncolors, gl_format, cached_levels.data);
+	}
+	if (mip_mode == 0) return;
+
+	for (unsigned w = width, h = height; w > 1 || h > 1;) {
+		gen_mipmap_level(idata.data(), w, h, odata, mip_mode);
+		w = max(w>>1, 1U);
+		h = max(h>>1, 1U);
+		cached_levels.offsets.push_back(cached_levels.data.size());
+		if (gl_format) {compress_image(odata.data(), w, h, ncolors, gl_format, cached_levels.data);}
+		else {cached_levels.data.insert(cached_levels.data.end(), odata.begin(), odata.end());}
+		idata.swap(odata);
+	}
+}
+
+// uploads the base level and mipmaps using cached CPU generated mipmaps and block compression, which are built and saved on the first run;
+// returns 0 if the texture isn't cached and should be uploaded with driver generated mipmaps and compression
+bool texture_t::upload_with_cache() {
+
+	if (cache_fn.empty()) return 0;
+	string const fn(cache_fn);
+	cache_fn.clear(); // only the first upload uses the cache; the data may be updated later
+	int const mip_mode((use_mipmaps == 2) ? 1 : use_mipmaps);
+	unsigned const gl_format(is_compressed() ? get_bc_gl_format(ncolors) : 0);
+	if (is_16_bit_gray || (mip_mode == 0 && gl_format == 0)) {cached_levels.clear(); return 0;} // nothing to precompute
+	fnv_hash_t hash;
+	hash.add_words(data, num_bytes());
+	uint64_t const data_hash(hash.get()), mip_key(get_cache_mip_key());
+
+	// the data may have been modified since the cache was written (resized, alpha merged, etc.), so check that the levels were generated from this data
+	if (cached_levels.empty() || cached_levels.data_hash != data_hash || cached_levels.mip_key != mip_key || cached_levels.gl_format != gl_format) {
+		build_cache_levels(gl_format);
+		cached_levels.data_hash = data_hash;
+		cached_levels.mip_key   = mip_key;
+		std::shared_ptr<tex_cache_levels_t> const levels(new tex_cache_levels_t(cached_levels));
+		uint64_t const load_key(get_load_key_from_cache_fn(fn));
+		get_job_system().run([fn, load_key, levels]() {update_tex_cache_file_levels(fn, load_key, *levels);}, JOB_PRI_IO);
+	}
+	vector<unsigned> const &offsets(cached_levels.offsets);
+	unsigned level(0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // needed for mipmap levels where width*ncolors is not aligned
+	if (!gl_format) {glTexImage2D(GL_TEXTURE_2D, level++, calc_internal_format(), width, height, 0, calc_format(), get_data_format(), data);}
+
+	for (unsigned i = 0; i < offsets.size(); ++i, ++level) {
+		unsigned const w(max(unsigned(width) >> level, 1U)), h(max(unsigned(height) >> level, 1U));
+		unsigned const end((i+1 < offsets.size()) ? offsets[i+1] : cached_levels.data.size());
+		unsigned char const *const ptr(cached_levels.data.data() + offsets[i]);
+		if (gl_format) {glCompressedTexImage2D(GL_TEXTURE_2D, level, gl_format, w, h, 0, (end - offsets[i]), ptr);}
+		else {glTexImage2D(GL_TEXTURE_2D, level, calc_internal_format(), w, h, 0, calc_format(), get_data_format(), ptr);}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	cached_levels.clear(); // free the memory
+	return 1;
+}
+
@@ -0,0 +1,189 @@
+// 3D World - Tiled Terrain Memory and Disk Cache
+// by Frank Gennari
+// 10/17/26
+
+#include "tiled_mesh.h"
+#include "binary_file_io.h"
+#include "file_utils.h"
+#include <iomanip>
+
+unsigned const TILE_CACHE_MAGIC   = 0x54434831; // "TCH1"
+unsigned const TILE_CACHE_VERSION = 2; // 2: deterministic per-tile erosion
+
+extern bool enable_terrain_env;
+extern unsigned erosion_iters_tt, tile_cache_mem_mb;
+extern float erode_amount;
+extern char *mh_filename_tt;
+extern string tile_cache_dir;
+
+
+template<typename T> size_t get_vector_mem(vector<T> const &v) {return v.capacity()*sizeof(T);}
+
+size_t tile_cache_entry_t::get_mem() const {
+
+	size_t mem(get_vector_mem(zvals) + get_vector_mem(ao_lighting));
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
+		mem += get_vector_mem(smask[l]) + get_vector_mem(sh_out[l][0]) + get_vector_mem(sh_out[l][1]);
+	}
+	return mem;
+}
+
+template<typename T> bool write_cache_vector(binary_file_writer &w, vector<T> const &v) {
+	unsigned const sz(v.size());
+	return (w.write(&sz, sizeof(unsigned), 1) && (v.empty() || w.write(v.data(), sizeof(T), sz)));
+}
+template<typename T> bool read_cache_vector(binary_file_reader &r, vector<T> &v, unsigned max_sz) {
+	unsigned sz(0);
+	if (!r.read(&sz, sizeof(unsigned), 1) || sz > max_sz) return 0; // truncated or corrupted file
+	v.resize(sz);
+	return (v.empty() || r.read(v.data(), sizeof(T), sz));
+}
+
+bool tile_cache_entry_t::write(string const &fn, uint64_t params_hash) const {
+
+	binary_file_writer w;
+	if (!w.open(fn)) return 0;
+	unsigned const header[3] = {TILE_CACHE_MAGIC, TILE_CACHE_VERSION, unsigned(zvals.size())};
+	bool ok(w.write(header, sizeof(unsigned), 3) && w.write(&params_hash, sizeof(uint64_t), 1));
+	ok &= write_cache_vector(w, zvals) && write_cache_vector(w, ao_lighting);
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC && ok; ++l) {
+		ok &= w.write(&light_pos[l], sizeof(point), 1) && write_cache_vector(w, smask[l]) && write_cache_vector(w, sh_out[l][0]) && write_cache_vector(w, sh_out[l][1]);
+	}
+	if (!ok) {std::cerr << "Error writing tile cache file " << fn << endl;}
+	return ok;
+}
+
+// returns 0 without printing an error if the file doesn't exist or was written with different params
+bool tile_cache_entry_t::read(string const &fn, uint64_t params_hash, unsigned zvsize) {
+
+	if (fn.empty() || !check_file_exists(fn)) return 0;
+	binary_file_reader r;
+	if (!r.open(fn)) return 0;
+	unsigned header[3] = {0};
+	uint64_t file_hash(0);
+	if (!r.read(header, sizeof(unsigned), 3) || !r.read(&file_hash, sizeof(uint64_t), 1)) return 0;
+	if (header[0] != TILE_CACHE_MAGIC || header[1] != TILE_CACHE_VERSION || header[2] != zvsize*zvsize || file_hash != params_hash) return 0; // old version or params
+	unsigned const num_zvals(zvsize*zvsize);
+	bool ok(read_cache_vector(r, zvals, num_zvals) && read_cache_vector(r, ao_lighting, num_zvals));
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC && ok; ++l) {
+		ok &= r.read(&light_pos[l], sizeof(point), 1) && read_cache_vector(r, smask[l], num_zvals) && read_cache_vector(r, sh_out[l][0], zvsize) && read_cache_vector(r, sh_out[l][1], zvsize);
+	}
+	if (!ok || zvals.size() != num_zvals) {
+		std::cerr << "Error reading tile cache file " << fn << endl;
+		*this = tile_cache_entry_t();
+		return 0;
+	}
+	return 1;
+}
+
+
+bool tile_cache_t::enabled() const {return (tile_cache_mem_mb > 0 || disk_enabled());}
+
+// heightmap edits aren't tracked across runs, so only procedural terrain is cached on disk
+bool tile_cache_t::disk_enabled() const {return (!tile_cache_dir.empty() && !using_tiled_terrain_hmap_tex());}
+
+void tile_cache_t::update_params_hash(unsigned tile_size) {
+
+	fnv_hash_t hash;
+	hash.add(get_mesh_gen_params_hash());
+	hash.add(tile_size);
+	hash.add(erosion_iters_tt);
+	hash.add(erode_amount);
+	hash.add(enable_terrain_env);
+	hash.add(using_tiled_terrain_hmap_tex());
+	hash.add_str(mh_filename_tt ? mh_filename_tt : "");
+	if (hash.get() == params_hash) return; // no change
+	clear();
+	params_hash = hash.get();
+}
+
+// Note: the file may still be being written; call take() first, which returns the in-flight data in that case
+string tile_cache_t::get_filename(tile_xy_pair const &txy) const {
+
+	if (!disk_enabled()) return string();
+	std::ostringstream oss;
+	oss << tile_cache_dir << "/tile_" << std::hex << std::setw(16) << std::setfill('0') << params_hash << std::dec << "_" << txy.x << "_" << txy.y << ".gz";
+	return oss.str();
+}
+
+// returns the job writing the file for txy, or an empty handle if there is none; used to order writes of the same file
+job_handle_t tile_cache_t::get_pending_write(tile_xy_pair const &txy) const {
+
+	auto it(pending_writes.find(txy));
+	return ((it == pending_writes.end() || job_system_t::is_done(it->second.job)) ? job_handle_t() : it->second.job);
+}
+
+void tile_cache_t::remove_completed_writes() {
+	for (auto i = pending_writes.begin(); i != pending_writes.end();) { // Note: no ++i
+		if (job_system_t::is_done(i->second.job)) {pending_writes.erase(i++);} else {++i;}
+	}
+}
+
+void tile_cache_t::write_to_disk(tile_xy_pair const &txy, tile_cache_entry_t &entry) {
+
+	string const fn(get_filename(txy));
+	if (fn.empty()) return;
+	std::shared_ptr<tile_cache_entry_t> const data(new tile_cache_entry_t);
+	swap(*data, entry);
+	uint64_t const hash(params_hash);
+	remove_completed_writes();
+	job_handle_t const prev_write(get_pending_write(txy)); // don't write the same file from two jobs at once
+	pending_write_t &pw(pending_writes[txy]);
+	pw.job  = get_job_system().run_after([data, fn, hash]() {data->write(fn, hash);}, prev_write, JOB_PRI_IO); // compress in the background
+	pw.data = data;
+}
+
+// moves the cached data for txy into entry and removes it from the memory cache; returns 0 if not in memory
+bool tile_cache_t::take(tile_xy_pair const &txy, tile_cache_entry_t &entry) {
+
+	auto it(entry_map.find(txy));
+
+	if (it == entry_map.end()) {
+		auto pw(pending_writes.find(txy));
+		if (pw == pending_writes.end() || job_system_t::is_done(pw->second.job)) return 0;
+		entry = *pw->second.data; // still being written to disk; copy it rather than waiting for the write to finish
+		return 1;
+	}
+	mem_used -= it->second->second.get_mem();
+	swap(entry, it->second->second);
+	entries.erase(it->second);
+	entry_map.erase(it);
+	return 1;
+}
+
+// moves entry into the memory cache; the least recently used entries are written to disk if over the memory limit
+void tile_cache_t::add(tile_xy_pair const &txy, tile_cache_entry_t &entry) {
+
+	if (entry.empty()) return;
+	remove(txy); // in case there's an old copy
+	entries.push_front(make_pair(txy, tile_cache_entry_t()));
+	swap(entries.front().second, entry);
+	entry_map[txy] = entries.begin();
+	mem_used += entries.front().second.get_mem();
+	size_t const max_mem(size_t(tile_cache_mem_mb) << 20);
+
+	while (mem_used > max_mem && !entries.empty()) { // evict LRU entries
+		tile_xy_pair const evict_txy(entries.back().first);
+		tile_cache_entry_t evicted;
+		take(evict_txy, evicted);
+		write_to_disk(evict_txy, evicted);
+	}
+}
+
+void tile_cache_t::remove(tile_xy_pair const &txy) {
+
+	tile_cache_entry_t entry;
+	take(txy, entry);
+}
+
+void tile_cache_t::clear() {
+
+	for (auto i = pending_writes.begin(); i != pending_writes.end(); ++i) {get_job_system().wait(i->second.job);} // drain pending writes
+	pending_writes.clear();
+	entries.clear();
+	entry_map.clear();
+	mem_used = 0;
+}
@@ -7,6 +7,7 @@
 #include "shaders.h"
 #include "openal_wrap.h"
 #include "heightmap.h"
+#include "job_system.h"
 
 
 bool const DEBUG_TILES        = 0;
@@ -50,8 +51,8 @@ hmap_brush_param_t cur_brush_param;
 tile_offset_t model3d_offset;
 
 extern bool inf_terrain_scenery, enable_tiled_mesh_ao, underwater, fog_enabled, volume_lighting, combined_gu, enable_depth_clamp, tt_triplanar_tex, use_grass_tess;
-extern bool use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down;
-extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, num_rnd_grass_blocks;
+extern bool use_instanced_pine_trees, enable_tt_model_reflect, water_is_lava, tt_fire_button_down, async_tile_gen;
+extern unsigned grass_density, max_unique_trees, shadow_map_sz, num_birds_per_tile, num_fish_per_tile, erosion_iters_tt, num_rnd_grass_blocks, tile_upload_budget_ms;
 extern int DISABLE_WATER, display_mode, tree_mode, leaf_color_changed, ground_effects_level, animate2, iticks, num_trees, window_width, window_height;
 extern int invert_mh_image, is_cloudy, camera_surf_collide, show_fog, mesh_gen_mode, mesh_gen_shape, cloud_model, precip_mode, auto_time_adv;
 extern float zmax, zmin, water_plane_z, mesh_scale, mesh_scale_z, vegetation, relh_adj_tex, grass_length, grass_width, fticks, cloud_height_offset, clouds_per_tile;
@@ -272,7 +273,11 @@ tile_t::tile_t(unsigned size_, int x, int y) : last_occluded_frame(0), weight_ti
 }
 
 float tile_t::get_draw_priority() const {
-	return (p2p_dist_xy(get_camera_pos(), get_center()) + (is_visible() ? 0.0 : FAR_CLIP)); // prioritize visible tiles
+	point const camera(get_camera_pos()), center(get_center());
+	float const dist(p2p_dist_xy(camera, center));
+	vector3d const view_dir(cview_dir.x, cview_dir.y, 0.0), tile_dir(center.x-camera.x, center.y-camera.y, 0.0);
+	float const heading_cos((dist > TOLERANCE && view_dir != zero_vector) ? dot_product(view_dir.get_norm(), tile_dir/dist) : 1.0);
+	return (dist*(1.5 - 0.5*heading_cos) + (is_visible() ? 0.0 : FAR_CLIP)); // prioritize visible tiles, then tiles in the direction the camera is facing
 }
 
 
@@ -381,6 +386,7 @@ void tile_t::clear_shadows(bool clear_sun, bool clear_moon, bool no_clear_adj) {
 	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
 		if ((l == LIGHT_SUN && !clear_sun) || (l == LIGHT_MOON && !clear_moon)) continue;
 		smask[l].clear();
+		cached_smask[l] = 0;
 		
 		if (!no_clear_adj) { // this is not necessary, but is an optimization for low sun angles to avoid recomputation of shadows on a tile when its neighbors have changed
 			for (unsigned d = 0; d < 2; ++d) {sh_out[l][d].clear();}
@@ -390,9 +396,9 @@ void tile_t::clear_shadows(bool clear_sun, bool clear_moon, bool no_clear_adj) {
 	moon_shadows_invalid = clear_moon;
 }
 
-void tile_t::clear_vbo_tid(tile_shadow_map_manager *smap_manager) {
+void tile_t::clear_vbo_tid(tile_shadow_map_manager *smap_manager, bool keep_shadows) {
 
-	clear_shadows();
+	if (!keep_shadows) {clear_shadows();} // kept for the tile cache if the tile is later deleted
 	clear_shadow_map(smap_manager);
 	pine_trees.clear_vbos();
 	decid_trees.clear_context(); // only necessary if not using instancing
@@ -417,35 +423,33 @@ bool setup_height_gen(mesh_xy_grid_cache_t &height_gen, float x0, float y0, floa
 }
 
 
-bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
+// update_params=0 is used for jobs, where the caller must call update_terrain_params() on the main thread first
+bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait, bool update_params) {
 
 	//timer_t timer("Create Zvals");
-	if (enable_terrain_env) {update_terrain_params();}
+	PROFILE_SCOPE("Tile Create Zvals");
+	if (update_params && enable_terrain_env) {update_terrain_params();}
 	zvals.resize(zvsize*zvsize);
-	mzmin =  FAR_DISTANCE;
-	mzmax = -FAR_DISTANCE;
-	unsigned const block_size(zvsize/4), context_sz(stride + 2*AO_RAY_LEN);
+	unsigned const context_sz(stride + 2*AO_RAY_LEN);
 	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()); // add procedural detail to heightmap
 
 	// When using AO + GPU noise generation, it's faster to compute the AO + context and clip the zvals from this rather than making two separate compute calls (one without blocking)
-	if (enable_tiled_mesh_ao && !using_hmap && mesh_gen_mode >= MGEN_SIMPLEX_GPU) {
+	if (enable_tiled_mesh_ao && !using_hmap && using_gpu_mesh_noise()) {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1 - AO_RAY_LEN), get_yval(y1 - AO_RAY_LEN), deltax, deltay, context_sz, context_sz, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 		ao_zvals.resize(context_sz*context_sz);
 
-#pragma omp parallel for schedule(static,1)
-		for (int y = 0; y < (int)context_sz; ++y) {
+		parallel_for(0, context_sz, [&](int y) {
 			for (unsigned x = 0; x < context_sz; ++x) {ao_zvals[y*context_sz + x] = height_gen.eval_index(x, y);}
-		}
+		});
 	}
 	else {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1), get_yval(y1), deltax, deltay, zvsize, zvsize, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 	}
-	float const xy_mult(1.0/float(size)), wpz_max(get_water_z_height() + ocean_wave_height);
+	float const xy_mult(1.0/float(size));
 
-#pragma omp parallel for schedule(static,1)
-	for (int y = 0; y < (int)zvsize; ++y) {
+	parallel_for(0, zvsize, [&](int y) {
 		for (unsigned x = 0; x < zvsize; ++x) {
 			float &zval(zvals[y*zvsize + x]);
 
@@ -463,8 +467,22 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 				}
 			}
 		} // for x
-	} // for y
-	if (!using_hmap) {apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt);} // heightmap is eroded during load
+	}); // for y
+	if (!using_hmap) { // heightmap is eroded during load
+		fnv_hash_t hash;
+		hash.add(get_tile_xy_pair());
+		apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt, unsigned(hash.get())); // seed by tile so that droplets differ across tiles but are reproducible
+	}
+	calc_zval_stats();
+	return 1; // results are ready
+}
+
+void tile_t::calc_zval_stats() { // zmin/zmax, sub-block bounds, and water bbox
+
+	unsigned const block_size(zvsize/4);
+	float const wpz_max(get_water_z_height() + ocean_wave_height);
+	mzmin =  FAR_DISTANCE;
+	mzmax = -FAR_DISTANCE;
 
 	for (unsigned yy = 0; yy < 4; ++yy) {
 		for (unsigned xx = 0; xx < 4; ++xx) {
@@ -494,7 +512,41 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	ptzmax = dtzmax = mzmin; // no trees yet
 	if (!can_have_trees()) {no_trees = 1;} // mark as no_trees so that trees don't pop when water is disabled later
 	if (DEBUG_TILES) {cout << "new tile coords: " << x1 << " " << y1 << " " << x2 << " " << y2 << endl;}
-	return 1; // results are ready
+}
+
+// returns 0 if entry doesn't have zvals for this tile size, in which case the tile must be generated
+bool tile_t::load_from_cache(tile_cache_entry_t &entry) {
+
+	if (entry.zvals.size() != zvsize*zvsize) return 0;
+	if (enable_terrain_env) {update_terrain_params();}
+	zvals.swap(entry.zvals);
+	if (entry.ao_lighting.size() == stride*stride) {ao_lighting.swap(entry.ao_lighting);}
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
+		if (entry.smask[l].size() != zvals.size() || entry.light_pos[l] != get_light_pos(l)) continue; // no shadows, or light has moved
+		smask[l].swap(entry.smask[l]);
+		for (unsigned d = 0; d < 2; ++d) {sh_out[l][d].swap(entry.sh_out[l][d]);}
+		smask_light_pos[l] = entry.light_pos[l];
+		cached_smask[l]    = 1;
+	}
+	calc_zval_stats();
+	return 1;
+}
+
+// moves generated data into entry; returns 0 if the data is invalid and shouldn't be cached
+bool tile_t::store_to_cache(tile_cache_entry_t &entry) {
+
+	if (zvals.empty() || mesh_height_invalid) return 0;
+	entry.zvals.swap(zvals);
+	entry.ao_lighting.swap(ao_lighting);
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
+		if (smask[l].empty() || sh_out[l][0].size() != zvsize || sh_out[l][1].size() != zvsize) continue; // not calculated
+		entry.smask[l].swap(smask[l]);
+		for (unsigned d = 0; d < 2; ++d) {entry.sh_out[l][d].swap(sh_out[l][d]);}
+		entry.light_pos[l] = smask_light_pos[l];
+	}
+	return 1;
 }
 
 void tile_t::get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const {
@@ -538,6 +590,7 @@ float tile_t::get_zval_at(float x, float y, bool in_global_space) const {
 void tile_t::calc_mesh_ao_lighting() {
 
 	//timer_t timer("Calc Tile AO Lighting");
+	PROFILE_SCOPE("Tile AO Lighting");
 	// caclulate ray step directions
 	tile_xy_pair ao_dirs[NUM_AO_DIRS]; // 0  1  2  3  4  5  6  7
 	unsigned ix(0);
@@ -642,11 +695,13 @@ void tile_t::calc_shadows_for_light(unsigned l) {
 	// calculate shadows of current tile
 	calc_mesh_shadows(l, lpos, &zvals.front(), &smask[l].front(), zvsize, zvsize,
 		sh_in[0], sh_in[1], &sh_out[l][0].front(), &sh_out[l][1].front());
+	smask_light_pos[l] = lpos;
 	((l == LIGHT_SUN) ? sun_shadows_invalid : moon_shadows_invalid) = 1;
 }
 
 
-void tile_t::proc_tile_queue(tile_t *init_tile, unsigned l) {
+// if skip_init_calc=1, init_tile's shadows are assumed to be valid (from the tile cache) and are only propagated to adjacent tiles
+void tile_t::proc_tile_queue(tile_t *init_tile, unsigned l, bool skip_init_calc) {
 
 	point const lpos(get_light_pos(l));
 	deque<tile_t *> tile_queue;
@@ -658,8 +713,13 @@ void tile_t::proc_tile_queue(tile_t *init_tile, unsigned l) {
 		tile_queue.pop_back();
 		assert(t->in_queue);
 		t->in_queue = 0;
-		vector<float> const prev_sh_out[2] = {t->sh_out[l][0], t->sh_out[l][1]};
-		t->calc_shadows_for_light(l);
+		vector<float> prev_sh_out[2];
+		
+		if (skip_init_calc && t == init_tile) {skip_init_calc = 0;} // empty prev_sh_out, so treated as changed
+		else {
+			for (unsigned d = 0; d < 2; ++d) {prev_sh_out[d] = t->sh_out[l][d];}
+			t->calc_shadows_for_light(l);
+		}
 		tile_xy_pair const tp(t->x1/int(t->size), t->y1/int(t->size));
 		tile_xy_pair const adj_tp2[2] = {tile_xy_pair((tp.x + ((lpos.x < 0.0) ? 1 : -1)), tp.y),
 										 tile_xy_pair(tp.x, (tp.y + ((lpos.y < 0.0) ? 1 : -1)))}; // away from the light source
@@ -683,7 +743,12 @@ void tile_t::calc_shadows(bool calc_sun, bool calc_moon, bool no_push) {
 
 	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) { // calculate mesh shadows for each light source
 		if (!calc_light[l])    continue; // light not enabled
-		if (!smask[l].empty()) continue; // already calculated (cached)
+
+		if (!smask[l].empty()) { // already calculated (cached)
+			if (cached_smask[l] && !no_push) {proc_tile_queue(this, l, 1);} // from the tile cache; adjacent tiles may have been calculated without this tile
+			cached_smask[l] = 0;
+			continue;
+		}
 		smask[l].resize(zvals.size(), 0);
 		//if (normal_zmin < 1.0 && get_light_pos(l).get_norm().xy_mag() < normal_zmin) { // terrain slope lower than sun slope
 		if (no_push) {calc_shadows_for_light(l);} else {proc_tile_queue(this, l);}
@@ -1005,6 +1070,7 @@ void get_texture_ixs(int &sand_tex_ix, int &dirt_tex_ix, int &grass_tex_ix, int
 void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
 
 	//timer_t timer("Create Tile Weights Texture");
+	PROFILE_SCOPE("Tile Weights Texture");
 	assert(zvals.size() == zvsize*zvsize);
 	unsigned const tsize(stride), num_texels(tsize*tsize);
 	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
@@ -1219,14 +1285,14 @@ void tile_t::calc_avg_mesh_color() {
 }
 
 
-bool tile_t::update_range(tile_shadow_map_manager &smap_manager) { // if returns 0, tile will be deleted
+bool tile_t::update_range(tile_shadow_map_manager &smap_manager, bool keep_shadows) { // if returns 0, tile will be deleted
 
 	update_pine_tree_state(0); // can free pine tree vbos
 	update_animals(); // if any were generated
 	float const dist(get_rel_dist_to_camera());
 	
 	if (dist > CLEAR_DIST_TILES || mesh_height_invalid) {
-		if (!just_cleared) {clear_vbo_tid(&smap_manager);} // avoid clearing every frame
+		if (!just_cleared) {clear_vbo_tid(&smap_manager, (keep_shadows && !mesh_height_invalid));} // avoid clearing every frame
 		just_cleared = 1;
 	}
 	else {just_cleared = 0;}
@@ -1354,6 +1420,7 @@ void tile_t::gen_decid_trees_if_needed() {
 		max_unique_trees = 100;
 	}
 	if (decid_trees.was_generated() || !can_have_decid_trees()) return; // already generated, elevation too high, or distant tile (no trees yet)
+	PROFILE_SCOPE("Tile Gen Decid Trees");
 	assert(decid_trees.empty());
 	dtree_off.set_from_xyoff2();
 	decid_trees.gen_deterministic(x1+dtree_off.dxoff, y1+dtree_off.dyoff, x2+dtree_off.dxoff, y2+dtree_off.dyoff, vegetation*get_avg_veg(), mesh_dz, this);
@@ -2061,14 +2128,16 @@ void lightning_strike_t::end_draw() const {
 // *** tile_draw_t ***
 
 
-tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrain_zmin(0.0), lod_renderer(USE_TREE_BILLBOARDS) {
+tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrain_zmin(0.0), avg_tile_upload_ms(0.0), lod_renderer(USE_TREE_BILLBOARDS) {
 	assert(MESH_X_SIZE == MESH_Y_SIZE && X_SCENE_SIZE == Y_SCENE_SIZE);
 }
 
 void tile_draw_t::clear(bool no_regen_buildings) {
 
 	clear_vbos_tids(); // needed to clear vbo, ivbo, and free list
+	finish_tile_gen_jobs(1, 1); // wait_all=1, discard=1
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear();} // may not be necessary
+	tile_cache.clear(); // terrain may be regenerated with different params
 	to_draw.clear();
 	tiles.clear();
 	shadow_recomp_queue.clear();
@@ -2080,6 +2149,75 @@ void tile_draw_t::insert_tile(tile_t *tile) {
 	assert(did_ins);
 }
 
+bool tile_draw_t::tile_gen_pending(tile_xy_pair const &txy) const {
+	for (auto i = tile_gen_jobs.begin(); i != tile_gen_jobs.end(); ++i) {if (i->tile->get_tile_xy_pair() == txy) return 1;}
+	return 0;
+}
+
+// starts background zval generation for the highest priority tiles in to_gen_zvals; the remaining tiles are deleted and will be recreated in a later frame
+void tile_draw_t::start_tile_gen_jobs(unsigned max_pending) {
+
+	if (to_gen_zvals.size() + tile_gen_jobs.size() > max_pending) {sort(to_gen_zvals.begin(), to_gen_zvals.end());} // sort by priority if not all started
+	job_system_t &js(get_job_system());
+
+	for (auto i = to_gen_zvals.begin(); i != to_gen_zvals.end(); ++i) {
+		tile_t *const tile(i->second);
+		if (tile_gen_jobs.size() >= max_pending) {delete tile; continue;}
+		tile_gen_jobs.push_back(tile_gen_job_t(tile));
+		std::shared_ptr<mesh_xy_grid_cache_t> const height_gen(tile_gen_jobs.back().height_gen);
+		std::shared_ptr<tile_cache_entry_t> const cached(tile_gen_jobs.back().cached);
+		// if the tile's file is still being written, copy the in-flight data rather than making this frame-critical job wait on the I/O job
+		bool const have_data(tile_cache.enabled() && tile_cache.take(tile->get_tile_xy_pair(), *cached));
+		string const cache_fn(have_data ? string() : tile_cache.get_filename(tile->get_tile_xy_pair())); // empty if the disk cache is disabled
+		uint64_t const params_hash(tile_cache.get_params_hash());
+		unsigned const zvsize(get_tile_size() + 2);
+		if (enable_terrain_env) {tile->update_terrain_params();} // on the main thread, since it reads global terrain state
+
+		tile_gen_jobs.back().job = js.run([tile, height_gen, cached, cache_fn, params_hash, zvsize]() {
+			if (!cached->empty()) return; // already have the data
+			if (!cached->read(cache_fn, params_hash, zvsize)) {tile->create_zvals(*height_gen, 0, 0);} // generate if not in the disk cache; update_params=0
+		}, JOB_PRI_NORMAL);
+	}
+	to_gen_zvals.clear();
+}
+
+// inserts tiles whose zvals are ready; waits for the tile containing the camera since it's needed for collision detection
+void tile_draw_t::finish_tile_gen_jobs(bool wait_all, bool discard) {
+
+	if (tile_gen_jobs.empty()) return;
+	job_system_t &js(get_job_system());
+	point const camera(get_camera_pos());
+	unsigned num_remain(0);
+
+	for (auto i = tile_gen_jobs.begin(); i != tile_gen_jobs.end(); ++i) {
+		if (wait_all || i->tile->xy_bounds_contain_point(camera)) {js.wait(i->job);}
+		if (!job_system_t::is_done(i->job)) {tile_gen_jobs[num_remain++] = *i; continue;} // still running
+		if (discard) {delete i->tile; continue;}
+		if (!i->cached->empty()) {bool const loaded(i->tile->load_from_cache(*i->cached)); assert(loaded);} // shadows must be loaded on the main thread
+		insert_tile(i->tile);
+	}
+	tile_gen_jobs.erase(tile_gen_jobs.begin()+num_remain, tile_gen_jobs.end());
+}
+
+// returns 1 if the tile's zvals were loaded from the memory or disk cache
+bool tile_draw_t::load_tile_from_cache(tile_t *tile, bool check_disk) {
+
+	if (!tile_cache.enabled()) return 0;
+	tile_xy_pair const txy(tile->get_tile_xy_pair());
+	tile_cache_entry_t entry;
+	if (tile_cache.take(txy, entry)) {return tile->load_from_cache(entry);}
+	if (!check_disk) return 0;
+	return (entry.read(tile_cache.get_filename(txy), tile_cache.get_params_hash(), get_tile_size()+2) && tile->load_from_cache(entry));
+}
+
+void tile_draw_t::add_tile_to_cache(tile_t &tile) {
+
+	if (!tile_cache.enabled()) return;
+	tile_cache_entry_t entry;
+	if (tile.store_to_cache(entry)) {tile_cache.add(tile.get_tile_xy_pair(), entry);}
+	else {tile_cache.remove(tile.get_tile_xy_pair());} // mesh was modified
+}
+
 void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
@@ -2087,6 +2225,7 @@ void tile_draw_t::free_compute_shader() {
 float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
 
 	//timer_t timer("TT Update");
+	PROFILE_SCOPE("TT Tile Update");
 	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
 	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
 	unsigned const max_defer_tiles        = 8; // 0 = disable
@@ -2099,6 +2238,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		buildings_valid = 1;
 	}
 	auto_calc_model_zvals(); // must be done after heightmap loading but before any tiles are created
+	tile_cache.update_params_hash(get_tile_size()); // after heightmap loading
 	to_draw.clear();
 	terrain_zmin = FAR_DISTANCE;
 	grass_tile_manager.update(); // every frame, even if not in tiled terrain mode?
@@ -2124,27 +2264,33 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		}
 		to_gen_zvals.clear();
 	}
+	finish_tile_gen_jobs(0); // insert tiles generated in the background
+	
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ) { // update tiles and free old tiles (Note: no ++i)
-		if (!i->second->update_range(smap_manager)) { // delete this tile
+		if (!i->second->update_range(smap_manager, tile_cache.enabled())) { // delete this tile
+			add_tile_to_cache(*i->second);
 			i->second->clear();
 			tiles.erase(i++);
 			++num_erased;
 		} else {++i;}
 	}
+	bool const gpu_mode(using_gpu_mesh_noise()), use_gen_jobs(async_tile_gen && !gpu_mode && inf_terrain_fire_mode == FM_NONE);
+
 	for (int y = y1; y <= y2; ++y ) { // create new tiles
 		for (int x = x1; x <= x2; ++x ) {
 			tile_xy_pair const txy(x, y);
 			if (tiles.find(txy) != tiles.end()) continue; // already exists
 			tile_t tile(get_tile_size(), x, y);
 			if (tile.get_rel_dist_to_camera() >= CREATE_DIST_TILES) continue; // too far away to create
+			if (tile_gen_pending(txy)) continue; // already being generated
 			tile_t *new_tile(new tile_t(tile));
+			if (load_tile_from_cache(new_tile, !use_gen_jobs)) {insert_tile(new_tile); continue;} // gen jobs read the disk cache in the background
 			to_gen_zvals.push_back(make_pair(new_tile->get_draw_priority(), new_tile));
 		}
 	}
 	//if (to_gen_zvals.size() < max_cpu_tiles) {to_gen_zvals.clear();} // block until at least max_cpu_tiles tiles to generate (lower average gen time, but causes more slow frames/lag)
 	unsigned const num_to_gen(to_gen_zvals.size());
 	unsigned gen_this_frame(min(num_to_gen, max_tile_gen_per_frame));
-	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
 	
 	// to balance tile gen time across frames, generate a number of tiles equal to the average of this frame and the previous frame
 	if (gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
@@ -2155,6 +2301,10 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	if (num_to_gen == 0) {
 		// do nothing
 	}
+	else if (use_gen_jobs) { // generate on the job system; tiles are inserted in a later frame when ready
+		start_tile_gen_jobs(2*get_job_system().get_num_threads()); // enough to keep all threads busy
+		finish_tile_gen_jobs(0); // in case the camera tile was just started
+	}
 	else if (gpu_mode && num_to_gen <= max_defer_tiles) { // async generation mode - delay until next frame
 		unsigned tgz_pos(0);
 
@@ -2459,7 +2609,9 @@ bool tile_draw_t::can_have_reflection(tile_t const *const tile, tile_set_t &tile
 void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU uploads
 
 	//timer_t timer("TT Pre-Draw");
+	PROFILE_SCOPE("TT Pre-Draw");
 	vector<tile_t *> to_update, to_gen_trees;
+	draw_vect_t to_upload;
 	assert((vbo == 0) == (ivbo == 0)); // either neither or both are valid
 	
 	if (vbo == 0) { // build mesh vbo/ivbo
@@ -2498,17 +2650,31 @@ void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU
 			tile->setup_shadow_maps(smap_manager, 1); // cleanup_only=1 (only clear shadow maps to increase LOD levels)
 			continue;
 		}
-		if (tile->can_have_trees()) { // no trees in water or distant tiles
-			if (tile->can_have_pine_palm_trees() && !tile->pine_trees_generated()) {to_gen_trees.push_back(tile);}
-			if (decid_trees_enabled()) {tile->gen_decid_trees_if_needed();}
-		}
-		to_update.push_back(tile);
+		if (!tile->has_weights_tex()) {to_upload.emplace_back(tile->get_rel_dist_to_camera(), tile);} // new tile, subject to the upload budget
+		else {to_update.push_back(tile);}
 	} // for i
+	unsigned num_new(to_upload.size());
+
+	if (tile_upload_budget_ms > 0 && num_new > 1) { // setup the closest new tiles that fit in the time budget; the others aren't drawn until a later frame
+		num_new = max(1U, min(num_new, unsigned(tile_upload_budget_ms/max(avg_tile_upload_ms, 0.01f))));
+		sort(to_upload.begin(), to_upload.end());
+	}
+	for (unsigned i = 0; i < num_new; ++i) {to_update.push_back(to_upload[i].second);}
+	int const start_time(GET_TIME_MS());
+
+	for (auto i = to_update.begin(); i != to_update.end(); ++i) {
+		tile_t *const tile(*i);
+		if (!tile->can_have_trees()) continue; // no trees in water or distant tiles
+		if (tile->can_have_pine_palm_trees() && !tile->pine_trees_generated()) {to_gen_trees.push_back(tile);}
+		if (decid_trees_enabled()) {tile->gen_decid_trees_if_needed();}
+	}
 	if (enable_instanced_pine_trees() && !to_gen_trees.empty()) {create_pine_tree_instances();}
 	//RESET_TIME;
 	// don't use parallel tree gen for a single tile, or when GPU heightmaps are enabled
-	#pragma omp parallel for schedule(dynamic,1) if (mesh_gen_mode < MGEN_SIMPLEX_GPU && to_gen_trees.size() > 1)
-	for (int i = 0; i < (int)to_gen_trees.size(); ++i) {to_gen_trees[i]->init_pine_tree_draw();}
+	parallel_for(0, to_gen_trees.size(), [&](int i) {
+		PROFILE_SCOPE("Tile Gen Pine Trees");
+		to_gen_trees[i]->init_pine_tree_draw();
+	}, (!using_gpu_mesh_noise() && to_gen_trees.size() > 1), 1); // grain=1 since tiles are large and uneven
 	//if (!to_gen_trees.empty()) {PRINT_TIME("Gen Trees2");}
 	assert(!height_gens.empty());
 	
@@ -2524,6 +2690,10 @@ void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU
 	for (vector<tile_t *>::iterator i = to_update.begin(); i != to_update.end(); ++i) { // after everything has been setup
 		(*i)->setup_shadow_maps(smap_manager, 0); // cleanup_only=0
 	}
+	if (num_new > 0) { // update the per-tile cost estimate; conservative, since it includes updates of existing tiles
+		float const ms_per_tile(float(GET_TIME_MS() - start_time)/num_new);
+		avg_tile_upload_ms = ((avg_tile_upload_ms == 0.0) ? ms_per_tile : (0.75*avg_tile_upload_ms + 0.25*ms_per_tile));
+	}
 }
 
 
@@ -2576,6 +2746,7 @@ void tile_draw_t::draw(bool reflection_pass) {
 		}
 		float const dist(tile->get_rel_dist_to_camera());
 		if (dist > DRAW_DIST_TILES || !tile->is_visible()) continue;
+		if (!tile->has_weights_tex()) continue; // new tile that didn't fit in this frame's upload budget
 		if (tile->was_last_occluded()) continue; // occluded in the shadow pass
 		tile_set_t tile_set;
 		if (reflection_pass && !can_have_reflection(tile, tile_set)) continue;
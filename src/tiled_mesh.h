@@ -15,6 +15,8 @@
 #include "tree_3dw.h"
 #include "shadow_map.h"
 #include "animals.h"
+#include "job_system.h"
+#include <list>
 
 
 bool const ENABLE_TREE_LOD    = 1; // faster but has popping artifacts
@@ -104,6 +106,7 @@ struct tile_xy_pair {
 	int x, y;
 	tile_xy_pair(int x_=0, int y_=0) : x(x_), y(y_) {}
 	bool operator<(tile_xy_pair const &t) const {return ((y == t.y) ? (x < t.x) : (y < t.y));}
+	bool operator==(tile_xy_pair const &t) const {return (x == t.x && y == t.y);}
 	void operator+=(tile_xy_pair const &tp) {x += tp.x; y += tp.y;}
 	void operator-=(tile_xy_pair const &tp) {x -= tp.x; y -= tp.y;}
 	tile_xy_pair operator+(tile_xy_pair const &tp) const {return tile_xy_pair(x+tp.x, y+tp.y);}
@@ -155,6 +158,48 @@ public:
 };
 
 
+struct tile_cache_entry_t { // generated data that's expensive to recompute when a tile is recreated
+	vector<float> zvals; // after erosion
+	vector<unsigned char> ao_lighting, smask[NUM_LIGHT_SRC];
+	vector<float> sh_out[NUM_LIGHT_SRC][2];
+	point light_pos[NUM_LIGHT_SRC]; // light positions used for smask and sh_out; shadows are only reused if the light hasn't moved
+
+	bool empty() const {return zvals.empty();}
+	size_t get_mem() const;
+	bool read (std::string const &fn, uint64_t params_hash, unsigned zvsize);
+	bool write(std::string const &fn, uint64_t params_hash) const;
+};
+
+class tile_cache_t { // LRU cache of tile_cache_entry_t, in memory and then as compressed files on disk
+
+	typedef std::list<pair<tile_xy_pair, tile_cache_entry_t> > entry_list_t;
+	entry_list_t entries; // most recently used first
+	map<tile_xy_pair, entry_list_t::iterator> entry_map;
+	struct pending_write_t {
+		job_handle_t job;
+		std::shared_ptr<tile_cache_entry_t const> data; // read-only while the job is running, so it can be copied by take()
+	};
+	map<tile_xy_pair, pending_write_t> pending_writes;
+	uint64_t params_hash;
+	size_t mem_used;
+
+	void write_to_disk(tile_xy_pair const &txy, tile_cache_entry_t &entry);
+	void remove_completed_writes();
+	job_handle_t get_pending_write(tile_xy_pair const &txy) const;
+public:
+	tile_cache_t() : params_hash(0), mem_used(0) {}
+	bool enabled() const;
+	bool disk_enabled() const;
+	uint64_t get_params_hash() const {return params_hash;}
+	void update_params_hash(unsigned tile_size);
+	std::string get_filename(tile_xy_pair const &txy) const;
+	bool take(tile_xy_pair const &txy, tile_cache_entry_t &entry);
+	void add(tile_xy_pair const &txy, tile_cache_entry_t &entry);
+	void remove(tile_xy_pair const &txy);
+	void clear();
+};
+
+
 class tile_t {
 
 public:
@@ -173,6 +218,8 @@ private:
 	colorRGB avg_mesh_tex_color;
 	tile_offset_t mesh_off, ptree_off, dtree_off, scenery_off;
 	float sub_zmin[4][4] = {0}, sub_zmax[4][4] = {0};
+	bool cached_smask[NUM_LIGHT_SRC] = {0}; // smask was loaded from the tile cache and hasn't been pushed to adjacent tiles
+	point smask_light_pos[NUM_LIGHT_SRC];
 	vector<float> zvals, ao_zvals;
 	vector<tree_map_val> tree_map;
 	vector<unsigned char> mesh_weight_data, weight_data, ao_lighting;
@@ -202,7 +249,7 @@ private:
 
 	terrain_params_t params[2][2]; // {ylo,yhi} x {xlo,xhi}
 
-	void update_terrain_params();
+	void calc_zval_stats();
 	unsigned get_lod_level(bool reflection_pass) const;
 
 public:
@@ -223,6 +270,7 @@ public:
 	bool pine_trees_generated() const {return pine_trees.generated;}
 	bool has_pine_trees() const {return (pine_trees_generated() && !pine_trees.empty());}
 	bool has_valid_shadow_map() const {return !smap_data.empty();}
+	bool has_weights_tex() const {return (weight_tid != 0);} // textures have been created by pre_draw()
 	bool has_grass() const {return !grass_blocks.empty();}
 	void invalidate_mesh_height() {mesh_height_invalid = 1;}
 	float get_avg_veg() const {return 0.25f*(params[0][0].veg + params[0][1].veg + params[1][0].veg + params[1][1].veg);}
@@ -270,6 +318,10 @@ public:
 	float get_max_xy_dist_to_pt(point const &pt) const;
 	bool contains_point(point const &pos) const {return get_bcube().contains_pt_xy(pos);}
 	bool contains_camera() const {return contains_point(get_camera_pos());}
+	bool xy_bounds_contain_point(point const &pos) const { // doesn't read zvals/zmin/zmax, so can be called while zvals are being generated
+		float const xv1(get_xval(x1 + xoff - xoff2)), yv1(get_yval(y1 + yoff - yoff2));
+		return (pos.x >= xv1 && pos.x <= xv1+(x2-x1)*deltax && pos.y >= yv1 && pos.y <= yv1+(y2-y1)*deltay);
+	}
 	unsigned get_gpu_mem() const;
 	unsigned get_smap_mem() const;
 	unsigned count_shadow_maps() const;
@@ -281,9 +333,12 @@ public:
 	void clear_flowers() {flowers.clear();}
 	void clear_shadows(bool clear_sun=1, bool clear_moon=1, bool no_clear_adj=0);
 	void clear_shadow_map(tile_shadow_map_manager *smap_manager);
-	void clear_vbo_tid(tile_shadow_map_manager *smap_manager);
+	void clear_vbo_tid(tile_shadow_map_manager *smap_manager, bool keep_shadows=0);
 	void clear_pine_tree_vbos() {pine_trees.clear_vbos();}
-	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
+	void update_terrain_params();
+	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait, bool update_params=1);
+	bool load_from_cache(tile_cache_entry_t &entry);
+	bool store_to_cache(tile_cache_entry_t &entry);
 	void get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const;
 	float get_zval_at(float x, float y, bool in_global_space) const;
 
@@ -296,7 +351,7 @@ public:
 	// *** shadows ***
 	void calc_mesh_ao_lighting();
 	void calc_shadows_for_light(unsigned l);
-	static void proc_tile_queue(tile_t *init_tile, unsigned l);
+	static void proc_tile_queue(tile_t *init_tile, unsigned l, bool skip_init_calc=0);
 	void calc_shadows(bool calc_sun, bool calc_moon, bool no_push=0);
 
 	tile_xy_pair get_tile_xy_pair(int dx=0, int dy=0) const {
@@ -336,7 +391,7 @@ public:
 	float get_bsphere_radius_inc_water() const;
 	bool use_as_occluder() const;
 	bool mesh_sphere_intersect(point const &pos, float rradius) const;
-	bool update_range(tile_shadow_map_manager &smap_manager);
+	bool update_range(tile_shadow_map_manager &smap_manager, bool keep_shadows);
 	bool is_visible() const {return camera_pdu.sphere_and_cube_visible_test(get_center(), get_bsphere_radius_inc_water(), get_bcube());}
 	float get_dist_to_camera_in_tiles(bool xy_dist=1) const {return get_rel_dist_to_camera(xy_dist)*TILE_RADIUS;}
 	float get_scenery_thresh    (bool reflection_pass) const {return (reflection_pass ? SCENERY_THRESH_REF : SCENERY_THRESH);}
@@ -419,11 +474,21 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	bool buildings_valid;
 	unsigned ivbo_ixs[NUM_LODS+1] = {0};
 	unsigned tiles_gen_prev_frame;
-	float terrain_zmin;
+	float terrain_zmin, avg_tile_upload_ms;
 	draw_vect_t to_draw;
 	vector<tile_t *> occluded_tiles;
 	vector<tile_t *> to_draw_trunk_pts;
 	vector<pair<float, tile_t *>> to_gen_zvals;
+
+	struct tile_gen_job_t { // tile with zvals being generated in the background
+		tile_t *tile;
+		job_handle_t job;
+		std::shared_ptr<mesh_xy_grid_cache_t> height_gen;
+		std::shared_ptr<tile_cache_entry_t> cached; // non-empty if read from the disk cache
+		tile_gen_job_t(tile_t *tile_) : tile(tile_), height_gen(new mesh_xy_grid_cache_t), cached(new tile_cache_entry_t) {}
+	};
+	vector<tile_gen_job_t> tile_gen_jobs;
+	tile_cache_t tile_cache;
 	cloud_draw_list_t to_draw_clouds;
 	vector<mesh_xy_grid_cache_t> height_gens;
 	lightning_strike_t lightning_strike;
@@ -439,6 +504,11 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<tile_t *> occluders; // reused across draw calls
 	vector<cube_t> test_cubes; // reused across draw calls
 	void insert_tile(tile_t *tile);
+	bool tile_gen_pending(tile_xy_pair const &txy) const;
+	void start_tile_gen_jobs(unsigned max_pending);
+	void finish_tile_gen_jobs(bool wait_all, bool discard=0);
+	bool load_tile_from_cache(tile_t *tile, bool check_disk);
+	void add_tile_to_cache(tile_t &tile);
 
 public:
 	tile_draw_t();
@@ -58,7 +58,7 @@ extern int frame_counter, iticks, onscreen_display, display_mode, animate2;
 extern float fticks, urm_proj, global_regen, ship_build_delay, hyperspeed_mult, player_turn_rate, rand_spawn_ship_dmax;
 extern unsigned alloced_fobjs[], team_credits[], init_credits[], ind_ships_used[];
 extern exp_type_params et_params[];
-extern vector<free_obj const *> a_targets, attackers;
+extern vector<free_obj_handle_t> a_targets, attackers;
 extern vector<ship_explosion> exploding;
 extern vector<us_class> sclasses;
 extern vector<us_weapon> us_weapons;
@@ -80,6 +80,7 @@ u_ship::u_ship(unsigned sclass_, point const &pos0, unsigned align, unsigned ai_
 	init_align  = align;
 	is_flagship = 0;
 	child_stray_dist = 0.0;
+	ai_rgen.set_state(rand(), rand()+1);
 	reset();
 	if (rand_orient) do_rotate(TWO_PI*rand_float(), TWO_PI*rand_float());
 }
@@ -407,7 +408,8 @@ bool u_ship::do_multi_target() const { // add time delay/rand-mod?
 }
 
 
-free_obj const *u_ship::find_closest_target(point const &pos0, float min_dist, float max_dist, bool req_shields) const {
+// Note: cur_targ and rgen are passed in rather than using target_obj and rand() so that this can be called from ai_plan()
+free_obj const *u_ship::find_closest_target(point const &pos0, float min_dist, float max_dist, bool req_shields, free_obj const *cur_targ, rand_gen_t &rgen) const {
 
 	bool const dir_pref(specs().max_turn > 0.0);
 
@@ -424,14 +426,14 @@ free_obj const *u_ship::find_closest_target(point const &pos0, float min_dist, f
 			case ALIGN_PLAYER:
 				if (!player_enemy) return NULL;
 			default: // ALIGN_PIRATE, ALIGN_RED, ALIGN_BLUE, etc.
-				if (COMMON_TARGETS && (rand()&7) == 0) { // every 8th frame
+				if (COMMON_TARGETS && (rgen.rand()&7) == 0) { // every 8th frame
 					free_obj const *friendly(get_closest_ship(pos0, min_dist, max_dist, 0, 0, 0, 0, 0));
 					
 					if (friendly) { // see if a friendly has chosen a target, and if so, then accept the target as our own
 						free_obj const *targ(friendly->get_target());
 						
 						if (target_valid(targ) && targ != friendly->get_parent() && (!req_shields || targ->has_shields()) &&
-							(target_obj == NULL  || p2p_dist(targ->get_pos(), pos) <= min_dist) &&
+							(cur_targ == NULL    || p2p_dist(targ->get_pos(), pos) <= min_dist) &&
 							(COMMON_TARGETS == 2 || p2p_dist(targ->get_pos(), pos) <= max_dist))
 						{
 							return targ;
@@ -445,59 +447,75 @@ free_obj const *u_ship::find_closest_target(point const &pos0, float min_dist, f
 }
 
 
-void u_ship::acquire_target(float min_dist) {
+float u_ship::get_ai_min_dist() const {
+
+	us_class const &sc(specs());
+	bool const no_ammo(out_of_ammo(0)), boarding(sc.for_boarding && ncrew > sc.ncrew/2), kamikaze((ai_type & AI_KAMIKAZE) != 0);
+	return ((no_ammo || kamikaze || boarding) ? 0.0 : get_min_att_dist()); // ram the enemy
+}
+
+
+// Note: may be called in parallel for different ships; reads other objects, but only writes to plan and ai_rgen
+void u_ship::plan_target(float min_dist, ai_target_plan_t &plan) {
 
+	plan = ai_target_plan_t();
+	plan.valid       = 1;
+	plan.min_dist    = min_dist;
+	plan.prev_target = target_obj;
+	plan.tup_time    = tup_time;
+	plan.retarg_time = retarg_time;
+	free_obj const *targ(target_obj);
 	unsigned const ai_base_type(ai_type & AI_BASE_TYPE);
-	float const tdist((target_obj == NULL) ? 0.0 : p2p_dist(pos, target_obj->get_pos()));
+	float const tdist((targ == NULL) ? 0.0 : p2p_dist(pos, targ->get_pos()));
 	float search_dist(specs().sensor_dist);
 
 	if (!can_move() && fighters.empty()) { // if can't move, then there is no point to acquiring a target out of weapons range
 		float const weap_range(specs().get_weap_range());
 		if (weap_range > 0.0) {search_dist = min(search_dist, (1.1f*weap_range + c_radius));}
 	}
-	if (target_obj != NULL && (target_obj->is_resetting() || target_obj->is_invisible() || (COMMON_TARGETS < 2 && tdist > search_dist))) {
-		target_obj = NULL; // don't target a ship that's out of sensor range or already dead
+	if (targ != NULL && (targ->is_resetting() || targ->is_invisible() || (COMMON_TARGETS < 2 && tdist > search_dist))) {
+		targ = NULL; // don't target a ship that's out of sensor range or already dead
 	}
 
 	// RETREAT, WAIT, ENEMY, ALL
 	if (ai_base_type != AI_ATT_WAIT) { // RETREAT, ENEMY, ALL
-		if (target_obj == NULL || target_obj == parent || target_obj->invalid() ||
+		if (targ == NULL || targ == parent || targ->invalid() ||
 			time > (tup_time + TARGET_CTIME) || tdist > search_dist || tdist < min_dist)
 		{
-			tup_time = time + ((rand()%TARGET_CTIME) >> 1);  // update target every so often, randomize
+			plan.tup_time = time + ((ai_rgen.rand()%TARGET_CTIME) >> 1);  // update target every so often, randomize
 			free_obj const *new_target_obj(NULL);
 			bool find_closest(0);
 
 			switch (target_mode) {
 			case TARGET_CLOSEST:
-				find_closest = (target_obj == NULL || retarg_time == 0);
+				find_closest = (targ == NULL || retarg_time == 0);
 				break;
 			case TARGET_ATTACKER:
 			case TARGET_LAST:
-				find_closest = (target_obj == NULL);
+				find_closest = (targ == NULL);
 				break;
 			case TARGET_PARENT:
-				if (parent != NULL && target_valid(parent->get_target()) && !parent->get_target()->is_invisible()) {target_obj = parent->get_target();}
+				if (parent != NULL && target_valid(parent->get_target()) && !parent->get_target()->is_invisible()) {targ = parent->get_target();}
 				else {find_closest = 1;}
 				break;
 			default:
 				assert(0);
 			}
 			bool const has_dest(dest_mgr.is_valid());
-			if (has_dest && (rand()&3)) {find_closest = 0;} // every 4th frame if already have a destination
+			if (has_dest && (ai_rgen.rand()&3)) {find_closest = 0;} // every 4th frame if already have a destination
 			
 			if (find_closest) {
-				if (target_obj != NULL) {
-					if (alignment == ALIGN_NEUTRAL && ai_base_type == AI_ATT_ENEMY && (rand() % NEUT_CHASE_T) == 0) {
-						target_obj = NULL; // give up the chase after awhile
+				if (targ != NULL) {
+					if (alignment == ALIGN_NEUTRAL && ai_base_type == AI_ATT_ENEMY && (ai_rgen.rand() % NEUT_CHASE_T) == 0) {
+						targ = NULL; // give up the chase after awhile
 					}
-					if (tdist > 2.0*search_dist) {target_obj = NULL;} // (tdist < min_dist) is ignored for now, out of range
+					if (tdist > 2.0*search_dist) {targ = NULL;} // (tdist < min_dist) is ignored for now, out of range
 				}
 				float eff_search_dist(search_dist);
 				if (has_dest) {eff_search_dist = min(search_dist, p2p_dist(pos, dest_mgr.get_pos()));}
-				if (target_obj != NULL && tdist >= min_dist) {eff_search_dist = min(search_dist, 0.8f*tdist);}
-				new_target_obj = find_closest_target(pos, min_dist, eff_search_dist, 0);
-				if (new_target_obj == NULL) {new_target_obj = target_obj;} // keep the same target
+				if (targ != NULL && tdist >= min_dist) {eff_search_dist = min(search_dist, 0.8f*tdist);}
+				new_target_obj = find_closest_target(pos, min_dist, eff_search_dist, 0, targ, ai_rgen);
+				if (new_target_obj == NULL) {new_target_obj = targ;} // keep the same target
 
 				if (new_target_obj == NULL && alignment != ALIGN_NEUTRAL) { // no target, choose to attack same target as teammates
 					assert(alignment < a_targets.size());
@@ -507,7 +525,7 @@ void u_ship::acquire_target(float min_dist) {
 					}
 				}
 				if ((ai_type & AI_GUARDIAN) && new_target_obj == NULL) { // seek out the last attacker
-					unsigned const start_i(rand() % NUM_ALIGNMENT); // don't show favoritism
+					unsigned const start_i(ai_rgen.rand() % NUM_ALIGNMENT); // don't show favoritism
 					
 					for (unsigned i = 0; i < NUM_ALIGNMENT; ++i) {
 						unsigned const ii((start_i + i) % NUM_ALIGNMENT);
@@ -524,29 +542,54 @@ void u_ship::acquire_target(float min_dist) {
 				}
 			}
 			if (new_target_obj != NULL) {
-				target_obj  = new_target_obj;
-				retarg_time = RETARG_DELAY;
-				
-				if (target_obj->is_player_ship() && target_obj != parent) {
-					send_warning_message(string("Enemy Ship Detected: ") + get_name());
-				}
+				targ = new_target_obj;
+				plan.retarg_time = RETARG_DELAY;
+				plan.warn        = (targ->is_player_ship() && targ != parent); // message is sent when the plan is applied
 			}
-			if (target_obj != NULL && target_mode == TARGET_LAST) {target_set = 1;}
+			if (targ != NULL && target_mode == TARGET_LAST) {plan.target_set = 1;}
 		}
 	}
-	if ((ai_type & AI_GUARDIAN) && target_obj != NULL && target_obj->get_align() == alignment) {
-		target_obj = NULL; // don't attack a friendly
+	if ((ai_type & AI_GUARDIAN) && targ != NULL && targ->get_align() == alignment) {
+		targ = NULL; // don't attack a friendly
 	}
-	if (target_obj == NULL && parent != NULL && target_valid(parent->get_target())) {
-		target_obj = parent->get_target(); // as a last resort, even if not TARGET_PARENT
+	if (targ == NULL && parent != NULL && target_valid(parent->get_target())) {
+		targ = parent->get_target(); // as a last resort, even if not TARGET_PARENT
 	}
-	if (!fighters.empty()) get_fighter_target(this);
+	if (targ == NULL && !fighters.empty() && !invalid_priv()) {targ = find_fighter_target(this);}
 	
-	if (target_obj != NULL && target_obj != parent) {
-		if (specs().for_boarding && !target_obj->can_board()) target_obj = NULL; // can't board this ship
-		else if (target_obj->is_invisible())                  target_obj = NULL; // invisible (cloaked ship)
+	if (targ != NULL && targ != parent) {
+		if (specs().for_boarding && !targ->can_board()) targ = NULL; // can't board this ship
+		else if (targ->is_invisible())                  targ = NULL; // invisible (cloaked ship)
 	}
-	assert(target_obj != this);
+	assert(targ != this);
+	plan.target = targ;
+}
+
+
+void u_ship::acquire_target(float min_dist) {
+
+	ai_target_plan_t &plan(targ_plan);
+
+	// replan if not planned this frame or if our state has changed since planning; in particular,
+	// a beam fired by a ship earlier in this frame can destroy the target or make us retarget an attacker
+	if (!plan.valid || plan.min_dist != min_dist || plan.prev_target != target_obj || (plan.target != NULL && plan.target->invalid())) {
+		plan_target(min_dist, plan);
+	}
+	target_obj  = plan.target;
+	tup_time    = plan.tup_time;
+	retarg_time = plan.retarg_time;
+	if (plan.target_set) {target_set = 1;}
+	if (plan.warn) {send_warning_message(string("Enemy Ship Detected: ") + get_name());}
+	plan.valid  = 0;
+}
+
+
+void u_ship::ai_plan() { // runs in parallel across objects
+
+	targ_plan.valid = 0;
+	if (time < SHIP_AI_DELAY || invalid_or_disabled() || !begin_motion || player_controlled()) return; // same early exits as ai_action()
+	if (is_orbiting() && (time&3) != 0) return; // orbiting ships only acquire targets every 4th frame
+	plan_target(get_ai_min_dist(), targ_plan);
 }
 
 
@@ -1007,13 +1050,12 @@ void u_ship::ai_action() {
 	bool const no_ammo(out_of_ammo(0)), boarding(sc.for_boarding && ncrew > sc.ncrew/2), kamikaze((ai_type & AI_KAMIKAZE) != 0);
 	if (no_ammo && !kamikaze && !boarding && target_obj != parent) move_dir = -1; // out of ammo, run away
 	vector3d avoid_orient(dir);
-	float const min_attack(get_min_att_dist()), vmag(velocity.mag());
-	float const min_dist((no_ammo || kamikaze || boarding) ? 0.0 : min_attack); // ram the enemy
+	float const min_attack(get_min_att_dist()), vmag(velocity.mag()), min_dist(get_ai_min_dist());
 	bool const avoid_exp(can_move_ && avoid_explosions(avoid_orient)), local_dest(dest_override);
 	dest_override = 0;
 	
 	if (!is_orbiting() || (time&3) == 0) { // every 4th frame if orbiting
-		acquire_target(min_dist); // slow
+		acquire_target(min_dist); // slow, but usually planned in parallel by ai_plan()
 	}
 	free_obj const *const acquired_target(target_obj);
 	if (local_dest) {target_obj = NULL;}
@@ -1551,7 +1593,7 @@ bool u_ship::fire_weapon(vector3d const &fire_dir, float target_dist) {
 			fpos += offsets[o]*radius; // fire from this point
 
 			if (multi_target) {
-				free_obj const *new_tobj(find_closest_target(fpos, get_min_att_dist(), weap.range, weap.shield_d_only));
+				free_obj const *new_tobj(find_closest_target(fpos, get_min_att_dist(), weap.range, weap.shield_d_only, target_obj, ai_rgen));
 				
 				if (new_tobj != NULL) {
 					tobj = new_tobj;
@@ -2109,7 +2151,7 @@ bool u_ship::capture_ship(u_ship *ship, bool add_as_fighter) { // this captures
 	ship->register_destruction(this); // counts as destroying the ship
 	ship->alignment  = alignment;
 	ship->parent     = this; // or could set to NULL?
-	ship->target_obj = ((target_obj == ship) ? NULL : target_obj);
+	ship->target_obj = ((target_obj == ship) ? NULL : get_target());
 	ship->captured   = 1;
 
 	if (player) { // create a ship of the same type as the player's ship, but can't have the special player weapons
@@ -2223,18 +2265,25 @@ bool u_ship::is_hostile_to(free_obj const *obj) const {
 }
 
 
-void u_ship::get_fighter_target(u_ship const *ship) { // recursive
+void u_ship::get_fighter_target(u_ship const *ship) {
+	if (target_obj == NULL && !invalid_priv()) {target_obj = find_fighter_target(ship);}
+}
+
+
+free_obj const *u_ship::find_fighter_target(u_ship const *ship) const { // recursive
 
-	if (target_obj != NULL || ship == NULL || invalid_priv()) return; // base case 1
+	if (ship == NULL) return NULL; // base case 1
 	
 	if (ship != this && ship->target_obj != NULL) { // base case 2
-		if (target_valid(ship->target_obj)) target_obj = ship->target_obj;
-		return;
+		return (target_valid(ship->target_obj) ? ship->target_obj.get() : NULL);
 	}
-	for (auto i = ship->fighters.begin(); i != ship->fighters.end() && target_obj == NULL; ++i) {
+	for (auto i = ship->fighters.begin(); i != ship->fighters.end(); ++i) {
 		assert(*i != NULL); // see if a fighter of yours has a target
-		if (!(*i)->invalid() && (*i)->get_parent() == this) get_fighter_target(*i);
+		if ((*i)->invalid() || (*i)->get_parent() != this) continue;
+		free_obj const *const targ(find_fighter_target(*i));
+		if (targ != NULL) return targ;
 	}
+	return NULL;
 }
 
 
@@ -2625,7 +2674,6 @@ void u_ship::detonate_weapons() {
 void u_ship::fragment(vector3d const &edir, float num, bool outside_cr) const { // send off ship parts
 
 	if (!GEN_FRAGMENTS || (flags & OBJ_FLAGS_DIST)) return;
-	static free_obj_allocator<uparticle> allocator;
 	unsigned const etype(specs().exp_type);
 	float const nscale((etype == ETYPE_NONE) ? 1.5 : 1.0), pscale(0.25*radius), psize(min(pscale, MAX_PARTICLE_SIZE*nscale));
 	float const mvscale(max(0.5f, (2.0f*pscale/MAX_PARTICLE_SIZE)));
@@ -3,8 +3,8 @@
 // 10/26/15
 #include "3DWorld.h"
 #include "openal_wrap.h" // for alut_sleep()
+#include "job_system.h"
 #include <list>
-#include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <cstring> // for memcpy()
@@ -17,8 +17,6 @@ extern int window_width, window_height;
 extern unsigned video_framerate; // Note: should probably be either 30 or 60
 extern unsigned num_video_threads; // defaults to 0 = max
 
-void write_video();
-
 // from http://vichargrave.com/multithreaded-work-queue-in-c/
 template<typename T> class thread_safe_queue {
 	list<T> m_queue;
@@ -52,51 +50,49 @@ public:
 
 class video_capture_t {
 
-	class video_buffer {
-		typedef vector<unsigned char> frame_t;
-		typedef shared_ptr<frame_t> p_frame_t;
-		thread_safe_queue<p_frame_t> frames, free_list; // queue of frames to compress
-
-	public:
-		void push_frame(void const *const data, unsigned data_sz) {
-			assert(data_sz > 0);
-			p_frame_t frame(free_list.empty() ? p_frame_t(new frame_t(data_sz)) : free_list.remove()); // take a frame from the free list if nonempty
-			memcpy(&frame->front(), data, data_sz);
-			frames.add(frame);
-		}
-		void pop_and_send_frame(FILE *fp) {
-			assert(fp != nullptr);
-			p_frame_t const frame(frames.remove());
-			fwrite(&frame->front(), frame->size(), 1, fp);
-			if (free_list.size() < MAX_FRAMES_BUFFERED/4) {free_list.add(frame);} // recycle it
-		}
-		void write_frames(FILE *fp) {
-			while (!frames.empty()) {pop_and_send_frame(fp);}
-		}
-		size_t num_pending_frames() const {return frames.size();}
-		bool empty() const {return frames.empty();}
-	};
+	typedef vector<unsigned char> frame_t;
+	typedef shared_ptr<frame_t> p_frame_t;
+	thread_safe_queue<p_frame_t> free_list; // recycled frame buffers
 
 	unsigned video_id, pbo, start_sz;
 	string filename;
 
-	// multithreaded writing support
-	bool is_recording, is_writing;
-	video_buffer buffer;
-	unique_ptr<std::thread> write_thread;
+	// multithreaded writing support: frames are written by a chain of I/O jobs, each depending on the previous one
+	bool is_recording; // only accessed on the main thread
+	std::atomic<bool> pipe_failed; // set by open_pipe() in a job
+	FILE *ffmpeg;
+	std::atomic<unsigned> num_pending_frames;
+	job_handle_t last_write_job;
 
+	void add_write_job(std::function<void()> const &func) {
+		last_write_job = get_job_system().run_after(func, last_write_job, JOB_PRI_IO);
+	}
 	void wait_for_write_complete() {
-		if (!write_thread) return;
-		is_recording = 0;
-		if (is_writing) {cout << "Wating for " << buffer.num_pending_frames() << " video frames to be written" << endl;}
-		write_thread->join();
-		write_thread.reset();
-		assert(!is_writing);
+		if (!last_write_job) return;
+
+		if (is_recording) { // called from the destructor while recording; can't make GL calls here
+			is_recording = 0;
+			add_write_job([this]() {close_pipe();});
+		}
+		if (num_pending_frames > 0) {cout << "Wating for " << num_pending_frames << " video frames to be written" << endl;}
+		get_job_system().wait(last_write_job);
+		last_write_job.reset();
+		assert(ffmpeg == nullptr);
+	}
+	void write_frame(p_frame_t const &frame) { // called from a job
+		if (ffmpeg != nullptr) {fwrite(&frame->front(), frame->size(), 1, ffmpeg);}
+		if (free_list.size() < MAX_FRAMES_BUFFERED/4) {free_list.add(frame);} // recycle it
+		--num_pending_frames;
 	}
 	void queue_frame(void const *const data) {
-		buffer.push_frame(data, get_num_bytes());
+		unsigned const data_sz(get_num_bytes());
+		assert(data_sz > 0);
+		p_frame_t frame(free_list.empty() ? p_frame_t(new frame_t(data_sz)) : free_list.remove()); // take a frame from the free list if nonempty
+		memcpy(&frame->front(), data, data_sz);
+		++num_pending_frames;
+		add_write_job([this, frame]() {write_frame(frame);});
 		
-		while (buffer.num_pending_frames() > MAX_FRAMES_BUFFERED) { // sleep for 10ms until buffer is partially emptied
+		while (num_pending_frames > MAX_FRAMES_BUFFERED) { // sleep for 10ms until buffer is partially emptied
 			cout << "Waiting for video write buffer to empty" << endl;
 			alut_sleep(0.01);
 		}
@@ -105,26 +101,26 @@ class video_capture_t {
 	static unsigned get_num_bytes() {return 4*window_width*window_height;}
 
 public:
-	video_capture_t() : video_id(0), pbo(0), start_sz(0), is_recording(0), is_writing(0) {}
+	video_capture_t() : video_id(0), pbo(0), start_sz(0), is_recording(0), pipe_failed(0), ffmpeg(nullptr), num_pending_frames(0) {}
 
 	void start(string const &fn) {
 		assert(!is_recording); // must end() before calling start() again
 		wait_for_write_complete();
-		assert(!is_writing);
 		is_recording = 1;
+		pipe_failed  = 0;
 		start_sz     = get_num_bytes();
 		assert(pbo == 0);
 		glGenBuffers(1, &pbo);
 		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
 		glBufferData(GL_PIXEL_PACK_BUFFER, start_sz, NULL, GL_STREAM_READ);
 		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-		// start writing in a different thread
+		// start ffmpeg in a background job
 		filename = fn;
-		assert(!write_thread);
-		write_thread.reset(new std::thread(write_video));
+		add_write_job([this]() {open_pipe();});
 	}
-	void write_buffer() {
+	void open_pipe() {
 		assert(!filename.empty());
+		assert(ffmpeg == nullptr);
 		// start ffmpeg telling it to expect raw RGBA, 60 FPS
 		// -i - tells it to read frames from stdin
 		// Note: 0 = max threads; the more threads the lower the frame rate, as video compression competes with 3DWorld for CPU cycles;
@@ -135,30 +131,30 @@ public:
 		// open pipe to ffmpeg's stdin in binary write mode
 #ifdef _WIN32
 		string const cmd(string("ffmpeg.exe.lnk") + oss.str());
-		FILE* ffmpeg = _popen(cmd.c_str(), "wb");
+		ffmpeg = _popen(cmd.c_str(), "wb");
 #else
 		string const cmd(string("ffmpeg") + oss.str());
-		FILE* ffmpeg = popen(cmd.c_str(), "w");
+		ffmpeg = popen(cmd.c_str(), "w");
 #endif
 		if(ffmpeg == nullptr) {
 		  cerr << "Error running ffmpeg command: " << cmd << endl;
-		  is_writing = 0;
-		  end();
-		  return;
+		  pipe_failed = 1; // end() will be called from end_frame() on the main thread, since it makes GL calls
 		}
-		is_writing   = 1;
-		while (is_recording || !buffer.empty()) {buffer.write_frames(ffmpeg); alut_sleep(0.001);} // 1ms sleep
+	}
+	void close_pipe() {
+		if (ffmpeg == nullptr) return; // failed to open
 #ifdef _WIN32
 		_pclose(ffmpeg);
 #else
 		pclose(ffmpeg);
 #endif
-		is_writing   = 0;
+		ffmpeg = nullptr;
 	}
 	void end() {
-		is_recording = 0; // signal writer to finish
+		is_recording = 0;
 		glDeleteBuffers(1, &pbo);
 		pbo = 0;
+		add_write_job([this]() {close_pipe();}); // runs after all queued frames are written
 	}
 	void toggle_start_stop() {
 		if (is_recording) {end(); return;} // start=>end
@@ -168,6 +164,7 @@ public:
 	}
 	void end_frame() {
 		if (!is_recording) return;
+		if (pipe_failed) {end(); return;} // ffmpeg failed to start
 		assert(pbo != 0);
 		assert(start_sz == get_num_bytes()); // make sure the resolution hasn't changed since recording started
 		//timer_t timer("Video Capture Frame"); // 13.7ms for 1920x1024, 10.9ms with free list
@@ -186,9 +183,6 @@ public:
 
 video_capture_t video_capture;
 
-// Note: must be a global function rather than member function for thread constructor
-void write_video() {video_capture.write_buffer();}
-
 // Note: not legal to resize the window between start() and end()
 void start_video_capture(string const &fn) {video_capture.start(fn);}
 void end_video_capture() {video_capture.end();}
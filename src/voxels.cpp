@@ -11,6 +11,7 @@
 #include "file_utils.h"
 #include "openal_wrap.h"
 #include "cobj_bsp_tree.h"
+#include "job_system.h"
 #include <glm/gtc/noise.hpp>
 
 
@@ -307,8 +308,7 @@ void voxel_manager::create_procedural(float mag, float freq, vector3d const &off
 		free_texture(tid);
 		return;
 	}
-	#pragma omp parallel for schedule(static,1)
-	for (int y = 0; y < (int)ny; ++y) { // generate voxel values
+	parallel_for(0, ny, [&](int y) { // generate voxel values
 		for (unsigned x = 0; x < nx; ++x) {
 			for (unsigned z = 0; z < nz; ++z) {
 				float val(0.0);
@@ -340,7 +340,7 @@ void voxel_manager::create_procedural(float mag, float freq, vector3d const &off
 				set(x, y, z, val); // scale value?
 			}
 		}
-	}
+	});
 }
 
 
@@ -1193,6 +1193,7 @@ void voxel_model::calc_ao_dirs() {
 void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_only) {
 
 	if (ao_lighting.empty()) return; // nothing to do
+	PROFILE_SCOPE("Voxel Block AO Lighting");
 	float const norm(params.ao_weight_scale/ao_dirs.size());
 	unsigned const xbix(block_ix%params.num_blocks), ybix(block_ix/params.num_blocks);
 	unsigned char const end_ray_flags((display_mode & 0x01) ? UNDER_MESH_BIT : 0);
@@ -1504,6 +1505,7 @@ void voxel_model::finalize_boundary_vmap() {
 void voxel_model::build(bool verbose, bool do_ao_lighting) {
 
 	RESET_TIME;
+	PROFILE_SCOPE("Voxel Model Build");
 	unsigned const lod_blocks(1 << (tri_data.size()-1));
 
 	if (lod_blocks > 1) { // LOD enabled, check that we divide evenly into blocks so that the max LOD level will work
@@ -1546,6 +1548,7 @@ void voxel_model::build(bool verbose, bool do_ao_lighting) {
 
 	#pragma omp parallel for schedule(dynamic,1)
 	for (int block = 0; block < (int)tot_blocks; ++block) {
+		PROFILE_SCOPE("Voxel Block LODs");
 		create_block_all_lods(block, 1, 0);
 	}
 	if (verbose) {PRINT_TIME("  Triangles to Model");}